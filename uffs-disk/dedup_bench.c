@@ -0,0 +1,341 @@
+/**
+ * \file dedup_bench.c
+ * \brief dedup benchmark: 같은 파일이 여러 디렉토리에 복사된 이미지
+ *
+ * mount 없이 mkuffs.c의 FUSE 콜백을 직접 불러서, 같은 corpus를
+ * dedup 없이 한 번, dedup으로 한 번 쓰고 블록 수와 디바이스에 쓴 양을 비교한다.
+ * 다 쓴 뒤에는 모든 파일을 읽어서 내용도 확인한다.
+ * 그 다음 dedup mount에서 offset이 있는 write(나눠 쓰기, inline 파일에 이어 쓰기,
+ * 공유 블록 일부 덮어쓰기, 블록 하나를 넘는 파일)를 하고 remount 전후로 내용과 길이를 확인한다.
+ *
+ * usage: dedup_bench <image file>
+ */
+
+#define main mkuffs_main
+#include "mkuffs.c"
+#undef main
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#define BENCH_DIRS			8		//!< 같은 blob을 복사해 넣는 디렉토리 수
+#define BENCH_BLOBS			8		//!< 디렉토리마다 들어가는 공통 파일 수
+#define BENCH_BLOB_MAX		(PAGES_PER_BLOCK_DEFAULT * PAGE_DATA_SIZE_DEFAULT)
+#define BENCH_CHUNK			4096	//!< offset write 확인 때 한 번에 쓰는 크기
+#define BENCH_WRITE_MAX		(3 * BENCH_BLOB_MAX - 1000)	//!< 블록 하나를 넘는 파일
+
+static char blobs[BENCH_BLOBS][BENCH_BLOB_MAX];
+static int blob_len[BENCH_BLOBS];
+static char config[BENCH_DIRS][2048];
+static int config_len[BENCH_DIRS];
+static char read_buf[BENCH_WRITE_MAX];
+static char write_data[BENCH_WRITE_MAX];
+
+struct bench_ResultSt {
+	int used_blocks;				//!< journal 뒤로 page 0이 쓰인 블록 수
+	unsigned long long written;		//!< 디바이스에 쓴 바이트 (/proc/self/io wchar)
+	double seconds;
+	int bad;						//!< 읽었을 때 내용이 다른 파일 수
+	uffs_DedupStat stat;
+};
+
+static unsigned long long _Wchar(void)
+{
+	unsigned long long v = 0;
+	char line[128];
+	FILE *fp = fopen("/proc/self/io", "r");
+
+	if (fp == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "wchar: %llu", &v) == 1)
+			break;
+	}
+	fclose(fp);
+	return v;
+}
+
+static double _Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// firmware blob은 압축 안 되는 바이트, template은 텍스트
+static void _MakeCorpus(void)
+{
+	int i, j;
+
+	srand(36);
+	for (i = 0; i < BENCH_BLOBS; i++) {
+		if (i % 2 == 0) {
+			blob_len[i] = 8192 + rand() % (BENCH_BLOB_MAX - 8192);
+			for (j = 0; j < blob_len[i]; j++)
+				blobs[i][j] = (char)rand();
+		}
+		else {
+			blob_len[i] = 0;
+			while (blob_len[i] < 3000)
+				blob_len[i] += sprintf(blobs[i] + blob_len[i], "<template id=%d line=%d>{{ value }}</template>\n", i, blob_len[i]);
+		}
+	}
+	for (i = 0; i < BENCH_DIRS; i++) {
+		config_len[i] = 0;
+		while (config_len[i] < 1500)
+			config_len[i] += sprintf(config[i] + config_len[i], "device%d.option%d=%d\n", i, config_len[i], rand());
+	}
+}
+
+static void _Mount(const char *image, UBOOL dedup)
+{
+	memset(&dev, 0, sizeof(dev));
+	dedup_enable = dedup;
+	dev.fd = diskOpen(image, NULL);
+	uffs_JournalInit(dev.fd);
+	uffs_init();
+}
+
+static void _Unmount(void)
+{
+	uffs_destroy(NULL);
+	diskClose(dev.fd);
+}
+
+static int _WriteFile(const char *path, const char *data, int len)
+{
+	struct fuse_file_info fi = {0};
+	int ret;
+
+	if (uffs_create(path, 0644, &fi) != 0)
+		return -1;
+	ret = uffs_write(path, data, len, 0, &fi);
+	uffs_flush(path, &fi);
+	uffs_release(path, &fi);
+	return ret == len ? 0 : -1;
+}
+
+static int _CheckFile(const char *path, const char *data, int len)
+{
+	struct fuse_file_info fi = {0};
+	int ret;
+
+	uffs_open(path, &fi);
+	ret = uffs_read(path, read_buf, sizeof(read_buf), 0, &fi);
+	uffs_release(path, &fi);
+	return ret == len && memcmp(read_buf, data, len) == 0 ? 0 : 1;
+}
+
+// path의 offset부터 len 바이트를 BENCH_CHUNK씩 나눠 씀 (파일이 없으면 만듦)
+static int _WriteChunks(const char *path, const char *data, int len, off_t offset)
+{
+	struct fuse_file_info fi = {0};
+	int off, n, ret = 0;
+
+	if (uffs_open(path, &fi) != 0 && uffs_create(path, 0644, &fi) != 0)
+		return -1;
+	for (off = 0; off < len && ret == 0; off += n) {
+		n = len - off < BENCH_CHUNK ? len - off : BENCH_CHUNK;
+		if (uffs_write(path, data + off, n, offset + off, &fi) != n)
+			ret = -1;
+	}
+	uffs_flush(path, &fi);
+	uffs_release(path, &fi);
+	return ret;
+}
+
+// path의 data 블록 참조 수
+static int _Refs(const char *path)
+{
+	TreeNode *file_node, *data_node;
+
+	if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, &file_node, path) == U_FAIL)
+		return -1;
+	data_node = uffs_TreeFindDataNodeByParent(&dev, file_node->u.file.serial);
+	return data_node != NULL ? uffs_DedupRefs(data_node->u.data.block) : 0;
+}
+
+// 내용과 getattr 길이가 모두 맞는지
+static int _CheckWritten(const char *path, const char *data, int len)
+{
+	struct stat st;
+
+	if (uffs_getattr(path, &st) != 0 || st.st_size != len) {
+		fprintf(stderr, "[dedup_bench] %s: size %ld, expected %d\n", path, (long)st.st_size, len);
+		return 1;
+	}
+	if (_CheckFile(path, data, len) != 0) {
+		fprintf(stderr, "[dedup_bench] %s: content differs\n", path);
+		return 1;
+	}
+	return 0;
+}
+
+static int _UsedBlocks(int fd)
+{
+	uffs_MiniHeader mini_header;
+	int block, used = 0;
+
+	for (block = UFFS_JOURNAL_BLOCK + 1; block < TOTAL_BLOCKS_DEFAULT; block++) {
+		if (IS_SUCC(readPage(fd, block, 0, &mini_header, NULL, NULL)) && mini_header.status != 0xFF)
+			used++;
+	}
+	return used;
+}
+
+static int _Run(const char *image, UBOOL dedup, struct bench_ResultSt *r)
+{
+	char path[64];
+	unsigned long long start_wchar;
+	double start;
+	int fd, d, b;
+
+	// 빈 이미지
+	fd = open(image, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	fd = diskOpen(image, NULL);
+	if (fd < 0 || diskFormat(fd) == U_FAIL)
+		return -1;
+	diskClose(fd);
+
+	memset(r, 0, sizeof(*r));
+	_Mount(image, dedup);
+
+	start_wchar = _Wchar();
+	start = _Now();
+	for (d = 0; d < BENCH_DIRS; d++) {
+		sprintf(path, "/dir%d", d);
+		uffs_mkdir(path, 0755);
+		for (b = 0; b < BENCH_BLOBS; b++) {
+			sprintf(path, "/dir%d/blob%d", d, b);
+			if (_WriteFile(path, blobs[b], blob_len[b]) != 0)
+				fprintf(stderr, "[dedup_bench] write error: %s\n", path);
+		}
+		sprintf(path, "/dir%d/config", d);
+		if (_WriteFile(path, config[d], config_len[d]) != 0)
+			fprintf(stderr, "[dedup_bench] write error: %s\n", path);
+	}
+	uffs_JournalCheckpoint(dev.fd);
+	r->seconds = _Now() - start;
+	r->written = _Wchar() - start_wchar;
+	uffs_DedupGetStat(&r->stat);
+
+	for (d = 0; d < BENCH_DIRS; d++) {
+		for (b = 0; b < BENCH_BLOBS; b++) {
+			sprintf(path, "/dir%d/blob%d", d, b);
+			r->bad += _CheckFile(path, blobs[b], blob_len[b]);
+		}
+		sprintf(path, "/dir%d/config", d);
+		r->bad += _CheckFile(path, config[d], config_len[d]);
+	}
+	r->used_blocks = _UsedBlocks(dev.fd);
+	_Unmount();
+	return 0;
+}
+
+// dedup mount의 offset write, remount 뒤에도 같은지
+static int _RunWrites(const char *image)
+{
+	char expect_a[BENCH_BLOB_MAX], expect_b[BENCH_BLOB_MAX], expect_append[5100];
+	int fd, i, round, bad = 0;
+
+	fd = open(image, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	fd = diskOpen(image, NULL);
+	if (fd < 0 || diskFormat(fd) == U_FAIL)
+		return -1;
+	diskClose(fd);
+
+	for (i = 0; i < BENCH_WRITE_MAX; i++)
+		write_data[i] = (char)(i * 7 + i / 251);
+
+	_Mount(image, U_TRUE);
+
+	// 10000 바이트를 0/4096/8192에 나눠 씀
+	bad += _WriteChunks("/chunked", write_data, 10000, 0) != 0;
+
+	// inline 파일(100 바이트) 뒤에 5000 바이트를 이어 씀
+	bad += _WriteChunks("/append", write_data + 1, 100, 0) != 0;
+	bad += _WriteChunks("/append", write_data + 2000, 5000, 100) != 0;
+	memcpy(expect_append, write_data + 1, 100);
+	memcpy(expect_append + 100, write_data + 2000, 5000);
+
+	// 같은 내용의 두 파일이 블록을 공유한 뒤 하나의 가운데만 덮어씀 (COW)
+	bad += _WriteFile("/shared_a", blobs[0], blob_len[0]) != 0;
+	bad += _WriteFile("/shared_b", blobs[0], blob_len[0]) != 0;
+	bad += _Refs("/shared_a") != 2;
+	bad += _WriteChunks("/shared_b", "overwritten", 11, 1000) != 0;
+	memcpy(expect_a, blobs[0], blob_len[0]);
+	memcpy(expect_b, blobs[0], blob_len[0]);
+	memcpy(expect_b + 1000, "overwritten", 11);
+
+	// 블록 하나를 넘어가는 파일
+	bad += _WriteChunks("/large", write_data, BENCH_WRITE_MAX, 0) != 0;
+
+	for (round = 0; round < 2; round++) {
+		bad += _CheckWritten("/chunked", write_data, 10000);
+		bad += _CheckWritten("/append", expect_append, sizeof(expect_append));
+		bad += _CheckWritten("/shared_a", expect_a, blob_len[0]);
+		bad += _CheckWritten("/shared_b", expect_b, blob_len[0]);
+		bad += _CheckWritten("/large", write_data, BENCH_WRITE_MAX);
+
+		_Unmount();
+		_Mount(image, U_TRUE);
+	}
+	_Unmount();
+
+	return bad;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_ResultSt off, on;
+	unsigned long long raw = 0;
+	int d, b, writes_bad;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <image file>\n", argv[0]);
+		return -1;
+	}
+
+	_MakeCorpus();
+	for (d = 0; d < BENCH_DIRS; d++) {
+		for (b = 0; b < BENCH_BLOBS; b++)
+			raw += blob_len[b];
+		raw += config_len[d];
+	}
+
+	// 파일시스템 로그는 stdout으로 나오므로 버리고 결과만 stderr로
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		return -1;
+
+	if (_Run(argv[1], U_FALSE, &off) != 0 || _Run(argv[1], U_TRUE, &on) != 0) {
+		fprintf(stderr, "[dedup_bench] image error: %s\n", argv[1]);
+		return -1;
+	}
+
+	fprintf(stderr, "corpus: %d dirs x (%d shared files + 1 config), %llu bytes\n", BENCH_DIRS, BENCH_BLOBS, raw);
+	fprintf(stderr, "%-8s %12s %16s %10s %8s\n", "dedup", "used blocks", "bytes written", "seconds", "bad");
+	fprintf(stderr, "%-8s %12d %16llu %10.3f %8d\n", "off", off.used_blocks, off.written, off.seconds, off.bad);
+	fprintf(stderr, "%-8s %12d %16llu %10.3f %8d\n", "on", on.used_blocks, on.written, on.seconds, on.bad);
+	fprintf(stderr, "space saved: %d blocks (%.1f%%), writes saved: %.1f%%\n",
+			off.used_blocks - on.used_blocks,
+			off.used_blocks ? 100.0 * (off.used_blocks - on.used_blocks) / off.used_blocks : 0.0,
+			off.written ? 100.0 * ((double)off.written - (double)on.written) / off.written : 0.0);
+	fprintf(stderr, "dedup: %u blocks, %u refs, hit %u (%llu bytes, %u pages not written), collision %u\n",
+			on.stat.blocks, on.stat.refs, on.stat.hits, on.stat.bytes_saved, on.stat.pages_saved, on.stat.collisions);
+
+	writes_bad = _RunWrites(argv[1]);
+	if (writes_bad < 0) {
+		fprintf(stderr, "[dedup_bench] image error: %s\n", argv[1]);
+		return -1;
+	}
+	fprintf(stderr, "offset writes (chunked, append, cow, > 1 block, remount): %d bad\n", writes_bad);
+
+	return off.bad + on.bad + writes_bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+/**
+ * \file ecc_bench.c
+ * \brief ECC benchmark: uffs_EccMake / uffs_EccCorrect throughput
+ *
+ * 랜덤 data를 페이지(PAGE_DATA_SIZE_DEFAULT) 단위로 나눠
+ *  - make: 쓰기 때처럼 ECC를 만들고
+ *  - check: 읽기 때처럼 다시 만든 ECC와 비교 (오류 없음)
+ *  - correct: 페이지마다 1비트를 뒤집고 교정
+ *  - detect: chunk 하나에 2비트를 뒤집고 교정 불가로 나오는지
+ * 각각 걸린 시간과 MB/s를 출력한다. 교정/검출 결과가 틀리면 bad로 센다.
+ *
+ * usage: ecc_bench [MB]
+ */
+
+#include "uffs_ecc.h"
+#include "uffs_disk.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define BENCH_DEFAULT_MB	64		//!< 인자가 없을 때 처리할 data 크기
+#define BENCH_BUF_PAGES		8192	//!< 한 번에 돌리는 페이지 수 (4 MB), MB만큼 반복
+#define BENCH_ECC_SIZE		UFFS_ECC_SIZE(PAGE_DATA_SIZE_DEFAULT)
+
+static char data[BENCH_BUF_PAGES][PAGE_DATA_SIZE_DEFAULT];
+static char orig[BENCH_BUF_PAGES][PAGE_DATA_SIZE_DEFAULT];
+static u8 ecc[BENCH_BUF_PAGES][BENCH_ECC_SIZE];
+static u8 test_ecc[BENCH_ECC_SIZE];
+
+static double _Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void _Report(const char *name, int rounds, double seconds, int bad)
+{
+	double mb = (double)rounds * BENCH_BUF_PAGES * PAGE_DATA_SIZE_DEFAULT / (1024 * 1024);
+
+	fprintf(stdout, "%-8s %10.1f %10.3f %10.1f %8d\n", name, mb, seconds, seconds > 0 ? mb / seconds : 0.0, bad);
+}
+
+int main(int argc, char *argv[])
+{
+	int mb = BENCH_DEFAULT_MB;
+	int rounds, r, i, bit, ret, bad, total = 0;
+	double start;
+
+	if (argc > 2 || (argc == 2 && (mb = atoi(argv[1])) <= 0)) {
+		fprintf(stderr, "usage: %s [MB]\n", argv[0]);
+		return -1;
+	}
+	rounds = (mb * 1024 * 1024 + sizeof(data) - 1) / sizeof(data);
+
+	srand(26);
+	for (i = 0; i < (int)sizeof(orig); i++)
+		((char *)orig)[i] = (char)rand();
+	memcpy(data, orig, sizeof(data));
+
+	fprintf(stdout, "page: %d bytes, ecc: %d bytes (%d byte chunks)\n",
+			PAGE_DATA_SIZE_DEFAULT, BENCH_ECC_SIZE, UFFS_ECC_CHUNK_SIZE);
+	fprintf(stdout, "%-8s %10s %10s %10s %8s\n", "op", "MB", "seconds", "MB/s", "bad");
+
+	// 쓰기 때
+	start = _Now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_BUF_PAGES; i++)
+			uffs_EccMake(data[i], PAGE_DATA_SIZE_DEFAULT, ecc[i]);
+	}
+	_Report("make", rounds, _Now() - start, 0);
+
+	// 읽기 때 (오류 없음): ECC를 다시 만들어 비교
+	bad = 0;
+	start = _Now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_BUF_PAGES; i++) {
+			uffs_EccMake(data[i], PAGE_DATA_SIZE_DEFAULT, test_ecc);
+			if (uffs_EccCorrect(data[i], PAGE_DATA_SIZE_DEFAULT, ecc[i], test_ecc) != 0)
+				bad++;
+		}
+	}
+	_Report("check", rounds, _Now() - start, bad);
+	total += bad;
+
+	// 페이지마다 1비트 오류: 교정돼서 원래 data로 돌아와야 함
+	bad = 0;
+	start = _Now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_BUF_PAGES; i++) {
+			bit = (i * 7919 + r * 104729) % (PAGE_DATA_SIZE_DEFAULT * 8);
+			data[i][bit / 8] ^= 1 << (bit % 8);
+			uffs_EccMake(data[i], PAGE_DATA_SIZE_DEFAULT, test_ecc);
+			ret = uffs_EccCorrect(data[i], PAGE_DATA_SIZE_DEFAULT, ecc[i], test_ecc);
+			if (ret != 1 || memcmp(data[i], orig[i], PAGE_DATA_SIZE_DEFAULT) != 0) {
+				bad++;
+				memcpy(data[i], orig[i], PAGE_DATA_SIZE_DEFAULT);
+			}
+		}
+	}
+	_Report("correct", rounds, _Now() - start, bad);
+	total += bad;
+
+	// 같은 chunk에 2비트 오류: 교정 불가(-1)로 나와야 함
+	bad = 0;
+	start = _Now();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < BENCH_BUF_PAGES; i++) {
+			bit = (i * 7919 + r * 104729) % (UFFS_ECC_CHUNK_SIZE * 8);
+			data[i][bit / 8] ^= 1 << (bit % 8);
+			bit = (bit + 1 + i % 61) % (UFFS_ECC_CHUNK_SIZE * 8);
+			data[i][bit / 8] ^= 1 << (bit % 8);
+			uffs_EccMake(data[i], PAGE_DATA_SIZE_DEFAULT, test_ecc);
+			if (uffs_EccCorrect(data[i], PAGE_DATA_SIZE_DEFAULT, ecc[i], test_ecc) != -1)
+				bad++;
+			memcpy(data[i], orig[i], PAGE_DATA_SIZE_DEFAULT);
+		}
+	}
+	_Report("detect", rounds, _Now() - start, bad);
+	total += bad;
+
+	return total == 0 ? 0 : 1;
+}
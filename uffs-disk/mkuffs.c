@@ -17,23 +17,116 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <fnmatch.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "uffs_types.h"
 #include "uffs_tree.h"
+#include "uffs_journal.h"
+#include "uffs_readahead.h"
+#include "uffs_compress.h"
+#include "uffs_dedup.h"
+#include "uffs_blockmap.h"
+#include "uffs_discard.h"
 #include <errno.h>
+#include <linux/falloc.h>
 
 uffs_Device dev = {0};
+static int compress_codec = UFFS_COMPRESS_NONE;	// 새로 쓰는 data 블록의 압축 codec
+static UBOOL dedup_enable = U_FALSE;				// 내용이 같은 data 블록을 공유
+static UBOOL discard_enable = U_FALSE;				// 빈 블록을 디바이스에 discard (TRIM)
+static UBOOL format_force = U_FALSE;				// 마운트 전에 디바이스를 지우고 새로 format
+static pthread_rwlock_t ns_lock = PTHREAD_RWLOCK_INITIALIZER;	// tree와 블록 할당 (아래 uffs_oper 앞의 wrapper)
 
 int uffs_init()
 {
 	fprintf(stdout, "[uffs_init] called\n");
 	uffs_TreeInit(&dev);
+	uffs_DiscardInit(dev.fd, discard_enable);
+	uffs_DedupInit(dedup_enable);
 	uffs_BuildTree(&dev);
+	uffs_ReadAheadInit(dev.fd);
+	uffs_CompressInit(compress_codec);
+	uffs_JournalStartTimer(dev.fd);
 	fprintf(stdout, "[uffs_init] finished\n");
 	return 0;
 }
 
-int uffs_getattr(const char *path, struct stat *stbuf)
+void uffs_destroy(void *private_data)
+{
+	uffs_ReadAheadStat stat;
+	uffs_CompressStat cstat;
+	uffs_DedupStat dstat;
+	uffs_DiscardStat tstat;
+
+	fprintf(stdout, "[uffs_destroy] called\n");
+	uffs_ReadAheadRelease();
+	uffs_ReadAheadGetStat(&stat);
+	fprintf(stdout, "[uffs_destroy] readahead - hit: %u, miss: %u, prefetched: %u, wasted: %u, max window: %d\n",
+			stat.hits, stat.misses, stat.prefetched, stat.wasted, stat.window);
+	uffs_CompressRelease();
+	uffs_CompressGetStat(&cstat);
+	fprintf(stdout, "[uffs_destroy] compress - chunks: %u (incompressible %u), %llu -> %llu bytes, decompressed: %u, cache hit: %u\n",
+			cstat.chunks, cstat.incompressible, cstat.raw_bytes, cstat.stored_bytes, cstat.decompressed, cstat.cache_hits);
+	uffs_DedupGetStat(&dstat);
+	fprintf(stdout, "[uffs_destroy] dedup - blocks: %u, refs: %u, hit: %u (%llu bytes, %u pages saved), cow: %u, collision: %u\n",
+			dstat.blocks, dstat.refs, dstat.hits, dstat.bytes_saved, dstat.pages_saved, dstat.cow, dstat.collisions);
+	// 남은 journal을 commit 하고 헤더 페이지를 제자리에 반영
+	uffs_JournalStopTimer();
+	if (uffs_JournalCheckpoint(dev.fd) == U_FAIL) {
+		fprintf(stderr, "[uffs_destroy] journal checkpoint error\n");
+	}
+	// 남은 discard를 모두 내림
+	uffs_DiscardExit();
+	uffs_DiscardGetStat(&tstat);
+	fprintf(stdout, "[uffs_destroy] discard - queued: %u, cancelled: %u, extents: %u, blocks: %u (%llu bytes), restored: %u, error: %u\n",
+			tstat.queued, tstat.cancelled, tstat.extents, tstat.blocks, tstat.bytes, tstat.restored, tstat.errors);
+	fprintf(stdout, "[uffs_destroy] finished\n");
+}
+
+// 호출 전까지의 write/create/mkdir을 디스크에 내림 (동시 호출은 한 번의 commit으로 묶임)
+int uffs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	fprintf(stdout, "[uffs_fsync] called - path: %s\n", path);
+	if (uffs_JournalSync(dev.fd) == U_FAIL) {
+		fprintf(stderr, "[uffs_fsync] journal sync error\n");
+		return -EIO;
+	}
+	fprintf(stdout, "[uffs_fsync] finished\n");
+	return 0;
+}
+
+// close() 마다 호출됨. pending op가 없으면 바로 끝남
+int uffs_flush(const char *path, struct fuse_file_info *fi)
+{
+	fprintf(stdout, "[uffs_flush] called - path: %s\n", path);
+	if (uffs_JournalSync(dev.fd) == U_FAIL) {
+		fprintf(stderr, "[uffs_flush] journal sync error\n");
+		return -EIO;
+	}
+	fprintf(stdout, "[uffs_flush] finished\n");
+	return 0;
+}
+
+int uffs_release(const char *path, struct fuse_file_info *fi)
+{
+	uffs_ReadAhead *ra = (uffs_ReadAhead *)(uintptr_t)fi->fh;
+	uffs_ReadAheadStat stat;
+	u32 total;
+
+	fprintf(stdout, "[uffs_release] called - path: %s\n", path);
+	// 디스크 반영은 flush에서 끝남. open 때 만든 readahead 상태만 정리
+	if (ra != NULL) {
+		uffs_ReadAheadClose(ra, &stat);
+		fi->fh = 0;
+		total = stat.hits + stat.misses;
+		fprintf(stdout, "[uffs_release] readahead - hit: %u/%u (%u%%), prefetched: %u, wasted: %u, window: %d\n",
+				stat.hits, total, total ? stat.hits * 100 / total : 0, stat.prefetched, stat.wasted, stat.window);
+	}
+	return 0;
+}
+
+static int uffs_getattr_locked(const char *path, struct stat *stbuf)
 {
 	fprintf(stdout, "[uffs_getattr] called - path: %s\n", path);
 
@@ -64,6 +157,21 @@ int uffs_getattr(const char *path, struct stat *stbuf)
         stbuf->st_mode = __S_IFREG | 0644;
         stbuf->st_nlink = 1; // 일반적으로 파일은 링크 개수가 1
         stbuf->st_size = PAGE_DATA_SIZE_DEFAULT; // 파일의 실제 길이
+        // 압축 파일은 헤더의 chunk index에 압축 전 길이가 있음
+        if (object_info.info.attr & FILE_ATTR_COMPRESS)
+            stbuf->st_size = uffs_CompressFileLen(&object_info.info);
+        // dedup 파일은 헤더의 참조에 길이가 있음
+        if (object_info.info.attr & FILE_ATTR_DEDUP)
+            stbuf->st_size = uffs_DedupFileLen(&object_info.info);
+        // inline 파일과 빈 파일(0으로 줄인 파일 포함)은 tag의 길이
+        if ((object_info.info.attr & FILE_ATTR_INLINE) ||
+            uffs_TreeFindDataNodeByParent(&dev, node->u.file.serial) == NULL)
+            stbuf->st_size = node->u.file.len;
+        // 블록 map 파일은 헤더에 길이가 있고, hole은 블록을 차지하지 않음
+        if (object_info.info.attr & FILE_ATTR_BLOCKMAP) {
+            stbuf->st_size = uffs_BlockMapFileLen(&object_info.info);
+            stbuf->st_blocks = (blkcnt_t)uffs_BlockMapCount(&dev, node->u.file.serial) * (UFFS_BLOCK_DATA_SIZE / 512);
+        }
         // stbuf->st_size = object_info.len; // 파일의 실제 길이
     } else {
         // 알려지지 않은 타입일 경우 에러 처리
@@ -74,8 +182,8 @@ int uffs_getattr(const char *path, struct stat *stbuf)
 	return 0;
 }
 
-int uffs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                 off_t offset, struct fuse_file_info *fi)
+static int uffs_readdir_locked(const char *path, void *buf, fuse_fill_dir_t filler,
+                                               off_t offset, struct fuse_file_info *fi)
 {
     fprintf(stdout, "[uffs_readdir] called - path: %s\n", path);
 
@@ -125,30 +233,32 @@ int uffs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     uffs_FileInfo file_info = {0};
     u32 dir_out_len;
     for (int i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
-        TreeNode *dnode = dev.tree.dir_entry[i];
-        while (dnode != EMPTY_NODE) {
+        u16 x = dev.tree.dir_entry[i];
+        while (x != EMPTY_NODE) {
+            TreeNode *dnode = FROM_IDX(x, TPOOL(&dev));
             if (dnode->u.dir.parent == parent_serial) {
                 // '.'와 '..'를 제외한 실제 하위 디렉토리 엔트리 이름 추가
-                if (getFileInfoBySerial(dev.fd, dnode->u.dir.serial, &file_info,&dir_out_len) == U_SUCC &&
+                if (getFileInfoByHeader(dev.fd, dnode->u.dir.hdr, &file_info,&dir_out_len) == U_SUCC &&
                 strcmp(file_info.name, "/") != 0) { 
                     // 루트 노드 이름 '/'는 하위에 직접 표시하지 않음 
                     // 필요에 따라 이 조건은 제거할 수 있음
                     filler(buf, file_info.name, NULL, 0);
                 }
             }
-            dnode = dnode->hash_next;
+            x = dnode->hash_next;
         }
     }
     u32 file_out_len;
     // 해당 디렉토리 하위에 존재하는 파일 엔트리 출력
     for (int i = 0; i < FILE_NODE_ENTRY_LEN; i++) {
-        TreeNode *fnode = dev.tree.file_entry[i];
-        while (fnode != EMPTY_NODE) {
+        u16 x = dev.tree.file_entry[i];
+        while (x != EMPTY_NODE) {
+            TreeNode *fnode = FROM_IDX(x, TPOOL(&dev));
             if (fnode->u.file.parent == parent_serial) {
-                if (getFileInfoBySerial(dev.fd, fnode->u.file.serial, &file_info, &file_out_len) == U_SUCC)
+                if (getFileInfoByHeader(dev.fd, fnode->u.file.hdr, &file_info, &file_out_len) == U_SUCC)
                     filler(buf, file_info.name, NULL, 0);
             }
-            fnode = fnode->hash_next;
+            x = fnode->hash_next;
         }
     }
 
@@ -156,7 +266,7 @@ int uffs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     return 0;
 }
 
-int uffs_opendir(const char *path, struct fuse_file_info *fu)
+static int uffs_opendir_locked(const char *path, struct fuse_file_info *fu)
 {
     fprintf(stdout, "[uffs_opendir] called\n");
     TreeNode* node;
@@ -177,7 +287,7 @@ int uffs_opendir(const char *path, struct fuse_file_info *fu)
 	return -ENOENT;
 }
 
-int uffs_open(const char *path, struct fuse_file_info *fi)
+static int uffs_open_locked(const char *path, struct fuse_file_info *fi)
 {
     fprintf(stdout, "[uffs_open] called\n");
     TreeNode* node;
@@ -185,6 +295,8 @@ int uffs_open(const char *path, struct fuse_file_info *fi)
     result = uffs_TreeFindNodeByName(&dev, &node, path, NULL, NULL);
 
 	if (result == U_SUCC){
+        // 없으면 readahead 없이 읽음
+        fi->fh = (uintptr_t)uffs_ReadAheadOpen();
         fprintf(stdout, "[uffs_open] finished\n");
 		return 0;	
 	}
@@ -192,8 +304,8 @@ int uffs_open(const char *path, struct fuse_file_info *fi)
 	return -ENOENT;
 }
 
-int uffs_read(const char *path, char *buf, size_t size, off_t offset,
-              struct fuse_file_info *fi) {
+static int uffs_read_locked(const char *path, char *buf, size_t size, off_t offset,
+                                            struct fuse_file_info *fi) {
     fprintf(stdout, "[uffs_read] called\n");
     fprintf(stdout, "[uffs_read] path: %s, size: %zu, offset: %ld\n", path, size, offset);
 
@@ -209,13 +321,49 @@ int uffs_read(const char *path, char *buf, size_t size, off_t offset,
         fprintf(stderr, "[uffs_read] Error: File node not found for path: %s\n", path);
         return -ENOENT;
     }
-    // fprintf(stdout, "[uffs_read] File node found: serial=%u, block=%d\n", file_node->u.file.serial, file_node->u.file.block);
+    // fprintf(stdout, "[uffs_read] File node found: serial=%u, hdr=%d\n", file_node->u.file.serial, file_node->u.file.hdr);
 
     // 데이터 노드 찾기
     // fprintf(stdout, "[uffs_read] Finding data node for file serial: %u\n", file_node->u.file.serial);
     data_node = uffs_TreeFindDataNodeByParent(&dev, file_node->u.file.serial);
 
+    // inline 데이터나 chunk index가 헤더 페이지에 있음
+    uffs_FileInfo file_info;
+    uffs_Tag tag;
+
+    if (IS_FAIL(readPage(dev.fd, HDR_BLOCK(file_node->u.file.hdr), HDR_PAGE(file_node->u.file.hdr), NULL, (char *)&file_info, &tag)))
+        return -EIO;
+
+    uffs_ReadAhead *ra = fi != NULL ? (uffs_ReadAhead *)(uintptr_t)fi->fh : NULL;
+
+    // 블록 map 파일은 걸친 파일 블록만 읽음 (hole은 0)
+    if (file_info.attr & FILE_ATTR_BLOCKMAP) {
+        result = uffs_BlockMapRead(&dev, file_node->u.file.serial, uffs_BlockMapFileLen(&file_info), buf, size, offset, ra);
+        fprintf(stdout, "[uffs_read] finished - block map data: %d bytes\n", result);
+        return result;
+    }
+
+    // 압축 파일은 걸친 chunk만 읽어서 풂
+    if (data_node != NULL && (file_info.attr & FILE_ATTR_COMPRESS)) {
+        result = uffs_CompressRead(dev.fd, data_node->u.data.block, &file_info, buf, size, offset);
+        fprintf(stdout, "[uffs_read] finished - compressed data: %d bytes\n", result);
+        return result;
+    }
+
     if (data_node == NULL) {
+        // 작은 파일은 헤더 페이지에 inline으로 있음 -> 헤더 페이지 하나만 읽음
+        if (file_info.attr & FILE_ATTR_INLINE) {
+            if (offset >= tag.s.data_len)
+                return 0;
+            if (size > tag.s.data_len - offset)
+                size = tag.s.data_len - offset;
+            memcpy(buf, UFFS_INLINE_DATA(&file_info) + offset, size);
+            fprintf(stdout, "[uffs_read] finished - inline data: %zu bytes\n", size);
+            return size;
+        }
+        // 아직 안 썼거나 0으로 줄인 파일
+        if (file_node->u.file.len == 0)
+            return 0;
         fprintf(stderr, "[uffs_read] Error: Data node not found for file serial: %u\n", file_node->u.file.serial);
         return -ENOENT;
     }
@@ -233,48 +381,286 @@ int uffs_read(const char *path, char *buf, size_t size, off_t offset,
         fprintf(stdout, "[uffs_read] Adjusted read size to %zu due to remaining file length.\n", size);
     }
 
-    // offset에 따라 시작 페이지/오프셋 계산
-    int start_page = offset / PAGE_DATA_SIZE_DEFAULT;
-    int start_offset = offset % PAGE_DATA_SIZE_DEFAULT;
+    // 블록 하나짜리 파일
+    int file_pages = (data_node->u.data.len + PAGE_DATA_SIZE_DEFAULT - 1) / PAGE_DATA_SIZE_DEFAULT;
+    int bytes_read = uffs_BlockMapReadBlock(dev.fd, data_node->u.data.block, buf, size, offset, 0, file_pages, -1, ra);
+    if (bytes_read < 0)
+        return bytes_read;
+
+    // 데이터 출력
+    fprintf(stdout, "[uffs_read] finished - Data read: %.*s\n", (int)bytes_read, buf);
+
+    return bytes_read;
+}
 
-    // fprintf(stdout, "[uffs_read] Start page: %d, start offset: %d\n", start_page, start_offset);
 
-    int page_id = start_page;
-    size_t bytes_to_read = size;
-    size_t bytes_read = 0;
-    uffs_MiniHeader miniHeader;
-    char data_buf[PAGE_DATA_SIZE_DEFAULT] = {0};
+// dedup mount거나 이미 공유 블록을 쓰는 파일의 write
+// 지금 내용(블록 또는 inline data)에 offset부터 buf를 덮은 블록 내용을 만들어서,
+// 같은 내용의 블록이 있으면 data를 쓰지 않고 그 블록을 같이 쓰고,
+// 다른 파일과 같이 쓰는 블록이면 새 블록에 씀(COW). 혼자 쓰는 블록은 바뀐 페이지만 제자리에 씀
+static int uffs_write_dedup(TreeNode *file_node, TreeNode *data_node, uffs_FileInfo *file_info,
+                            const char *buf, size_t size, off_t offset,
+                            const char *inline_buf, u32 inline_len) {
+    size_t max_block_size = PAGES_PER_BLOCK_DEFAULT * PAGE_DATA_SIZE_DEFAULT;
+    int old_block = data_node != NULL ? data_node->u.data.block : -1;
+    u16 old_refs = (file_info->attr & FILE_ATTR_DEDUP) ? uffs_DedupRefs(old_block) : 0;
+    UBOOL share = uffs_DedupEnabled() && UFFS_DEDUP_REF_FITS(file_info->name_len);
+    u32 old_len = data_node != NULL ? data_node->u.data.len : inline_len;
+    u32 len;
+    int first_page = 0;
+    char *data;
+    u16 serial;
+    int block = -1;
+    int ret;
 
-    // 페이지별 읽기
-    while (bytes_to_read > 0) {
-        size_t read_size = (bytes_to_read < PAGE_DATA_SIZE_DEFAULT) ? bytes_to_read : PAGE_DATA_SIZE_DEFAULT;
+    if ((size_t)offset >= max_block_size) {
+        return -EFBIG;
+    }
+    if (offset + size > max_block_size) {
+        size = max_block_size - offset;
+    }
+    len = offset + size > old_len ? offset + size : old_len;
 
-        if (readPage(dev.fd, data_node->u.data.block, page_id, &miniHeader, data_buf, NULL) != U_SUCC) {
-            // fprintf(stderr, "[uffs_read] Error: Failed to read page %d in block %d.\n", page_id, data_node->u.data.block);
-            break;
+    // 블록 내용: 지금 내용 + EOF 뒤의 0 + buf
+    data = (char *)calloc(1, max_block_size);
+    if (data == NULL) {
+        return -ENOMEM;
+    }
+    if (data_node != NULL && old_len > 0) {
+        ret = uffs_BlockMapReadBlock(dev.fd, old_block, data, old_len, 0,
+                                     0, (old_len + PAGE_DATA_SIZE_DEFAULT - 1) / PAGE_DATA_SIZE_DEFAULT, -1, NULL);
+        if (ret >= 0 && (u32)ret != old_len) {
+            ret = -EIO;
+        }
+        if (ret < 0) {
+            free(data);
+            return ret;
+        }
+    } else if (data_node == NULL) {
+        memcpy(data, inline_buf, inline_len);
+    }
+    memcpy(data + offset, buf, size);
+
+    // 같은 내용의 블록 찾기 (지금 블록과 같으면 할 일 없음)
+    if (share && len > 0) {
+        block = uffs_DedupFind(dev.fd, data, len);
+        if (block >= 0 && block != old_block && uffs_DedupAddRef(dev.fd, block) == U_FAIL) {
+            block = -1;
+        }
+    }
+
+    if (block < 0) {
+        // 혼자 쓰는 블록이면 제자리, 같이 쓰는 블록이거나 블록이 없으면 새 블록
+        if (old_block >= 0 && old_refs <= 1) {
+            block = old_block;
+            if (old_refs == 1) {
+                uffs_DedupRemove(block);
+            }
+            // 앞쪽 페이지는 그대로, page 0 tag의 참조 수를 처음 적을 때만 page 0부터
+            if (!(share && old_refs == 0)) {
+                first_page = ((size_t)offset < old_len ? (u32)offset : old_len) / PAGE_DATA_SIZE_DEFAULT;
+            }
+        } else if (getFreeBlock(dev.fd, &block, &serial) == U_FAIL) {
+            fprintf(stderr, "[uffs_write] no free block available for data\n");
+            free(data);
+            return -ENOSPC;
+        } else if (old_refs > 1) {
+            uffs_DedupCow();
+        }
+
+        uffs_ReadAheadInvalidate(block);
+        for (int page_id = first_page; page_id * PAGE_DATA_SIZE_DEFAULT < len || page_id == 0; page_id++) {
+            size_t write_size = len - page_id * PAGE_DATA_SIZE_DEFAULT;
+            if (write_size > PAGE_DATA_SIZE_DEFAULT) {
+                write_size = PAGE_DATA_SIZE_DEFAULT;
+            }
+
+            uffs_MiniHeader mini_header = {0x01, 0x00, 0xFFFF};
+            uffs_Tag tag = {0};
+            tag.s.dirty = 1;
+            tag.s.valid = 0;
+            tag.s.type = UFFS_TYPE_DATA;
+            tag.s.data_len = write_size;
+            tag.s.serial = data_node != NULL ? data_node->u.data.serial : block;
+            tag.s.page_id = page_id;
+            tag.s.parent = file_node->u.file.serial;
+            // page 0 tag의 data_sum은 참조 수
+            tag.data_sum = (share && page_id == 0) ? 1 : 0;
+
+            if (writePage(dev.fd, block, page_id, &mini_header, data + page_id * PAGE_DATA_SIZE_DEFAULT, &tag) == U_FAIL) {
+                fprintf(stderr, "[uffs_write] failed to write page %d\n", page_id);
+                uffs_ReadAheadInvalidate(block);
+                free(data);
+                return -EIO;
+            }
+        }
+        uffs_ReadAheadInvalidate(block);
+
+        if (share) {
+            uffs_DedupInsert(block, data, len);
+        }
+    }
+    free(data);
+
+    // 전에 쓰던 블록 놓기 (마지막 참조였으면 지워짐)
+    if (old_block >= 0 && block != old_block) {
+        uffs_ReadAheadInvalidate(old_block);
+        if (old_refs > 0) {
+            uffs_DedupDelRef(dev.fd, old_block);
         } else {
-            // fprintf(stdout, "[uffs_read] Read success at block %d, page %d. Data: %.*s\n",
-            //         data_node->u.data.block, page_id, read_size, data_buf);
+            eraseBlock(dev.fd, old_block);
         }
+        uffs_ReadAheadInvalidate(old_block);
+    }
 
-        // buf에 복사
-        memcpy(buf + bytes_read, data_buf + start_offset, read_size);
+    if (data_node == NULL) {
+        data_node = uffs_TreeNodeGet(&dev);
+        if (!data_node) {
+            fprintf(stderr, "[uffs_write] no tree node left for data_node\n");
+            return -ENOMEM;
+        }
+        initNode(&dev, data_node, block, UFFS_TYPE_DATA, file_node->u.file.serial, block);
+        uffs_InsertNodeToTree(&dev, UFFS_TYPE_DATA, data_node);
+    }
+    data_node->u.data.block = block;
+    data_node->u.data.len = len;
+    file_node->u.file.len = len;
+
+    // 헤더에 공유 블록 참조를 둠
+    memset(UFFS_INLINE_DATA(file_info), 0, sizeof(uffs_DedupRef));
+    if (share) {
+        uffs_DedupRef ref = {0};
+        ref.block = block;
+        ref.len = len;
+        memcpy(UFFS_INLINE_DATA(file_info), &ref, sizeof(ref));
+        file_info->attr |= FILE_ATTR_DEDUP;
+    } else {
+        file_info->attr &= ~FILE_ATTR_DEDUP;
+    }
+    if (updateFileInfoPage(&dev, file_node, file_info, 0, UFFS_TYPE_FILE) == U_FAIL) {
+        fprintf(stderr, "[uffs_write] header page write error\n");
+        return -EIO;
+    }
 
-        bytes_read += read_size;
-        bytes_to_read -= read_size;
-        page_id++;
-        start_offset = 0;  // 이후 페이지는 offset 없음
+    fprintf(stdout, "[uffs_write] finished - %zu bytes at %ld, file %u bytes in block %d (refs %u)\n",
+            size, (long)offset, len, block, uffs_DedupRefs(block));
+    return size;
+}
+
+// 블록 하나(또는 inline)로 된 파일을 블록 map 파일로 바꿈 (헤더 페이지는 호출한 쪽에서 씀)
+// 블록 map 파일은 offset 그대로 쓰고, 중간을 비워 둘 수 있고(hole), 길이를 줄일 수 있음
+static int uffs_to_blockmap(TreeNode *file_node, TreeNode *data_node, uffs_FileInfo *file_info) {
+    u16 parent = file_node->u.file.serial;
+    int limit = UFFS_INLINE_LIMIT(file_info->name_len);
+    u32 len = 0;
+    int ret;
+
+    if (file_info->attr & FILE_ATTR_BLOCKMAP) {
+        return 0;
+    }
+    if (file_info->attr & FILE_ATTR_COMPRESS) {
+        return -EOPNOTSUPP;
+    }
+    if (!UFFS_BLOCKMAP_FITS(file_info->name_len)) {
+        return -ENAMETOOLONG;
     }
 
-    // 데이터 출력
-    fprintf(stdout, "[uffs_read] finished - Data read: %.*s\n", (int)bytes_read, buf);
+    if (file_info->attr & FILE_ATTR_INLINE) {
+        // 헤더 페이지의 data를 파일 블록 0으로 옮김
+        char inline_buf[MAX_FILENAME_LENGTH];
 
-    return bytes_read;
+        len = file_node->u.file.len;
+        if ((int)len > limit) {
+            len = limit;
+        }
+        memcpy(inline_buf, UFFS_INLINE_DATA(file_info), len);
+        ret = uffs_BlockMapWrite(&dev, parent, 0, inline_buf, len, 0);
+        if (ret >= 0 && (u32)ret != len) {
+            ret = -ENOSPC;
+        }
+        if (ret < 0) {
+            uffs_BlockMapTruncate(&dev, parent, len, 0);
+            return ret;
+        }
+    } else if (file_info->attr & FILE_ATTR_DEDUP) {
+        // 공유 블록의 내용을 이 파일의 블록으로 복사하고 참조를 놓음
+        int old_block = data_node->u.data.block;
+        char *data = (char *)malloc(UFFS_BLOCK_DATA_SIZE);
+
+        len = data_node->u.data.len;
+        if (data == NULL) {
+            return -ENOMEM;
+        }
+        ret = uffs_BlockMapReadBlock(dev.fd, old_block, data, len, 0,
+                                     0, (len + PAGE_DATA_SIZE_DEFAULT - 1) / PAGE_DATA_SIZE_DEFAULT, -1, NULL);
+        if (ret >= 0 && (u32)ret != len) {
+            ret = -EIO;
+        }
+        if (ret >= 0) {
+            ret = uffs_BlockMapWrite(&dev, parent, 0, data, len, 0);
+            if (ret >= 0 && (u32)ret != len) {
+                ret = -ENOSPC;
+            }
+        }
+        free(data);
+        if (ret < 0) {
+            uffs_BlockMapTruncate(&dev, parent, len, 0);
+            return ret;
+        }
+
+        uffs_ReadAheadInvalidate(old_block);
+        uffs_DedupDelRef(dev.fd, old_block);
+        uffs_ReadAheadInvalidate(old_block);
+        uffs_BreakFromEntry(&dev, UFFS_TYPE_DATA, data_node);
+        uffs_TreeNodePut(&dev, data_node);
+    } else if (data_node != NULL) {
+        // 예전 파일: 블록을 그대로 파일 블록 0으로
+        len = data_node->u.data.len;
+        if (uffs_BlockMapAdopt(&dev, data_node) == U_FAIL) {
+            return -EIO;
+        }
+    }
+
+    file_info->attr &= ~(FILE_ATTR_INLINE | FILE_ATTR_DEDUP);
+    file_info->attr |= FILE_ATTR_BLOCKMAP;
+    memset(UFFS_INLINE_DATA(file_info), 0, limit);
+    uffs_BlockMapSetFileLen(file_info, len);
+    file_node->u.file.len = len;
+    fprintf(stdout, "[uffs_to_blockmap] file %u converted, %u bytes\n", parent, len);
+    return 0;
 }
 
+static int uffs_write_blockmap(TreeNode *file_node, TreeNode *data_node, uffs_FileInfo *file_info,
+                               const char *buf, size_t size, off_t offset) {
+    u32 len;
+    int ret;
 
-int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
-              struct fuse_file_info *fi) {
+    ret = uffs_to_blockmap(file_node, data_node, file_info);
+    if (ret < 0) {
+        fprintf(stderr, "[uffs_write] block map conversion error: %d\n", ret);
+        return ret;
+    }
+
+    len = uffs_BlockMapFileLen(file_info);
+    ret = uffs_BlockMapWrite(&dev, file_node->u.file.serial, len, buf, size, offset);
+    if (ret > 0 && offset + ret > len) {
+        len = offset + ret;
+    }
+    uffs_BlockMapSetFileLen(file_info, len);
+    file_node->u.file.len = len;
+
+    // 쓰다가 실패해도 바뀐 형식은 헤더에 남김
+    if (updateFileInfoPage(&dev, file_node, file_info, 0, UFFS_TYPE_FILE) == U_FAIL) {
+        fprintf(stderr, "[uffs_write] header page write error\n");
+        return -EIO;
+    }
+
+    fprintf(stdout, "[uffs_write] finished - block map %d bytes at %ld, file %u bytes\n", ret, (long)offset, len);
+    return ret;
+}
+
+static int uffs_write_locked(const char *path, const char *buf, size_t size, off_t offset,
+                                            struct fuse_file_info *fi) {
     fprintf(stdout, "[uffs_write] called, data: %s, path: %s, size: %zu\n", buf, path, size);
 
     TreeNode *file_node;
@@ -286,8 +672,73 @@ int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
         return -ENOENT;
     }
 
+    // 지금 헤더 페이지의 이름/시간을 유지한 채 갱신
+    uffs_FileInfo file_info = {0};
+    if (IS_FAIL(readPage(dev.fd, HDR_BLOCK(file_node->u.file.hdr), HDR_PAGE(file_node->u.file.hdr), NULL, (char *)&file_info, NULL))) {
+        fprintf(stderr, "[uffs_write] header page read error\n");
+        return -EIO;
+    }
+    file_info.name[MAX_FILENAME_LENGTH - 1] = '\0';
+    file_info.name_len = strlen(file_info.name);
+
     // 데이터 노드 찾기
     data_node = uffs_TreeFindDataNodeByParent(&dev, file_node->u.file.serial);
+
+    // 압축 mount면 data 블록으로 가는 write는 chunk 단위로 압축해서 씀 (이미 압축된 파일은 mount 옵션과 상관없이)
+    UBOOL compress = (file_info.attr & FILE_ATTR_COMPRESS) ||
+                     (data_node == NULL && uffs_CompressCodec() != UFFS_COMPRESS_NONE &&
+                      UFFS_CHUNK_INDEX_FITS(file_info.name_len));
+
+    // data 블록이 없고 헤더 페이지의 남은 자리에 들어가면 inline으로 씀
+    if (data_node == NULL && !(file_info.attr & (FILE_ATTR_COMPRESS | FILE_ATTR_BLOCKMAP)) &&
+        offset + (off_t)size <= UFFS_INLINE_LIMIT(file_info.name_len)) {
+        u32 len = (file_info.attr & FILE_ATTR_INLINE) ? file_node->u.file.len : 0;
+
+        // EOF 뒤에 쓰면 그 사이는 0
+        if (!(file_info.attr & FILE_ATTR_INLINE))
+            memset(UFFS_INLINE_DATA(&file_info), 0, UFFS_INLINE_LIMIT(file_info.name_len));
+        else if ((off_t)len < offset)
+            memset(UFFS_INLINE_DATA(&file_info) + len, 0, offset - len);
+        file_info.attr |= FILE_ATTR_INLINE;
+        memcpy(UFFS_INLINE_DATA(&file_info) + offset, buf, size);
+        if (offset + size > len)
+            len = offset + size;
+        file_node->u.file.len = len;
+        if (updateFileInfoPage(&dev, file_node, &file_info, 0, UFFS_TYPE_FILE) == U_FAIL) {
+            fprintf(stderr, "[uffs_write] header page write error\n");
+            return -EIO;
+        }
+        fprintf(stdout, "[uffs_write] finished - inline %zu bytes\n", size);
+        return size;
+    }
+
+    // 압축/dedup 파일이 아니면 파일 블록 단위로 offset 그대로 씀
+    // dedup 파일도 블록 하나를 넘어가면 블록 map 파일로 바꿈 (더는 공유하지 않음)
+    UBOOL dedup = !compress && (uffs_DedupEnabled() || (file_info.attr & FILE_ATTR_DEDUP));
+    if ((file_info.attr & FILE_ATTR_BLOCKMAP) ||
+        (!compress && UFFS_BLOCKMAP_FITS(file_info.name_len) &&
+         (!dedup || offset + size > PAGES_PER_BLOCK_DEFAULT * PAGE_DATA_SIZE_DEFAULT))) {
+        return uffs_write_blockmap(file_node, data_node, &file_info, buf, size, offset);
+    }
+
+    // 여기부터는 data 블록에 씀. inline이었으면 헤더 페이지에서 data를 지움
+    // (압축할 때는 inline이던 data를 chunk로 옮겨야 하므로 따로 둠)
+    char inline_buf[MAX_FILENAME_LENGTH];
+    u32 inline_len = 0;
+    if (file_info.attr & FILE_ATTR_INLINE) {
+        inline_len = file_node->u.file.len;
+        if ((int)inline_len > UFFS_INLINE_LIMIT(file_info.name_len))
+            inline_len = UFFS_INLINE_LIMIT(file_info.name_len);
+        memcpy(inline_buf, UFFS_INLINE_DATA(&file_info), inline_len);
+        file_info.attr &= ~FILE_ATTR_INLINE;
+        memset(UFFS_INLINE_DATA(&file_info), 0, UFFS_INLINE_LIMIT(file_info.name_len));
+    }
+
+    // 같은 내용의 블록을 공유하거나, 이미 공유 블록을 쓰고 있는 파일
+    if (dedup) {
+        return uffs_write_dedup(file_node, data_node, &file_info, buf, size, offset, inline_buf, inline_len);
+    }
+
     if (data_node == NULL) {
         // 데이터 노드가 없으면 생성
         int data_block_id;
@@ -297,24 +748,49 @@ int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
             return -ENOSPC;
         }
 
-        data_node = (TreeNode *)malloc(sizeof(TreeNode));
+        data_node = uffs_TreeNodeGet(&dev);
         if (!data_node) {
-            fprintf(stderr, "[uffs_write] memory allocation failed for data_node\n");
+            fprintf(stderr, "[uffs_write] no tree node left for data_node\n");
             return -ENOMEM;
         }
 
         if (initNode(&dev, data_node, data_block_id, UFFS_TYPE_DATA, file_node->u.file.serial, serial) == U_FAIL) {
             fprintf(stderr, "[uffs_write] data node initialization failed\n");
-            free(data_node);
+            uffs_TreeNodePut(&dev, data_node);
             return -EIO;
         }
 
-        file_node->u.file.block = data_block_id;
         uffs_InsertNodeToTree(&dev, UFFS_TYPE_DATA, data_node);
     }
 
     // // 데이터 블록 초기화 (모든 페이지를 0으로 설정)
     int block_id = data_node->u.data.block;
+
+    if (compress) {
+        int ret = 0;
+
+        uffs_ReadAheadInvalidate(block_id);
+        if (inline_len > 0)
+            ret = uffs_CompressWrite(dev.fd, block_id, data_node->u.data.serial, file_node->u.file.serial,
+                                     &file_info, inline_buf, inline_len, 0);
+        if (ret >= 0)
+            ret = uffs_CompressWrite(dev.fd, block_id, data_node->u.data.serial, file_node->u.file.serial,
+                                     &file_info, buf, size, offset);
+        uffs_ReadAheadInvalidate(block_id);
+        if (ret < 0) {
+            fprintf(stderr, "[uffs_write] compressed write error: %d\n", ret);
+            return ret;
+        }
+
+        file_node->u.file.len = uffs_CompressFileLen(&file_info);
+        data_node->u.data.len = file_node->u.file.len;
+        if (updateFileInfoPage(&dev, file_node, &file_info, 0, UFFS_TYPE_FILE) == U_FAIL) {
+            fprintf(stderr, "[uffs_write] header page write error\n");
+            return -EIO;
+        }
+        fprintf(stdout, "[uffs_write] finished - compressed %d bytes at %ld\n", ret, (long)offset);
+        return ret;
+    }
     // for (int page_id = 0; page_id < PAGES_PER_BLOCK_DEFAULT; page_id++) {
     //     char empty_buf[PAGE_DATA_SIZE_DEFAULT] = {0};
     //     uffs_MiniHeader mini_header = {0x01, 0x00, 0xFFFF};
@@ -345,6 +821,9 @@ int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
         size = max_block_size;
     }
 
+    // 이 블록을 미리 읽어둔 cache는 write 전후로 모두 무효
+    uffs_ReadAheadInvalidate(block_id);
+
     // 데이터 쓰기
     int page_id = 0;
     while (written < size) {
@@ -374,6 +853,7 @@ int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
         // 페이지 쓰기
         if (writePage(dev.fd, block_id, page_id, &mini_header, data_buf, &tag) == U_FAIL) {
             fprintf(stderr, "[uffs_write] failed to write page %d\n", page_id);
+            uffs_ReadAheadInvalidate(block_id);
             return -EIO;
         }else{
             // fprintf(stdout, "[uffs_write] write success at block id %d, page %d, data: %s\n",block_id, page_id, data_buf);
@@ -385,11 +865,12 @@ int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
             break;
     }
 
+    uffs_ReadAheadInvalidate(block_id);
+
     // 파일 크기 갱신
     file_node->u.file.len = written;
     data_node->u.data.len = written;
     // 메타데이터 갱신
-    uffs_FileInfo file_info = {0};
     updateFileInfoPage(&dev, file_node, &file_info, 0, UFFS_TYPE_FILE);
 
     fprintf(stdout, "[uffs_write] finished\n");
@@ -397,7 +878,149 @@ int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
 }
 
 
-int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+// 파일 노드, data 노드, 헤더 페이지 찾기 (truncate/fallocate)
+static int uffs_find_file(const char *path, TreeNode **file_node, TreeNode **data_node, uffs_FileInfo *file_info) {
+    if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, file_node, path) == U_FAIL) {
+        return -ENOENT;
+    }
+    if (IS_FAIL(readPage(dev.fd, HDR_BLOCK((*file_node)->u.file.hdr), HDR_PAGE((*file_node)->u.file.hdr), NULL, (char *)file_info, NULL))) {
+        return -EIO;
+    }
+    file_info->name[MAX_FILENAME_LENGTH - 1] = '\0';
+    file_info->name_len = strlen(file_info->name);
+    *data_node = uffs_TreeFindDataNodeByParent(&dev, (*file_node)->u.file.serial);
+    return 0;
+}
+
+static int uffs_truncate_locked(const char *path, off_t size) {
+    fprintf(stdout, "[uffs_truncate] called - path: %s, size: %ld\n", path, (long)size);
+
+    TreeNode *file_node;
+    TreeNode *data_node;
+    uffs_FileInfo file_info = {0};
+    int limit;
+    int ret;
+
+    if (size < 0) {
+        return -EINVAL;
+    }
+    if (size > UFFS_BLOCKMAP_MAX_LEN) {
+        return -EFBIG;
+    }
+    ret = uffs_find_file(path, &file_node, &data_node, &file_info);
+    if (ret < 0) {
+        fprintf(stderr, "[uffs_truncate] file not found: %s\n", path);
+        return ret;
+    }
+    limit = UFFS_INLINE_LIMIT(file_info.name_len);
+
+    if (file_info.attr & FILE_ATTR_COMPRESS) {
+        // 압축 파일은 chunk를 다시 만들어야 해서 0으로만 줄임
+        if (size != 0) {
+            return -EOPNOTSUPP;
+        }
+        if (data_node != NULL) {
+            uffs_ReadAheadInvalidate(data_node->u.data.block);
+            eraseBlock(dev.fd, data_node->u.data.block);
+            uffs_ReadAheadInvalidate(data_node->u.data.block);
+            uffs_BreakFromEntry(&dev, UFFS_TYPE_DATA, data_node);
+            uffs_TreeNodePut(&dev, data_node);
+        }
+        file_info.attr &= ~FILE_ATTR_COMPRESS;
+        memset(UFFS_INLINE_DATA(&file_info), 0, limit);
+        file_node->u.file.len = 0;
+    } else if ((file_info.attr & FILE_ATTR_INLINE) && data_node == NULL && size <= limit) {
+        // inline 파일은 헤더 페이지 안에서
+        if ((u32)size < file_node->u.file.len) {
+            memset(UFFS_INLINE_DATA(&file_info) + size, 0, limit - size);
+        }
+        file_node->u.file.len = size;
+    } else {
+        ret = uffs_to_blockmap(file_node, data_node, &file_info);
+        if (ret < 0) {
+            fprintf(stderr, "[uffs_truncate] block map conversion error: %d\n", ret);
+            return ret;
+        }
+        ret = uffs_BlockMapTruncate(&dev, file_node->u.file.serial, uffs_BlockMapFileLen(&file_info), size);
+        if (ret == 0) {
+            file_node->u.file.len = size;
+        }
+        // 0이면 블록이 없으므로 보통 빈 파일로 (다음 write가 inline일 수 있음)
+        if (ret == 0 && size == 0) {
+            file_info.attr &= ~FILE_ATTR_BLOCKMAP;
+            memset(UFFS_INLINE_DATA(&file_info), 0, limit);
+        } else {
+            uffs_BlockMapSetFileLen(&file_info, file_node->u.file.len);
+        }
+    }
+
+    if (updateFileInfoPage(&dev, file_node, &file_info, 0, UFFS_TYPE_FILE) == U_FAIL) {
+        fprintf(stderr, "[uffs_truncate] header page write error\n");
+        return -EIO;
+    }
+    fprintf(stdout, "[uffs_truncate] finished - %u bytes\n", file_node->u.file.len);
+    return ret;
+}
+
+// FALLOC_FL_KEEP_SIZE: 블록만 미리 받음, FALLOC_FL_PUNCH_HOLE(KEEP_SIZE와 같이): 블록을 돌려주고 hole로
+static int uffs_fallocate_locked(const char *path, int mode, off_t offset, off_t len, struct fuse_file_info *fi) {
+    fprintf(stdout, "[uffs_fallocate] called - path: %s, mode: 0x%x, offset: %ld, len: %ld\n", path, mode, (long)offset, (long)len);
+
+    TreeNode *file_node;
+    TreeNode *data_node;
+    uffs_FileInfo file_info = {0};
+    u32 file_len;
+    int ret;
+
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) {
+        return -EOPNOTSUPP;
+    }
+    if ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE)) {
+        return -EOPNOTSUPP;
+    }
+    if (offset < 0 || len <= 0) {
+        return -EINVAL;
+    }
+    if (offset + len > UFFS_BLOCKMAP_MAX_LEN) {
+        return -EFBIG;
+    }
+    ret = uffs_find_file(path, &file_node, &data_node, &file_info);
+    if (ret < 0) {
+        fprintf(stderr, "[uffs_fallocate] file not found: %s\n", path);
+        return ret;
+    }
+
+    ret = uffs_to_blockmap(file_node, data_node, &file_info);
+    if (ret < 0) {
+        fprintf(stderr, "[uffs_fallocate] block map conversion error: %d\n", ret);
+        return ret;
+    }
+    file_len = uffs_BlockMapFileLen(&file_info);
+
+    if (mode & FALLOC_FL_PUNCH_HOLE) {
+        ret = uffs_BlockMapPunch(&dev, file_node->u.file.serial, file_len, offset, len);
+    } else {
+        ret = uffs_BlockMapAllocate(&dev, file_node->u.file.serial, offset, len);
+        // KEEP_SIZE가 없으면 파일 길이도 늘림
+        if (ret == 0 && !(mode & FALLOC_FL_KEEP_SIZE) && offset + len > file_len) {
+            ret = uffs_BlockMapTruncate(&dev, file_node->u.file.serial, file_len, offset + len);
+            if (ret == 0) {
+                file_len = offset + len;
+            }
+        }
+    }
+
+    uffs_BlockMapSetFileLen(&file_info, file_len);
+    file_node->u.file.len = file_len;
+    if (updateFileInfoPage(&dev, file_node, &file_info, 0, UFFS_TYPE_FILE) == U_FAIL) {
+        fprintf(stderr, "[uffs_fallocate] header page write error\n");
+        return -EIO;
+    }
+    fprintf(stdout, "[uffs_fallocate] finished - %d, file %u bytes\n", ret, file_len);
+    return ret;
+}
+
+static int uffs_create_locked(const char *path, mode_t mode, struct fuse_file_info *fi) {
     fprintf(stdout, "[uffs_create] called, path: %s\n", path);
 
     // 부모 디렉토리 노드 찾기
@@ -408,20 +1031,28 @@ int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
         return -ENOENT;
     }
 
-    // 파일 블록 할당
-    int file_block_id;
-    u16 serial;
-    if (getFreeBlock(dev.fd, &file_block_id, &serial) == U_FAIL) {
-        fprintf(stderr, "[uffs_create] no free block available for file\n");
+    // 헤더 페이지 할당 (metadata 블록에 모아 둠)
+    int file_block_id, file_page_id;
+    u16 serial = uffs_FindFreeFsnSerial(&dev);
+    if (serial == INVALID_UFFS_SERIAL) {
+        fprintf(stderr, "[uffs_create] no free serial\n");
+        return -ENOSPC;
+    }
+    if (getFreeHeaderPage(dev.fd, &file_block_id, &file_page_id) == U_FAIL) {
+        fprintf(stderr, "[uffs_create] no free page available for file header\n");
         return -ENOSPC;
     }
 
     // 파일 노드 생성
-    TreeNode *file_node = (TreeNode *)malloc(sizeof(TreeNode));
+    TreeNode *file_node = uffs_TreeNodeGet(&dev);
+    if (file_node == NULL) {
+        return -ENOSPC;
+    }
 
     // 파일 노드 초기화
-    if (initNode(&dev, file_node, file_block_id, UFFS_TYPE_FILE, parent_node->u.dir.serial, serial) == U_FAIL) {
+    if (initNode(&dev, file_node, HDR_ADDR(file_block_id, file_page_id), UFFS_TYPE_FILE, parent_node->u.dir.serial, serial) == U_FAIL) {
         fprintf(stderr, "[uffs_create] file node initialization failed\n");
+        uffs_TreeNodePut(&dev, file_node);
         return -EIO;
     }
 
@@ -439,6 +1070,7 @@ int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
 
     // 길이 검사
     if (strlen(file_name) > MAX_FILENAME_LENGTH - 1) {
+        uffs_TreeNodePut(&dev, file_node);
         return -ENOENT;
     }
 
@@ -451,17 +1083,21 @@ int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
 
     if (updateFileInfoPage(&dev, file_node, &file_info, 1, UFFS_TYPE_FILE) == U_FAIL) {
         fprintf(stderr, "[uffs_create] file metadata write error\n");
+        uffs_TreeNodePut(&dev, file_node);
         return -EIO;
     }
 
     // 파일 노드 삽입
     uffs_InsertNodeToTree(&dev, UFFS_TYPE_FILE, file_node);
 
+    // create는 open을 겸함
+    fi->fh = (uintptr_t)uffs_ReadAheadOpen();
+
     fprintf(stdout, "[uffs_create] finished\n");
     return 0;
 }
 
-int uffs_mkdir(const char *path, mode_t mode) {
+static int uffs_mkdir_locked(const char *path, mode_t mode) {
     fprintf(stdout, "[uffs_mkdir] called, path: %s\n", path);
     // 트리 부분
     TreeNode* parent_node;
@@ -480,16 +1116,22 @@ int uffs_mkdir(const char *path, mode_t mode) {
     uffs_MiniHeader miniHeader = {0};
     uffs_Tag tag = {0};
     uffs_FileInfo dir_file_info = {0};
-    int new_block_id = -1;
-    u16 serial;
+    int new_block_id = -1, new_page_id = -1;
+    u16 serial = uffs_FindFreeFsnSerial(&dev);
 
-    result = getFreeBlock(dev.fd, &new_block_id, &serial);
+    if (serial == INVALID_UFFS_SERIAL) {
+        return -ENOSPC;
+    }
+    result = getFreeHeaderPage(dev.fd, &new_block_id, &new_page_id);
     if(result == U_FAIL){
         return -ENOENT;
     }
 
-    dir_node = (TreeNode*)malloc(sizeof(TreeNode));
-    initNode(&dev, dir_node, new_block_id, UFFS_TYPE_DIR, parent_node->u.dir.serial, serial);
+    dir_node = uffs_TreeNodeGet(&dev);
+    if (dir_node == NULL) {
+        return -ENOSPC;
+    }
+    initNode(&dev, dir_node, HDR_ADDR(new_block_id, new_page_id), UFFS_TYPE_DIR, parent_node->u.dir.serial, serial);
     
     // 파일 이름 추출
     char dir_name[MAX_FILENAME_LENGTH]; // 크기가 충분한 버퍼로 선언
@@ -502,6 +1144,7 @@ int uffs_mkdir(const char *path, mode_t mode) {
 
     // 길이 검사
     if (strlen(dir_name) > MAX_FILENAME_LENGTH - 1) {
+        uffs_TreeNodePut(&dev, dir_node);
         return -ENOENT;
     }
 
@@ -513,6 +1156,7 @@ int uffs_mkdir(const char *path, mode_t mode) {
     
     // 디스크 업데이트
     if(updateFileInfoPage(&dev, dir_node, &dir_file_info, 1, UFFS_TYPE_DIR) == U_FAIL){
+        uffs_TreeNodePut(&dev, dir_node);
         return -ENOENT;
     }
     // 트리에 노드 추가
@@ -522,34 +1166,491 @@ int uffs_mkdir(const char *path, mode_t mode) {
     return 0;
 }
 
+// 파일 헤더 읽기 (name_len은 이름에서 다시 셈)
+static int uffs_read_header(TreeNode *node, uffs_FileInfo *file_info) {
+    if (IS_FAIL(readPage(dev.fd, HDR_BLOCK(node->u.file.hdr), HDR_PAGE(node->u.file.hdr), NULL, (char *)file_info, NULL))) {
+        return -EIO;
+    }
+    file_info->name[MAX_FILENAME_LENGTH - 1] = '\0';
+    file_info->name_len = strlen(file_info->name);
+    return 0;
+}
+
+// serial 파일의 data 블록과 dedup 참조를 모두 돌려줌, file_info: 그 파일의 헤더
+static int uffs_free_file_data(u16 serial, const uffs_FileInfo *file_info) {
+    TreeNode *data_node;
+    int block;
+
+    if ((file_info->attr & FILE_ATTR_BLOCKMAP) &&
+        uffs_BlockMapTruncate(&dev, serial, uffs_BlockMapFileLen(file_info), 0) < 0) {
+        return -EIO;
+    }
+    // 예전 파일, 압축 파일의 블록과 dedup 참조 (공유 블록은 마지막 참조일 때만 지워짐)
+    while ((data_node = uffs_TreeFindDataNodeByParent(&dev, serial)) != NULL) {
+        block = data_node->u.data.block;
+        uffs_ReadAheadInvalidate(block);
+        if (file_info->attr & FILE_ATTR_DEDUP) {
+            uffs_DedupDelRef(dev.fd, block);
+        } else {
+            eraseBlock(dev.fd, block);
+        }
+        uffs_ReadAheadInvalidate(block);
+        uffs_BreakFromEntry(&dev, UFFS_TYPE_DATA, data_node);
+        uffs_TreeNodePut(&dev, data_node);
+    }
+    return 0;
+}
+
+// 파일의 data 블록을 모두 돌려주고 헤더 페이지를 지운 뒤 트리에서 뺌
+// data를 먼저 지우므로 중간에 멈춰도 다른 파일이 쓰는 블록을 가리키는 헤더는 남지 않음
+static int uffs_remove_file(TreeNode *file_node) {
+    uffs_FileInfo file_info = {0};
+    int ret;
+
+    ret = uffs_read_header(file_node, &file_info);
+    if (ret == 0) {
+        ret = uffs_free_file_data(file_node->u.file.serial, &file_info);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (deleteFileInfoPage(&dev, file_node) == U_FAIL) {
+        return -EIO;
+    }
+    uffs_BreakFromEntry(&dev, UFFS_TYPE_FILE, file_node);
+    uffs_TreeNodePut(&dev, file_node);
+    return 0;
+}
+
+// 하위에 디렉토리나 파일이 있는지 (자식 목록이 따로 없어서 hash를 훑음)
+static UBOOL uffs_dir_empty(TreeNode *dir_node) {
+    u16 serial = dir_node->u.dir.serial;
+
+    TreeNode *node;
+    u16 x;
+
+    for (int i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
+        for (x = dev.tree.dir_entry[i]; x != EMPTY_NODE; x = node->hash_next) {
+            node = FROM_IDX(x, TPOOL(&dev));
+            if (node != dir_node && node->u.dir.parent == serial) {
+                return U_FALSE;
+            }
+        }
+    }
+    for (int i = 0; i < FILE_NODE_ENTRY_LEN; i++) {
+        for (x = dev.tree.file_entry[i]; x != EMPTY_NODE; x = node->hash_next) {
+            node = FROM_IDX(x, TPOOL(&dev));
+            if (node->u.file.parent == serial) {
+                return U_FALSE;
+            }
+        }
+    }
+    return U_TRUE;
+}
+
+static int uffs_remove_dir(TreeNode *dir_node) {
+    if (!uffs_dir_empty(dir_node)) {
+        return -ENOTEMPTY;
+    }
+    if (deleteFileInfoPage(&dev, dir_node) == U_FAIL) {
+        return -EIO;
+    }
+    uffs_BreakFromEntry(&dev, UFFS_TYPE_DIR, dir_node);
+    uffs_TreeNodePut(&dev, dir_node);
+    return 0;
+}
+
+static int uffs_unlink_locked(const char *path) {
+    fprintf(stdout, "[uffs_unlink] called, path: %s\n", path);
+
+    TreeNode *file_node;
+    int ret;
+
+    if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, &file_node, path) == U_FAIL) {
+        if (uffs_TreeFindDirNodeByNameWithoutParent(&dev, &file_node, path) == U_SUCC) {
+            return -EISDIR;
+        }
+        fprintf(stderr, "[uffs_unlink] file node not found\n");
+        return -ENOENT;
+    }
+
+    ret = uffs_remove_file(file_node);
+    if (ret < 0) {
+        fprintf(stderr, "[uffs_unlink] remove error: %d\n", ret);
+        return ret;
+    }
+    fprintf(stdout, "[uffs_unlink] finished\n");
+    return 0;
+}
+
+static int uffs_rmdir_locked(const char *path) {
+    fprintf(stdout, "[uffs_rmdir] called, path: %s\n", path);
+
+    TreeNode *dir_node;
+    int ret;
+
+    if (strcmp(path, "/") == 0) {
+        return -EBUSY;
+    }
+    if (uffs_TreeFindDirNodeByNameWithoutParent(&dev, &dir_node, path) == U_FAIL) {
+        if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, &dir_node, path) == U_SUCC) {
+            return -ENOTDIR;
+        }
+        fprintf(stderr, "[uffs_rmdir] dir node not found\n");
+        return -ENOENT;
+    }
+
+    ret = uffs_remove_dir(dir_node);
+    if (ret < 0) {
+        fprintf(stderr, "[uffs_rmdir] remove error: %d\n", ret);
+        return ret;
+    }
+    fprintf(stdout, "[uffs_rmdir] finished\n");
+    return 0;
+}
+
+// 이름과 부모만 바뀌므로 헤더 페이지 하나만 다시 씀 (data 블록은 parent가 파일 serial이라 그대로)
+static int uffs_rename_locked(const char *from, const char *to) {
+    fprintf(stdout, "[uffs_rename] called - from: %s, to: %s\n", from, to);
+
+    TreeNode *node, *new_parent, *target, *dir, *data_node;
+    u8 type = UFFS_TYPE_DIR, target_type = UFFS_TYPE_DIR;
+    uffs_FileInfo file_info = {0};
+    uffs_FileInfo target_info = {0};
+    char parent_path[MAX_FILENAME_LENGTH];
+    char payload[MAX_FILENAME_LENGTH];
+    const char *name = strrchr(to, '/') ? strrchr(to, '/') + 1 : to;
+    int name_len = strlen(name);
+    int payload_len = 0;
+    u16 old_parent;
+    int ret;
+
+    if (strcmp(from, "/") == 0 || strcmp(to, "/") == 0) {
+        return -EBUSY;
+    }
+    if (name_len == 0 || name_len > MAX_FILENAME_LENGTH - 1 || name - to >= MAX_FILENAME_LENGTH) {
+        return -ENAMETOOLONG;
+    }
+    if (uffs_TreeFindNodeByName(&dev, &node, from, &type, NULL) == U_FAIL) {
+        fprintf(stderr, "[uffs_rename] node not found: %s\n", from);
+        return -ENOENT;
+    }
+
+    // 새 부모 디렉토리
+    memcpy(parent_path, to, name - to);
+    parent_path[name - to] = '\0';
+    if (parent_path[0] == '\0') {
+        strcpy(parent_path, "/");
+    }
+    if (uffs_TreeFindDirNodeByNameWithoutParent(&dev, &new_parent, parent_path) == U_FAIL) {
+        fprintf(stderr, "[uffs_rename] parent dir not found: %s\n", parent_path);
+        return -ENOENT;
+    }
+
+    // 디렉토리를 자기 아래로 옮길 수 없음
+    if (type == UFFS_TYPE_DIR) {
+        for (dir = new_parent; dir != NULL && dir->u.dir.serial != ROOT_DIR_SERIAL; dir = uffs_TreeFindDirNode(&dev, dir->u.dir.parent)) {
+            if (dir == node) {
+                return -EINVAL;
+            }
+        }
+    }
+
+    // 같은 이름이 이미 있으면 바꿔치기
+    target = uffs_TreeFindDirNodeByName(&dev, name, name_len, new_parent->u.dir.serial, NULL);
+    if (target == NULL) {
+        target = uffs_TreeFindFileNodeByName(&dev, name, name_len, new_parent->u.dir.serial, NULL);
+        target_type = UFFS_TYPE_FILE;
+    }
+    if (target == node) {
+        return 0;
+    }
+    if (target != NULL && target_type == UFFS_TYPE_DIR && type != UFFS_TYPE_DIR) {
+        return -EISDIR;
+    }
+    if (target != NULL && target_type == UFFS_TYPE_FILE && type == UFFS_TYPE_DIR) {
+        return -ENOTDIR;
+    }
+    if (target != NULL && target_type == UFFS_TYPE_DIR && !uffs_dir_empty(target)) {
+        return -ENOTEMPTY;
+    }
+    // target의 data 블록은 헤더를 지운 뒤에 돌려주므로 헤더를 미리 읽어 둠
+    if (target != NULL && target_type == UFFS_TYPE_FILE && uffs_read_header(target, &target_info) < 0) {
+        return -EIO;
+    }
+
+    // 지금 헤더를 읽어서 이름만 바꿈, 이름 뒤의 inline 영역(inline data, chunk index 등)은 새 이름 뒤로 옮김
+    if (IS_FAIL(readPage(dev.fd, HDR_BLOCK(node->u.file.hdr), HDR_PAGE(node->u.file.hdr), NULL, (char *)&file_info, NULL))) {
+        return -EIO;
+    }
+    file_info.name[MAX_FILENAME_LENGTH - 1] = '\0';
+    file_info.name_len = strlen(file_info.name);
+
+    if (type == UFFS_TYPE_FILE) {
+        if (file_info.attr & FILE_ATTR_COMPRESS) {
+            payload_len = sizeof(uffs_ChunkIndex);
+        } else if (file_info.attr & FILE_ATTR_DEDUP) {
+            payload_len = sizeof(uffs_DedupRef);
+        } else if (file_info.attr & FILE_ATTR_BLOCKMAP) {
+            payload_len = sizeof(u32);
+        } else if (file_info.attr & FILE_ATTR_INLINE) {
+            payload_len = node->u.file.len;
+            // 새 이름 뒤에 inline data가 안 들어가면 파일 블록으로 옮김
+            if (payload_len > UFFS_INLINE_LIMIT(name_len) && UFFS_BLOCKMAP_FITS(name_len)) {
+                ret = uffs_to_blockmap(node, NULL, &file_info);
+                if (ret < 0) {
+                    return ret;
+                }
+                payload_len = sizeof(u32);
+            }
+        }
+        if (payload_len > UFFS_INLINE_LIMIT(name_len)) {
+            return -ENAMETOOLONG;
+        }
+        memcpy(payload, UFFS_INLINE_DATA(&file_info), payload_len);
+    }
+    memset(file_info.name, 0, MAX_FILENAME_LENGTH);
+    memcpy(file_info.name, name, name_len);
+    file_info.name_len = name_len;
+    memcpy(UFFS_INLINE_DATA(&file_info), payload, payload_len);
+
+    // 새 헤더와 target 헤더 삭제를 한 commit에 묶음: replay 때 둘 다 반영되거나 둘 다 버려짐
+    // (중간에 멈춰도 target은 그대로 있고 원래 이름도 남음)
+    if (uffs_JournalBeginGroup(dev.fd, 2) == U_FAIL) {
+        return -EIO;
+    }
+
+    // parent는 hash key가 아니라서 노드는 그대로 두고 값만 바꿈
+    old_parent = node->u.file.parent;
+    node->u.file.parent = new_parent->u.dir.serial;
+    if (updateFileInfoPage(&dev, node, &file_info, 0, type) == U_FAIL) {
+        node->u.file.parent = old_parent;
+        uffs_JournalEndGroup(dev.fd);
+        fprintf(stderr, "[uffs_rename] header page write error\n");
+        return -EIO;
+    }
+    if (target != NULL && deleteFileInfoPage(&dev, target) == U_FAIL) {
+        uffs_JournalEndGroup(dev.fd);
+        fprintf(stderr, "[uffs_rename] target header delete error\n");
+        return -EIO;
+    }
+    uffs_JournalEndGroup(dev.fd);
+
+    // target의 data 블록은 헤더 삭제가 commit 된 뒤에 돌려줌 (블록은 journal 없이 바로 지워지므로)
+    // 여기서 멈추면 주인 없는 data 블록은 다음 mount에서 uffs_BuildTree가 지움
+    if (target != NULL) {
+        if (target_type == UFFS_TYPE_FILE && uffs_TreeFindDataNodeByParent(&dev, target->u.file.serial) != NULL &&
+            uffs_JournalSync(dev.fd) == U_FAIL) {
+            // 블록은 디스크에 두고 트리에서만 뺌 (같은 serial을 받은 새 파일이 가져가지 않게)
+            fprintf(stderr, "[uffs_rename] journal sync error, target data kept\n");
+            while ((data_node = uffs_TreeFindDataNodeByParent(&dev, target->u.file.serial)) != NULL) {
+                uffs_BreakFromEntry(&dev, UFFS_TYPE_DATA, data_node);
+                uffs_TreeNodePut(&dev, data_node);
+            }
+        } else if (target_type == UFFS_TYPE_FILE) {
+            ret = uffs_free_file_data(target->u.file.serial, &target_info);
+            if (ret < 0) {
+                fprintf(stderr, "[uffs_rename] free target data error: %d\n", ret);
+            }
+        }
+        uffs_BreakFromEntry(&dev, target_type, target);
+        uffs_TreeNodePut(&dev, target);
+    }
+
+    fprintf(stdout, "[uffs_rename] finished\n");
+    return 0;
+}
+
+// fuse_main은 여러 thread에서 op를 부름. tree와 블록 할당(getFreeBlock/getFreeHeaderPage)은
+// lock이 없으므로 ns_lock으로 줄 세움
+// - 찾기만 하는 op (getattr/readdir/opendir/open/read)는 read로 같이
+// - 트리나 블록을 바꾸는 op (write/truncate/fallocate/create/mkdir/unlink/rmdir/rename)는 write로 하나씩
+// fsync/flush는 잡지 않으므로 여러 fsync가 journal의 group commit으로 묶임
+
+int uffs_getattr(const char *path, struct stat *stbuf)
+{
+    pthread_rwlock_rdlock(&ns_lock);
+    int ret = uffs_getattr_locked(path, stbuf);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                 off_t offset, struct fuse_file_info *fi)
+{
+    pthread_rwlock_rdlock(&ns_lock);
+    int ret = uffs_readdir_locked(path, buf, filler, offset, fi);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_opendir(const char *path, struct fuse_file_info *fu)
+{
+    pthread_rwlock_rdlock(&ns_lock);
+    int ret = uffs_opendir_locked(path, fu);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_open(const char *path, struct fuse_file_info *fi)
+{
+    pthread_rwlock_rdlock(&ns_lock);
+    int ret = uffs_open_locked(path, fi);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_read(const char *path, char *buf, size_t size, off_t offset,
+              struct fuse_file_info *fi)
+{
+    pthread_rwlock_rdlock(&ns_lock);
+    int ret = uffs_read_locked(path, buf, size, offset, fi);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
+               struct fuse_file_info *fi)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_write_locked(path, buf, size, offset, fi);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_truncate(const char *path, off_t size)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_truncate_locked(path, size);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_fallocate(const char *path, int mode, off_t offset, off_t len, struct fuse_file_info *fi)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_fallocate_locked(path, mode, offset, len, fi);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_create_locked(path, mode, fi);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_mkdir(const char *path, mode_t mode)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_mkdir_locked(path, mode);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_unlink(const char *path)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_unlink_locked(path);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_rmdir(const char *path)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_rmdir_locked(path);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
+int uffs_rename(const char *from, const char *to)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    int ret = uffs_rename_locked(from, to);
+    pthread_rwlock_unlock(&ns_lock);
+    return ret;
+}
+
 struct fuse_operations uffs_oper = {
 	.init		= uffs_init,
+	.destroy	= uffs_destroy,
 	.getattr	= uffs_getattr,
 	.readdir	= uffs_readdir,
     .opendir    = uffs_opendir,
     .open       = uffs_open,
     .read       = uffs_read,
     .write      = uffs_write,
+    .truncate   = uffs_truncate,
+    .fallocate  = uffs_fallocate,
     .create     = uffs_create,
-    .mkdir      = uffs_mkdir
+    .mkdir      = uffs_mkdir,
+    .unlink     = uffs_unlink,
+    .rmdir      = uffs_rmdir,
+    .rename     = uffs_rename,
+    .flush      = uffs_flush,
+    .release    = uffs_release,
+    .fsync      = uffs_fsync
 };
 
+// usage: mkuffs <fuse option> <mount point> <device> [io backend: posix|direct|uring|mmap] [options: none|lz4|zstd[,dedup][,discard][,format]]
 int main(int argc, char *argv[])
 {
     fprintf(stderr, "[main] called\n");
+    int ret;
+
+    if (argc < 4 || argc > 6) {
+        fprintf(stderr, "[main] argc is not 4 ~ 6 error\n");
+        return -1;
+    }
+    // 옵션은 ','로 구분 (예: lz4,dedup,discard)
+    if (argc == 6) {
+        char opts[64];
+        char *opt, *save;
+
+        strncpy(opts, argv[5], sizeof(opts) - 1);
+        opts[sizeof(opts) - 1] = '\0';
+        for (opt = strtok_r(opts, ",", &save); opt != NULL; opt = strtok_r(NULL, ",", &save)) {
+            if (strcmp(opt, "dedup") == 0) {
+                dedup_enable = U_TRUE;
+                continue;
+            }
+            if (strcmp(opt, "discard") == 0) {
+                discard_enable = U_TRUE;
+                continue;
+            }
+            if (strcmp(opt, "format") == 0) {
+                format_force = U_TRUE;
+                continue;
+            }
+            compress_codec = uffs_CompressFind(opt);
+            if (compress_codec < 0) {
+                fprintf(stderr, "[main] unknown option: %s\n", opt);
+                return -1;
+            }
+        }
+    }
+
     // USB 디바이스 파일 오픈
-    dev.fd = open(argv[3], O_RDWR, 0666);
+    dev.fd = diskOpen(argv[3], argc >= 5 ? argv[4] : NULL);
     if (dev.fd < 0) {
         fprintf(stderr, "[main] strerror: %s\n", strerror(errno));
         return -1;
     }
 
-    if (argc != 4) {
-        fprintf(stderr, "[main] argc is not 4 error\n");
+    // magic이 없는 디바이스만 format 함. 버전이 다르거나 superblock이 깨진 이미지는
+    // 지우지 않고 마운트를 거부 ('format' 옵션을 주면 지우고 새로 만듦)
+    ret = format_force ? UFFS_DISK_NOT_UFFS : diskFormatCheck(dev.fd);
+    if (ret == UFFS_DISK_BAD_VERSION || ret == UFFS_DISK_BAD_SB) {
+        fprintf(stderr, "[main] %s, not mounting (use the 'format' option to erase it)\n",
+                ret == UFFS_DISK_BAD_VERSION ? "unsupported disk version" : "super block is damaged");
+        diskClose(dev.fd);
         return -1;
     }
-
-    if(diskFormatCheck(dev.fd) == U_FAIL){
+    if (ret == UFFS_DISK_NOT_UFFS) {
         fprintf(stderr, "[main] disk format check error\n");
         if(diskFormat(dev.fd)==U_FAIL){
             fprintf(stderr, "[main] disk format error\n");
@@ -558,6 +1659,14 @@ int main(int argc, char *argv[])
         fprintf(stdout, "[main] disk format success\n");
     }
 
+    // 비정상 종료로 남은 journal 반영
+    if (uffs_JournalInit(dev.fd) == U_FAIL) {
+        fprintf(stderr, "[main] journal recovery error\n");
+        return -1;
+    }
+
     fprintf(stderr, "[main] finished\n");
-    return fuse_main(3, argv, &uffs_oper, NULL);
+    ret = fuse_main(3, argv, &uffs_oper, NULL);
+    diskClose(dev.fd);
+    return ret;
 }
@@ -0,0 +1,540 @@
+/**
+ * \file uffs_blockmap.c
+ * \brief per-file block map: sparse files, fallocate, truncate
+ *
+ * 파일 블록 k는 uffs_TreeFindDataNode(parent, k)로 찾는다.
+ * 새 블록은 getFreeBlock으로 받고 바로 page 0을 써서 자기 블록으로 만든다
+ * (쓰는 범위가 page 0부터가 아니면 0으로 채운 page 0만 따로 씀).
+ * hole을 뚫거나 줄여서 필요 없어진 블록은 바로 eraseBlock 해서 빈 블록으로 돌려준다.
+ */
+
+#include "uffs_blockmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+u32 uffs_BlockMapFileLen(const uffs_FileInfo *info)
+{
+	u32 len;
+
+	memcpy(&len, UFFS_INLINE_DATA(info), sizeof(len));
+	return len;
+}
+
+void uffs_BlockMapSetFileLen(uffs_FileInfo *info, u32 len)
+{
+	memcpy(UFFS_INLINE_DATA(info), &len, sizeof(len));
+}
+
+static void _SetTag(uffs_Tag *tag, u16 k, u16 parent, int page)
+{
+	memset(tag, 0, sizeof(uffs_Tag));
+	tag->s.dirty = 1;
+	tag->s.valid = 0;
+	tag->s.type = UFFS_TYPE_DATA;
+	tag->s.data_len = PAGE_DATA_SIZE_DEFAULT;
+	tag->s.serial = k;
+	tag->s.parent = parent;
+	tag->s.page_id = page;
+	tag->s.tag_ecc = TAG_ECC_DEFAULT;
+}
+
+// 새 블록의 page 0: 0으로 채운 data에 tag로 주인(파일, 블록 번호)을 적음
+static URET _WriteMark(int fd, int block, u16 k, u16 parent)
+{
+	uffs_MiniHeader mini_header = {0x01, 0x00, 0xFFFF};
+	uffs_Tag tag;
+
+	_SetTag(&tag, k, parent, 0);
+	return writePages(fd, block, 0, 1, &mini_header, NULL, &tag, U_FALSE);
+}
+
+/**
+ * 블록 안의 [offset, offset + size)를 buf로 씀, buf가 NULL이면 0으로
+ * 걸친 페이지의 나머지는 읽어서 유지함. fresh: 방금 받은 블록이라 다른 페이지는 모두 0
+ */
+static URET _WriteRange(int fd, int block, u16 k, u16 parent, const char *buf, u32 offset, u32 size, UBOOL fresh)
+{
+	uffs_MiniHeader mini_headers[PAGES_PER_BLOCK_DEFAULT];
+	uffs_Tag tags[PAGES_PER_BLOCK_DEFAULT];
+	uffs_PageReq reqs[2];
+	int first = offset / PAGE_DATA_SIZE_DEFAULT;
+	int last = (offset + size - 1) / PAGE_DATA_SIZE_DEFAULT;
+	int count = last - first + 1;
+	int i, n = 0;
+	char *data;
+	URET ret = U_SUCC;
+
+	data = (char *)malloc((size_t)count * PAGE_DATA_SIZE_DEFAULT);
+	if (data == NULL)
+		return U_FAIL;
+	memset(data, 0, (size_t)count * PAGE_DATA_SIZE_DEFAULT);
+
+	if (!fresh) {
+		if (offset % PAGE_DATA_SIZE_DEFAULT != 0) {
+			reqs[n].block_id = block;
+			reqs[n].page_Id = first;
+			reqs[n].data = data;
+			n++;
+		}
+		if ((offset + size) % PAGE_DATA_SIZE_DEFAULT != 0 && (last != first || n == 0)) {
+			reqs[n].block_id = block;
+			reqs[n].page_Id = last;
+			reqs[n].data = data + (size_t)(last - first) * PAGE_DATA_SIZE_DEFAULT;
+			n++;
+		}
+		for (i = 0; i < n; i++) {
+			reqs[i].mini_header = NULL;
+			reqs[i].tag = NULL;
+		}
+		if (n > 0 && IS_FAIL(readPages(fd, reqs, n))) {
+			free(data);
+			return U_FAIL;
+		}
+	}
+
+	if (buf != NULL)
+		memcpy(data + offset % PAGE_DATA_SIZE_DEFAULT, buf, size);
+	else
+		memset(data + offset % PAGE_DATA_SIZE_DEFAULT, 0, size);
+
+	for (i = 0; i < count; i++) {
+		mini_headers[i].status = 0x01;
+		mini_headers[i].reserved = 0x00;
+		mini_headers[i].crc = 0xFFFF;
+		_SetTag(&tags[i], k, parent, first + i);
+	}
+
+	uffs_ReadAheadInvalidate(block);
+	if (fresh && first != 0)
+		ret = _WriteMark(fd, block, k, parent);
+	if (ret == U_SUCC)
+		ret = writePages(fd, block, first, count, mini_headers, data, tags, U_FALSE);
+	uffs_ReadAheadInvalidate(block);
+
+	free(data);
+	return ret;
+}
+
+// 파일 블록 k에 쓸 빈 블록을 받아서 data 노드를 만듦. page 0은 호출한 쪽에서 바로 씀
+static int _Alloc(uffs_Device *dev, u16 parent, u16 k, TreeNode **out)
+{
+	TreeNode *node;
+	int block;
+	u16 serial;
+
+	if (getFreeBlock(dev->fd, &block, &serial) == U_FAIL)
+		return -ENOSPC;
+
+	node = uffs_TreeNodeGet(dev);
+	if (node == NULL)
+		return -ENOMEM;
+	initNode(dev, node, block, UFFS_TYPE_DATA, parent, k);
+	node->u.data.len = UFFS_BLOCK_DATA_SIZE;
+	uffs_InsertNodeToTree(dev, UFFS_TYPE_DATA, node);
+
+	*out = node;
+	return 0;
+}
+
+// 블록을 지워서 빈 블록으로 돌려주고 노드를 뺌
+static URET _Free(uffs_Device *dev, TreeNode *node)
+{
+	int block = node->u.data.block;
+	URET ret;
+
+	uffs_ReadAheadInvalidate(block);
+	ret = eraseBlock(dev->fd, block);
+	uffs_ReadAheadInvalidate(block);
+
+	uffs_BreakFromEntry(dev, UFFS_TYPE_DATA, node);
+	uffs_TreeNodePut(dev, node);
+	return ret;
+}
+
+// 파일 블록 번호가 [first, last]인 블록을 모두 돌려줌
+static URET _FreeRange(uffs_Device *dev, u16 parent, u32 first, u32 last)
+{
+	TreeNode *node;
+	u16 x, next;
+	URET ret = U_SUCC;
+	int i;
+
+	for (i = 0; i < DATA_NODE_ENTRY_LEN; i++) {
+		x = dev->tree.data_entry[i];
+		while (x != EMPTY_NODE) {
+			node = FROM_IDX(x, TPOOL(dev));
+			next = node->hash_next;
+			if (node->u.data.parent == parent && node->u.data.serial >= first && node->u.data.serial <= last) {
+				if (_Free(dev, node) == U_FAIL)
+					ret = U_FAIL;
+			}
+			x = next;
+		}
+	}
+	return ret;
+}
+
+// 파일의 [from, to) 중 블록이 있는 부분을 0으로
+static int _Zero(uffs_Device *dev, u16 parent, off_t from, off_t to)
+{
+	TreeNode *node;
+	u16 k;
+	u32 in, n;
+
+	while (from < to) {
+		k = from / UFFS_BLOCK_DATA_SIZE;
+		in = from % UFFS_BLOCK_DATA_SIZE;
+		n = UFFS_BLOCK_DATA_SIZE - in;
+		if (n > to - from)
+			n = to - from;
+
+		node = uffs_TreeFindDataNode(dev, parent, k);
+		if (node != NULL && _WriteRange(dev->fd, node->u.data.block, k, parent, NULL, in, n, U_FALSE) == U_FAIL)
+			return -EIO;
+		from += n;
+	}
+	return 0;
+}
+
+// 파일을 old_len에서 new_len으로 늘림: EOF가 있던 블록에 남아 있을 수 있는 예전 data를 지움
+static int _ZeroTail(uffs_Device *dev, u16 parent, u32 old_len, off_t new_len)
+{
+	off_t end = ((off_t)old_len / UFFS_BLOCK_DATA_SIZE + 1) * UFFS_BLOCK_DATA_SIZE;
+
+	if (old_len % UFFS_BLOCK_DATA_SIZE == 0 || new_len <= old_len)
+		return 0;
+	return _Zero(dev, parent, old_len, new_len < end ? new_len : end);
+}
+
+/**
+ * \brief 파일이 가진 블록 수 (st_blocks)
+ */
+int uffs_BlockMapCount(uffs_Device *dev, u16 parent)
+{
+	TreeNode *node;
+	u16 x;
+	int i, count = 0;
+
+	for (i = 0; i < DATA_NODE_ENTRY_LEN; i++) {
+		for (x = dev->tree.data_entry[i]; x != EMPTY_NODE; x = node->hash_next) {
+			node = FROM_IDX(x, TPOOL(dev));
+			if (node->u.data.parent == parent)
+				count++;
+		}
+	}
+	return count;
+}
+
+/**
+ * \brief 블록 하나에서 [offset, offset + size) 읽기
+ * \param[in] first_page 이 블록의 page 0이 파일 안에서 몇 번째 페이지인지
+ * \param[in] file_pages 파일의 페이지 수 (readahead 범위)
+ * \param[in] next_block 다음 파일 블록의 디바이스 블록, 없거나 hole이면 -1 (readahead가 이어 읽음)
+ * \param[in] ra NULL이면 readahead 없이
+ * \return 읽은 길이, 하나도 못 읽었으면 -EIO
+ */
+int uffs_BlockMapReadBlock(int fd, int block, char *buf, size_t size, u32 offset,
+						   int first_page, int file_pages, int next_block, uffs_ReadAhead *ra)
+{
+	int start_page = offset / PAGE_DATA_SIZE_DEFAULT;
+	int start_offset = offset % PAGE_DATA_SIZE_DEFAULT;
+	int npages = (start_offset + size + PAGE_DATA_SIZE_DEFAULT - 1) / PAGE_DATA_SIZE_DEFAULT;
+	int page_id = start_page;
+	size_t bytes_to_read = size;
+	size_t bytes_read = 0;
+	size_t read_size;
+	uffs_PageReq *reqs;
+	char *data_buf;
+	int i;
+
+	if (npages == 0)
+		return 0;
+
+	// 매핑을 쓰는 backend면 매핑에서 buf로 바로 복사
+	if (diskCanMap()) {
+		char page_buf[PAGE_DATA_SIZE_DEFAULT];
+		const char *data;
+
+		while (bytes_to_read > 0) {
+			read_size = PAGE_DATA_SIZE_DEFAULT - start_offset;
+			if (read_size > bytes_to_read)
+				read_size = bytes_to_read;
+
+			if (IS_FAIL(readPageRef(fd, block, page_id, NULL, page_buf, &data, NULL))) {
+				if (bytes_read == 0)
+					return -EIO;
+				break;
+			}
+			memcpy(buf + bytes_read, data + start_offset, read_size);
+
+			bytes_read += read_size;
+			bytes_to_read -= read_size;
+			page_id++;
+			start_offset = 0;
+		}
+		return bytes_read;
+	}
+
+	// 필요한 페이지를 한꺼번에 읽음
+	reqs = (uffs_PageReq *)malloc(npages * sizeof(uffs_PageReq));
+	data_buf = (char *)malloc((size_t)npages * PAGE_DATA_SIZE_DEFAULT);
+	if (reqs == NULL || data_buf == NULL) {
+		free(reqs);
+		free(data_buf);
+		return -ENOMEM;
+	}
+	for (i = 0; i < npages; i++) {
+		reqs[i].block_id = block;
+		reqs[i].page_Id = start_page + i;
+		reqs[i].mini_header = NULL;
+		reqs[i].data = data_buf + (size_t)i * PAGE_DATA_SIZE_DEFAULT;
+		reqs[i].tag = NULL;
+	}
+	if (ra != NULL)
+		uffs_ReadAheadRead(ra, fd, first_page + start_page, file_pages, next_block, reqs, npages);
+	else
+		readPages(fd, reqs, npages);
+
+	// 페이지별 복사
+	while (bytes_to_read > 0) {
+		read_size = PAGE_DATA_SIZE_DEFAULT - start_offset;
+		if (read_size > bytes_to_read)
+			read_size = bytes_to_read;
+
+		// 아무것도 못 읽었으면 ECC/IO 오류를 그대로 알림
+		if (IS_FAIL(reqs[page_id - start_page].ret)) {
+			if (bytes_read == 0) {
+				free(reqs);
+				free(data_buf);
+				return -EIO;
+			}
+			break;
+		}
+		memcpy(buf + bytes_read, data_buf + (size_t)(page_id - start_page) * PAGE_DATA_SIZE_DEFAULT + start_offset, read_size);
+
+		bytes_read += read_size;
+		bytes_to_read -= read_size;
+		page_id++;
+		start_offset = 0;
+	}
+
+	free(reqs);
+	free(data_buf);
+	return bytes_read;
+}
+
+/**
+ * \brief 블록 map 파일 읽기, hole은 디바이스를 읽지 않고 0
+ * \return 읽은 길이 또는 -errno
+ */
+int uffs_BlockMapRead(uffs_Device *dev, u16 parent, u32 file_len, char *buf, size_t size, off_t offset, uffs_ReadAhead *ra)
+{
+	TreeNode *node, *next;
+	size_t done = 0, n;
+	int file_pages = (file_len + PAGE_DATA_SIZE_DEFAULT - 1) / PAGE_DATA_SIZE_DEFAULT;
+	u32 in;
+	u16 k;
+	int ret;
+
+	if (offset >= file_len)
+		return 0;
+	if (size > file_len - offset)
+		size = file_len - offset;
+
+	while (done < size) {
+		k = (offset + done) / UFFS_BLOCK_DATA_SIZE;
+		in = (offset + done) % UFFS_BLOCK_DATA_SIZE;
+		n = UFFS_BLOCK_DATA_SIZE - in;
+		if (n > size - done)
+			n = size - done;
+
+		node = uffs_TreeFindDataNode(dev, parent, k);
+		if (node == NULL) {
+			memset(buf + done, 0, n);
+		}
+		else {
+			// readahead가 블록 경계를 넘어 이어 읽을 수 있게 다음 파일 블록도 찾아 둠
+			next = ra != NULL ? uffs_TreeFindDataNode(dev, parent, k + 1) : NULL;
+			ret = uffs_BlockMapReadBlock(dev->fd, node->u.data.block, buf + done, n, in,
+										 (int)k * PAGES_PER_BLOCK_DEFAULT, file_pages,
+										 next != NULL ? next->u.data.block : -1, ra);
+			if (ret < 0)
+				return done > 0 ? (int)done : ret;
+			if ((size_t)ret < n)
+				return done + ret;
+		}
+		done += n;
+	}
+	return done;
+}
+
+/**
+ * \brief 블록 map 파일 쓰기, 쓰는 범위에 걸친 파일 블록만 만듦 (사이는 hole)
+ * \param[in] file_len 지금 파일 길이 (헤더의 길이는 호출한 쪽에서 갱신)
+ * \return 쓴 길이 또는 -errno
+ */
+int uffs_BlockMapWrite(uffs_Device *dev, u16 parent, u32 file_len, const char *buf, size_t size, off_t offset)
+{
+	TreeNode *node;
+	size_t done = 0, n;
+	UBOOL fresh;
+	u32 in;
+	u16 k;
+	int ret;
+
+	if (offset < 0 || offset + (off_t)size > UFFS_BLOCKMAP_MAX_LEN)
+		return -EFBIG;
+	if (size == 0)
+		return 0;
+
+	// EOF 뒤에 쓰면 그 사이는 0이어야 함
+	if (offset > file_len && _ZeroTail(dev, parent, file_len, offset) < 0)
+		return -EIO;
+
+	while (done < size) {
+		k = (offset + done) / UFFS_BLOCK_DATA_SIZE;
+		in = (offset + done) % UFFS_BLOCK_DATA_SIZE;
+		n = UFFS_BLOCK_DATA_SIZE - in;
+		if (n > size - done)
+			n = size - done;
+
+		node = uffs_TreeFindDataNode(dev, parent, k);
+		fresh = node == NULL ? U_TRUE : U_FALSE;
+		if (fresh && (ret = _Alloc(dev, parent, k, &node)) < 0)
+			return done > 0 ? (int)done : ret;
+
+		if (_WriteRange(dev->fd, node->u.data.block, k, parent, buf + done, in, n, fresh) == U_FAIL) {
+			fprintf(stderr, "[uffs_BlockMapWrite] write error - block %d\n", node->u.data.block);
+			if (fresh)
+				_Free(dev, node);
+			return done > 0 ? (int)done : -EIO;
+		}
+		done += n;
+	}
+	return done;
+}
+
+/**
+ * \brief 블록 하나짜리 예전 파일의 data 노드를 파일 블록 0으로 바꿈
+ */
+URET uffs_BlockMapAdopt(uffs_Device *dev, TreeNode *data_node)
+{
+	uffs_MiniHeader mini_header;
+	char data[PAGE_DATA_SIZE_DEFAULT];
+	uffs_Tag tag;
+	int block = data_node->u.data.block;
+
+	// 길이가 0이면 EOF 뒤의 예전 data를 지울 기준이 없어서 블록을 그냥 돌려줌
+	if (data_node->u.data.len == 0)
+		return _Free(dev, data_node);
+
+	if (IS_FAIL(readPage(dev->fd, block, 0, &mini_header, data, &tag)))
+		return U_FAIL;
+	tag.s.serial = 0;
+	if (writePage(dev->fd, block, 0, &mini_header, data, &tag) == U_FAIL)
+		return U_FAIL;
+
+	uffs_BreakFromEntry(dev, UFFS_TYPE_DATA, data_node);
+	data_node->u.data.serial = 0;
+	uffs_InsertNodeToTree(dev, UFFS_TYPE_DATA, data_node);
+	return U_SUCC;
+}
+
+/**
+ * \brief [offset, offset + len)에 걸친 파일 블록을 미리 받아 둠 (파일 길이는 그대로)
+ *
+ * 블록마다 page 0 하나만 쓰므로 큰 파일도 금방 만들어진다.
+ * 블록이 모자라면 이번에 받은 블록은 모두 돌려주고 -ENOSPC.
+ */
+int uffs_BlockMapAllocate(uffs_Device *dev, u16 parent, off_t offset, off_t len)
+{
+	TreeNode **added;
+	TreeNode *node;
+	u32 first, last, k;
+	int i, count = 0, ret = 0;
+
+	if (offset < 0 || len <= 0)
+		return -EINVAL;
+	if (offset + len > UFFS_BLOCKMAP_MAX_LEN)
+		return -EFBIG;
+
+	first = offset / UFFS_BLOCK_DATA_SIZE;
+	last = (offset + len - 1) / UFFS_BLOCK_DATA_SIZE;
+	added = (TreeNode **)malloc((last - first + 1) * sizeof(TreeNode *));
+	if (added == NULL)
+		return -ENOMEM;
+
+	for (k = first; k <= last; k++) {
+		if (uffs_TreeFindDataNode(dev, parent, k) != NULL)
+			continue;
+		if ((ret = _Alloc(dev, parent, k, &node)) < 0)
+			break;
+		added[count++] = node;
+		if (_WriteMark(dev->fd, node->u.data.block, k, parent) == U_FAIL) {
+			ret = -EIO;
+			break;
+		}
+	}
+
+	if (ret < 0) {
+		for (i = 0; i < count; i++)
+			_Free(dev, added[i]);
+		count = 0;
+	}
+	free(added);
+
+	fprintf(stdout, "[uffs_BlockMapAllocate] file %u, blocks %u ~ %u, %d new\n", parent, first, last, count);
+	return ret;
+}
+
+/**
+ * \brief [offset, offset + len)를 hole로 만듦 (파일 길이는 그대로)
+ *
+ * 범위 안에 통째로 들어가는 파일 블록은 바로 돌려주고, 일부만 걸친 블록은 그 부분을 0으로 쓴다.
+ */
+int uffs_BlockMapPunch(uffs_Device *dev, u16 parent, u32 file_len, off_t offset, off_t len)
+{
+	off_t end, zero_end;
+	u32 first, last;
+
+	if (offset < 0 || len <= 0)
+		return -EINVAL;
+	end = offset + len;
+	if (end > UFFS_BLOCKMAP_MAX_LEN)
+		end = UFFS_BLOCKMAP_MAX_LEN;
+
+	// 통째로 들어가는 블록: [first, last]
+	first = (offset + UFFS_BLOCK_DATA_SIZE - 1) / UFFS_BLOCK_DATA_SIZE;
+	last = end / UFFS_BLOCK_DATA_SIZE;
+	if (first < last && _FreeRange(dev, parent, first, last - 1) == U_FAIL)
+		return -EIO;
+
+	// 나머지(앞뒤 일부만 걸친 블록), EOF 뒤는 상관없음
+	zero_end = end < file_len ? end : file_len;
+	if (offset < zero_end)
+		return _Zero(dev, parent, offset, zero_end);
+	return 0;
+}
+
+/**
+ * \brief 파일 길이를 old_len에서 new_len으로 바꿈
+ *
+ * 줄이면 new_len 뒤의 파일 블록(미리 받아 둔 블록 포함)을 돌려주고,
+ * 늘리면 늘어난 부분은 hole이다.
+ */
+int uffs_BlockMapTruncate(uffs_Device *dev, u16 parent, u32 old_len, u32 new_len)
+{
+	u32 first;
+
+	if (new_len > UFFS_BLOCKMAP_MAX_LEN)
+		return -EFBIG;
+
+	if (new_len > old_len)
+		return _ZeroTail(dev, parent, old_len, new_len);
+
+	first = (new_len + UFFS_BLOCK_DATA_SIZE - 1) / UFFS_BLOCK_DATA_SIZE;
+	if (first < UFFS_BLOCKMAP_MAX_BLOCKS && _FreeRange(dev, parent, first, UFFS_BLOCKMAP_MAX_BLOCKS - 1) == U_FAIL)
+		return -EIO;
+	return 0;
+}
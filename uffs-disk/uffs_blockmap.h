@@ -0,0 +1,42 @@
+/**
+ * \file uffs_blockmap.h
+ * \brief per-file block map: sparse files, fallocate, truncate
+ *
+ * 블록 map 파일(#FILE_ATTR_BLOCKMAP)은 data를 #UFFS_BLOCK_DATA_SIZE 단위의
+ * 파일 블록으로 나누고, 파일 블록마다 data 노드 하나를 둔다.
+ * data 노드의 serial은 파일 안의 블록 번호이고 page 0 tag의 serial에도 같이 적는다.
+ * data 노드가 없는 파일 블록은 hole이라 디바이스를 읽지 않고 0을 돌려준다.
+ *
+ * 파일 길이는 헤더 페이지의 name 뒤에 u32로 둔다 (tag의 data_len은 12 bits라서).
+ * EOF 뒤의 data는 보장하지 않고, 파일을 늘릴 때 EOF가 있던 블록의 나머지를 0으로 채운다.
+ */
+
+#ifndef _UFFS_BLOCKMAP_H_
+#define _UFFS_BLOCKMAP_H_
+
+#include "uffs_types.h"
+#include "uffs_tree.h"
+#include "uffs_readahead.h"
+
+#define UFFS_BLOCK_DATA_SIZE	(PAGES_PER_BLOCK_DEFAULT * PAGE_DATA_SIZE_DEFAULT)	//!< 파일 블록 하나의 data 크기
+#define UFFS_BLOCKMAP_MAX_BLOCKS	(1 << 14)	//!< 파일 블록 번호는 tag serial(14 bits) 안에서
+#define UFFS_BLOCKMAP_MAX_LEN	((off_t)UFFS_BLOCKMAP_MAX_BLOCKS * UFFS_BLOCK_DATA_SIZE)
+
+/** 이름이 name_len일 때 헤더 페이지에 파일 길이를 둘 수 있는지 */
+#define UFFS_BLOCKMAP_FITS(name_len)	(UFFS_INLINE_LIMIT(name_len) >= (int)sizeof(u32))
+
+u32 uffs_BlockMapFileLen(const uffs_FileInfo *info);
+void uffs_BlockMapSetFileLen(uffs_FileInfo *info, u32 len);
+int uffs_BlockMapCount(uffs_Device *dev, u16 parent);
+
+int uffs_BlockMapReadBlock(int fd, int block, char *buf, size_t size, u32 offset,
+						   int first_page, int file_pages, int next_block, uffs_ReadAhead *ra);
+int uffs_BlockMapRead(uffs_Device *dev, u16 parent, u32 file_len, char *buf, size_t size, off_t offset, uffs_ReadAhead *ra);
+int uffs_BlockMapWrite(uffs_Device *dev, u16 parent, u32 file_len, const char *buf, size_t size, off_t offset);
+URET uffs_BlockMapAdopt(uffs_Device *dev, TreeNode *data_node);
+
+int uffs_BlockMapAllocate(uffs_Device *dev, u16 parent, off_t offset, off_t len);
+int uffs_BlockMapPunch(uffs_Device *dev, u16 parent, u32 file_len, off_t offset, off_t len);
+int uffs_BlockMapTruncate(uffs_Device *dev, u16 parent, u32 old_len, u32 new_len);
+
+#endif
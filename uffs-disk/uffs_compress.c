@@ -0,0 +1,659 @@
+/**
+ * \file uffs_compress.c
+ * \brief per-chunk compressed file data
+ *
+ * write는 바뀐 chunk만 다시 압축한다. 압축은 worker 스레드가 하고, 호출한 쪽은
+ * 앞 chunk가 끝나는 대로 페이지에 쓰므로 chunk i를 쓰는 동안 chunk i+1이 압축된다.
+ * 바뀐 chunk 뒤의 chunk들은 압축된 그대로 자리만 옮긴다.
+ *
+ * read는 chunk index로 필요한 chunk의 페이지만 읽어서 풀고, 풀어둔 chunk 몇 개를
+ * cache 해서 같은 chunk를 나눠 읽을 때 다시 풀지 않는다.
+ *
+ * zstd는 빌드 의존성을 만들지 않도록 libzstd.so.1을 dlopen 해서 쓴다.
+ */
+
+#include "uffs_compress.h"
+#include "uffs_lz4.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPRESS_QUEUE_SIZE		64
+#define COMPRESS_CACHE_SIZE		4		//!< 풀어둔 chunk 수
+#define COMPRESS_ZSTD_LEVEL		3
+
+#define CHUNK_PAGES(len)		(((len) + PAGE_DATA_SIZE_DEFAULT - 1) / PAGE_DATA_SIZE_DEFAULT)
+
+struct cmp_JobSt {
+	int codec;
+	const char *src;
+	int src_len;
+	char *dst;
+	int dst_cap;
+	int out_len;		//!< 압축된 길이, 0: dst_cap 안에 들어가지 않음
+	UBOOL done;
+};
+
+struct cmp_CacheSt {
+	UBOOL valid;
+	int block;
+	int chunk;
+	u32 gen;			//!< 풀 때의 block generation
+	int len;			//!< 풀린 길이
+	u32 last_use;
+	char data[UFFS_CHUNK_SIZE];
+};
+
+static pthread_mutex_t cmp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cmp_cond = PTHREAD_COND_INITIALIZER;		//!< queue에 job이 들어옴
+static pthread_cond_t cmp_done_cond = PTHREAD_COND_INITIALIZER;	//!< job 하나가 끝남
+
+static struct cmp_JobSt *cmp_queue[COMPRESS_QUEUE_SIZE];
+static int cmp_queue_head = 0, cmp_queue_len = 0;
+
+static pthread_t cmp_worker;
+static UBOOL cmp_running = U_FALSE;
+static UBOOL cmp_stop = U_FALSE;
+static int cmp_codec = UFFS_COMPRESS_NONE;
+
+static u32 cmp_block_gen[TOTAL_BLOCKS_DEFAULT];
+static struct cmp_CacheSt cmp_cache[COMPRESS_CACHE_SIZE];
+static u32 cmp_clock = 0;
+static uffs_CompressStat cmp_stat;
+
+// libzstd (dlopen)
+static pthread_once_t zstd_once = PTHREAD_ONCE_INIT;
+static size_t (*zstd_compress)(void *dst, size_t dst_cap, const void *src, size_t src_len, int level);
+static size_t (*zstd_decompress)(void *dst, size_t dst_cap, const void *src, size_t src_len);
+static unsigned (*zstd_is_error)(size_t ret);
+
+static void _ZstdLoad(void)
+{
+	void *lib = dlopen("libzstd.so.1", RTLD_NOW);
+
+	if (lib == NULL) {
+		fprintf(stderr, "[_ZstdLoad] %s\n", dlerror());
+		return;
+	}
+	zstd_compress = dlsym(lib, "ZSTD_compress");
+	zstd_decompress = dlsym(lib, "ZSTD_decompress");
+	zstd_is_error = dlsym(lib, "ZSTD_isError");
+	if (zstd_compress == NULL || zstd_decompress == NULL || zstd_is_error == NULL) {
+		fprintf(stderr, "[_ZstdLoad] libzstd symbol not found\n");
+		zstd_compress = NULL;
+		dlclose(lib);
+	}
+}
+
+static UBOOL _ZstdReady(void)
+{
+	pthread_once(&zstd_once, _ZstdLoad);
+	return zstd_compress != NULL ? U_TRUE : U_FALSE;
+}
+
+// 결과가 dst_cap 안에 들어가지 않으면 0
+static int _Compress(int codec, const char *src, int src_len, char *dst, int dst_cap)
+{
+	size_t n;
+
+	if (dst_cap <= 0)
+		return 0;
+	if (codec == UFFS_COMPRESS_LZ4)
+		return uffs_Lz4Compress(src, src_len, dst, dst_cap);
+	if (codec == UFFS_COMPRESS_ZSTD && _ZstdReady()) {
+		n = zstd_compress(dst, dst_cap, src, src_len, COMPRESS_ZSTD_LEVEL);
+		return zstd_is_error(n) ? 0 : (int)n;
+	}
+	return 0;
+}
+
+// 풀린 길이, 실패하면 -1
+static int _Decompress(int codec, const char *src, int src_len, char *dst, int dst_cap)
+{
+	size_t n;
+
+	if (codec == UFFS_COMPRESS_LZ4)
+		return uffs_Lz4Decompress(src, src_len, dst, dst_cap);
+	if (codec == UFFS_COMPRESS_ZSTD && _ZstdReady()) {
+		n = zstd_decompress(dst, dst_cap, src, src_len);
+		return zstd_is_error(n) ? -1 : (int)n;
+	}
+	return -1;
+}
+
+static void * _Worker(void *arg)
+{
+	struct cmp_JobSt *job;
+
+	pthread_mutex_lock(&cmp_lock);
+
+	while (1) {
+		while (!cmp_stop && cmp_queue_len == 0)
+			pthread_cond_wait(&cmp_cond, &cmp_lock);
+		if (cmp_queue_len == 0)
+			break;
+
+		job = cmp_queue[cmp_queue_head];
+		cmp_queue_head = (cmp_queue_head + 1) % COMPRESS_QUEUE_SIZE;
+		cmp_queue_len--;
+
+		pthread_mutex_unlock(&cmp_lock);
+		job->out_len = _Compress(job->codec, job->src, job->src_len, job->dst, job->dst_cap);
+		pthread_mutex_lock(&cmp_lock);
+
+		job->done = U_TRUE;
+		pthread_cond_broadcast(&cmp_done_cond);
+	}
+
+	pthread_mutex_unlock(&cmp_lock);
+	return NULL;
+}
+
+static void _Submit(struct cmp_JobSt *job)
+{
+	job->done = U_FALSE;
+
+	pthread_mutex_lock(&cmp_lock);
+	if (cmp_running && !cmp_stop && cmp_queue_len < COMPRESS_QUEUE_SIZE) {
+		cmp_queue[(cmp_queue_head + cmp_queue_len) % COMPRESS_QUEUE_SIZE] = job;
+		cmp_queue_len++;
+		pthread_cond_signal(&cmp_cond);
+		pthread_mutex_unlock(&cmp_lock);
+		return;
+	}
+	pthread_mutex_unlock(&cmp_lock);
+
+	// worker가 없거나 queue가 차 있으면 직접 압축
+	job->out_len = _Compress(job->codec, job->src, job->src_len, job->dst, job->dst_cap);
+	job->done = U_TRUE;
+}
+
+static void _Wait(struct cmp_JobSt *job)
+{
+	pthread_mutex_lock(&cmp_lock);
+	while (!job->done)
+		pthread_cond_wait(&cmp_done_cond, &cmp_lock);
+	pthread_mutex_unlock(&cmp_lock);
+}
+
+static void _Invalidate(int block)
+{
+	pthread_mutex_lock(&cmp_lock);
+	cmp_block_gen[block]++;
+	pthread_mutex_unlock(&cmp_lock);
+}
+
+static void _LoadIndex(const uffs_FileInfo *info, uffs_ChunkIndex *idx)
+{
+	if ((info->attr & FILE_ATTR_COMPRESS) && UFFS_CHUNK_INDEX_FITS(info->name_len))
+		memcpy(idx, UFFS_INLINE_DATA(info), sizeof(uffs_ChunkIndex));
+	else
+		memset(idx, 0, sizeof(uffs_ChunkIndex));
+	if (idx->count > UFFS_MAX_CHUNKS)
+		idx->count = UFFS_MAX_CHUNKS;
+}
+
+// file_len 길이 파일의 chunk 하나의 압축 전 길이
+static int _ChunkRawLen(u32 file_len, int chunk)
+{
+	u32 start = (u32)chunk * UFFS_CHUNK_SIZE;
+
+	if (file_len <= start)
+		return 0;
+	return file_len - start > UFFS_CHUNK_SIZE ? UFFS_CHUNK_SIZE : (int)(file_len - start);
+}
+
+// 메모리에 읽어둔 chunk 페이지(src)를 풂
+static int _UnpackChunk(const uffs_ChunkIndex *idx, int chunk, const char *src, char *out)
+{
+	const struct uffs_ChunkSt *ch = &idx->chunk[chunk];
+	int raw_len = _ChunkRawLen(idx->file_len, chunk);
+
+	if (ch->len == 0) {
+		if (raw_len > ch->pages * PAGE_DATA_SIZE_DEFAULT)
+			return -1;
+		memcpy(out, src, raw_len);
+		return raw_len;
+	}
+	if (ch->len > ch->pages * PAGE_DATA_SIZE_DEFAULT)
+		return -1;
+	return _Decompress(idx->codec, src, ch->len, out, raw_len) == raw_len ? raw_len : -1;
+}
+
+// data 블록의 [page, page + count) 를 buf(페이지 순서대로)로 읽음
+static URET _ReadPages(int fd, int block, int page, int count, uffs_MiniHeader *mh, char *buf, uffs_Tag *tags)
+{
+	uffs_PageReq reqs[PAGES_PER_BLOCK_DEFAULT];
+	int i;
+
+	for (i = 0; i < count; i++) {
+		reqs[i].block_id = block;
+		reqs[i].page_Id = page + i;
+		reqs[i].mini_header = mh != NULL ? &mh[i] : NULL;
+		reqs[i].data = buf + (size_t)i * PAGE_DATA_SIZE_DEFAULT;
+		reqs[i].tag = tags != NULL ? &tags[i] : NULL;
+	}
+	if (readPages(fd, reqs, count) == U_FAIL)
+		return U_FAIL;
+	for (i = 0; i < count; i++) {
+		if (IS_FAIL(reqs[i].ret))
+			return U_FAIL;
+	}
+	return U_SUCC;
+}
+
+// chunk 하나(len bytes)를 data 페이지로 씀
+static URET _WriteChunk(int fd, int block, int page, int pages, const char *data, int len, u16 serial, u16 parent)
+{
+	uffs_MiniHeader mh[PAGES_PER_BLOCK_DEFAULT];
+	uffs_Tag tags[PAGES_PER_BLOCK_DEFAULT];
+	int i, left;
+
+	for (i = 0; i < pages; i++) {
+		left = len - i * PAGE_DATA_SIZE_DEFAULT;
+		mh[i].status = 0x01;
+		mh[i].reserved = 0x00;
+		mh[i].crc = 0xFFFF;
+		memset(&tags[i], 0, sizeof(uffs_Tag));
+		tags[i].s.dirty = 1;
+		tags[i].s.valid = 0;
+		tags[i].s.type = UFFS_TYPE_DATA;
+		tags[i].s.data_len = left > PAGE_DATA_SIZE_DEFAULT ? PAGE_DATA_SIZE_DEFAULT : left;
+		tags[i].s.serial = serial;
+		tags[i].s.parent = parent;
+		tags[i].s.page_id = page + i;
+		tags[i].s.tag_ecc = TAG_ECC_DEFAULT;
+	}
+	return writePages(fd, block, page, pages, mh, (char *)data, tags, U_FALSE);
+}
+
+static UBOOL _CacheCopy(int block, int chunk, char *dst, int in, int n)
+{
+	int i;
+
+	pthread_mutex_lock(&cmp_lock);
+	for (i = 0; i < COMPRESS_CACHE_SIZE; i++) {
+		struct cmp_CacheSt *e = &cmp_cache[i];
+
+		if (e->valid && e->block == block && e->chunk == chunk &&
+			e->gen == cmp_block_gen[block] && e->len >= in + n) {
+			memcpy(dst, e->data + in, n);
+			e->last_use = ++cmp_clock;
+			cmp_stat.cache_hits++;
+			pthread_mutex_unlock(&cmp_lock);
+			return U_TRUE;
+		}
+	}
+	pthread_mutex_unlock(&cmp_lock);
+	return U_FALSE;
+}
+
+static void _CacheInsert(int block, int chunk, u32 gen, const char *data, int len)
+{
+	struct cmp_CacheSt *victim = &cmp_cache[0];
+	int i;
+
+	pthread_mutex_lock(&cmp_lock);
+	// 푸는 동안 write가 있었으면 넣지 않음
+	if (gen == cmp_block_gen[block]) {
+		for (i = 0; i < COMPRESS_CACHE_SIZE; i++) {
+			if (!cmp_cache[i].valid) {
+				victim = &cmp_cache[i];
+				break;
+			}
+			if (cmp_cache[i].last_use < victim->last_use)
+				victim = &cmp_cache[i];
+		}
+		victim->valid = U_TRUE;
+		victim->block = block;
+		victim->chunk = chunk;
+		victim->gen = gen;
+		victim->len = len;
+		victim->last_use = ++cmp_clock;
+		memcpy(victim->data, data, len);
+	}
+	pthread_mutex_unlock(&cmp_lock);
+}
+
+/**
+ * \brief codec 이름 -> UFFS_COMPRESS_xxx
+ * \return 모르는 이름이거나 쓸 수 없는 codec이면 -1
+ */
+int uffs_CompressFind(const char *name)
+{
+	if (strcmp(name, "none") == 0)
+		return UFFS_COMPRESS_NONE;
+	if (strcmp(name, "lz4") == 0)
+		return UFFS_COMPRESS_LZ4;
+	if (strcmp(name, "zstd") == 0) {
+		if (!_ZstdReady()) {
+			fprintf(stderr, "[uffs_CompressFind] zstd is not available\n");
+			return -1;
+		}
+		return UFFS_COMPRESS_ZSTD;
+	}
+	return -1;
+}
+
+/**
+ * \brief 새로 쓰는 data 블록에 쓸 codec을 정하고 압축 스레드를 띄움
+ *
+ * UFFS_COMPRESS_NONE이어도 이미 압축된 파일은 읽고 쓸 수 있음 (압축은 직접 함)
+ */
+URET uffs_CompressInit(int codec)
+{
+	pthread_mutex_lock(&cmp_lock);
+	cmp_codec = codec;
+	cmp_stop = U_FALSE;
+	cmp_running = U_FALSE;
+	if (codec != UFFS_COMPRESS_NONE)
+		cmp_running = pthread_create(&cmp_worker, NULL, _Worker, NULL) == 0 ? U_TRUE : U_FALSE;
+	pthread_mutex_unlock(&cmp_lock);
+
+	if (codec != UFFS_COMPRESS_NONE && !cmp_running) {
+		fprintf(stderr, "[uffs_CompressInit] compress thread create error\n");
+		return U_FAIL;
+	}
+	return U_SUCC;
+}
+
+void uffs_CompressRelease(void)
+{
+	pthread_mutex_lock(&cmp_lock);
+	if (!cmp_running) {
+		pthread_mutex_unlock(&cmp_lock);
+		return;
+	}
+	cmp_stop = U_TRUE;
+	pthread_cond_broadcast(&cmp_cond);
+	pthread_mutex_unlock(&cmp_lock);
+
+	pthread_join(cmp_worker, NULL);
+	cmp_running = U_FALSE;
+}
+
+int uffs_CompressCodec(void)
+{
+	return cmp_codec;
+}
+
+/**
+ * \brief 압축 파일의 (압축 전) 길이, 압축 파일이 아니면 0
+ */
+u32 uffs_CompressFileLen(const uffs_FileInfo *info)
+{
+	uffs_ChunkIndex idx;
+
+	_LoadIndex(info, &idx);
+	return idx.file_len;
+}
+
+/**
+ * \brief 압축 파일 read. offset이 걸친 chunk만 읽어서 풂
+ * \param[in] block 파일의 data 블록
+ * \param[in] info 파일 헤더 페이지 (chunk index)
+ * \return 읽은 길이, 실패하면 -errno
+ */
+int uffs_CompressRead(int fd, int block, const uffs_FileInfo *info, char *buf, size_t size, off_t offset)
+{
+	uffs_ChunkIndex idx;
+	char *pages = NULL, *raw = NULL;
+	size_t done = 0;
+	int chunk, in, n, len;
+	u32 gen;
+
+	_LoadIndex(info, &idx);
+	if (offset < 0 || (u32)offset >= idx.file_len)
+		return 0;
+	if (size > idx.file_len - offset)
+		size = idx.file_len - offset;
+
+	while (done < size) {
+		chunk = (offset + done) / UFFS_CHUNK_SIZE;
+		in = (offset + done) % UFFS_CHUNK_SIZE;
+		n = UFFS_CHUNK_SIZE - in;
+		if ((size_t)n > size - done)
+			n = size - done;
+		if (chunk >= idx.count)
+			break;
+
+		if (_CacheCopy(block, chunk, buf + done, in, n)) {
+			done += n;
+			continue;
+		}
+
+		if (raw == NULL) {
+			pages = (char *)malloc(UFFS_CHUNK_SIZE);
+			raw = (char *)malloc(UFFS_CHUNK_SIZE);
+			if (pages == NULL || raw == NULL)
+				break;
+		}
+
+		pthread_mutex_lock(&cmp_lock);
+		gen = cmp_block_gen[block];
+		pthread_mutex_unlock(&cmp_lock);
+
+		if (idx.chunk[chunk].page + idx.chunk[chunk].pages > PAGES_PER_BLOCK_DEFAULT ||
+			_ReadPages(fd, block, idx.chunk[chunk].page, idx.chunk[chunk].pages, NULL, pages, NULL) == U_FAIL ||
+			(len = _UnpackChunk(&idx, chunk, pages, raw)) < in + n) {
+			fprintf(stderr, "[uffs_CompressRead] chunk %d of block %d is broken\n", chunk, block);
+			break;
+		}
+
+		memcpy(buf + done, raw + in, n);
+		_CacheInsert(block, chunk, gen, raw, len);
+		done += n;
+
+		pthread_mutex_lock(&cmp_lock);
+		cmp_stat.decompressed++;
+		pthread_mutex_unlock(&cmp_lock);
+	}
+
+	free(pages);
+	free(raw);
+	if (done == 0 && size > 0)
+		return -EIO;
+	return done;
+}
+
+/**
+ * \brief 압축 파일 write
+ *
+ * write가 걸친 chunk를 풀어서 고치고 다시 압축한다. 그 뒤 chunk들은 압축된 그대로
+ * 페이지만 옮긴다. 블록에 다 들어가지 않으면 원래 페이지를 되돌리고 -ENOSPC.
+ * 성공하면 info의 chunk index를 고침 (헤더 페이지 갱신은 호출한 쪽에서).
+ *
+ * \param[in] serial, parent data 페이지 tag에 넣을 data/file serial
+ * \param[in,out] info 파일 헤더 페이지
+ * \return 쓴 길이, 실패하면 -errno
+ */
+int uffs_CompressWrite(int fd, int block, u16 serial, u16 parent, uffs_FileInfo *info,
+					   const char *buf, size_t size, off_t offset)
+{
+	static const int page_size = PAGE_DATA_SIZE_DEFAULT;
+	uffs_ChunkIndex old, idx;
+	struct cmp_JobSt jobs[UFFS_MAX_CHUNKS];
+	UBOOL recompress[UFFS_MAX_CHUNKS];
+	uffs_MiniHeader old_mh[PAGES_PER_BLOCK_DEFAULT];
+	uffs_Tag old_tags[PAGES_PER_BLOCK_DEFAULT];
+	char *old_data = NULL, *raw = NULL, *out = NULL;
+	int first, c, cursor, old_start, old_end, submitted = 0;
+	int raw_len, len, pages, ret;
+	u32 end, start;
+	u32 lo, hi;
+	const char *data;
+
+	if (!UFFS_CHUNK_INDEX_FITS(info->name_len))
+		return -ENAMETOOLONG;
+	if (offset < 0 || offset + (off_t)size > (off_t)UFFS_MAX_CHUNKS * UFFS_CHUNK_SIZE)
+		return -EFBIG;
+	if (size == 0)
+		return 0;
+
+	_LoadIndex(info, &old);
+	idx = old;
+	if (!(info->attr & FILE_ATTR_COMPRESS))
+		idx.codec = cmp_codec;
+	if (idx.codec != UFFS_COMPRESS_LZ4 && (idx.codec != UFFS_COMPRESS_ZSTD || !_ZstdReady()))
+		return -EINVAL;
+
+	end = offset + size;
+	idx.file_len = end > old.file_len ? end : old.file_len;
+	idx.count = (idx.file_len + UFFS_CHUNK_SIZE - 1) / UFFS_CHUNK_SIZE;
+
+	// 다시 압축할 chunk: write가 걸친 chunk, 새로 생기는 chunk, 길이가 바뀌는 마지막 chunk
+	first = idx.count;
+	for (c = 0; c < idx.count; c++) {
+		start = (u32)c * UFFS_CHUNK_SIZE;
+		recompress[c] = c >= old.count ||
+						(start < end && (u32)offset < start + UFFS_CHUNK_SIZE) ||
+						_ChunkRawLen(old.file_len, c) != _ChunkRawLen(idx.file_len, c);
+		if (recompress[c] && first == idx.count)
+			first = c;
+	}
+
+	old_end = old.count > 0 ? old.chunk[old.count - 1].page + old.chunk[old.count - 1].pages : 0;
+	old_start = first < old.count ? old.chunk[first].page : old_end;
+	cursor = first == 0 ? 0 : old.chunk[first - 1].page + old.chunk[first - 1].pages;
+	if (old_end > PAGES_PER_BLOCK_DEFAULT || old_start > old_end)
+		return -EIO;
+
+	old_data = (char *)malloc(PAGES_PER_BLOCK_DEFAULT * PAGE_DATA_SIZE_DEFAULT);
+	raw = (char *)malloc((size_t)(idx.count - first) * UFFS_CHUNK_SIZE);
+	out = (char *)malloc((size_t)(idx.count - first) * UFFS_CHUNK_SIZE);
+	if (old_data == NULL || raw == NULL || out == NULL) {
+		ret = -ENOMEM;
+		goto ext;
+	}
+
+	_Invalidate(block);
+
+	// first부터는 페이지를 새로 씀. 원래 페이지는 먼저 읽어둠 (풀거나, 옮기거나, 실패 시 되돌림)
+	if (old_end > old_start &&
+		_ReadPages(fd, block, old_start, old_end - old_start, &old_mh[old_start],
+				   old_data + (size_t)old_start * page_size, &old_tags[old_start]) == U_FAIL) {
+		ret = -EIO;
+		goto ext;
+	}
+
+	// 풀고 고친 chunk는 바로 worker로 넘겨서, 다음 chunk를 푸는 동안 압축되게 함
+	for (c = first; c < idx.count; c++) {
+		char *r = raw + (size_t)(c - first) * UFFS_CHUNK_SIZE;
+
+		if (!recompress[c])
+			continue;
+
+		raw_len = _ChunkRawLen(idx.file_len, c);
+		memset(r, 0, UFFS_CHUNK_SIZE);
+		if (c < old.count && _UnpackChunk(&old, c, old_data + (size_t)old.chunk[c].page * page_size, r) < 0) {
+			fprintf(stderr, "[uffs_CompressWrite] chunk %d of block %d is broken\n", c, block);
+			ret = -EIO;
+			goto ext;
+		}
+
+		start = (u32)c * UFFS_CHUNK_SIZE;
+		lo = (u32)offset > start ? (u32)offset : start;
+		hi = end < start + raw_len ? end : start + raw_len;
+		if (lo < hi)
+			memcpy(r + (lo - start), buf + (lo - offset), hi - lo);
+
+		// 페이지가 하나라도 줄어야 압축해서 둠
+		jobs[c].codec = idx.codec;
+		jobs[c].src = r;
+		jobs[c].src_len = raw_len;
+		jobs[c].dst = out + (size_t)(c - first) * UFFS_CHUNK_SIZE;
+		jobs[c].dst_cap = (CHUNK_PAGES(raw_len) - 1) * page_size;
+		_Submit(&jobs[c]);
+		submitted = c + 1;
+	}
+
+	for (c = first; c < idx.count; c++) {
+		if (recompress[c]) {
+			_Wait(&jobs[c]);
+			raw_len = jobs[c].src_len;
+			if (jobs[c].out_len > 0) {
+				data = jobs[c].dst;
+				len = jobs[c].out_len;
+				pages = CHUNK_PAGES(len);
+				memset(jobs[c].dst + len, 0, pages * page_size - len);
+			}
+			else {
+				data = jobs[c].src;
+				len = 0;
+				pages = CHUNK_PAGES(raw_len);
+			}
+		}
+		else {
+			data = old_data + (size_t)old.chunk[c].page * page_size;
+			len = old.chunk[c].len;
+			pages = old.chunk[c].pages;
+			raw_len = _ChunkRawLen(idx.file_len, c);
+			// 자리가 그대로면 쓸 필요 없음
+			if (old.chunk[c].page == cursor) {
+				cursor += pages;
+				continue;
+			}
+		}
+
+		if (cursor + pages > PAGES_PER_BLOCK_DEFAULT) {
+			fprintf(stderr, "[uffs_CompressWrite] block %d is full - chunk %d needs %d pages at %d\n",
+					block, c, pages, cursor);
+			ret = -ENOSPC;
+			goto restore;
+		}
+		if (_WriteChunk(fd, block, cursor, pages, data, len > 0 ? len : raw_len, serial, parent) == U_FAIL) {
+			ret = -EIO;
+			goto restore;
+		}
+
+		idx.chunk[c].page = cursor;
+		idx.chunk[c].pages = pages;
+		idx.chunk[c].len = len;
+		cursor += pages;
+
+		if (recompress[c]) {
+			pthread_mutex_lock(&cmp_lock);
+			cmp_stat.chunks++;
+			cmp_stat.raw_bytes += raw_len;
+			cmp_stat.stored_bytes += pages * page_size;
+			if (len == 0)
+				cmp_stat.incompressible++;
+			pthread_mutex_unlock(&cmp_lock);
+		}
+	}
+
+	memset(UFFS_INLINE_DATA(info), 0, UFFS_INLINE_LIMIT(info->name_len));
+	memcpy(UFFS_INLINE_DATA(info), &idx, sizeof(uffs_ChunkIndex));
+	info->attr = (info->attr & ~FILE_ATTR_INLINE) | FILE_ATTR_COMPRESS;
+	ret = size;
+	goto ext;
+
+restore:
+	// index는 그대로이므로 원래 페이지만 되돌리면 됨
+	if (old_end > old_start &&
+		writePages(fd, block, old_start, old_end - old_start, &old_mh[old_start],
+				   old_data + (size_t)old_start * page_size, &old_tags[old_start], U_FALSE) == U_FAIL) {
+		fprintf(stderr, "[uffs_CompressWrite] restore error - block %d\n", block);
+	}
+
+ext:
+	// worker가 아직 잡고 있는 job은 끝날 때까지 기다림
+	for (c = first; c < submitted; c++) {
+		if (recompress[c])
+			_Wait(&jobs[c]);
+	}
+	_Invalidate(block);
+	free(old_data);
+	free(raw);
+	free(out);
+	return ret;
+}
+
+void uffs_CompressGetStat(uffs_CompressStat *stat)
+{
+	pthread_mutex_lock(&cmp_lock);
+	*stat = cmp_stat;
+	pthread_mutex_unlock(&cmp_lock);
+}
@@ -0,0 +1,75 @@
+/**
+ * \file uffs_compress.h
+ * \brief per-chunk compressed file data
+ *
+ * 압축 파일(#FILE_ATTR_COMPRESS)의 data는 #UFFS_CHUNK_SIZE 단위로 나눠 chunk마다
+ * 따로 압축하고, data 블록 페이지에 앞에서부터 이어서 둔다.
+ * 어느 chunk가 어느 페이지에 있는지는 헤더 페이지의 name 뒤(inline data 자리)에
+ * #uffs_ChunkIndex 로 둬서, 랜덤 read는 chunk 하나만 읽어서 푼다.
+ */
+
+#ifndef _UFFS_COMPRESS_H_
+#define _UFFS_COMPRESS_H_
+
+#include "uffs_types.h"
+#include "uffs_disk.h"
+
+#define UFFS_COMPRESS_NONE		0
+#define UFFS_COMPRESS_LZ4		1		//!< 빠름, 기본
+#define UFFS_COMPRESS_ZSTD		2		//!< 압축률 높음, libzstd.so.1이 있을 때만
+
+#define UFFS_CHUNK_SIZE			(PAGES_PER_BLOCK_DEFAULT * PAGE_DATA_SIZE_DEFAULT)	//!< 압축 전 chunk 크기 (블록 하나)
+#define UFFS_MAX_CHUNKS			16		//!< 파일 하나의 최대 chunk 수
+
+/**
+ * \struct uffs_ChunkSt
+ * \brief chunk 하나의 위치
+ */
+struct uffs_ChunkSt {
+	u8 page;			//!< data 블록에서 시작 페이지
+	u8 pages;			//!< 차지하는 페이지 수
+	u16 len;			//!< 압축된 길이, 0이면 압축하지 않고 그대로 둠
+};
+
+/**
+ * \struct uffs_ChunkIndexSt
+ * \brief 헤더 페이지에 들어가는 chunk index
+ */
+struct uffs_ChunkIndexSt {
+	u32 file_len;		//!< 압축 전 파일 길이
+	u8 codec;			//!< #UFFS_COMPRESS_LZ4 or #UFFS_COMPRESS_ZSTD
+	u8 count;			//!< chunk 수
+	u16 reserved;
+	struct uffs_ChunkSt chunk[UFFS_MAX_CHUNKS];
+};
+typedef struct uffs_ChunkIndexSt uffs_ChunkIndex;
+
+/** 이름이 name_len일 때 헤더 페이지에 chunk index를 둘 수 있는지 */
+#define UFFS_CHUNK_INDEX_FITS(name_len)	(UFFS_INLINE_LIMIT(name_len) >= (int)sizeof(uffs_ChunkIndex))
+
+/**
+ * \struct uffs_CompressStatSt
+ * \brief 압축 metrics
+ */
+struct uffs_CompressStatSt {
+	unsigned long long raw_bytes;	//!< 압축한 chunk의 원래 크기 합
+	unsigned long long stored_bytes;	//!< 그 chunk들이 실제로 차지한 페이지 크기 합
+	u32 chunks;			//!< 새로 압축한 chunk 수
+	u32 incompressible;	//!< 줄지 않아서 그대로 둔 chunk 수
+	u32 decompressed;	//!< read에서 푼 chunk 수
+	u32 cache_hits;		//!< 풀어둔 chunk로 처리한 read 수
+};
+typedef struct uffs_CompressStatSt uffs_CompressStat;
+
+int uffs_CompressFind(const char *name);
+URET uffs_CompressInit(int codec);
+void uffs_CompressRelease(void);
+int uffs_CompressCodec(void);
+
+u32 uffs_CompressFileLen(const uffs_FileInfo *info);
+int uffs_CompressRead(int fd, int block, const uffs_FileInfo *info, char *buf, size_t size, off_t offset);
+int uffs_CompressWrite(int fd, int block, u16 serial, u16 parent, uffs_FileInfo *info,
+					   const char *buf, size_t size, off_t offset);
+void uffs_CompressGetStat(uffs_CompressStat *stat);
+
+#endif
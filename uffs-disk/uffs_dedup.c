@@ -0,0 +1,388 @@
+/**
+ * \file uffs_dedup.c
+ * \brief content-addressed data block deduplication
+ *
+ * index는 블록 번호로 바로 찾는 entry 배열과, hash로 찾는 bucket chain 두 가지다.
+ * 블록이 #TOTAL_BLOCKS_DEFAULT 개뿐이라 entry는 블록마다 하나씩 고정으로 둔다.
+ *
+ * 참조 수는 page 0 tag의 data_sum에 있다 (일반 data 블록은 0).
+ * 참조 수를 바꿀 때는 page 0만 다시 쓰고, mount 때는 헤더에서 센 값이 기준이다.
+ */
+
+#include "uffs_dedup.h"
+#include "uffs_xxh3.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define DEDUP_HASH_BITS		6
+#define DEDUP_BUCKETS		(1 << DEDUP_HASH_BITS)
+#define DEDUP_BLOCK_SIZE	(PAGES_PER_BLOCK_DEFAULT * PAGE_DATA_SIZE_DEFAULT)
+
+struct dedup_EntrySt {
+	uffs_Hash128 hash;
+	u32 len;			//!< 블록 안의 data 길이
+	u16 refs;			//!< 0이면 dedup 블록이 아님
+	UBOOL indexed;		//!< hash bucket에 들어 있음
+	int next;			//!< 같은 bucket의 다음 블록, -1: 끝
+
+	// mount scan
+	u16 tag_refs;		//!< page 0 tag에 적힌 참조 수
+	u16 scan_refs;		//!< 헤더에서 센 참조 수
+};
+
+static pthread_mutex_t dd_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dedup_EntrySt dd_entry[TOTAL_BLOCKS_DEFAULT];
+static int dd_bucket[DEDUP_BUCKETS];
+static UBOOL dd_enabled = U_FALSE;
+static uffs_DedupStat dd_stat;
+
+// 블록 내용 비교/hash용, dd_lock 잡고 씀
+static char dd_buf[DEDUP_BLOCK_SIZE];
+
+static int _Bucket(const uffs_Hash128 *hash)
+{
+	return (int)(hash->low & (DEDUP_BUCKETS - 1));
+}
+
+static int _Pages(u32 len)
+{
+	return (int)((len + PAGE_DATA_SIZE_DEFAULT - 1) / PAGE_DATA_SIZE_DEFAULT);
+}
+
+// dd_lock 잡고 호출
+static void _Unlink(int block)
+{
+	struct dedup_EntrySt *e = &dd_entry[block];
+	int *p;
+
+	if (!e->indexed)
+		return;
+	for (p = &dd_bucket[_Bucket(&e->hash)]; *p != -1; p = &dd_entry[*p].next) {
+		if (*p == block) {
+			*p = e->next;
+			break;
+		}
+	}
+	e->indexed = U_FALSE;
+	e->next = -1;
+}
+
+// dd_lock 잡고 호출
+static void _Link(int block, const uffs_Hash128 *hash, u32 len)
+{
+	struct dedup_EntrySt *e = &dd_entry[block];
+	int b = _Bucket(hash);
+
+	_Unlink(block);
+	e->hash = *hash;
+	e->len = len;
+	e->next = dd_bucket[b];
+	e->indexed = U_TRUE;
+	dd_bucket[b] = block;
+}
+
+// 블록 앞에서부터 len 바이트를 dd_buf로 읽음
+static URET _ReadBlock(int fd, int block, u32 len)
+{
+	uffs_PageReq reqs[PAGES_PER_BLOCK_DEFAULT];
+	int i, pages = _Pages(len);
+
+	for (i = 0; i < pages; i++) {
+		reqs[i].block_id = block;
+		reqs[i].page_Id = i;
+		reqs[i].mini_header = NULL;
+		reqs[i].data = dd_buf + i * PAGE_DATA_SIZE_DEFAULT;
+		reqs[i].tag = NULL;
+	}
+	return readPages(fd, reqs, pages);
+}
+
+// page 0 tag의 참조 수를 바꿈 (page 0 data는 그대로 다시 씀)
+static URET _WriteTagRefs(int fd, int block, u16 refs)
+{
+	uffs_MiniHeader mini_header;
+	char data[PAGE_DATA_SIZE_DEFAULT];
+	uffs_Tag tag;
+
+	if (IS_FAIL(readPage(fd, block, 0, &mini_header, data, &tag)))
+		return U_FAIL;
+	tag.data_sum = refs;
+	return writePage(fd, block, 0, &mini_header, data, &tag);
+}
+
+/**
+ * \brief reset index, mount scan(uffs_BuildTree) 전에 호출
+ * \param[in] enable U_FALSE면 새로 공유하지는 않지만 이미 공유된 블록은 계속 관리함
+ */
+URET uffs_DedupInit(UBOOL enable)
+{
+	int i;
+
+	pthread_mutex_lock(&dd_lock);
+	memset(dd_entry, 0, sizeof(dd_entry));
+	for (i = 0; i < TOTAL_BLOCKS_DEFAULT; i++)
+		dd_entry[i].next = -1;
+	for (i = 0; i < DEDUP_BUCKETS; i++)
+		dd_bucket[i] = -1;
+	memset(&dd_stat, 0, sizeof(dd_stat));
+	dd_enabled = enable;
+	pthread_mutex_unlock(&dd_lock);
+	return U_SUCC;
+}
+
+UBOOL uffs_DedupEnabled(void)
+{
+	return dd_enabled;
+}
+
+/**
+ * \brief mount scan: page 0 tag의 data_sum이 0이 아닌 data 블록
+ */
+void uffs_DedupScanBlock(int block, u16 refs)
+{
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT)
+		return;
+	pthread_mutex_lock(&dd_lock);
+	dd_entry[block].tag_refs = refs;
+	pthread_mutex_unlock(&dd_lock);
+}
+
+/**
+ * \brief mount scan: #FILE_ATTR_DEDUP 헤더 하나
+ */
+void uffs_DedupScanRef(int block, u32 len)
+{
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT)
+		return;
+	pthread_mutex_lock(&dd_lock);
+	dd_entry[block].scan_refs++;
+	dd_entry[block].len = len;
+	pthread_mutex_unlock(&dd_lock);
+}
+
+/**
+ * \brief mount scan이 끝난 뒤 index를 만듦
+ *
+ * 헤더에서 센 참조 수로 tag를 맞추고(AddRef/DelRef 도중 끊긴 경우),
+ * 가리키는 헤더가 없는 dedup 블록은 지운다.
+ */
+URET uffs_DedupBuild(int fd)
+{
+	struct dedup_EntrySt *e;
+	uffs_Hash128 hash;
+	int block, blocks = 0, fixed = 0, freed = 0;
+	URET ret = U_SUCC;
+
+	pthread_mutex_lock(&dd_lock);
+
+	for (block = 1; block < TOTAL_BLOCKS_DEFAULT; block++) {
+		e = &dd_entry[block];
+
+		if (e->tag_refs == 0 && e->scan_refs == 0)
+			continue;
+
+		if (e->scan_refs == 0) {
+			fprintf(stdout, "[uffs_DedupBuild] block %d has no reference, erase\n", block);
+			if (eraseBlock(fd, block) == U_FAIL)
+				ret = U_FAIL;
+			freed++;
+		}
+		else if (e->tag_refs == 0) {
+			fprintf(stderr, "[uffs_DedupBuild] block %d is referenced but not a dedup block\n", block);
+			ret = U_FAIL;
+		}
+		else if (e->len > DEDUP_BLOCK_SIZE || IS_FAIL(_ReadBlock(fd, block, e->len))) {
+			fprintf(stderr, "[uffs_DedupBuild] block %d read error\n", block);
+			ret = U_FAIL;
+		}
+		else {
+			if (e->tag_refs != e->scan_refs) {
+				fprintf(stdout, "[uffs_DedupBuild] block %d refs %u -> %u\n", block, e->tag_refs, e->scan_refs);
+				if (_WriteTagRefs(fd, block, e->scan_refs) == U_FAIL)
+					ret = U_FAIL;
+				fixed++;
+			}
+			e->refs = e->scan_refs;
+			hash = uffs_Xxh3_128(dd_buf, e->len);
+			_Link(block, &hash, e->len);
+			blocks++;
+		}
+		e->tag_refs = 0;
+		e->scan_refs = 0;
+	}
+
+	pthread_mutex_unlock(&dd_lock);
+
+	fprintf(stdout, "[uffs_DedupBuild] %d dedup blocks, %d refs fixed, %d freed\n", blocks, fixed, freed);
+	return ret;
+}
+
+/**
+ * \brief data와 내용이 같은 dedup 블록 찾기
+ * \return 블록 번호, 없으면 -1
+ */
+int uffs_DedupFind(int fd, const char *data, u32 len)
+{
+	uffs_Hash128 hash;
+	int block;
+
+	if (len == 0 || len > DEDUP_BLOCK_SIZE)
+		return -1;
+
+	hash = uffs_Xxh3_128(data, len);
+
+	pthread_mutex_lock(&dd_lock);
+	for (block = dd_bucket[_Bucket(&hash)]; block != -1; block = dd_entry[block].next) {
+		struct dedup_EntrySt *e = &dd_entry[block];
+
+		if (e->len != len || e->hash.low != hash.low || e->hash.high != hash.high)
+			continue;
+		// hash만 믿지 않고 블록 내용을 읽어서 비교
+		if (IS_SUCC(_ReadBlock(fd, block, len)) && memcmp(dd_buf, data, len) == 0) {
+			dd_stat.hits++;
+			dd_stat.bytes_saved += len;
+			dd_stat.pages_saved += _Pages(len);
+			break;
+		}
+		dd_stat.collisions++;
+	}
+	pthread_mutex_unlock(&dd_lock);
+
+	return block;
+}
+
+/**
+ * \brief 새로 쓴 dedup 블록을 index에 넣음 (page 0 tag의 data_sum은 1로 써 둔 상태)
+ */
+URET uffs_DedupInsert(int block, const char *data, u32 len)
+{
+	uffs_Hash128 hash;
+
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT || len > DEDUP_BLOCK_SIZE)
+		return U_FAIL;
+
+	hash = uffs_Xxh3_128(data, len);
+
+	pthread_mutex_lock(&dd_lock);
+	dd_entry[block].refs = 1;
+	_Link(block, &hash, len);
+	pthread_mutex_unlock(&dd_lock);
+	return U_SUCC;
+}
+
+/**
+ * \brief 참조가 하나뿐인 블록을 제자리에서 고쳐 쓰기 전에 index에서 뺌
+ */
+void uffs_DedupRemove(int block)
+{
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT)
+		return;
+	pthread_mutex_lock(&dd_lock);
+	_Unlink(block);
+	dd_entry[block].refs = 0;
+	pthread_mutex_unlock(&dd_lock);
+}
+
+/**
+ * \return 헤더의 dedup 참조에 있는 파일 길이
+ */
+u32 uffs_DedupFileLen(const uffs_FileInfo *info)
+{
+	uffs_DedupRef ref;
+
+	memcpy(&ref, UFFS_INLINE_DATA(info), sizeof(ref));
+	return ref.len;
+}
+
+/**
+ * \return 블록의 참조 수, dedup 블록이 아니면 0
+ */
+u16 uffs_DedupRefs(int block)
+{
+	u16 refs;
+
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT)
+		return 0;
+	pthread_mutex_lock(&dd_lock);
+	refs = dd_entry[block].refs;
+	pthread_mutex_unlock(&dd_lock);
+	return refs;
+}
+
+/**
+ * \brief 파일 하나가 블록을 같이 쓰기 시작함
+ * \return 그 사이 블록이 지워졌으면 U_FAIL
+ */
+URET uffs_DedupAddRef(int fd, int block)
+{
+	struct dedup_EntrySt *e;
+	URET ret = U_FAIL;
+
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT)
+		return U_FAIL;
+
+	pthread_mutex_lock(&dd_lock);
+	e = &dd_entry[block];
+	if (e->refs > 0 && e->refs < 0xFFFF && _WriteTagRefs(fd, block, e->refs + 1) == U_SUCC) {
+		e->refs++;
+		ret = U_SUCC;
+	}
+	pthread_mutex_unlock(&dd_lock);
+	return ret;
+}
+
+/**
+ * \brief 파일 하나가 블록을 더 이상 쓰지 않음, 마지막 참조면 블록을 지움
+ */
+URET uffs_DedupDelRef(int fd, int block)
+{
+	struct dedup_EntrySt *e;
+	URET ret;
+
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT)
+		return U_FAIL;
+
+	pthread_mutex_lock(&dd_lock);
+	e = &dd_entry[block];
+	if (e->refs == 0) {
+		pthread_mutex_unlock(&dd_lock);
+		return U_FAIL;
+	}
+	if (--e->refs == 0) {
+		_Unlink(block);
+		ret = eraseBlock(fd, block);
+	}
+	else {
+		ret = _WriteTagRefs(fd, block, e->refs);
+	}
+	pthread_mutex_unlock(&dd_lock);
+	return ret;
+}
+
+/**
+ * \brief 공유 블록에 써서 새 블록으로 복사함 (metrics)
+ */
+void uffs_DedupCow(void)
+{
+	pthread_mutex_lock(&dd_lock);
+	dd_stat.cow++;
+	pthread_mutex_unlock(&dd_lock);
+}
+
+void uffs_DedupGetStat(uffs_DedupStat *stat)
+{
+	int block;
+
+	pthread_mutex_lock(&dd_lock);
+	*stat = dd_stat;
+	stat->blocks = 0;
+	stat->refs = 0;
+	for (block = 1; block < TOTAL_BLOCKS_DEFAULT; block++) {
+		if (dd_entry[block].refs > 0) {
+			stat->blocks++;
+			stat->refs += dd_entry[block].refs;
+		}
+	}
+	pthread_mutex_unlock(&dd_lock);
+}
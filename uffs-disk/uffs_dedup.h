@@ -0,0 +1,66 @@
+/**
+ * \file uffs_dedup.h
+ * \brief content-addressed data block deduplication
+ *
+ * 내용이 같은 파일은 data 블록 하나를 같이 쓴다. 블록 내용의 XXH3-128 hash로
+ * 메모리 index(hash -> 블록)를 두고, 찾은 블록은 바이트 비교로 한 번 더 확인한다.
+ *
+ * 공유되는 블록(dedup 블록)은 page 0 tag의 data_sum에 참조 수를 두고,
+ * 참조하는 파일 헤더는 #FILE_ATTR_DEDUP 과 name 뒤의 #uffs_DedupRef 로 블록을 가리킨다.
+ * 참조 수가 2 이상인 블록에 쓰면 새 블록으로 복사해서 쓴다(COW).
+ * mount 때 헤더를 세서 참조 수를 다시 맞추고, 아무도 안 쓰는 블록은 지운다.
+ */
+
+#ifndef _UFFS_DEDUP_H_
+#define _UFFS_DEDUP_H_
+
+#include "uffs_types.h"
+#include "uffs_disk.h"
+
+/**
+ * \struct uffs_DedupRefSt
+ * \brief 헤더 페이지에 들어가는 dedup 블록 참조
+ */
+struct uffs_DedupRefSt {
+	u16 block;			//!< dedup 블록
+	u16 reserved;
+	u32 len;			//!< 파일 길이 (블록 안의 data 길이)
+};
+typedef struct uffs_DedupRefSt uffs_DedupRef;
+
+/** 이름이 name_len일 때 헤더 페이지에 dedup 참조를 둘 수 있는지 */
+#define UFFS_DEDUP_REF_FITS(name_len)	(UFFS_INLINE_LIMIT(name_len) >= (int)sizeof(uffs_DedupRef))
+
+/**
+ * \struct uffs_DedupStatSt
+ * \brief dedup metrics
+ */
+struct uffs_DedupStatSt {
+	u32 blocks;			//!< index에 있는 dedup 블록 수
+	u32 refs;			//!< 그 블록들의 참조 수 합
+	u32 hits;			//!< 같은 내용의 블록을 찾아서 data를 쓰지 않은 write 수
+	u32 cow;			//!< 공유 블록에 써서 새 블록으로 복사한 수
+	u32 collisions;		//!< hash는 같았지만 내용이 달랐던 수
+	u32 pages_saved;	//!< 쓰지 않은 data 페이지 수 (참조 수를 적는 page 0 쓰기는 빼지 않음)
+	unsigned long long bytes_saved;	//!< 공유해서 쓰지 않은 data 바이트
+};
+typedef struct uffs_DedupStatSt uffs_DedupStat;
+
+URET uffs_DedupInit(UBOOL enable);
+u32 uffs_DedupFileLen(const uffs_FileInfo *info);
+UBOOL uffs_DedupEnabled(void);
+
+void uffs_DedupScanBlock(int block, u16 refs);
+void uffs_DedupScanRef(int block, u32 len);
+URET uffs_DedupBuild(int fd);
+
+int uffs_DedupFind(int fd, const char *data, u32 len);
+URET uffs_DedupInsert(int block, const char *data, u32 len);
+void uffs_DedupRemove(int block);
+u16 uffs_DedupRefs(int block);
+URET uffs_DedupAddRef(int fd, int block);
+URET uffs_DedupDelRef(int fd, int block);
+void uffs_DedupCow(void);
+void uffs_DedupGetStat(uffs_DedupStat *stat);
+
+#endif
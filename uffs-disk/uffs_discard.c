@@ -0,0 +1,253 @@
+/**
+ * \file uffs_discard.c
+ * \brief discard/TRIM of freed blocks to the backing device
+ *
+ * 블록마다 상태 하나(없음/queue에 있음/discard 중)를 두고, worker는
+ * queue에 있는 블록 중 번호가 이어지는 것끼리 묶어서 diskDiscard를 한 번씩 부른다.
+ * discard 하는 동안은 dc_lock을 놓으므로 다른 블록의 write는 기다리지 않는다.
+ */
+
+#include "uffs_discard.h"
+#include "uffs_disk.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#define DC_NONE		0
+#define DC_QUEUED	1		//!< eraseBlock 됐고 아직 discard 안 됨
+#define DC_BUSY		2		//!< worker가 discard 중
+
+static pthread_mutex_t dc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dc_cond = PTHREAD_COND_INITIALIZER;		//!< worker 깨우기
+static pthread_cond_t dc_done_cond = PTHREAD_COND_INITIALIZER;	//!< discard 하나가 끝남
+static pthread_t dc_worker;
+static UBOOL dc_running = U_FALSE;
+static UBOOL dc_stop = U_FALSE;
+static UBOOL dc_flush = U_FALSE;
+static int dc_fd = -1;
+
+static u8 dc_state[TOTAL_BLOCKS_DEFAULT];
+static int dc_queued;				//!< DC_QUEUED인 블록 수
+static int dc_busy;					//!< DC_BUSY인 블록 수
+static struct timespec dc_first;	//!< dc_queued가 0에서 1이 된 시각
+static uffs_DiscardStat dc_stat;
+
+// dc_lock 잡고 호출, 처음 쌓인 뒤 UFFS_DISCARD_INTERVAL_MS가 지난 시각
+static void _Deadline(struct timespec *ts)
+{
+	*ts = dc_first;
+	ts->tv_sec += UFFS_DISCARD_INTERVAL_MS / 1000;
+	ts->tv_nsec += (long)(UFFS_DISCARD_INTERVAL_MS % 1000) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+// dc_lock 잡고 호출, queue에 있는 블록을 이어지는 것끼리 discard
+static void _DiscardQueued(void)
+{
+	int block = UFFS_JOURNAL_BLOCK + 1;
+	int first, count, i;
+	URET ret;
+
+	while (block < TOTAL_BLOCKS_DEFAULT) {
+		if (dc_state[block] != DC_QUEUED) {
+			block++;
+			continue;
+		}
+		first = block;
+		while (block < TOTAL_BLOCKS_DEFAULT && dc_state[block] == DC_QUEUED) {
+			dc_state[block] = DC_BUSY;
+			block++;
+		}
+		count = block - first;
+		dc_queued -= count;
+		dc_busy += count;
+
+		pthread_mutex_unlock(&dc_lock);
+		ret = diskDiscard(dc_fd, first, count);
+		pthread_mutex_lock(&dc_lock);
+
+		for (i = first; i < first + count; i++)
+			dc_state[i] = DC_NONE;
+		dc_busy -= count;
+		if (ret == U_SUCC) {
+			dc_stat.extents++;
+			dc_stat.blocks += count;
+			dc_stat.bytes += (unsigned long long)count * PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT;
+		}
+		else {
+			dc_stat.errors++;
+		}
+		pthread_cond_broadcast(&dc_done_cond);
+	}
+}
+
+static void * _Worker(void *arg)
+{
+	struct timespec ts;
+
+	(void)arg;
+	pthread_mutex_lock(&dc_lock);
+	for (;;) {
+		// batch가 차거나, 처음 쌓인 뒤 시간이 지나거나, flush/stop 할 때까지 모음
+		while (!dc_stop && !dc_flush && dc_queued < UFFS_DISCARD_BATCH) {
+			if (dc_queued == 0) {
+				pthread_cond_wait(&dc_cond, &dc_lock);
+				continue;
+			}
+			_Deadline(&ts);
+			if (pthread_cond_timedwait(&dc_cond, &dc_lock, &ts) == ETIMEDOUT)
+				break;
+		}
+
+		_DiscardQueued();
+
+		if (dc_queued == 0) {
+			dc_flush = U_FALSE;
+			pthread_cond_broadcast(&dc_done_cond);
+			if (dc_stop)
+				break;
+		}
+	}
+	pthread_mutex_unlock(&dc_lock);
+	return NULL;
+}
+
+/**
+ * \brief start discard thread
+ * \param[in] enable U_FALSE면 아무것도 discard 하지 않음
+ * \return backend가 discard를 못 하거나 thread를 못 만들면 U_FAIL (discard 없이 동작)
+ */
+URET uffs_DiscardInit(int fd, UBOOL enable)
+{
+	pthread_mutex_lock(&dc_lock);
+	memset(dc_state, 0, sizeof(dc_state));
+	memset(&dc_stat, 0, sizeof(dc_stat));
+	dc_queued = 0;
+	dc_busy = 0;
+	dc_fd = fd;
+	dc_stop = U_FALSE;
+	dc_flush = U_FALSE;
+	dc_running = U_FALSE;
+	pthread_mutex_unlock(&dc_lock);
+
+	if (!enable)
+		return U_SUCC;
+
+	if (!diskCanDiscard()) {
+		fprintf(stderr, "[uffs_DiscardInit] io backend has no discard\n");
+		return U_FAIL;
+	}
+
+	pthread_mutex_lock(&dc_lock);
+	dc_running = pthread_create(&dc_worker, NULL, _Worker, NULL) == 0 ? U_TRUE : U_FALSE;
+	pthread_mutex_unlock(&dc_lock);
+
+	if (!dc_running) {
+		fprintf(stderr, "[uffs_DiscardInit] discard thread create error\n");
+		return U_FAIL;
+	}
+	fprintf(stdout, "[uffs_DiscardInit] discard on, batch %d blocks, interval %d ms\n",
+			UFFS_DISCARD_BATCH, UFFS_DISCARD_INTERVAL_MS);
+	return U_SUCC;
+}
+
+UBOOL uffs_DiscardEnabled(void)
+{
+	return dc_running;
+}
+
+/**
+ * \brief eraseBlock 된 블록을 discard 할 queue에 넣음
+ */
+void uffs_DiscardQueue(int block)
+{
+	if (!dc_running || block <= UFFS_JOURNAL_BLOCK || block >= TOTAL_BLOCKS_DEFAULT)
+		return;
+
+	pthread_mutex_lock(&dc_lock);
+	if (dc_state[block] == DC_NONE) {
+		// 다른 batch가 discard 중이어도 이 블록부터 새로 기다림
+		if (dc_queued == 0)
+			clock_gettime(CLOCK_REALTIME, &dc_first);
+		dc_state[block] = DC_QUEUED;
+		dc_queued++;
+		dc_stat.queued++;
+		if (dc_queued >= UFFS_DISCARD_BATCH || dc_queued == 1)
+			pthread_cond_signal(&dc_cond);
+	}
+	pthread_mutex_unlock(&dc_lock);
+}
+
+/**
+ * \brief 블록에 쓰기 전에 호출: queue에 있으면 빼고, discard 중이면 끝날 때까지 기다림
+ */
+void uffs_DiscardCancel(int block)
+{
+	if (!dc_running || block <= UFFS_JOURNAL_BLOCK || block >= TOTAL_BLOCKS_DEFAULT)
+		return;
+
+	pthread_mutex_lock(&dc_lock);
+	if (dc_state[block] == DC_QUEUED) {
+		dc_state[block] = DC_NONE;
+		dc_queued--;
+		dc_stat.cancelled++;
+	}
+	while (dc_state[block] == DC_BUSY)
+		pthread_cond_wait(&dc_done_cond, &dc_lock);
+	pthread_mutex_unlock(&dc_lock);
+}
+
+/**
+ * \brief getFreeBlock이 discard 된 블록을 빈 상태로 다시 채움 (metrics)
+ */
+void uffs_DiscardRestored(void)
+{
+	pthread_mutex_lock(&dc_lock);
+	dc_stat.restored++;
+	pthread_mutex_unlock(&dc_lock);
+}
+
+/**
+ * \brief queue에 있는 블록을 바로 discard 하고 끝날 때까지 기다림
+ */
+void uffs_DiscardFlush(void)
+{
+	pthread_mutex_lock(&dc_lock);
+	if (dc_running) {
+		dc_flush = U_TRUE;
+		pthread_cond_signal(&dc_cond);
+		while (dc_queued > 0 || dc_busy > 0)
+			pthread_cond_wait(&dc_done_cond, &dc_lock);
+	}
+	pthread_mutex_unlock(&dc_lock);
+}
+
+/**
+ * \brief 남은 queue를 모두 discard 하고 thread 종료
+ */
+void uffs_DiscardExit(void)
+{
+	pthread_mutex_lock(&dc_lock);
+	if (!dc_running) {
+		pthread_mutex_unlock(&dc_lock);
+		return;
+	}
+	dc_stop = U_TRUE;
+	pthread_cond_broadcast(&dc_cond);
+	pthread_mutex_unlock(&dc_lock);
+
+	pthread_join(dc_worker, NULL);
+	dc_running = U_FALSE;
+}
+
+void uffs_DiscardGetStat(uffs_DiscardStat *stat)
+{
+	pthread_mutex_lock(&dc_lock);
+	*stat = dc_stat;
+	pthread_mutex_unlock(&dc_lock);
+}
@@ -0,0 +1,47 @@
+/**
+ * \file uffs_discard.h
+ * \brief discard/TRIM of freed blocks to the backing device
+ *
+ * eraseBlock으로 빈 블록이 되면 블록 번호를 queue에 넣고, background thread가
+ * 이웃한 블록끼리 묶어서 큰 extent 하나로 디바이스에 discard 한다
+ * (block device는 BLKDISCARD, 이미지 파일은 FALLOC_FL_PUNCH_HOLE).
+ *
+ * discard 된 블록은 page 0만 빈 블록 표시(#MINI_HEADER_TRIMMED)로 다시 쓰고,
+ * 나머지 페이지는 내용을 알 수 없으므로 getFreeBlock이 다시 줄 때 빈 상태로 채운다.
+ * 아직 discard 안 된 블록에 쓰면 queue에서 빠지고, discard 중인 블록에 쓰면 끝날 때까지 기다린다.
+ */
+
+#ifndef _UFFS_DISCARD_H_
+#define _UFFS_DISCARD_H_
+
+#include "uffs_types.h"
+
+#define UFFS_DISCARD_BATCH			16		//!< 이만큼 쌓이면 바로 discard
+#define UFFS_DISCARD_INTERVAL_MS	1000	//!< 처음 쌓인 뒤 이 시간이 지나면 batch가 덜 차도 discard
+#define UFFS_DISCARD_ALIGN			4096	//!< discard 범위는 이 단위로 안쪽으로 자름
+
+/**
+ * \struct uffs_DiscardStatSt
+ * \brief discard metrics
+ */
+struct uffs_DiscardStatSt {
+	u32 queued;			//!< queue에 들어간 블록 수
+	u32 cancelled;		//!< discard 전에 다시 쓰여서 빠진 블록 수
+	u32 extents;		//!< 디바이스에 보낸 discard 수
+	u32 blocks;			//!< discard 된 블록 수
+	u32 restored;		//!< 다시 쓰려고 빈 상태로 채운 discard 된 블록 수
+	u32 errors;			//!< 실패한 discard 수
+	unsigned long long bytes;	//!< discard 된 바이트
+};
+typedef struct uffs_DiscardStatSt uffs_DiscardStat;
+
+URET uffs_DiscardInit(int fd, UBOOL enable);
+UBOOL uffs_DiscardEnabled(void);
+void uffs_DiscardQueue(int block);
+void uffs_DiscardCancel(int block);
+void uffs_DiscardRestored(void);
+void uffs_DiscardFlush(void);
+void uffs_DiscardExit(void);
+void uffs_DiscardGetStat(uffs_DiscardStat *stat);
+
+#endif
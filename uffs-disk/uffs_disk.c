@@ -1,17 +1,135 @@
 #include "uffs_disk.h"
+#include "uffs_ecc.h"
+#include "uffs_journal.h"
+#include "uffs_io.h"
+#include "uffs_discard.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// 페이지 내 각 영역의 위치: [mini header][data][tag][ecc]
+#define PAGE_DATA_OFFSET    (sizeof(uffs_MiniHeader))
+#define PAGE_TAG_OFFSET     (PAGE_DATA_OFFSET + PAGE_DATA_SIZE_DEFAULT)
+#define PAGE_ECC_OFFSET     (PAGE_TAG_OFFSET + sizeof(uffs_Tag))
+#define PAGE_ECC_SIZE       UFFS_ECC_SIZE(PAGE_DATA_SIZE_DEFAULT)
+
+#if PAGE_ECC_SIZE_DEFAULT < UFFS_ECC_SIZE(PAGE_DATA_SIZE_DEFAULT)
+#error "PAGE_ECC_SIZE_DEFAULT is too small for page data ECC"
+#endif
+
+// 마운트된 디스크의 ECC 옵션 (superblock에서 읽음)
+static int disk_ecc_opt = ECC_OPTION_DEFAULT;
+
+// metadata 블록(헤더 페이지를 모아두는 블록)별 빈 페이지 bitmap
+// META_NOT_META: metadata 블록이 아님. 32 pages라 모든 비트가 1인 값은 쓰이지 않음
+// (page 0은 블록을 metadata 블록으로 만든 헤더가 늘 차지)
+#define META_NOT_META   0xFFFFFFFFU
+#if PAGES_PER_BLOCK_DEFAULT > 32
+#error "metadata page bitmap is u32"
+#endif
+static pthread_mutex_t meta_lock = PTHREAD_MUTEX_INITIALIZER;
+static u32 meta_free[TOTAL_BLOCKS_DEFAULT] = { [0 ... TOTAL_BLOCKS_DEFAULT - 1] = META_NOT_META };
+
+// 디바이스 I/O backend (diskOpen에서 선택)
+static const uffs_IoOps *disk_io = &uffs_IoPosixOps;
+
+// io_name: NULL이면 기본(posix) backend
+// return: fd 또는 -1
+int diskOpen(const char *path, const char *io_name) {
+    const uffs_IoOps *ops = &uffs_IoPosixOps;
+
+    if (io_name != NULL) {
+        ops = uffs_IoFind(io_name);
+        if (ops == NULL) {
+            fprintf(stderr, "[diskOpen] unknown io backend: %s\n", io_name);
+            return -1;
+        }
+    }
+    disk_io = ops;
+    fprintf(stdout, "[diskOpen] io backend: %s\n", disk_io->name);
+    return disk_io->Open(path);
+}
+
+// 지금까지 쓴 페이지를 모두 디바이스에 내림
+URET diskSync(int fd) {
+    if (disk_io->Sync(fd) < 0) {
+        fprintf(stderr, "[diskSync] sync error\n");
+        return U_FAIL;
+    }
+    return U_SUCC;
+}
+
+// 지금까지 쓴 페이지가 이후에 쓰는 페이지보다 먼저 디바이스에 닿게 함 (cache flush 없음)
+// backend가 못 하면 diskSync
+URET diskWriteback(int fd) {
+    if (disk_io->Writeback == NULL) {
+        return diskSync(fd);
+    }
+    if (disk_io->Writeback(fd) < 0) {
+        fprintf(stderr, "[diskWriteback] writeback error\n");
+        return U_FAIL;
+    }
+    return U_SUCC;
+}
+
+void diskClose(int fd) {
+    disk_io->Close(fd);
+}
+
+// block 1 page 0에 root 디렉토리 헤더가 있으면 uffs 이미지로 봄
+static UBOOL _HasRootDir(int fd) {
+    uffs_Tag tag = {0};
+
+    if (IS_FAIL(readPage(fd, 1, 0, NULL, NULL, &tag))) {
+        return U_FALSE;
+    }
+    return (tag.s.type == UFFS_TYPE_DIR && tag.s.serial == ROOT_DIR_SERIAL &&
+            tag.s.parent == ROOT_DIR_SERIAL) ? U_TRUE : U_FALSE;
+}
 
-URET diskFormatCheck(int fd){
+// return: UFFS_DISK_OK, UFFS_DISK_NOT_UFFS, UFFS_DISK_BAD_VERSION 또는 UFFS_DISK_BAD_SB
+// format 해도 되는 건 UFFS_DISK_NOT_UFFS 뿐. 나머지는 데이터가 있는 이미지라 마운트를 거부함
+int diskFormatCheck(int fd){
     fprintf(stdout,"[diskFormatCheck] called\n");
-    char magic[PAGE_DATA_SIZE_DEFAULT];
+    char data[PAGE_DATA_SIZE_DEFAULT] = {0};
+    uffs_SuperBlock *sb = (uffs_SuperBlock *)data;
+    int ret;
 
-    readPage(fd,0,0,NULL,magic,NULL);
+    ret = readPage(fd,0,0,NULL,data,NULL);
 
-    if (memcmp(magic, MAGIC,4) == 0) {
-        fprintf(stdout,"[diskFormatCheck] finished\n");
-        return U_SUCC;
+    if (ret == UFFS_FLASH_IO_ERR) {
+        // 아무것도 없는 새 이미지 파일
+        char page_buf[PAGE_SIZE_DEFAULT];
+        if (disk_io->Read(fd, page_buf, sizeof(page_buf), 0) == 0) {
+            fprintf(stderr,"[diskFormatCheck] empty device\n");
+            return UFFS_DISK_NOT_UFFS;
+        }
+        fprintf(stderr,"[diskFormatCheck] super block read error\n");
+        return UFFS_DISK_BAD_SB;
     }
-    fprintf(stderr,"[diskFormatCheck] is not uffs\n");
-    return U_FAIL;
+    if (memcmp(sb->magic, MAGIC, 4) != 0) {
+        // 교정 못 한 bit flip이 magic에 걸렸을 수 있음: root 디렉토리가 있으면 지우지 않음
+        if (ret == UFFS_FLASH_ECC_FAIL && _HasRootDir(fd)) {
+            fprintf(stderr,"[diskFormatCheck] super block ECC fail\n");
+            return UFFS_DISK_BAD_SB;
+        }
+        fprintf(stderr,"[diskFormatCheck] is not uffs\n");
+        return UFFS_DISK_NOT_UFFS;
+    }
+    if (IS_FAIL(ret)) {
+        fprintf(stderr,"[diskFormatCheck] super block ECC fail: %d\n", ret);
+        return UFFS_DISK_BAD_SB;
+    }
+    if (sb->version != UFFS_DISK_VERSION) {
+        fprintf(stderr,"[diskFormatCheck] disk version %d is not supported (expected %d)\n",
+                sb->version, UFFS_DISK_VERSION);
+        return UFFS_DISK_BAD_VERSION;
+    }
+    disk_ecc_opt = sb->ecc_opt;
+    fprintf(stdout,"[diskFormatCheck] finished - ecc option: %d\n", disk_ecc_opt);
+    return UFFS_DISK_OK;
 }
 
 static u32 GET_CURRENT_TIME() {
@@ -56,8 +174,10 @@ URET diskFormat(int fd) {
 
     char data[PAGE_DATA_SIZE_DEFAULT] = {0};
 
-    // 블록 및 페이지 초기화
-    for (int block = 2; block < TOTAL_BLOCKS_DEFAULT; block++) {
+    disk_ecc_opt = ECC_OPTION_DEFAULT;
+
+    // 블록 및 페이지 초기화 (root 블록도 나머지 페이지는 헤더 자리로 비워 둠)
+    for (int block = 1; block < TOTAL_BLOCKS_DEFAULT; block++) {
         for (int page = 0; page < PAGES_PER_BLOCK_DEFAULT; page++) {
             struct uffs_MiniHeaderSt mini_header = {0xFF, 0x00, (u16)(block + page)}; // CRC: 블록+페이지 합
             struct uffs_TagsSt tag = {0};
@@ -85,11 +205,14 @@ URET diskFormat(int fd) {
 
     // write magic number
     char magic[PAGE_DATA_SIZE_DEFAULT];
+    uffs_SuperBlock *sb = (uffs_SuperBlock *)magic;
     uffs_MiniHeader mini_header = {0xFF, 0x00, 0x00}; // CRC: 블록+페이지 합    
     uffs_Tag tag={0};
 
     memset(magic, 0, sizeof(magic));
-    memcpy(magic, MAGIC, 4);
+    memcpy(sb->magic, MAGIC, 4);
+    sb->version = UFFS_DISK_VERSION;
+    sb->ecc_opt = disk_ecc_opt;
 
     if (writePage(fd,0,0,&mini_header,magic,&tag) < 0) {
         fprintf(stderr, "[diskFormat] write magic number error\n");    
@@ -111,48 +234,201 @@ URET diskFormat(int fd) {
     return U_SUCC;
 }
 
-URET readPage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag) {
+// page data의 ECC를 검사하고 1비트 오류는 교정
+static int checkPageEcc(char *page_buf, int block_id, int page_Id) {
+    u8 ecc[PAGE_ECC_SIZE];
+    int corrected;
+
+    uffs_EccMake(page_buf + PAGE_DATA_OFFSET, PAGE_DATA_SIZE_DEFAULT, ecc);
+    corrected = uffs_EccCorrect(page_buf + PAGE_DATA_OFFSET, PAGE_DATA_SIZE_DEFAULT,
+                                page_buf + PAGE_ECC_OFFSET, ecc);
+    if (corrected < 0) {
+        fprintf(stderr, "[readPage] ECC fail - block %d, page %d\n", block_id, page_Id);
+        return UFFS_FLASH_ECC_FAIL;
+    }
+    if (corrected > 0) {
+        fprintf(stderr, "[readPage] ECC corrected %d bit flip(s) - block %d, page %d\n",
+                corrected, block_id, page_Id);
+        return UFFS_FLASH_ECC_OK;
+    }
+    return UFFS_FLASH_NO_ERR;
+}
 
-    char page_buf[PAGE_SIZE_DEFAULT];
-    off_t read_offset = block_id * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT) + page_Id * PAGE_SIZE_DEFAULT;
+// 읽어온 페이지 버퍼를 영역별로 나눠 복사
+// ECC 검사는 data를 요청했을 때만 수행
+static int parsePage(char *page_buf, int block_id, int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag) {
+    int ret = UFFS_FLASH_NO_ERR;
 
-    ssize_t bytes_read = pread(fd, page_buf, sizeof(page_buf), read_offset);
-    
-    off_t offset = 0;
     if (mini_header != NULL) {
-        memcpy(mini_header, page_buf + offset, sizeof(uffs_MiniHeader));
-        // fprintf(stdout, "[readPage] Data extracted: %.*s\n", PAGE_DATA_SIZE_DEFAULT, data);
+        memcpy(mini_header, page_buf, sizeof(uffs_MiniHeader));
     }
-    offset += sizeof(uffs_MiniHeader);
 
     if (data != NULL) {
-        memcpy(data, page_buf + offset, PAGE_DATA_SIZE_DEFAULT);
+        if (disk_ecc_opt == UFFS_ECC_SOFT) {
+            ret = checkPageEcc(page_buf, block_id, page_Id);
+        }
+        memcpy(data, page_buf + PAGE_DATA_OFFSET, PAGE_DATA_SIZE_DEFAULT);
     }
-    offset += PAGE_DATA_SIZE_DEFAULT;
 
     if (tag != NULL) {
-        memcpy(tag, page_buf + offset, sizeof(uffs_Tag));
+        memcpy(tag, page_buf + PAGE_TAG_OFFSET, sizeof(uffs_Tag));
     }
 
-    return U_SUCC;
+    return ret;
 }
 
+// return: UFFS_FLASH_NO_ERR, UFFS_FLASH_ECC_OK, UFFS_FLASH_ECC_FAIL 또는 UFFS_FLASH_IO_ERR
+// ECC 검사는 data를 요청했을 때만 수행
+int readPage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag) {
 
-URET writePage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag) {
-    static int previous_block_id = -1;
-    static int previous_page_id = -1;
+    char page_buf[PAGE_SIZE_DEFAULT];
+    off_t read_offset = block_id * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT) + page_Id * PAGE_SIZE_DEFAULT;
 
-    // fprintf(stdout, "[writePage] Called: block_id=%d, page_Id=%d\n", block_id, page_Id);
+    // 아직 checkpoint 되지 않은 헤더 페이지는 journal에서 읽음
+    if (uffs_JournalReadHeader(block_id, page_Id, mini_header, data, tag) == U_SUCC) {
+        return UFFS_FLASH_NO_ERR;
+    }
+
+    ssize_t bytes_read = disk_io->Read(fd, page_buf, sizeof(page_buf), read_offset);
+    if (bytes_read != sizeof(page_buf)) {
+        return UFFS_FLASH_IO_ERR;
+    }
+
+    return parsePage(page_buf, block_id, page_Id, mini_header, data, tag);
+}
+
+// backend가 매핑을 지원하면 readPageRef가 복사 없이 읽음
+UBOOL diskCanMap(void) {
+    return disk_io->Map != NULL ? U_TRUE : U_FALSE;
+}
+
+// block_id부터 count개 블록의 access pattern 힌트 (UFFS_IO_ADVISE_*)
+void diskAdvise(int fd, int block_id, int count, int advice) {
+    if (disk_io->Advise == NULL)
+        return;
+    disk_io->Advise(fd, (off_t)block_id * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT),
+                    (size_t)count * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT), advice);
+}
+
+// readPage와 같지만 *data에 페이지 data를 가리키는 포인터를 돌려줌
+// backend가 매핑을 지원하면 매핑 안을 바로 가리키고(복사 없음),
+// 아니면(또는 journal에 있거나 ECC 교정이 필요하면) buf에 읽어서 *data = buf
+int readPageRef(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char *buf, const char **data, uffs_Tag *tag) {
+    off_t offset = block_id * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT) + page_Id * PAGE_SIZE_DEFAULT;
+    const char *page;
+    u8 ecc[PAGE_ECC_SIZE];
+
+    *data = buf;
+    if (disk_io->Map == NULL) {
+        return readPage(fd, block_id, page_Id, mini_header, buf, tag);
+    }
+    if (uffs_JournalReadHeader(block_id, page_Id, mini_header, buf, tag) == U_SUCC) {
+        return UFFS_FLASH_NO_ERR;
+    }
+
+    page = disk_io->Map(fd, offset, PAGE_SIZE_DEFAULT);
+    if (page == NULL) {
+        return UFFS_FLASH_IO_ERR;
+    }
+
+    // 매핑은 고치지 않음. ECC가 다르면 복사해서 교정
+    if (disk_ecc_opt == UFFS_ECC_SOFT) {
+        uffs_EccMake(page + PAGE_DATA_OFFSET, PAGE_DATA_SIZE_DEFAULT, ecc);
+        if (memcmp(ecc, page + PAGE_ECC_OFFSET, PAGE_ECC_SIZE) != 0) {
+            return readPage(fd, block_id, page_Id, mini_header, buf, tag);
+        }
+    }
+
+    if (mini_header != NULL) {
+        memcpy(mini_header, page, sizeof(uffs_MiniHeader));
+    }
+    if (tag != NULL) {
+        memcpy(tag, page + PAGE_TAG_OFFSET, sizeof(uffs_Tag));
+    }
+    *data = page + PAGE_DATA_OFFSET;
+    return UFFS_FLASH_NO_ERR;
+}
 
-    // 이전에 동일한 블록과 페이지에 호출되었는지 확인
-    if (previous_block_id == block_id && previous_page_id == page_Id) {
-        // fprintf(stdout, "[writePage] Skipping redundant write for block_id=%d, page_Id=%d\n", block_id, page_Id);
+// 여러 페이지를 한 번에 읽음. backend가 ReadV를 지원하면 한꺼번에 submit 해서
+// 디바이스 queue에 같이 걸리게 함
+// 각 요청의 결과는 reqs[i].ret (readPage와 같은 값)
+// return: 모두 성공(ECC 교정 포함)이면 U_SUCC
+URET readPages(int fd, uffs_PageReq *reqs, int count) {
+    uffs_IoVec *vec;
+    char *bufs;
+    int *idx;
+    int i, n = 0;
+    URET ret = U_SUCC;
+
+    if (count <= 0)
         return U_SUCC;
+
+    vec = (uffs_IoVec *)malloc(count * sizeof(uffs_IoVec));
+    idx = (int *)malloc(count * sizeof(int));
+    bufs = (char *)malloc((size_t)count * PAGE_SIZE_DEFAULT);
+    if (vec == NULL || idx == NULL || bufs == NULL) {
+        free(vec);
+        free(idx);
+        free(bufs);
+        // 메모리가 없으면 한 페이지씩
+        for (i = 0; i < count; i++) {
+            reqs[i].ret = readPage(fd, reqs[i].block_id, reqs[i].page_Id,
+                                   reqs[i].mini_header, reqs[i].data, reqs[i].tag);
+            if (IS_FAIL(reqs[i].ret))
+                ret = U_FAIL;
+        }
+        return ret;
     }
 
-    // 이전 블록과 페이지 업데이트
-    previous_block_id = block_id;
-    previous_page_id = page_Id;
+    for (i = 0; i < count; i++) {
+        if (uffs_JournalReadHeader(reqs[i].block_id, reqs[i].page_Id,
+                                   reqs[i].mini_header, reqs[i].data, reqs[i].tag) == U_SUCC) {
+            reqs[i].ret = UFFS_FLASH_NO_ERR;
+            continue;
+        }
+        vec[n].buf = bufs + (size_t)n * PAGE_SIZE_DEFAULT;
+        vec[n].len = PAGE_SIZE_DEFAULT;
+        vec[n].offset = (off_t)reqs[i].block_id * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT) +
+                        reqs[i].page_Id * PAGE_SIZE_DEFAULT;
+        vec[n].res = 0;
+        idx[n++] = i;
+    }
+
+    if (n > 0) {
+        if (disk_io->ReadV != NULL) {
+            disk_io->ReadV(fd, vec, n);
+        }
+        else {
+            for (i = 0; i < n; i++)
+                vec[i].res = disk_io->Read(fd, vec[i].buf, vec[i].len, vec[i].offset);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        uffs_PageReq *r = &reqs[idx[i]];
+
+        if (vec[i].res != PAGE_SIZE_DEFAULT)
+            r->ret = UFFS_FLASH_IO_ERR;
+        else
+            r->ret = parsePage(vec[i].buf, r->block_id, r->page_Id, r->mini_header, r->data, r->tag);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (IS_FAIL(reqs[i].ret))
+            ret = U_FAIL;
+    }
+
+    free(vec);
+    free(idx);
+    free(bufs);
+    return ret;
+}
+
+URET writePage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag) {
+    // fprintf(stdout, "[writePage] Called: block_id=%d, page_Id=%d\n", block_id, page_Id);
+
+    // discard 하려던 블록이면 queue에서 뺌
+    uffs_DiscardCancel(block_id);
 
     // 페이지 버퍼 초기화
     char page_buf[PAGE_SIZE_DEFAULT];
@@ -189,11 +465,17 @@ URET writePage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header,
         return U_FAIL;
     }
 
+    // ECC 계산 후 spare에 기록 (사용하지 않는 영역은 0xFF)
+    memset(page_buf + PAGE_ECC_OFFSET, 0xFF, PAGE_ECC_SIZE_DEFAULT);
+    if (disk_ecc_opt == UFFS_ECC_SOFT) {
+        uffs_EccMake(page_buf + PAGE_DATA_OFFSET, PAGE_DATA_SIZE_DEFAULT, page_buf + PAGE_ECC_OFFSET);
+    }
+
     // pwrite 호출: 블록과 페이지에 따른 오프셋 계산
     off_t file_offset = block_id * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT) +
                         page_Id * PAGE_SIZE_DEFAULT;
 
-    ssize_t written = pwrite(fd, page_buf, sizeof(page_buf), file_offset);
+    ssize_t written = disk_io->Write(fd, page_buf, sizeof(page_buf), file_offset);
     if (written != sizeof(page_buf)) {
         // fprintf(stderr, "[writePage] Error: Failed to write full page (expected: %zu, written: %zd)\n", sizeof(page_buf), written);
         return U_FAIL;
@@ -203,7 +485,7 @@ URET writePage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header,
 
     // 데이터 검증
     char verify_buf[PAGE_SIZE_DEFAULT];
-    ssize_t read_bytes = pread(fd, verify_buf, sizeof(page_buf), file_offset);
+    ssize_t read_bytes = disk_io->Read(fd, verify_buf, sizeof(page_buf), file_offset);
     if (read_bytes != sizeof(page_buf)) {
         fprintf(stderr, "[writePage] Error: Failed to read back full page (expected: %zu, read: %zd)\n", sizeof(page_buf), read_bytes);
         return U_FAIL;
@@ -218,34 +500,192 @@ URET writePage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header,
     return U_SUCC;
 }
 
+// 한 블록 안의 연속된 count개 페이지를 한 번의 write로 씀 (verify read 없음)
+// mini_header, tags는 페이지마다 하나씩, data는 count * PAGE_DATA_SIZE_DEFAULT
+// sync: 쓰고 나서 디바이스까지 내림. backend가 지원하면 write와 sync를 묶어 한 번에 submit
+static URET _WritePages(int fd, int block_id, int page_Id, int count, uffs_MiniHeader *mini_header, char *data, uffs_Tag *tags, UBOOL sync) {
+    char *buf, *page_buf;
+    size_t len = (size_t)count * PAGE_SIZE_DEFAULT;
+    off_t file_offset = block_id * (PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT) +
+                        page_Id * PAGE_SIZE_DEFAULT;
+    ssize_t written;
+    int i;
 
+    if (count <= 0 || page_Id + count > PAGES_PER_BLOCK_DEFAULT || mini_header == NULL || tags == NULL) {
+        fprintf(stderr, "[writePages] invalid request - block %d, page %d, count %d\n", block_id, page_Id, count);
+        return U_FAIL;
+    }
 
+    buf = (char *)malloc(len);
+    if (buf == NULL)
+        return U_FAIL;
+    memset(buf, 0, len);
+
+    for (i = 0; i < count; i++) {
+        page_buf = buf + (size_t)i * PAGE_SIZE_DEFAULT;
+        memcpy(page_buf, &mini_header[i], sizeof(uffs_MiniHeader));
+        if (data != NULL)
+            memcpy(page_buf + PAGE_DATA_OFFSET, data + (size_t)i * PAGE_DATA_SIZE_DEFAULT, PAGE_DATA_SIZE_DEFAULT);
+        memcpy(page_buf + PAGE_TAG_OFFSET, &tags[i], sizeof(uffs_Tag));
+        memset(page_buf + PAGE_ECC_OFFSET, 0xFF, PAGE_ECC_SIZE_DEFAULT);
+        if (disk_ecc_opt == UFFS_ECC_SOFT) {
+            uffs_EccMake(page_buf + PAGE_DATA_OFFSET, PAGE_DATA_SIZE_DEFAULT, page_buf + PAGE_ECC_OFFSET);
+        }
+    }
 
-URET getFileInfoBySerial(int fd, u32 serial, uffs_FileInfo *file_info, u32 *out_len) {
-    uffs_Tag tag = {0};
-    for (int block = 0; block < TOTAL_BLOCKS_DEFAULT; block++) {
-        if (readPage(fd, block, 0, NULL, (char *)file_info, &tag) == U_SUCC) {
-            if (tag.s.serial == serial) {
-                // 여기서 tag.s.data_len이 파일 길이
-                if (out_len) {
-                    *out_len = tag.s.data_len;
-                }
-                return U_SUCC;
-            }
+    if (sync && disk_io->WriteSync != NULL) {
+        written = disk_io->WriteSync(fd, buf, len, file_offset);
+    }
+    else {
+        written = disk_io->Write(fd, buf, len, file_offset);
+        if (sync && written == (ssize_t)len && disk_io->Sync(fd) < 0)
+            written = -1;
+    }
+    free(buf);
+
+    if (written != (ssize_t)len) {
+        fprintf(stderr, "[writePages] write error - block %d, page %d, count %d\n", block_id, page_Id, count);
+        return U_FAIL;
+    }
+    return U_SUCC;
+}
+
+URET writePages(int fd, int block_id, int page_Id, int count, uffs_MiniHeader *mini_header, char *data, uffs_Tag *tags, UBOOL sync) {
+    // discard 하려던 블록이면 queue에서 뺌
+    uffs_DiscardCancel(block_id);
+    return _WritePages(fd, block_id, page_Id, count, mini_header, data, tags, sync);
+}
+
+// format 직후의 빈 페이지 (diskFormat과 같은 tag)
+static void _ErasedPage(int block_id, int page, uffs_MiniHeader *mini_header, uffs_Tag *tag) {
+    memset(tag, 0, sizeof(uffs_Tag));
+    mini_header->status = 0xFF;
+    mini_header->reserved = 0x00;
+    mini_header->crc = (u16)(block_id + page);
+    tag->s.dirty = 1;
+    tag->s.serial = block_id;
+    tag->s.page_id = page;
+    tag->s.tag_ecc = TAG_ECC_DEFAULT;
+}
+
+// 블록 전체를 빈 페이지로 씀 (discard queue는 건드리지 않음)
+static URET _EraseBlock(int fd, int block_id) {
+    uffs_MiniHeader mini_headers[PAGES_PER_BLOCK_DEFAULT];
+    uffs_Tag tags[PAGES_PER_BLOCK_DEFAULT];
+
+    for (int page = 0; page < PAGES_PER_BLOCK_DEFAULT; page++) {
+        _ErasedPage(block_id, page, &mini_headers[page], &tags[page]);
+    }
+    return _WritePages(fd, block_id, 0, PAGES_PER_BLOCK_DEFAULT, mini_headers, NULL, tags, U_FALSE);
+}
+
+// 블록 하나를 format 직후 상태로 되돌림 (모든 페이지 status 0xFF, tag는 diskFormat과 같음)
+// discard mount면 나중에 디바이스에도 discard 함
+URET eraseBlock(int fd, int block_id) {
+    if (block_id <= UFFS_JOURNAL_BLOCK || block_id >= TOTAL_BLOCKS_DEFAULT) {
+        fprintf(stderr, "[eraseBlock] invalid block %d\n", block_id);
+        return U_FAIL;
+    }
+
+    uffs_DiscardCancel(block_id);
+    if (_EraseBlock(fd, block_id) == U_FAIL) {
+        return U_FAIL;
+    }
+    uffs_DiscardQueue(block_id);
+    return U_SUCC;
+}
+
+UBOOL diskCanDiscard(void) {
+    return disk_io->Discard != NULL ? U_TRUE : U_FALSE;
+}
+
+// 이어지는 빈 블록 [block_id, block_id + count)를 디바이스에서 discard
+// 범위는 UFFS_DISCARD_ALIGN 단위로 안쪽으로 자르고, 블록마다 page 0을 discard 된 빈 블록 표시로 다시 씀
+// 표시를 다시 쓰기 전에 끊기면 page 0은 0(이미지 파일의 hole)으로 남는데, getFreeBlock은
+// 종류가 없는 page 0도 discard 된 빈 블록으로 보므로 블록이 새지 않음
+URET diskDiscard(int fd, int block_id, int count) {
+    off_t block_bytes = (off_t)PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT;
+    off_t start = (off_t)block_id * block_bytes;
+    off_t end = start + (off_t)count * block_bytes;
+    uffs_MiniHeader mini_header;
+    uffs_Tag tag;
+    URET ret = U_SUCC;
+
+    if (disk_io->Discard == NULL || block_id <= UFFS_JOURNAL_BLOCK || block_id + count > TOTAL_BLOCKS_DEFAULT) {
+        return U_FAIL;
+    }
+
+    start = (start + UFFS_DISCARD_ALIGN - 1) / UFFS_DISCARD_ALIGN * UFFS_DISCARD_ALIGN;
+    end = end / UFFS_DISCARD_ALIGN * UFFS_DISCARD_ALIGN;
+    if (end <= start) {
+        return U_SUCC;
+    }
+
+    // backend에 남아 있는 write가 discard 뒤에 덮어쓰지 않게 먼저 내림
+    if (disk_io->Sync(fd) < 0 || disk_io->Discard(fd, start, end - start) < 0) {
+        fprintf(stderr, "[diskDiscard] discard error - block %d, count %d\n", block_id, count);
+        ret = U_FAIL;
+    }
+
+    // discard가 실패했어도 page 0을 건드렸을 수 있으니 표시는 다시 씀
+    for (int block = block_id; block < block_id + count; block++) {
+        _ErasedPage(block, 0, &mini_header, &tag);
+        mini_header.reserved = MINI_HEADER_TRIMMED;
+        if (_WritePages(fd, block, 0, 1, &mini_header, NULL, &tag, U_FALSE) == U_FAIL) {
+            ret = U_FAIL;
         }
     }
-    return U_FAIL;
+    return ret;
+}
+
+// hdr(HDR_ADDR) 위치의 헤더 페이지 읽기, out_len: tag의 파일 길이
+URET getFileInfoByHeader(int fd, u16 hdr, uffs_FileInfo *file_info, u32 *out_len) {
+    uffs_Tag tag = {0};
+
+    if (IS_FAIL(readPage(fd, HDR_BLOCK(hdr), HDR_PAGE(hdr), NULL, (char *)file_info, &tag))) {
+        return U_FAIL;
+    }
+    if (tag.s.type != UFFS_TYPE_DIR && tag.s.type != UFFS_TYPE_FILE) {
+        return U_FAIL;
+    }
+    if (out_len) {
+        *out_len = tag.s.data_len;
+    }
+    return U_SUCC;
+}
+
+// page 0으로 본 빈 블록: status 0xFF, 또는 tag에 블록 종류가 없음
+// (discard 하다 끊겨 page 0이 0으로 남은 블록. 쓰고 있는 블록의 page 0은 늘 DIR/FILE/DATA tag)
+static UBOOL _IsFreeBlock(const uffs_MiniHeader *mini_header, const uffs_Tag *tag) {
+    return (mini_header->status == 0xFF || tag->s.type == UFFS_TYPE_RESV) ? U_TRUE : U_FALSE;
 }
 
 // 빈 블록 찾기
 URET getFreeBlock(int fd, int *free_block_id, u16 *serial) {
-    // 여기서는 2번 블록부터 free라고 가정 (0:마법,1:root)
-    for (int i=2;i<TOTAL_BLOCKS_DEFAULT;i++){
+    // journal 블록 다음부터 free라고 가정 (0:마법,1:root,2:journal)
+    for (int i=UFFS_JOURNAL_BLOCK+1;i<TOTAL_BLOCKS_DEFAULT;i++){
         // mini_header의 status로 해당 블록 사용중인지 확인
         uffs_MiniHeader mini_header={0};
         uffs_Tag tag;
-        if (readPage(fd,i,0,&mini_header,NULL,&tag)==U_SUCC) {
-            if (mini_header.status == 0xFF) {
+        // 헤더를 받기로 한 metadata 블록은 아직 page 0이 비어 있어도 건너뜀
+        if (meta_free[i] != META_NOT_META) {
+            continue;
+        }
+        if (IS_SUCC(readPage(fd,i,0,&mini_header,NULL,&tag))) {
+            if (_IsFreeBlock(&mini_header, &tag)) {
+                // discard 중이면 끝날 때까지 기다린 뒤 page 0을 다시 봄
+                uffs_DiscardCancel(i);
+                if (IS_FAIL(readPage(fd,i,0,&mini_header,NULL,&tag)) || !_IsFreeBlock(&mini_header, &tag)) {
+                    continue;
+                }
+                // discard 된 블록은 나머지 페이지 내용을 알 수 없으므로 빈 페이지로 채워서 줌
+                if ((mini_header.reserved & MINI_HEADER_TRIMMED) || mini_header.status != 0xFF) {
+                    if (_EraseBlock(fd, i) == U_FAIL) {
+                        continue;
+                    }
+                    uffs_DiscardRestored();
+                    tag.s.serial = i;
+                }
                 *free_block_id = i;
                 *serial = tag.s.serial;
                 return U_SUCC;
@@ -253,4 +693,70 @@ URET getFreeBlock(int fd, int *free_block_id, u16 *serial) {
         }
     }
     return U_FAIL;
+}
+
+// 파일/디렉토리 헤더 페이지 하나 할당
+// 이미 있는 metadata 블록의 빈 페이지를 먼저 쓰고, 없으면 빈 블록 하나를 metadata 블록으로 만듦
+URET getFreeHeaderPage(int fd, int *block_id, int *page_Id) {
+    int block, page;
+    u16 serial;
+
+    pthread_mutex_lock(&meta_lock);
+
+    for (block = 1; block < TOTAL_BLOCKS_DEFAULT; block++) {
+        if (meta_free[block] != META_NOT_META && meta_free[block] != 0) {
+            page = __builtin_ctz(meta_free[block]);
+            meta_free[block] &= ~(1U << page);
+            pthread_mutex_unlock(&meta_lock);
+            *block_id = block;
+            *page_Id = page;
+            return U_SUCC;
+        }
+    }
+
+    if (getFreeBlock(fd, &block, &serial) == U_FAIL) {
+        pthread_mutex_unlock(&meta_lock);
+        return U_FAIL;
+    }
+    // page 0은 지금 주고 나머지는 빈 자리
+    meta_free[block] = ~1U;
+
+    pthread_mutex_unlock(&meta_lock);
+    *block_id = block;
+    *page_Id = 0;
+    return U_SUCC;
+}
+
+// 지운 헤더 페이지를 다시 쓸 수 있게 돌려줌
+// page 0은 블록을 metadata 블록으로 표시하는 tombstone이 남으므로 다시 주지 않음
+void diskMetaFreePage(int block_id, int page_Id) {
+    if (block_id <= 0 || block_id >= TOTAL_BLOCKS_DEFAULT || page_Id <= 0 || page_Id >= PAGES_PER_BLOCK_DEFAULT) {
+        return;
+    }
+    pthread_mutex_lock(&meta_lock);
+    if (meta_free[block_id] != META_NOT_META) {
+        meta_free[block_id] |= 1U << page_Id;
+    }
+    pthread_mutex_unlock(&meta_lock);
+}
+
+// 지운 헤더 페이지의 내용: page 0은 tombstone(status DEAD, tag type은 FILE), 나머지는 빈 페이지
+void diskDeadHeaderPage(int block_id, int page_Id, uffs_MiniHeader *mini_header, uffs_Tag *tag) {
+    _ErasedPage(block_id, page_Id, mini_header, tag);
+    if (page_Id == 0) {
+        mini_header->status = MINI_HEADER_STATUS_DEAD;
+        mini_header->crc = 0xFFFF;
+        tag->s.type = UFFS_TYPE_FILE;
+        tag->s.serial = 0;
+    }
+}
+
+// mount scan에서 찾은 metadata 블록 등록, free_pages: 빈 페이지 bitmap
+void diskMetaAddBlock(int block_id, u32 free_pages) {
+    if (block_id <= 0 || block_id >= TOTAL_BLOCKS_DEFAULT || block_id == UFFS_JOURNAL_BLOCK) {
+        return;
+    }
+    pthread_mutex_lock(&meta_lock);
+    meta_free[block_id] = free_pages;
+    pthread_mutex_unlock(&meta_lock);
 }
\ No newline at end of file
@@ -8,6 +8,18 @@
 #include <errno.h>
 
 #define MAGIC "UFFS" // must 4 char
+/**
+ * 디스크 레이아웃 버전. 예전 이미지를 잘못 읽지 않도록 형식이 바뀔 때마다 올림
+ *  2: spare에 ECC 영역 추가
+ *  3: journal 블록
+ *  4: 작은 파일 data를 헤더 페이지에 inline으로 둠 (#FILE_ATTR_INLINE)
+ *  5: 헤더 페이지를 metadata 블록의 page 1~31에도 둠
+ *  6: 압축 파일의 chunk index (#FILE_ATTR_COMPRESS)
+ *  7: dedup 블록의 참조 수를 page 0 tag의 data_sum에 둠 (#FILE_ATTR_DEDUP)
+ *  8: 파일 블록 단위 block map과 hole (#FILE_ATTR_BLOCKMAP)
+ *  9: 지운 헤더의 page 0 tombstone (#MINI_HEADER_STATUS_DEAD)
+ */
+#define UFFS_DISK_VERSION	9
 
 /** ECC options (uffs_StorageAttrSt.ecc_opt) */
 #define UFFS_ECC_NONE		0	//!< do not use ECC
@@ -15,17 +27,42 @@
 #define UFFS_ECC_HW			2	//!< Flash driver(or by hardware) calculate the ECC
 #define UFFS_ECC_HW_AUTO	3	//!< Hardware calculate the ECC and automatically write to spare.
 
+/** flash operation return code (readPage) */
+#define UFFS_FLASH_NO_ERR		0		//!< no error
+#define UFFS_FLASH_ECC_OK		1		//!< bit-flip found, but corrected by ECC
+#define UFFS_FLASH_IO_ERR		-1		//!< I/O error
+#define UFFS_FLASH_ECC_FAIL		-2		//!< ECC failed
+
+/** diskFormatCheck return code */
+#define UFFS_DISK_OK			0		//!< 마운트 가능
+#define UFFS_DISK_NOT_UFFS		-1		//!< magic이 없음 (format 해도 되는 디바이스)
+#define UFFS_DISK_BAD_VERSION	-2		//!< 다른 레이아웃 버전의 이미지
+#define UFFS_DISK_BAD_SB		-3		//!< uffs 이미지지만 superblock을 읽지 못함 (I/O, ECC)
+
 /* default basic parameters of the NAND device */
 #define PAGES_PER_BLOCK_DEFAULT			32
 #define PAGE_DATA_SIZE_DEFAULT			512
 #define PAGE_SPARE_SIZE_DEFAULT			16
-#define PAGE_SIZE_DEFAULT               528
+#define PAGE_ECC_SIZE_DEFAULT			16	// spare에서 page data ECC가 차지하는 영역
+#define PAGE_SIZE_DEFAULT               544	// mini header(4) + data(512) + tag(12) + ecc(16)
 #define STATUS_BYTE_OFFSET_DEFAULT		5
 #define TOTAL_BLOCKS_DEFAULT			128
 #define ECC_OPTION_DEFAULT				UFFS_ECC_SOFT
+#define UFFS_JOURNAL_BLOCK				2	// metadata journal ring으로 예약된 블록
 
 #define MAX_FILENAME_LENGTH PAGE_DATA_SIZE_DEFAULT - 24
 
+/**
+ * 헤더 페이지 주소. file/dir 헤더는 metadata 블록의 아무 페이지에나 있을 수 있어서
+ * (블록, 페이지)를 u16 하나로 묶어 TreeNode에 둠
+ */
+#define HDR_ADDR(block, page)   ((block) * PAGES_PER_BLOCK_DEFAULT + (page))
+#define HDR_BLOCK(addr)         ((addr) / PAGES_PER_BLOCK_DEFAULT)
+#define HDR_PAGE(addr)          ((addr) % PAGES_PER_BLOCK_DEFAULT)
+
+/** file/dir serial 범위. tag의 parent가 10 bits라 그 안에서만 씀 */
+#define MAX_OBJECT_SERIAL   ((1 << 10) - 1)
+
 #define UFFS_TYPE_DIR		1
 #define UFFS_TYPE_FILE		2
 #define UFFS_TYPE_DATA		3
@@ -41,6 +78,15 @@
 /** \note 8-bits attr goes to uffs_dirent::d_type */
 #define FILE_ATTR_DIR       (1 << 7)    //!< attribute for directory
 #define FILE_ATTR_WRITE     (1 << 0)    //!< writable
+#define FILE_ATTR_INLINE    (1 << 1)    //!< file data가 헤더 페이지의 name 뒤에 있음 (data 블록 없음)
+#define FILE_ATTR_COMPRESS  (1 << 2)    //!< data 블록이 chunk 단위로 압축됨, name 뒤에 chunk index
+#define FILE_ATTR_DEDUP     (1 << 3)    //!< data 블록을 다른 파일과 공유할 수 있음, name 뒤에 블록 번호와 길이
+#define FILE_ATTR_BLOCKMAP  (1 << 4)    //!< data 블록이 파일 블록 단위로 나뉨 (hole 가능), name 뒤에 u32 파일 길이
+
+/** 작은 파일 data는 헤더 페이지의 name[] 중 name 뒤(NULL 다음)에 둠 */
+#define UFFS_INLINE_DATA(info)          ((info)->name + (info)->name_len + 1)
+/** 이름이 name_len일 때 inline으로 둘 수 있는 최대 길이, 넘으면 data 블록으로 */
+#define UFFS_INLINE_LIMIT(name_len)     ((int)MAX_FILENAME_LENGTH - (int)(name_len) - 1)
 /**
  * \struct uffs_TagStoreSt
  * \brief uffs tag, 8 bytes, will be store in page spare area.
@@ -88,6 +134,12 @@ struct uffs_MiniHeaderSt {
 };
 typedef struct uffs_MiniHeaderSt uffs_MiniHeader;
 
+/** 빈 블록 page 0의 reserved: 블록이 discard 돼서 나머지 페이지 내용을 알 수 없음 (다시 쓰기 전에 채움) */
+#define MINI_HEADER_TRIMMED     (1 << 0)
+
+/** 지워진 헤더가 page 0에 남기는 status: 블록은 계속 metadata 블록이지만 헤더는 없음 */
+#define MINI_HEADER_STATUS_DEAD 0x00
+
 
 /**
  * \structure uffs_FileInfoSt
@@ -115,10 +167,52 @@ typedef struct uffs_ObjectInfoSt {
     u16 serial;             //!< object serial num
 } uffs_ObjectInfo;
 
-URET diskFormatCheck(int fd);
+/**
+ * \struct uffs_SuperBlockSt
+ * \brief 0번 블록 0번 페이지에 기록되는 디스크 정보
+ */
+struct uffs_SuperBlockSt {
+    char magic[4];          //!< #MAGIC
+    u8 version;             //!< #UFFS_DISK_VERSION
+    u8 ecc_opt;             //!< #UFFS_ECC_NONE or #UFFS_ECC_SOFT
+    u16 reserved;
+};
+typedef struct uffs_SuperBlockSt uffs_SuperBlock;
+
+/**
+ * \struct uffs_PageReqSt
+ * \brief readPages 요청 한 건, 필요 없는 영역은 NULL
+ */
+struct uffs_PageReqSt {
+    int block_id;
+    int page_Id;
+    uffs_MiniHeader *mini_header;
+    char *data;
+    uffs_Tag *tag;
+    int ret;                //!< readPage와 같은 return code
+};
+typedef struct uffs_PageReqSt uffs_PageReq;
+
+int diskOpen(const char *path, const char *io_name);
+URET diskSync(int fd);
+URET diskWriteback(int fd);
+void diskClose(int fd);
+int diskFormatCheck(int fd);
 URET diskFormat(int fd);
-URET readPage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag);
+int readPage(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag);
 URET writePage(int fd,int block_id,int page_Id, uffs_MiniHeader* mini_header, char* data, uffs_Tag *tag);
-URET getFileInfoBySerial(int fd, u32 serial, uffs_FileInfo *file_info, u32 *out_len);
+URET readPages(int fd, uffs_PageReq *reqs, int count);
+int readPageRef(int fd, int block_id, int page_Id, uffs_MiniHeader* mini_header, char *buf, const char **data, uffs_Tag *tag);
+UBOOL diskCanMap(void);
+void diskAdvise(int fd, int block_id, int count, int advice);
+URET writePages(int fd, int block_id, int page_Id, int count, uffs_MiniHeader *mini_header, char *data, uffs_Tag *tags, UBOOL sync);
+URET eraseBlock(int fd, int block_id);
+UBOOL diskCanDiscard(void);
+URET diskDiscard(int fd, int block_id, int count);
+URET getFileInfoByHeader(int fd, u16 hdr, uffs_FileInfo *file_info, u32 *out_len);
 URET getFreeBlock(int fd, int *freeBlockId, u16 *serial);
+void diskMetaAddBlock(int block_id, u32 free_pages);
+void diskMetaFreePage(int block_id, int page_Id);
+void diskDeadHeaderPage(int block_id, int page_Id, uffs_MiniHeader *mini_header, uffs_Tag *tag);
+URET getFreeHeaderPage(int fd, int *block_id, int *page_Id);
 #endif
\ No newline at end of file
@@ -0,0 +1,161 @@
+/**
+ * \file uffs_ecc.c
+ * \brief software ECC (Hamming code, 256 bytes per chunk) for page data
+ *
+ * 256바이트 chunk의 각 비트 주소(11 bits: word index 5 + word 내 위치 6)마다
+ * "주소 비트가 1인 비트들의 parity"(P1)와 "0인 비트들의 parity"(P0)를 구해
+ * 22비트 코드를 만든다. 1비트 오류는 교정, 2비트 오류는 검출한다.
+ *
+ * parity는 64비트 word 단위로 한 번에 계산한다:
+ *  - word index 비트 k가 1인 word들을 XOR 해두고 (rp[k]) 마지막에 parity 1번
+ *  - 전체 word XOR(all)에 위치 mask를 씌워 word 내 위치 비트의 parity를 구함
+ */
+
+#include "uffs_ecc.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#define ECC_WORDS_PER_CHUNK		(UFFS_ECC_CHUNK_SIZE / sizeof(uint64_t))
+#define ECC_CODE_MASK			0x3fffff	//!< 11쌍의 (P0, P1) = 22 bits
+#define ECC_PAIR_MASK			0x155555	//!< 각 쌍의 P0 위치
+
+/** word 내 위치(0~63)의 비트 k가 1인 자리 */
+static const uint64_t ECC_POS_MASK[6] = {
+	0xAAAAAAAAAAAAAAAAULL,
+	0xCCCCCCCCCCCCCCCCULL,
+	0xF0F0F0F0F0F0F0F0ULL,
+	0xFF00FF00FF00FF00ULL,
+	0xFFFF0000FFFF0000ULL,
+	0xFFFFFFFF00000000ULL,
+};
+
+static u32 _EccChunkCode(const u8 *p)
+{
+	uint64_t w, all = 0;
+	uint64_t rp[5] = {0};
+	u32 code = 0;
+	u32 total, p1;
+	unsigned int i;
+	int k;
+
+	for (i = 0; i < ECC_WORDS_PER_CHUNK; i++) {
+		memcpy(&w, p + i * sizeof(uint64_t), sizeof(uint64_t));
+		w = le64toh(w);
+		all ^= w;
+		rp[0] ^= w & -(uint64_t)(i & 1);
+		rp[1] ^= w & -(uint64_t)((i >> 1) & 1);
+		rp[2] ^= w & -(uint64_t)((i >> 2) & 1);
+		rp[3] ^= w & -(uint64_t)((i >> 3) & 1);
+		rp[4] ^= w & -(uint64_t)((i >> 4) & 1);
+	}
+
+	total = __builtin_parityll(all);
+
+	// 주소 비트 0~5: word 내 비트 위치
+	for (k = 0; k < 6; k++) {
+		p1 = __builtin_parityll(all & ECC_POS_MASK[k]);
+		code |= ((total ^ p1) << (2 * k)) | (p1 << (2 * k + 1));
+	}
+	// 주소 비트 6~10: word index
+	for (k = 0; k < 5; k++) {
+		p1 = __builtin_parityll(rp[k]);
+		code |= ((total ^ p1) << (2 * (k + 6))) | (p1 << (2 * (k + 6) + 1));
+	}
+
+	// 반전해서 저장 -> 지워진(0xFF) 페이지의 ECC도 0xFF
+	return ~code & ECC_CODE_MASK;
+}
+
+static void _EccStore(u32 code, u8 *ecc)
+{
+	ecc[0] = code & 0xFF;
+	ecc[1] = (code >> 8) & 0xFF;
+	ecc[2] = ((code >> 16) & 0x3F) | 0xC0;
+}
+
+static u32 _EccLoad(const u8 *ecc)
+{
+	return (ecc[0] | (ecc[1] << 8) | (ecc[2] << 16)) & ECC_CODE_MASK;
+}
+
+/**
+ * \brief make ECC for page data
+ * \param[in] data page data
+ * \param[in] data_len length of data, 마지막 chunk가 모자라면 0xFF로 채운 것으로 계산
+ * \param[out] ecc ECC output, #UFFS_ECC_SIZE(data_len) bytes
+ */
+void uffs_EccMake(const void *data, int data_len, void *ecc)
+{
+	const u8 *p = (const u8 *)data;
+	u8 *out = (u8 *)ecc;
+	u8 chunk[UFFS_ECC_CHUNK_SIZE];
+	int len;
+
+	while (data_len > 0) {
+		len = data_len < UFFS_ECC_CHUNK_SIZE ? data_len : UFFS_ECC_CHUNK_SIZE;
+		if (len < UFFS_ECC_CHUNK_SIZE) {
+			memset(chunk, 0xFF, sizeof(chunk));
+			memcpy(chunk, p, len);
+			_EccStore(_EccChunkCode(chunk), out);
+		}
+		else {
+			_EccStore(_EccChunkCode(p), out);
+		}
+		p += len;
+		data_len -= len;
+		out += UFFS_ECC_CHUNK_BYTES;
+	}
+}
+
+/**
+ * \brief correct page data with ECC
+ * \param[in,out] data page data read from disk, 1비트 오류는 그 자리에서 교정됨
+ * \param[in] data_len length of data
+ * \param[in,out] read_ecc ECC read from spare, ECC 자체가 깨졌으면 test_ecc로 덮어씀
+ * \param[in] test_ecc ECC calculated from data
+ * \return 0: no error, > 0: number of corrected bit flips, -1: uncorrectable
+ */
+int uffs_EccCorrect(void *data, int data_len, void *read_ecc, const void *test_ecc)
+{
+	u8 *p = (u8 *)data;
+	u8 *r = (u8 *)read_ecc;
+	const u8 *t = (const u8 *)test_ecc;
+	int len, k, corrected = 0;
+	u32 s, addr, byte;
+
+	while (data_len > 0) {
+		len = data_len < UFFS_ECC_CHUNK_SIZE ? data_len : UFFS_ECC_CHUNK_SIZE;
+		s = _EccLoad(r) ^ _EccLoad(t);
+
+		if (s != 0) {
+			if (((s ^ (s >> 1)) & ECC_PAIR_MASK) == ECC_PAIR_MASK) {
+				// 1비트 오류: P1 비트들이 곧 오류 비트의 주소
+				addr = 0;
+				for (k = 0; k < 11; k++)
+					addr |= ((s >> (2 * k + 1)) & 1) << k;
+				byte = (addr >> 6) * sizeof(uint64_t) + ((addr & 63) >> 3);
+				if (byte >= (u32)len)
+					return -1;
+				p[byte] ^= 1 << (addr & 7);
+				corrected++;
+			}
+			else if (__builtin_popcount(s) == 1) {
+				// 데이터는 멀쩡하고 ECC 한 비트가 뒤집힘
+				memcpy(r, t, UFFS_ECC_CHUNK_BYTES);
+				corrected++;
+			}
+			else {
+				return -1;
+			}
+		}
+
+		p += len;
+		data_len -= len;
+		r += UFFS_ECC_CHUNK_BYTES;
+		t += UFFS_ECC_CHUNK_BYTES;
+	}
+
+	return corrected;
+}
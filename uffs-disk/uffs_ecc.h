@@ -0,0 +1,21 @@
+/**
+ * \file uffs_ecc.h
+ * \brief software ECC (Hamming code, 256 bytes per chunk) for page data
+ */
+
+#ifndef _UFFS_ECC_H_
+#define _UFFS_ECC_H_
+
+#include "uffs_types.h"
+
+#define UFFS_ECC_CHUNK_SIZE		256		//!< 한 번에 ECC를 계산하는 데이터 단위
+#define UFFS_ECC_CHUNK_BYTES	3		//!< chunk 하나당 ECC 크기 (22 bits)
+
+/** data_len 바이트 데이터에 필요한 ECC 크기 */
+#define UFFS_ECC_SIZE(data_len)	\
+			((((data_len) + UFFS_ECC_CHUNK_SIZE - 1) / UFFS_ECC_CHUNK_SIZE) * UFFS_ECC_CHUNK_BYTES)
+
+void uffs_EccMake(const void *data, int data_len, void *ecc);
+int uffs_EccCorrect(void *data, int data_len, void *read_ecc, const void *test_ecc);
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * \file uffs_io.c
+ * \brief default (page cache) backend and backend lookup
+ */
+
+#define _GNU_SOURCE
+
+#include "uffs_io.h"
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int posix_Open(const char *path)
+{
+	return open(path, O_RDWR, 0666);
+}
+
+static ssize_t posix_Read(int fd, void *buf, size_t len, off_t offset)
+{
+	return pread(fd, buf, len, offset);
+}
+
+static ssize_t posix_Write(int fd, const void *buf, size_t len, off_t offset)
+{
+	return pwrite(fd, buf, len, offset);
+}
+
+static int posix_Sync(int fd)
+{
+	return fdatasync(fd);
+}
+
+/**
+ * \brief page cache의 dirty page를 모두 디바이스에 쓰고 끝날 때까지 기다림
+ *        (fdatasync와 달리 디바이스 cache flush는 하지 않음, page cache를 쓰는 backend가 같이 씀)
+ * \return 0 or -1
+ */
+int uffs_IoWriteback(int fd)
+{
+	return sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+						   SYNC_FILE_RANGE_WAIT_AFTER);
+}
+
+static void posix_Advise(int fd, off_t offset, size_t len, int advice)
+{
+	int fadv = POSIX_FADV_NORMAL;
+
+	if (advice == UFFS_IO_ADVISE_SEQUENTIAL)
+		fadv = POSIX_FADV_SEQUENTIAL;
+	else if (advice == UFFS_IO_ADVISE_RANDOM)
+		fadv = POSIX_FADV_RANDOM;
+	posix_fadvise(fd, offset, len, fadv);
+}
+
+/**
+ * \brief block device는 BLKDISCARD, 이미지 파일은 hole을 뚫음 (모든 backend가 같이 씀)
+ * \return 0 or -1
+ */
+int uffs_IoDiscard(int fd, off_t offset, size_t len)
+{
+	struct stat st;
+	uint64_t range[2];
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+	if (S_ISBLK(st.st_mode)) {
+		range[0] = offset;
+		range[1] = len;
+		return ioctl(fd, BLKDISCARD, &range);
+	}
+	return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len);
+}
+
+static void posix_Close(int fd)
+{
+	close(fd);
+}
+
+const uffs_IoOps uffs_IoPosixOps = {
+	.name	= "posix",
+	.Open	= posix_Open,
+	.Read	= posix_Read,
+	.Write	= posix_Write,
+	.Sync	= posix_Sync,
+	.Writeback	= uffs_IoWriteback,
+	.Advise	= posix_Advise,
+	.Discard	= uffs_IoDiscard,
+	.Close	= posix_Close,
+};
+
+static const uffs_IoOps *io_backends[] = {
+	&uffs_IoPosixOps,
+	&uffs_IoDirectOps,
+	&uffs_IoUringOps,
+	&uffs_IoMmapOps,
+};
+
+/**
+ * \brief find backend by name
+ * \return NULL if not found
+ */
+const uffs_IoOps * uffs_IoFind(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(io_backends) / sizeof(io_backends[0]); i++) {
+		if (strcmp(io_backends[i]->name, name) == 0)
+			return io_backends[i];
+	}
+	return NULL;
+}
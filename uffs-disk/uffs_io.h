@@ -0,0 +1,79 @@
+/**
+ * \file uffs_io.h
+ * \brief disk I/O backend (readPage/writePage 아래에서 실제 디바이스를 다루는 부분)
+ */
+
+#ifndef _UFFS_IO_H_
+#define _UFFS_IO_H_
+
+#include <sys/types.h>
+#include "uffs_types.h"
+
+#define UFFS_IO_ADVISE_NORMAL		0
+#define UFFS_IO_ADVISE_SEQUENTIAL	1	//!< 앞에서부터 한 번씩 읽음 (mount scan)
+#define UFFS_IO_ADVISE_RANDOM		2
+
+/**
+ * \struct uffs_IoVecSt
+ * \brief ReadV 한 건
+ */
+struct uffs_IoVecSt {
+	void *buf;
+	size_t len;
+	off_t offset;
+	ssize_t res;		//!< 읽은 bytes 또는 -errno
+};
+typedef struct uffs_IoVecSt uffs_IoVec;
+
+/**
+ * \struct uffs_IoOpsSt
+ * \brief backend operations, 모든 함수는 여러 스레드에서 동시에 불릴 수 있음
+ */
+struct uffs_IoOpsSt {
+	const char *name;
+
+	/** open device, return fd or -1 */
+	int (*Open)(const char *path);
+
+	/** read/write len bytes at offset, return bytes done or -1 */
+	ssize_t (*Read)(int fd, void *buf, size_t len, off_t offset);
+	ssize_t (*Write)(int fd, const void *buf, size_t len, off_t offset);
+
+	/** 그때까지의 Write를 모두 디바이스에 내리고 fdatasync */
+	int (*Sync)(int fd);
+
+	/**
+	 * (optional) 그때까지의 Write를 디바이스에 써서 끝날 때까지 기다림 (디바이스 cache flush 없음)
+	 * 이후의 Write보다 먼저 디바이스에 도착하게 하는 순서 보장용, 성공하면 0
+	 */
+	int (*Writeback)(int fd);
+
+	/** (optional) n개의 read를 한 번에 submit 하고 모두 끝나면 return, 모두 성공하면 0 */
+	int (*ReadV)(int fd, uffs_IoVec *vec, int n);
+
+	/** (optional) write 후 이어서 fdatasync (write가 끝난 뒤에 sync 되도록 묶음) */
+	ssize_t (*WriteSync)(int fd, const void *buf, size_t len, off_t offset);
+
+	/** (optional) 디바이스 [offset, offset + len)를 가리키는 포인터, 없으면 NULL (zero-copy read) */
+	const void * (*Map)(int fd, off_t offset, size_t len);
+
+	/** (optional) 앞으로의 access pattern 힌트, #UFFS_IO_ADVISE_NORMAL 등 */
+	void (*Advise)(int fd, off_t offset, size_t len, int advice);
+
+	/** (optional) 디바이스 [offset, offset + len)를 버림 (TRIM), 이후 그 범위를 읽은 값은 알 수 없음. 성공하면 0 */
+	int (*Discard)(int fd, off_t offset, size_t len);
+
+	void (*Close)(int fd);
+};
+typedef struct uffs_IoOpsSt uffs_IoOps;
+
+extern const uffs_IoOps uffs_IoPosixOps;
+extern const uffs_IoOps uffs_IoDirectOps;
+extern const uffs_IoOps uffs_IoUringOps;
+extern const uffs_IoOps uffs_IoMmapOps;
+
+const uffs_IoOps * uffs_IoFind(const char *name);
+int uffs_IoDiscard(int fd, off_t offset, size_t len);
+int uffs_IoWriteback(int fd);
+
+#endif
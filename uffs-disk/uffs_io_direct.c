@@ -0,0 +1,337 @@
+/**
+ * \file uffs_io_direct.c
+ * \brief O_DIRECT backend: host page cache를 거치지 않음
+ *
+ * O_DIRECT는 버퍼, offset, 길이가 모두 logical block size에 맞아야 하는데
+ * 페이지(544 bytes)는 그렇지 않다. 그래서
+ *  - write는 flash 블록 하나를 덮는 정렬된 extent 버퍼에 모았다가
+ *    다른 블록으로 넘어가거나 Sync 할 때 바뀐 sector만 한 번에 쓰고
+ *  - extent 밖의 read는 정렬된 bounce 버퍼(pool)로 읽어 필요한 부분만 복사한다.
+ * 인접한 두 flash 블록의 extent는 경계 sector를 공유할 수 있어서
+ * extent는 하나만 두고, 바꿀 때는 항상 먼저 flush 한다.
+ */
+
+#define _GNU_SOURCE
+
+#include "uffs_io.h"
+#include "uffs_disk.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#define DIRECT_FLASH_BLOCK_BYTES	(PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT)
+#define DIRECT_POOL_SIZE			8		//!< 미리 잡아두는 bounce 버퍼 수
+#define DIRECT_ALIGN_DEFAULT		4096
+
+#define ALIGN_DOWN(x, a)	((x) & ~((off_t)(a) - 1))
+#define ALIGN_UP(x, a)		ALIGN_DOWN((x) + (a) - 1, (a))
+
+/** write를 모으는 flash 블록 하나 크기의 정렬된 구간 */
+struct direct_ExtentSt {
+	char *buf;
+	off_t start;
+	size_t len;
+	int flash_block;	//!< -1: 비어 있음
+	UBOOL dirty;
+	off_t dirty_start;	//!< 바뀐 구간 [dirty_start, dirty_end), flush는 이 구간을 덮는 sector만 씀
+	off_t dirty_end;
+};
+
+static pthread_mutex_t direct_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t direct_align = DIRECT_ALIGN_DEFAULT;
+
+static void *direct_pool[DIRECT_POOL_SIZE];
+static int direct_pool_free = 0;
+static size_t direct_bounce_size = 0;
+
+static struct direct_ExtentSt direct_extent = { NULL, 0, 0, -1, U_FALSE, 0, 0 };
+
+static void * _PoolGet(size_t len)
+{
+	void *p = NULL;
+
+	if (len <= direct_bounce_size) {
+		if (direct_pool_free > 0)
+			return direct_pool[--direct_pool_free];
+		len = direct_bounce_size;
+	}
+	if (posix_memalign(&p, direct_align, ALIGN_UP(len, direct_align)) != 0)
+		return NULL;
+	return p;
+}
+
+static void _PoolPut(void *p, size_t len)
+{
+	if (len <= direct_bounce_size && direct_pool_free < DIRECT_POOL_SIZE)
+		direct_pool[direct_pool_free++] = p;
+	else
+		free(p);
+}
+
+// 정렬된 구간 읽기. 파일 끝 너머는 0으로 채움
+static int _ReadAligned(int fd, char *buf, off_t start, size_t len)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = pread(fd, buf + done, len - done, start + done);
+		if (n < 0)
+			return -1;
+		if (n == 0) {
+			memset(buf + done, 0, len - done);
+			break;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static int _FlushExtent(int fd)
+{
+	struct direct_ExtentSt *ext = &direct_extent;
+	off_t start, end;
+
+	if (!ext->dirty)
+		return 0;
+	start = ALIGN_DOWN(ext->dirty_start, direct_align);
+	end = ALIGN_UP(ext->dirty_end, direct_align);
+	if (pwrite(fd, ext->buf + (start - ext->start), end - start, start) != (ssize_t)(end - start)) {
+		fprintf(stderr, "[direct_FlushExtent] write error - flash block %d\n", ext->flash_block);
+		return -1;
+	}
+	ext->dirty = U_FALSE;
+	return 0;
+}
+
+static int _LoadExtent(int fd, int flash_block)
+{
+	struct direct_ExtentSt *ext = &direct_extent;
+	off_t start = ALIGN_DOWN((off_t)flash_block * DIRECT_FLASH_BLOCK_BYTES, direct_align);
+	off_t end = ALIGN_UP((off_t)(flash_block + 1) * DIRECT_FLASH_BLOCK_BYTES, direct_align);
+
+	if (_FlushExtent(fd) < 0)
+		return -1;
+
+	ext->flash_block = -1;
+	if (_ReadAligned(fd, ext->buf, start, end - start) < 0)
+		return -1;
+
+	ext->start = start;
+	ext->len = end - start;
+	ext->flash_block = flash_block;
+	return 0;
+}
+
+static UBOOL _InExtent(off_t offset, size_t len)
+{
+	struct direct_ExtentSt *ext = &direct_extent;
+
+	return ext->flash_block >= 0 &&
+		offset >= ext->start && offset + (off_t)len <= ext->start + (off_t)ext->len;
+}
+
+static UBOOL _OverlapExtent(off_t start, off_t end)
+{
+	struct direct_ExtentSt *ext = &direct_extent;
+
+	return ext->flash_block >= 0 &&
+		start < ext->start + (off_t)ext->len && end > ext->start;
+}
+
+static int direct_Open(const char *path)
+{
+	struct stat st;
+	int fd, ssz = 0, i;
+
+	fd = open(path, O_RDWR | O_DIRECT, 0666);
+	if (fd < 0)
+		return -1;
+
+	direct_align = DIRECT_ALIGN_DEFAULT;
+	if (fstat(fd, &st) == 0) {
+		if (S_ISBLK(st.st_mode) && ioctl(fd, BLKSSZGET, &ssz) == 0 && ssz > 0)
+			direct_align = ssz;
+		else if (st.st_blksize >= 512 && (st.st_blksize & (st.st_blksize - 1)) == 0)
+			direct_align = st.st_blksize;
+	}
+
+	direct_extent.len = 0;
+	direct_extent.flash_block = -1;
+	direct_extent.dirty = U_FALSE;
+	if (posix_memalign((void **)&direct_extent.buf, direct_align,
+					   ALIGN_UP(DIRECT_FLASH_BLOCK_BYTES, direct_align) + direct_align) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	// 페이지 하나는 최대 2개의 정렬 단위에 걸침
+	direct_bounce_size = ALIGN_UP(PAGE_SIZE_DEFAULT, direct_align) + direct_align;
+	for (i = 0; i < DIRECT_POOL_SIZE; i++) {
+		if (posix_memalign(&direct_pool[i], direct_align, direct_bounce_size) != 0)
+			break;
+	}
+	direct_pool_free = i;
+
+	fprintf(stdout, "[direct_Open] O_DIRECT, alignment: %zu\n", direct_align);
+	return fd;
+}
+
+static ssize_t direct_Read(int fd, void *buf, size_t len, off_t offset)
+{
+	off_t start = ALIGN_DOWN(offset, direct_align);
+	off_t end = ALIGN_UP(offset + (off_t)len, direct_align);
+	char *bounce;
+	ssize_t ret = len;
+
+	pthread_mutex_lock(&direct_lock);
+
+	if (_InExtent(offset, len)) {
+		memcpy(buf, direct_extent.buf + (offset - direct_extent.start), len);
+		pthread_mutex_unlock(&direct_lock);
+		return len;
+	}
+
+	// 경계 sector가 아직 extent에만 있을 수 있음
+	if (_OverlapExtent(start, end) && _FlushExtent(fd) < 0) {
+		pthread_mutex_unlock(&direct_lock);
+		return -1;
+	}
+
+	bounce = _PoolGet(end - start);
+	if (bounce == NULL || _ReadAligned(fd, bounce, start, end - start) < 0)
+		ret = -1;
+	else
+		memcpy(buf, bounce + (offset - start), len);
+	if (bounce != NULL)
+		_PoolPut(bounce, end - start);
+
+	pthread_mutex_unlock(&direct_lock);
+	return ret;
+}
+
+static ssize_t direct_Write(int fd, const void *buf, size_t len, off_t offset)
+{
+	int flash_block = offset / DIRECT_FLASH_BLOCK_BYTES;
+	off_t start, end;
+	char *bounce;
+	ssize_t ret = len;
+
+	pthread_mutex_lock(&direct_lock);
+
+	if (offset + (off_t)len <= (off_t)(flash_block + 1) * DIRECT_FLASH_BLOCK_BYTES) {
+		// 보통의 경우: 블록 하나 안의 페이지 -> extent에 모음
+		if (direct_extent.flash_block != flash_block && _LoadExtent(fd, flash_block) < 0) {
+			pthread_mutex_unlock(&direct_lock);
+			return -1;
+		}
+		memcpy(direct_extent.buf + (offset - direct_extent.start), buf, len);
+		if (!direct_extent.dirty || offset < direct_extent.dirty_start)
+			direct_extent.dirty_start = offset;
+		if (!direct_extent.dirty || offset + (off_t)len > direct_extent.dirty_end)
+			direct_extent.dirty_end = offset + len;
+		direct_extent.dirty = U_TRUE;
+		pthread_mutex_unlock(&direct_lock);
+		return len;
+	}
+
+	// 블록 경계를 넘는 write는 read-modify-write
+	start = ALIGN_DOWN(offset, direct_align);
+	end = ALIGN_UP(offset + (off_t)len, direct_align);
+	if (_OverlapExtent(start, end)) {
+		if (_FlushExtent(fd) < 0) {
+			pthread_mutex_unlock(&direct_lock);
+			return -1;
+		}
+		direct_extent.flash_block = -1;
+	}
+
+	bounce = _PoolGet(end - start);
+	if (bounce == NULL || _ReadAligned(fd, bounce, start, end - start) < 0) {
+		ret = -1;
+	}
+	else {
+		memcpy(bounce + (offset - start), buf, len);
+		if (pwrite(fd, bounce, end - start, start) != end - start)
+			ret = -1;
+	}
+	if (bounce != NULL)
+		_PoolPut(bounce, end - start);
+
+	pthread_mutex_unlock(&direct_lock);
+	return ret;
+}
+
+static int direct_Sync(int fd)
+{
+	int ret;
+
+	pthread_mutex_lock(&direct_lock);
+	ret = _FlushExtent(fd);
+	pthread_mutex_unlock(&direct_lock);
+
+	if (ret < 0)
+		return -1;
+	return fdatasync(fd);
+}
+
+// O_DIRECT write는 끝나면 디바이스에 가 있으므로 extent만 내림
+static int direct_Writeback(int fd)
+{
+	int ret;
+
+	pthread_mutex_lock(&direct_lock);
+	ret = _FlushExtent(fd);
+	pthread_mutex_unlock(&direct_lock);
+
+	return ret < 0 ? -1 : 0;
+}
+
+// extent에 있는 구간이면 먼저 내리고 비운 뒤 discard
+static int direct_Discard(int fd, off_t offset, size_t len)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&direct_lock);
+	if (_OverlapExtent(ALIGN_DOWN(offset, direct_align), ALIGN_UP(offset + (off_t)len, direct_align))) {
+		ret = _FlushExtent(fd);
+		direct_extent.flash_block = -1;
+	}
+	pthread_mutex_unlock(&direct_lock);
+
+	if (ret < 0)
+		return -1;
+	return uffs_IoDiscard(fd, offset, len);
+}
+
+static void direct_Close(int fd)
+{
+	pthread_mutex_lock(&direct_lock);
+
+	_FlushExtent(fd);
+	free(direct_extent.buf);
+	direct_extent.buf = NULL;
+	direct_extent.flash_block = -1;
+	while (direct_pool_free > 0)
+		free(direct_pool[--direct_pool_free]);
+
+	pthread_mutex_unlock(&direct_lock);
+	close(fd);
+}
+
+const uffs_IoOps uffs_IoDirectOps = {
+	.name	= "direct",
+	.Open	= direct_Open,
+	.Read	= direct_Read,
+	.Write	= direct_Write,
+	.Sync	= direct_Sync,
+	.Writeback	= direct_Writeback,
+	.Discard	= direct_Discard,
+	.Close	= direct_Close,
+};
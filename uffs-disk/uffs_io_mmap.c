@@ -0,0 +1,199 @@
+/**
+ * \file uffs_io_mmap.c
+ * \brief mmap backend: 이미지 전체를 MAP_SHARED로 매핑
+ *
+ * Read/Write는 syscall 없이 매핑에 memcpy만 한다. Map으로 매핑 안의 포인터를
+ * 바로 넘겨주면 readPageRef가 복사 없이 읽을 수 있다.
+ * Write한 flash 블록은 bitmap에 표시해 두었다가 Sync(= journal commit,
+ * fsync) 때 그 블록 구간만 msync 한다.
+ */
+
+#define _GNU_SOURCE
+
+#include "uffs_io.h"
+#include "uffs_disk.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#define MMAP_FLASH_BLOCK_BYTES	(PAGES_PER_BLOCK_DEFAULT * PAGE_SIZE_DEFAULT)
+#define MMAP_DISK_BYTES			((off_t)TOTAL_BLOCKS_DEFAULT * MMAP_FLASH_BLOCK_BYTES)
+#define MMAP_DIRTY_WORDS		((TOTAL_BLOCKS_DEFAULT + 31) / 32)
+
+static pthread_mutex_t mmap_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *mmap_base = NULL;
+static size_t mmap_size = 0;
+static size_t mmap_page_size = 4096;
+static u32 mmap_dirty[MMAP_DIRTY_WORDS];	//!< msync 해야 하는 flash 블록
+
+static UBOOL _InMap(off_t offset, size_t len)
+{
+	return mmap_base != NULL && offset >= 0 && offset + (off_t)len <= (off_t)mmap_size;
+}
+
+static int _SyncBlocks(int first, int last)
+{
+	size_t start = (size_t)first * MMAP_FLASH_BLOCK_BYTES;
+	size_t end = (size_t)(last + 1) * MMAP_FLASH_BLOCK_BYTES;
+
+	// msync는 host page 단위 주소만 받음
+	start &= ~(mmap_page_size - 1);
+	if (end > mmap_size)
+		end = mmap_size;
+	return msync(mmap_base + start, end - start, MS_SYNC);
+}
+
+static int mmap_Open(const char *path)
+{
+	struct stat st;
+	unsigned long long dev_size = 0;
+	int fd;
+
+	fd = open(path, O_RDWR, 0666);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	if (S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &dev_size) < 0 || dev_size < (unsigned long long)MMAP_DISK_BYTES) {
+			fprintf(stderr, "[mmap_Open] device is smaller than %lld bytes\n", (long long)MMAP_DISK_BYTES);
+			goto fail;
+		}
+	}
+	else if (st.st_size < MMAP_DISK_BYTES) {
+		// 매핑 밖을 건드리면 SIGBUS 이므로 이미지를 디스크 크기까지 늘려둠
+		if (ftruncate(fd, MMAP_DISK_BYTES) < 0)
+			goto fail;
+	}
+
+	mmap_size = MMAP_DISK_BYTES;
+	mmap_base = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mmap_base == MAP_FAILED) {
+		mmap_base = NULL;
+		goto fail;
+	}
+
+	mmap_page_size = sysconf(_SC_PAGESIZE);
+	memset(mmap_dirty, 0, sizeof(mmap_dirty));
+
+	fprintf(stdout, "[mmap_Open] mapped %zu bytes\n", mmap_size);
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static ssize_t mmap_Read(int fd, void *buf, size_t len, off_t offset)
+{
+	if (!_InMap(offset, len))
+		return -1;
+	memcpy(buf, mmap_base + offset, len);
+	return len;
+}
+
+static ssize_t mmap_Write(int fd, const void *buf, size_t len, off_t offset)
+{
+	int block;
+
+	if (!_InMap(offset, len) || len == 0)
+		return len == 0 ? 0 : -1;
+
+	memcpy(mmap_base + offset, buf, len);
+
+	pthread_mutex_lock(&mmap_lock);
+	for (block = offset / MMAP_FLASH_BLOCK_BYTES; block <= (offset + (off_t)len - 1) / MMAP_FLASH_BLOCK_BYTES; block++)
+		mmap_dirty[block / 32] |= 1U << (block % 32);
+	pthread_mutex_unlock(&mmap_lock);
+
+	return len;
+}
+
+static int mmap_Sync(int fd)
+{
+	u32 dirty[MMAP_DIRTY_WORDS];
+	int block, first = -1, ret = 0;
+
+	pthread_mutex_lock(&mmap_lock);
+	memcpy(dirty, mmap_dirty, sizeof(dirty));
+	memset(mmap_dirty, 0, sizeof(mmap_dirty));
+	pthread_mutex_unlock(&mmap_lock);
+
+	// 연속된 dirty 블록은 msync 한 번으로
+	for (block = 0; block <= TOTAL_BLOCKS_DEFAULT; block++) {
+		UBOOL is_dirty = block < TOTAL_BLOCKS_DEFAULT && (dirty[block / 32] & (1U << (block % 32)));
+
+		if (is_dirty && first < 0) {
+			first = block;
+		}
+		else if (!is_dirty && first >= 0) {
+			if (_SyncBlocks(first, block - 1) < 0)
+				ret = -1;
+			first = -1;
+		}
+	}
+
+	if (ret < 0) {
+		// 다음 Sync에서 다시 시도
+		pthread_mutex_lock(&mmap_lock);
+		for (block = 0; block < MMAP_DIRTY_WORDS; block++)
+			mmap_dirty[block] |= dirty[block];
+		pthread_mutex_unlock(&mmap_lock);
+	}
+	return ret;
+}
+
+static const void * mmap_Map(int fd, off_t offset, size_t len)
+{
+	if (!_InMap(offset, len))
+		return NULL;
+	return mmap_base + offset;
+}
+
+static void mmap_Advise(int fd, off_t offset, size_t len, int advice)
+{
+	int madv = MADV_NORMAL;
+	size_t start;
+
+	if (!_InMap(offset, len))
+		return;
+
+	if (advice == UFFS_IO_ADVISE_SEQUENTIAL)
+		madv = MADV_SEQUENTIAL;
+	else if (advice == UFFS_IO_ADVISE_RANDOM)
+		madv = MADV_RANDOM;
+
+	start = offset & ~(mmap_page_size - 1);
+	madvise(mmap_base + start, offset + len - start, madv);
+}
+
+static void mmap_Close(int fd)
+{
+	if (mmap_base != NULL) {
+		msync(mmap_base, mmap_size, MS_SYNC);
+		munmap(mmap_base, mmap_size);
+		mmap_base = NULL;
+	}
+	close(fd);
+}
+
+const uffs_IoOps uffs_IoMmapOps = {
+	.name	= "mmap",
+	.Open	= mmap_Open,
+	.Read	= mmap_Read,
+	.Write	= mmap_Write,
+	.Sync	= mmap_Sync,
+	.Writeback	= uffs_IoWriteback,
+	.Map	= mmap_Map,
+	.Advise	= mmap_Advise,
+	.Discard	= uffs_IoDiscard,
+	.Close	= mmap_Close,
+};
@@ -0,0 +1,494 @@
+/**
+ * \file uffs_io_uring.c
+ * \brief io_uring backend (커널 AIO fallback)
+ *
+ * ring 하나를 모든 FUSE 스레드가 같이 쓴다. 각 스레드는 자기 요청을 submit 하고
+ * 기다리기만 하고, completion은 reaper 스레드가 받아서 요청한 스레드를 깨운다.
+ * 그래서 적은 스레드로도 디바이스 queue에 여러 요청이 동시에 걸린다.
+ *
+ * io_uring을 쓸 수 없으면 커널 AIO(io_submit), 그것도 안 되면 pread/pwrite.
+ * liburing/libaio 없이 syscall을 직접 쓴다.
+ */
+
+#define _GNU_SOURCE
+
+#include "uffs_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES		64		//!< 동시에 걸 수 있는 최대 요청 수
+#define AIO_EVENTS_MAX		32
+#define AIO_WAIT_NSEC		100000000	//!< reaper가 종료 플래그를 보는 주기 (AIO)
+
+enum {
+	URING_MODE_SYNC = 0,
+	URING_MODE_URING,
+	URING_MODE_AIO,
+};
+
+enum {
+	URING_OP_READ = 0,
+	URING_OP_WRITE,
+	URING_OP_FSYNC,
+	URING_OP_NOP,
+};
+
+/** 한 번에 submit 하고 같이 기다리는 요청 묶음 */
+struct uring_BatchSt {
+	int pending;
+	UBOOL error;
+};
+
+struct uring_ReqSt {
+	int op;
+	void *buf;
+	size_t len;
+	off_t offset;
+	UBOOL link;			//!< 다음 요청은 이 요청이 끝난 뒤에 시작 (io_uring만)
+	ssize_t res;
+	struct uring_BatchSt *batch;
+};
+
+static struct {
+	int mode;
+	int ring_fd;
+	unsigned entries;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size, sqes_size;
+
+	aio_context_t aio_ctx;
+
+	pthread_t reaper;
+	UBOOL stop;
+	int inflight;
+	int unsubmitted;
+} uring;
+
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t uring_cond = PTHREAD_COND_INITIALIZER;
+
+static void _Complete(struct uring_ReqSt *req, ssize_t res)
+{
+	req->res = res;
+	if (res < 0 || (req->op != URING_OP_FSYNC && req->op != URING_OP_NOP && (size_t)res != req->len))
+		req->batch->error = U_TRUE;
+	req->batch->pending--;
+}
+
+/* ---------------- io_uring ---------------- */
+
+static int _UringSetup(void)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	uring.ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (uring.ring_fd < 0)
+		return -1;
+
+	uring.sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	uring.cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (uring.cq_size > uring.sq_size)
+			uring.sq_size = uring.cq_size;
+		uring.cq_size = uring.sq_size;
+	}
+
+	uring.sq_ptr = mmap(NULL, uring.sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						uring.ring_fd, IORING_OFF_SQ_RING);
+	if (uring.sq_ptr == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		uring.cq_ptr = uring.sq_ptr;
+	}
+	else {
+		uring.cq_ptr = mmap(NULL, uring.cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+							uring.ring_fd, IORING_OFF_CQ_RING);
+		if (uring.cq_ptr == MAP_FAILED)
+			goto fail_sq;
+	}
+
+	uring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					  uring.ring_fd, IORING_OFF_SQES);
+	if (uring.sqes == MAP_FAILED)
+		goto fail_cq;
+
+	uring.sq_head = (unsigned *)((char *)uring.sq_ptr + p.sq_off.head);
+	uring.sq_tail = (unsigned *)((char *)uring.sq_ptr + p.sq_off.tail);
+	uring.sq_mask = (unsigned *)((char *)uring.sq_ptr + p.sq_off.ring_mask);
+	uring.sq_array = (unsigned *)((char *)uring.sq_ptr + p.sq_off.array);
+	uring.cq_head = (unsigned *)((char *)uring.cq_ptr + p.cq_off.head);
+	uring.cq_tail = (unsigned *)((char *)uring.cq_ptr + p.cq_off.tail);
+	uring.cq_mask = (unsigned *)((char *)uring.cq_ptr + p.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *)((char *)uring.cq_ptr + p.cq_off.cqes);
+
+	// CQ는 SQ의 두 배라서 inflight를 SQ 크기로 막으면 넘치지 않음
+	uring.entries = p.sq_entries;
+	return 0;
+
+fail_cq:
+	if (uring.cq_ptr != uring.sq_ptr)
+		munmap(uring.cq_ptr, uring.cq_size);
+fail_sq:
+	munmap(uring.sq_ptr, uring.sq_size);
+fail:
+	close(uring.ring_fd);
+	return -1;
+}
+
+static void _UringRelease(void)
+{
+	munmap(uring.sqes, uring.sqes_size);
+	if (uring.cq_ptr != uring.sq_ptr)
+		munmap(uring.cq_ptr, uring.cq_size);
+	munmap(uring.sq_ptr, uring.sq_size);
+	close(uring.ring_fd);
+}
+
+// uring_lock 잡고 호출
+static void _UringFlush(void)
+{
+	int n;
+
+	while (uring.unsubmitted > 0) {
+		n = syscall(__NR_io_uring_enter, uring.ring_fd, uring.unsubmitted, 0, 0, NULL, 0);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			fprintf(stderr, "[uring_Submit] io_uring_enter error: %s\n", strerror(errno));
+			return;
+		}
+		uring.unsubmitted -= n;
+	}
+}
+
+// uring_lock 잡고 호출
+static void _UringPush(int fd, struct uring_ReqSt *req)
+{
+	unsigned tail = *uring.sq_tail;
+	unsigned idx = tail & *uring.sq_mask;
+	struct io_uring_sqe *sqe = &uring.sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = fd;
+	sqe->user_data = (__u64)(uintptr_t)req;
+	switch (req->op) {
+	case URING_OP_READ:
+		sqe->opcode = IORING_OP_READ;
+		break;
+	case URING_OP_WRITE:
+		sqe->opcode = IORING_OP_WRITE;
+		break;
+	case URING_OP_FSYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		break;
+	default:
+		sqe->opcode = IORING_OP_NOP;
+		sqe->fd = -1;
+		break;
+	}
+	if (req->op == URING_OP_READ || req->op == URING_OP_WRITE) {
+		sqe->addr = (__u64)(uintptr_t)req->buf;
+		sqe->len = req->len;
+		sqe->off = req->offset;
+	}
+	if (req->link)
+		sqe->flags |= IOSQE_IO_LINK;
+
+	uring.sq_array[idx] = idx;
+	__atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring.unsubmitted++;
+}
+
+static void * _UringReaper(void *arg)
+{
+	unsigned head, tail;
+	struct io_uring_cqe *cqe;
+	struct uring_ReqSt *req;
+	UBOOL stop;
+
+	do {
+		syscall(__NR_io_uring_enter, uring.ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+		pthread_mutex_lock(&uring_lock);
+		head = *uring.cq_head;
+		tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail) {
+			cqe = &uring.cqes[head & *uring.cq_mask];
+			req = (struct uring_ReqSt *)(uintptr_t)cqe->user_data;
+			if (req != NULL)
+				_Complete(req, cqe->res);
+			uring.inflight--;
+			head++;
+		}
+		__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&uring_cond);
+		stop = uring.stop;
+		pthread_mutex_unlock(&uring_lock);
+	} while (!stop);
+
+	return NULL;
+}
+
+/* ---------------- kernel AIO ---------------- */
+
+static void * _AioReaper(void *arg)
+{
+	struct io_event events[AIO_EVENTS_MAX];
+	struct timespec ts = { 0, AIO_WAIT_NSEC };
+	UBOOL stop;
+	int n, i;
+
+	do {
+		n = syscall(__NR_io_getevents, uring.aio_ctx, 1, AIO_EVENTS_MAX, events, &ts);
+
+		pthread_mutex_lock(&uring_lock);
+		for (i = 0; i < n; i++) {
+			_Complete((struct uring_ReqSt *)(uintptr_t)events[i].data, events[i].res);
+			uring.inflight--;
+		}
+		if (n > 0)
+			pthread_cond_broadcast(&uring_cond);
+		stop = uring.stop && uring.inflight == 0;
+		pthread_mutex_unlock(&uring_lock);
+	} while (!stop);
+
+	return NULL;
+}
+
+// uring_lock 잡고 호출. 커널 AIO에는 link가 없어서 fsync는 여기로 오지 않음
+static int _AioPush(int fd, struct uring_ReqSt *req)
+{
+	struct iocb cb;
+	struct iocb *cbs[1] = { &cb };
+
+	memset(&cb, 0, sizeof(cb));
+	cb.aio_fildes = fd;
+	cb.aio_lio_opcode = (req->op == URING_OP_READ) ? IOCB_CMD_PREAD : IOCB_CMD_PWRITE;
+	cb.aio_buf = (__u64)(uintptr_t)req->buf;
+	cb.aio_nbytes = req->len;
+	cb.aio_offset = req->offset;
+	cb.aio_data = (__u64)(uintptr_t)req;
+
+	return syscall(__NR_io_submit, uring.aio_ctx, 1, cbs) == 1 ? 0 : -1;
+}
+
+/* ---------------- common ---------------- */
+
+/**
+ * \brief 요청들을 submit 하고 모두 끝날 때까지 기다림
+ * \return 0: 모두 성공, -1: 하나라도 실패
+ */
+static int _Submit(int fd, struct uring_ReqSt *reqs, int n)
+{
+	struct uring_BatchSt batch = { 0, U_FALSE };
+	int i, need;
+
+	if (uring.mode == URING_MODE_SYNC) {
+		for (i = 0; i < n; i++) {
+			reqs[i].batch = &batch;
+			batch.pending++;
+			if (reqs[i].op == URING_OP_READ)
+				_Complete(&reqs[i], pread(fd, reqs[i].buf, reqs[i].len, reqs[i].offset));
+			else if (reqs[i].op == URING_OP_WRITE)
+				_Complete(&reqs[i], pwrite(fd, reqs[i].buf, reqs[i].len, reqs[i].offset));
+			else if (reqs[i].op == URING_OP_FSYNC)
+				_Complete(&reqs[i], fdatasync(fd));
+		}
+		return batch.error ? -1 : 0;
+	}
+
+	pthread_mutex_lock(&uring_lock);
+
+	for (i = 0; i < n; i++) {
+		// link로 묶인 요청은 같이 들어가야 함
+		need = reqs[i].link ? 2 : 1;
+		while (uring.inflight + need > (int)uring.entries) {
+			if (uring.mode == URING_MODE_URING)
+				_UringFlush();
+			pthread_cond_wait(&uring_cond, &uring_lock);
+		}
+
+		reqs[i].batch = &batch;
+		reqs[i].res = 0;
+		batch.pending++;
+		uring.inflight++;
+
+		if (uring.mode == URING_MODE_URING) {
+			_UringPush(fd, &reqs[i]);
+		}
+		else if (_AioPush(fd, &reqs[i]) < 0) {
+			_Complete(&reqs[i], -errno);
+			uring.inflight--;
+		}
+	}
+	if (uring.mode == URING_MODE_URING)
+		_UringFlush();
+
+	while (batch.pending > 0)
+		pthread_cond_wait(&uring_cond, &uring_lock);
+
+	pthread_mutex_unlock(&uring_lock);
+	return batch.error ? -1 : 0;
+}
+
+static int uring_Open(const char *path)
+{
+	int fd;
+
+	fd = open(path, O_RDWR, 0666);
+	if (fd < 0)
+		return -1;
+
+	memset(&uring, 0, sizeof(uring));
+
+	if (_UringSetup() == 0) {
+		uring.mode = URING_MODE_URING;
+		if (pthread_create(&uring.reaper, NULL, _UringReaper, NULL) != 0) {
+			_UringRelease();
+			uring.mode = URING_MODE_SYNC;
+		}
+	}
+	if (uring.mode == URING_MODE_SYNC && syscall(__NR_io_setup, URING_ENTRIES, &uring.aio_ctx) == 0) {
+		uring.mode = URING_MODE_AIO;
+		uring.entries = URING_ENTRIES;
+		if (pthread_create(&uring.reaper, NULL, _AioReaper, NULL) != 0) {
+			syscall(__NR_io_destroy, uring.aio_ctx);
+			uring.mode = URING_MODE_SYNC;
+		}
+	}
+
+	fprintf(stdout, "[uring_Open] mode: %s\n",
+			uring.mode == URING_MODE_URING ? "io_uring" :
+			uring.mode == URING_MODE_AIO ? "aio" : "sync");
+	return fd;
+}
+
+static ssize_t uring_Read(int fd, void *buf, size_t len, off_t offset)
+{
+	struct uring_ReqSt req = { URING_OP_READ, buf, len, offset, U_FALSE, 0, NULL };
+
+	_Submit(fd, &req, 1);
+	return req.res < 0 ? -1 : req.res;
+}
+
+static ssize_t uring_Write(int fd, const void *buf, size_t len, off_t offset)
+{
+	struct uring_ReqSt req = { URING_OP_WRITE, (void *)buf, len, offset, U_FALSE, 0, NULL };
+
+	_Submit(fd, &req, 1);
+	return req.res < 0 ? -1 : req.res;
+}
+
+static int uring_Sync(int fd)
+{
+	struct uring_ReqSt req = { URING_OP_FSYNC, NULL, 0, 0, U_FALSE, 0, NULL };
+
+	if (uring.mode == URING_MODE_AIO)
+		return fdatasync(fd);
+	return _Submit(fd, &req, 1);
+}
+
+static int uring_ReadV(int fd, uffs_IoVec *vec, int n)
+{
+	struct uring_ReqSt *reqs;
+	int i, ret;
+
+	reqs = (struct uring_ReqSt *)malloc(n * sizeof(struct uring_ReqSt));
+	if (reqs == NULL)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		reqs[i].op = URING_OP_READ;
+		reqs[i].buf = vec[i].buf;
+		reqs[i].len = vec[i].len;
+		reqs[i].offset = vec[i].offset;
+		reqs[i].link = U_FALSE;
+	}
+
+	ret = _Submit(fd, reqs, n);
+	for (i = 0; i < n; i++)
+		vec[i].res = reqs[i].res;
+
+	free(reqs);
+	return ret;
+}
+
+static ssize_t uring_WriteSync(int fd, const void *buf, size_t len, off_t offset)
+{
+	struct uring_ReqSt reqs[2] = {
+		{ URING_OP_WRITE, (void *)buf, len, offset, U_TRUE, 0, NULL },
+		{ URING_OP_FSYNC, NULL, 0, 0, U_FALSE, 0, NULL },
+	};
+
+	if (uring.mode != URING_MODE_URING) {
+		reqs[0].link = U_FALSE;
+		if (_Submit(fd, reqs, 1) < 0)
+			return -1;
+		return fdatasync(fd) < 0 ? -1 : reqs[0].res;
+	}
+
+	// write -> fsync 를 link로 묶어 한 번에 submit
+	if (_Submit(fd, reqs, 2) < 0)
+		return -1;
+	return reqs[0].res;
+}
+
+static void uring_Close(int fd)
+{
+	struct uring_ReqSt nop = { URING_OP_NOP, NULL, 0, 0, U_FALSE, 0, NULL };
+	struct uring_BatchSt batch = { 1, U_FALSE };
+
+	if (uring.mode != URING_MODE_SYNC) {
+		pthread_mutex_lock(&uring_lock);
+		uring.stop = U_TRUE;
+		if (uring.mode == URING_MODE_URING) {
+			// reaper를 깨우기 위한 빈 요청
+			nop.batch = &batch;
+			uring.inflight++;
+			_UringPush(fd, &nop);
+			_UringFlush();
+		}
+		pthread_mutex_unlock(&uring_lock);
+
+		pthread_join(uring.reaper, NULL);
+
+		if (uring.mode == URING_MODE_URING)
+			_UringRelease();
+		else
+			syscall(__NR_io_destroy, uring.aio_ctx);
+		uring.mode = URING_MODE_SYNC;
+	}
+	close(fd);
+}
+
+const uffs_IoOps uffs_IoUringOps = {
+	.name		= "uring",
+	.Open		= uring_Open,
+	.Read		= uring_Read,
+	.Write		= uring_Write,
+	.Sync		= uring_Sync,
+	.Writeback	= uffs_IoWriteback,
+	.ReadV		= uring_ReadV,
+	.WriteSync	= uring_WriteSync,
+	.Discard	= uffs_IoDiscard,
+	.Close		= uring_Close,
+};
@@ -0,0 +1,708 @@
+/**
+ * \file uffs_journal.c
+ * \brief metadata journal for file/dir header pages
+ *
+ * journal은 UFFS_JOURNAL_BLOCK의 페이지들을 ring으로 사용한다.
+ * 한 번의 commit은 seq가 연속인 페이지 몇 장이고, 마지막 페이지에 COMMIT_END가 붙는다.
+ * (ckpt_seq, 마지막 seq] 구간의 페이지만 살아있고, 그 수가 ring을 넘지 않도록
+ * commit 직후에 checkpoint 한다.
+ *
+ * commit은 leader/follower 방식: 한 스레드(leader)가 그때까지 쌓인 op를
+ * 떼어내 lock 없이 기록하는 동안, 다른 스레드는 계속 append 하거나
+ * (sync 요청이면) leader가 끝나기를 기다렸다가 다음 leader가 된다.
+ *
+ * 여러 헤더 갱신이 함께 반영돼야 하면(rename) uffs_JournalBeginGroup으로 묶는다.
+ * group이 열려 있는 동안은 commit 하지 않고, 그 op들이 쓸 자리를 buf에 남겨 두므로
+ * group의 op는 한 commit에 같이 들어가 replay 때 모두 반영되거나 모두 버려진다.
+ * leader가 기록하는 동안에는 group을 열지 않으므로, commit 직후의 checkpoint가
+ * 아직 journal에 없는 group의 일부를 제자리에 쓰는 일은 없다.
+ *
+ * append 때 UFFS_JOURNAL_COMMIT_INTERVAL이 지났으면 commit 하지만, 그 뒤로 op가 없으면
+ * 남은 op는 계속 쌓여 있게 되므로 timer 스레드가 간격이 지난 pending op를 commit 한다.
+ */
+
+#include "uffs_journal.h"
+#include "uffs_crc.h"
+#include "uffs_compress.h"
+#include "uffs_dedup.h"
+#include "uffs_blockmap.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/** checkpoint 전까지 헤더 페이지의 최신 내용 (readPage가 여기서 먼저 찾음) */
+struct uffs_JournalCacheSt {
+	u8 valid;
+	uffs_MiniHeader mini_header;
+	uffs_FileInfo info;
+	uffs_Tag tag;
+};
+
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t journal_cond = PTHREAD_COND_INITIALIZER;
+static struct uffs_JournalCacheSt journal_cache[TOTAL_BLOCKS_DEFAULT * PAGES_PER_BLOCK_DEFAULT];	//!< HDR_ADDR로 찾음
+static int journal_block_cached[TOTAL_BLOCKS_DEFAULT];	//!< 블록별 valid cache 수 (0이면 lock 없이 건너뜀)
+
+static char journal_buf[UFFS_JOURNAL_GROUP_PAGES * UFFS_JOURNAL_PAYLOAD_SIZE];
+static int journal_buf_len = 0;		//!< commit 안 된 record 크기
+static int journal_pending_ops = 0;
+static time_t journal_pending_since = 0;
+
+static char journal_commit_buf[sizeof(journal_buf)];	//!< leader가 기록 중인 group
+static UBOOL journal_committing = U_FALSE;
+// leader가 writePages로 한 번에 쓰는 페이지들
+static uffs_MiniHeader commit_mh[UFFS_JOURNAL_GROUP_PAGES];
+static char commit_data[UFFS_JOURNAL_GROUP_PAGES * PAGE_DATA_SIZE_DEFAULT];
+static uffs_Tag commit_tag[UFFS_JOURNAL_GROUP_PAGES];
+static u32 journal_ops_appended = 0;	//!< 지금까지 append 된 op 수
+static u32 journal_ops_committed = 0;	//!< 그 중 기록을 마친 op 수
+static UBOOL journal_io_error = U_FALSE;	//!< commit 실패가 있었음 (이후 sync는 모두 실패)
+static UBOOL journal_group = U_FALSE;	//!< 열린 group이 있음 (끝날 때까지 commit 안 함)
+static int journal_reserved = 0;		//!< group의 남은 op가 쓸 buf 자리
+static pthread_t journal_group_owner;	//!< group을 연 스레드
+
+static pthread_cond_t journal_timer_cond = PTHREAD_COND_INITIALIZER;	//!< timer 깨우기 (첫 pending op, stop)
+static pthread_t journal_timer;
+static UBOOL journal_timer_running = U_FALSE;
+static UBOOL journal_timer_stop = U_FALSE;
+static int journal_timer_fd = -1;
+
+static u32 journal_next_seq = 1;		//!< 다음에 쓸 page seq
+static u32 journal_ckpt_seq = 0;		//!< 이 seq까지는 제자리에 반영됨
+
+// record 뒤에 name에 이어 붙는 inline file data (또는 chunk index, dedup 참조) 길이
+static int _InlineLen(const uffs_JournalRec *rec)
+{
+	if ((rec->attr & FILE_ATTR_COMPRESS) && UFFS_CHUNK_INDEX_FITS(rec->name_len))
+		return sizeof(uffs_ChunkIndex);
+	if ((rec->attr & FILE_ATTR_DEDUP) && UFFS_DEDUP_REF_FITS(rec->name_len))
+		return sizeof(uffs_DedupRef);
+	if ((rec->attr & FILE_ATTR_BLOCKMAP) && UFFS_BLOCKMAP_FITS(rec->name_len))
+		return sizeof(u32);
+	if (!(rec->attr & FILE_ATTR_INLINE) || (int)rec->len > UFFS_INLINE_LIMIT(rec->name_len))
+		return 0;
+	return rec->len;
+}
+
+// name: name_len bytes 뒤에 inline data가 이어짐
+static void _RecToHeader(const uffs_JournalRec *rec, const char *name,
+						 uffs_MiniHeader *mini_header, uffs_FileInfo *info, uffs_Tag *tag)
+{
+	memset(info, 0, sizeof(uffs_FileInfo));
+
+	// 지워진 헤더: 빈 페이지 (page 0은 블록이 metadata 블록으로 남도록 tombstone)
+	if (rec->type == UFFS_TYPE_RESV) {
+		diskDeadHeaderPage(rec->block, rec->page, mini_header, tag);
+		return;
+	}
+
+	mini_header->status = 0x01;
+	mini_header->reserved = 0x00;
+	mini_header->crc = 0xFFFF;
+	info->attr = rec->attr;
+	info->create_time = rec->create_time;
+	info->last_modify = rec->last_modify;
+	info->access = rec->access;
+	info->name_len = rec->name_len;
+	memcpy(info->name, name, rec->name_len);
+	memcpy(UFFS_INLINE_DATA(info), name + rec->name_len, _InlineLen(rec));
+
+	// updateFileInfoPage와 같은 tag
+	memset(tag, 0, sizeof(uffs_Tag));
+	tag->s.dirty = 1;
+	tag->s.valid = 0;
+	tag->s.type = rec->type;
+	tag->s.block_ts = 0;
+	tag->s.data_len = rec->len;
+	tag->s.serial = rec->serial;
+	tag->s.parent = rec->parent;
+	tag->s.page_id = rec->page;
+	tag->s.tag_ecc = TAG_ECC_DEFAULT;
+	tag->data_sum = rec->data_sum;
+	tag->seal_byte = 0;
+}
+
+static URET _WriteHomePage(int fd, int block, int page, uffs_MiniHeader *mini_header, uffs_FileInfo *info, uffs_Tag *tag)
+{
+	return writePage(fd, block, page, mini_header, (char *)info, tag);
+}
+
+// journal 페이지 하나를 만듦 (쓰지는 않음)
+static void _MakeJournalPage(u32 seq, u32 ckpt_seq, u8 flags, const char *payload, int used,
+							 uffs_MiniHeader *mini_header, char *data, uffs_Tag *tag)
+{
+	uffs_JournalHeader *hdr = (uffs_JournalHeader *)data;
+
+	memset(data, 0, PAGE_DATA_SIZE_DEFAULT);
+	hdr->magic = UFFS_JOURNAL_MAGIC;
+	hdr->seq = seq;
+	hdr->ckpt_seq = ckpt_seq;
+	hdr->used = used;
+	hdr->flags = flags;
+	memcpy(data + sizeof(uffs_JournalHeader), payload, used);
+
+	// 찢어진 페이지는 crc로 걸러냄
+	mini_header->status = 0x01;
+	mini_header->reserved = 0x00;
+	mini_header->crc = uffs_crc16sum(data, PAGE_DATA_SIZE_DEFAULT);
+
+	memset(tag, 0, sizeof(uffs_Tag));
+	tag->s.dirty = 1;
+	tag->s.valid = 0;
+	tag->s.type = UFFS_TYPE_RESV;
+	tag->s.serial = UFFS_JOURNAL_BLOCK;
+	tag->s.page_id = seq % UFFS_JOURNAL_PAGES;
+	tag->s.tag_ecc = TAG_ECC_DEFAULT;
+}
+
+static URET _Checkpoint(int fd)
+{
+	int addr, count = 0;
+
+	// data page가 먼저 내려가야 헤더의 길이가 data를 앞서지 않음
+	// (flush는 아래 헤더 페이지와 함께 한 번)
+	if (diskWriteback(fd) == U_FAIL)
+		return U_FAIL;
+
+	for (addr = 0; addr < TOTAL_BLOCKS_DEFAULT * PAGES_PER_BLOCK_DEFAULT; addr++) {
+		if (!journal_cache[addr].valid)
+			continue;
+		if (_WriteHomePage(fd, HDR_BLOCK(addr), HDR_PAGE(addr), &journal_cache[addr].mini_header,
+						   &journal_cache[addr].info, &journal_cache[addr].tag) == U_FAIL) {
+			fprintf(stderr, "[uffs_JournalCheckpoint] write header page error - block %d, page %d\n",
+					HDR_BLOCK(addr), HDR_PAGE(addr));
+			return U_FAIL;
+		}
+		count++;
+	}
+
+	if (diskSync(fd) == U_FAIL) {
+		fprintf(stderr, "[uffs_JournalCheckpoint] sync error\n");
+		return U_FAIL;
+	}
+
+	memset(journal_cache, 0, sizeof(journal_cache));
+	memset(journal_block_cached, 0, sizeof(journal_block_cached));
+
+	// 다음 commit 페이지에 실려서 디스크에 남음
+	journal_ckpt_seq = journal_next_seq - 1;
+
+	fprintf(stdout, "[uffs_JournalCheckpoint] %d header page(s), ckpt seq: %u\n", count, journal_ckpt_seq);
+	return U_SUCC;
+}
+
+// journal_lock을 잡은 채 호출. 기록하는 동안은 lock을 풀어둠
+static URET _Commit(int fd)
+{
+	int npages, i, used, off = 0, len, ops, slot, run;
+	u32 first_seq, ckpt_seq;
+	URET ret = U_SUCC;
+	u8 flags;
+
+	// 이전 leader가 끝나야 seq 순서대로 기록됨, 열린 group은 닫힐 때까지 기다림
+	while (journal_committing || journal_group)
+		pthread_cond_wait(&journal_cond, &journal_lock);
+
+	if (journal_buf_len == 0)
+		return U_SUCC;
+
+	// 지금까지 쌓인 group을 떼어냄
+	len = journal_buf_len;
+	ops = journal_pending_ops;
+	memcpy(journal_commit_buf, journal_buf, len);
+	npages = (len + UFFS_JOURNAL_PAYLOAD_SIZE - 1) / UFFS_JOURNAL_PAYLOAD_SIZE;
+	first_seq = journal_next_seq;
+	ckpt_seq = journal_ckpt_seq;
+
+	journal_next_seq += npages;
+	journal_buf_len = 0;
+	journal_pending_ops = 0;
+	journal_committing = U_TRUE;
+
+	pthread_mutex_unlock(&journal_lock);
+
+	// ordered: data page -> journal page
+	// data page의 write가 끝난 뒤에 journal page를 내고, 디바이스 flush는 마지막 write에 묶은 한 번
+	if (diskWriteback(fd) == U_FAIL)
+		ret = U_FAIL;
+
+	for (i = 0; i < npages; i++) {
+		used = len - off;
+		if (used > (int)UFFS_JOURNAL_PAYLOAD_SIZE)
+			used = UFFS_JOURNAL_PAYLOAD_SIZE;
+		flags = (i == npages - 1) ? UFFS_JOURNAL_FLAG_COMMIT_END : 0;
+		_MakeJournalPage(first_seq + i, ckpt_seq, flags, journal_commit_buf + off, used,
+						 &commit_mh[i], commit_data + i * PAGE_DATA_SIZE_DEFAULT, &commit_tag[i]);
+		off += used;
+	}
+
+	// ring 안에서 연속된 페이지끼리 한 번에 쓰고, 마지막 write에 sync를 묶음
+	for (i = 0; ret == U_SUCC && i < npages; i += run) {
+		slot = (first_seq + i) % UFFS_JOURNAL_PAGES;
+		run = npages - i;
+		if (slot + run > UFFS_JOURNAL_PAGES)
+			run = UFFS_JOURNAL_PAGES - slot;
+
+		if (writePages(fd, UFFS_JOURNAL_BLOCK, slot, run, &commit_mh[i], commit_data + i * PAGE_DATA_SIZE_DEFAULT,
+					   &commit_tag[i], i + run == npages) == U_FAIL) {
+			fprintf(stderr, "[uffs_JournalCommit] write journal page error - seq %u\n", first_seq + i);
+			ret = U_FAIL;
+			break;
+		}
+	}
+
+	pthread_mutex_lock(&journal_lock);
+
+	journal_committing = U_FALSE;
+	journal_ops_committed += ops;
+	if (ret == U_FAIL)
+		journal_io_error = U_TRUE;
+	pthread_cond_broadcast(&journal_cond);
+
+	if (ret == U_FAIL)
+		return U_FAIL;
+
+	fprintf(stdout, "[uffs_JournalCommit] %d op(s) in %d page(s), seq %u\n", ops, npages, first_seq);
+
+	// 다음 commit이 살아있는 페이지를 덮지 않도록 미리 checkpoint
+	if (journal_next_seq - 1 - journal_ckpt_seq > UFFS_JOURNAL_PAGES - UFFS_JOURNAL_GROUP_PAGES)
+		return _Checkpoint(fd);
+
+	return U_SUCC;
+}
+
+static int _ApplyRecords(int fd, const char *stream, int len)
+{
+	uffs_JournalRec rec;
+	uffs_MiniHeader mini_header;
+	uffs_FileInfo info;
+	uffs_Tag tag;
+	int off = 0, count = 0;
+
+	while (off + (int)sizeof(rec) <= len) {
+		memcpy(&rec, stream + off, sizeof(rec));
+		off += sizeof(rec);
+		if (rec.name_len >= MAX_FILENAME_LENGTH || off + rec.name_len + _InlineLen(&rec) > len)
+			break;
+		if (rec.block == 0 || rec.block == UFFS_JOURNAL_BLOCK || rec.block >= TOTAL_BLOCKS_DEFAULT ||
+			rec.page >= PAGES_PER_BLOCK_DEFAULT)
+			break;
+
+		_RecToHeader(&rec, stream + off, &mini_header, &info, &tag);
+		off += rec.name_len + _InlineLen(&rec);
+
+		if (_WriteHomePage(fd, rec.block, rec.page, &mini_header, &info, &tag) == U_FAIL) {
+			fprintf(stderr, "[uffs_JournalInit] replay error - block %d, page %d\n", rec.block, rec.page);
+			break;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * \brief mount 시 호출. ring을 읽어 checkpoint 안 된 commit을 제자리에 반영
+ */
+URET uffs_JournalInit(int fd)
+{
+	fprintf(stdout, "[uffs_JournalInit] called\n");
+
+	static char pages[UFFS_JOURNAL_PAGES][PAGE_DATA_SIZE_DEFAULT];
+	uffs_JournalHeader hdr[UFFS_JOURNAL_PAGES];
+	UBOOL valid[UFFS_JOURNAL_PAGES];
+	char stream[UFFS_JOURNAL_GROUP_PAGES * UFFS_JOURNAL_PAYLOAD_SIZE];
+	uffs_MiniHeader mini_header;
+	u32 seq, max_seq = 0, ckpt_seq = 0;
+	int slot, len = 0, ops = 0, commits = 0;
+
+	pthread_mutex_lock(&journal_lock);
+
+	memset(journal_cache, 0, sizeof(journal_cache));
+	memset(journal_block_cached, 0, sizeof(journal_block_cached));
+	journal_buf_len = 0;
+	journal_pending_ops = 0;
+	journal_ops_appended = 0;
+	journal_ops_committed = 0;
+	journal_io_error = U_FALSE;
+	journal_group = U_FALSE;
+	journal_reserved = 0;
+
+	for (slot = 0; slot < UFFS_JOURNAL_PAGES; slot++) {
+		valid[slot] = U_FALSE;
+		if (IS_FAIL(readPage(fd, UFFS_JOURNAL_BLOCK, slot, &mini_header, pages[slot], NULL)))
+			continue;
+		memcpy(&hdr[slot], pages[slot], sizeof(uffs_JournalHeader));
+		if (hdr[slot].magic != UFFS_JOURNAL_MAGIC ||
+			hdr[slot].seq % UFFS_JOURNAL_PAGES != (u32)slot ||
+			hdr[slot].used > UFFS_JOURNAL_PAYLOAD_SIZE ||
+			uffs_crc16sum(pages[slot], PAGE_DATA_SIZE_DEFAULT) != mini_header.crc)
+			continue;
+		valid[slot] = U_TRUE;
+		if (hdr[slot].seq > max_seq) {
+			max_seq = hdr[slot].seq;
+			ckpt_seq = hdr[slot].ckpt_seq;
+		}
+	}
+
+	for (seq = ckpt_seq + 1; seq <= max_seq; seq++) {
+		slot = seq % UFFS_JOURNAL_PAGES;
+		if (!valid[slot] || hdr[slot].seq != seq)
+			break;
+		if (len + hdr[slot].used > (int)sizeof(stream))
+			break;
+		memcpy(stream + len, pages[slot] + sizeof(uffs_JournalHeader), hdr[slot].used);
+		len += hdr[slot].used;
+		if (hdr[slot].flags & UFFS_JOURNAL_FLAG_COMMIT_END) {
+			ops += _ApplyRecords(fd, stream, len);
+			commits++;
+			len = 0;
+		}
+	}
+	// 마지막 commit이 COMMIT_END 없이 끝났으면 버림
+
+	if (commits > 0 && diskSync(fd) == U_FAIL) {
+		fprintf(stderr, "[uffs_JournalInit] sync error\n");
+		pthread_mutex_unlock(&journal_lock);
+		return U_FAIL;
+	}
+
+	journal_next_seq = max_seq + 1;
+	journal_ckpt_seq = max_seq;
+
+	pthread_mutex_unlock(&journal_lock);
+
+	fprintf(stdout, "[uffs_JournalInit] finished - replayed %d op(s) in %d commit(s), next seq: %u\n",
+			ops, commits, journal_next_seq);
+	return U_SUCC;
+}
+
+// record 하나를 append 하고 cache에 반영, payload: name과 inline data
+static URET _Append(int fd, const uffs_JournalRec *rec, const char *payload)
+{
+	struct uffs_JournalCacheSt *cache;
+	int len = rec->name_len + _InlineLen(rec);
+	URET ret = U_SUCC;
+
+	pthread_mutex_lock(&journal_lock);
+
+	if (journal_group && pthread_equal(journal_group_owner, pthread_self())) {
+		// BeginGroup에서 남겨 둔 자리에 씀
+		journal_reserved -= sizeof(*rec) + len;
+		if (journal_reserved < 0)
+			journal_reserved = 0;
+	}
+	else if (journal_buf_len + journal_reserved + sizeof(*rec) + len > sizeof(journal_buf)) {
+		if (_Commit(fd) == U_FAIL) {
+			pthread_mutex_unlock(&journal_lock);
+			return U_FAIL;
+		}
+	}
+
+	memcpy(journal_buf + journal_buf_len, rec, sizeof(*rec));
+	if (len > 0)
+		memcpy(journal_buf + journal_buf_len + sizeof(*rec), payload, len);
+	journal_buf_len += sizeof(*rec) + len;
+	if (journal_pending_ops++ == 0) {
+		journal_pending_since = time(NULL);
+		pthread_cond_signal(&journal_timer_cond);
+	}
+	journal_ops_appended++;
+
+	// replay 때와 같은 모양으로 cache
+	cache = &journal_cache[HDR_ADDR(rec->block, rec->page)];
+	_RecToHeader(rec, payload, &cache->mini_header, &cache->info, &cache->tag);
+	if (!cache->valid)
+		journal_block_cached[rec->block]++;
+	cache->valid = 1;
+
+	if (!journal_group && time(NULL) - journal_pending_since >= UFFS_JOURNAL_COMMIT_INTERVAL)
+		ret = _Commit(fd);
+
+	pthread_mutex_unlock(&journal_lock);
+	return ret;
+}
+
+// pending op가 UFFS_JOURNAL_COMMIT_INTERVAL 넘게 남아 있으면 commit (idle mount 용)
+static void * _Timer(void *arg)
+{
+	struct timespec ts;
+
+	(void)arg;
+	pthread_mutex_lock(&journal_lock);
+	while (!journal_timer_stop) {
+		// 열린 group은 EndGroup이 닫으면서 깨움
+		if (journal_pending_ops == 0 || journal_group) {
+			pthread_cond_wait(&journal_timer_cond, &journal_lock);
+			continue;
+		}
+		ts.tv_sec = journal_pending_since + UFFS_JOURNAL_COMMIT_INTERVAL;
+		ts.tv_nsec = 0;
+		if (time(NULL) < ts.tv_sec) {
+			pthread_cond_timedwait(&journal_timer_cond, &journal_lock, &ts);
+			continue;
+		}
+		if (_Commit(journal_timer_fd) == U_FAIL)
+			fprintf(stderr, "[uffs_JournalTimer] commit error\n");
+	}
+	pthread_mutex_unlock(&journal_lock);
+	return NULL;
+}
+
+/**
+ * \brief start idle commit timer thread (fork 뒤 uffs_init에서 호출)
+ * \return thread를 못 만들면 U_FAIL (append/sync 때만 commit)
+ */
+URET uffs_JournalStartTimer(int fd)
+{
+	pthread_mutex_lock(&journal_lock);
+	journal_timer_fd = fd;
+	journal_timer_stop = U_FALSE;
+	journal_timer_running = pthread_create(&journal_timer, NULL, _Timer, NULL) == 0 ? U_TRUE : U_FALSE;
+	pthread_mutex_unlock(&journal_lock);
+
+	if (!journal_timer_running) {
+		fprintf(stderr, "[uffs_JournalStartTimer] timer thread create error\n");
+		return U_FAIL;
+	}
+	return U_SUCC;
+}
+
+/**
+ * \brief stop idle commit timer thread. 남은 op는 commit 하지 않음 (checkpoint에서)
+ */
+void uffs_JournalStopTimer(void)
+{
+	pthread_mutex_lock(&journal_lock);
+	if (!journal_timer_running) {
+		pthread_mutex_unlock(&journal_lock);
+		return;
+	}
+	journal_timer_stop = U_TRUE;
+	pthread_cond_signal(&journal_timer_cond);
+	pthread_mutex_unlock(&journal_lock);
+
+	pthread_join(journal_timer, NULL);
+	journal_timer_running = U_FALSE;
+}
+
+/**
+ * \brief 헤더 페이지 갱신을 journal에 append. 디스크 반영은 commit/checkpoint 때
+ */
+URET uffs_JournalWriteHeader(int fd, int block, int page, uffs_FileInfo *file_info, uffs_Tag *tag)
+{
+	uffs_JournalRec rec = {0};
+	char payload[MAX_FILENAME_LENGTH];
+	int inline_len;
+
+	if (block <= 0 || block == UFFS_JOURNAL_BLOCK || block >= TOTAL_BLOCKS_DEFAULT ||
+		page < 0 || page >= PAGES_PER_BLOCK_DEFAULT) {
+		fprintf(stderr, "[uffs_JournalWriteHeader] invalid header page - block %d, page %d\n", block, page);
+		return U_FAIL;
+	}
+
+	rec.block = block;
+	rec.page = page;
+	rec.name_len = strnlen(file_info->name, MAX_FILENAME_LENGTH - 1);
+	rec.serial = tag->s.serial;
+	rec.parent = tag->s.parent;
+	rec.type = tag->s.type;
+	rec.data_sum = tag->data_sum;
+	rec.len = tag->s.data_len;
+	rec.attr = file_info->attr;
+	rec.create_time = file_info->create_time;
+	rec.last_modify = file_info->last_modify;
+	rec.access = file_info->access;
+
+	// name 뒤에 inline data를 붙여서 기록
+	inline_len = _InlineLen(&rec);
+	if ((file_info->attr & FILE_ATTR_COMPRESS) && inline_len == 0) {
+		fprintf(stderr, "[uffs_JournalWriteHeader] no room for chunk index - block %d\n", block);
+		return U_FAIL;
+	}
+	if (!(file_info->attr & FILE_ATTR_COMPRESS) && (file_info->attr & FILE_ATTR_INLINE) && inline_len != (int)rec.len) {
+		fprintf(stderr, "[uffs_JournalWriteHeader] inline data too long - block %d, len %u\n", block, rec.len);
+		return U_FAIL;
+	}
+	memcpy(payload, file_info->name, rec.name_len);
+	memcpy(payload + rec.name_len, file_info->name + rec.name_len + 1, inline_len);
+
+	return _Append(fd, &rec, payload);
+}
+
+/**
+ * \brief 헤더 페이지를 지움 (unlink/rmdir). 디스크 반영은 commit/checkpoint 때
+ *
+ * 페이지는 빈 페이지가 되고, page 0이면 블록이 metadata 블록으로 남도록 tombstone이 됨
+ */
+URET uffs_JournalDeleteHeader(int fd, int block, int page)
+{
+	uffs_JournalRec rec = {0};
+
+	if (block <= 0 || block == UFFS_JOURNAL_BLOCK || block >= TOTAL_BLOCKS_DEFAULT ||
+		page < 0 || page >= PAGES_PER_BLOCK_DEFAULT) {
+		fprintf(stderr, "[uffs_JournalDeleteHeader] invalid header page - block %d, page %d\n", block, page);
+		return U_FAIL;
+	}
+
+	rec.block = block;
+	rec.page = page;
+	rec.type = UFFS_TYPE_RESV;
+
+	return _Append(fd, &rec, NULL);
+}
+
+/**
+ * \brief checkpoint 안 된 헤더 페이지 찾기
+ * \return U_SUCC: cache에 있음, U_FAIL: 디스크에서 읽어야 함
+ */
+URET uffs_JournalReadHeader(int block, int page, uffs_MiniHeader *mini_header, char *data, uffs_Tag *tag)
+{
+	struct uffs_JournalCacheSt *cache;
+
+	// journal 블록 자체는 cache 대상이 아님 (recovery 중에도 lock 없이 읽힘)
+	if (block <= 0 || block == UFFS_JOURNAL_BLOCK || block >= TOTAL_BLOCKS_DEFAULT ||
+		page < 0 || page >= PAGES_PER_BLOCK_DEFAULT)
+		return U_FAIL;
+
+	// data 블록처럼 cache가 하나도 없는 블록은 lock 없이 바로 디스크로
+	if (__atomic_load_n(&journal_block_cached[block], __ATOMIC_RELAXED) == 0)
+		return U_FAIL;
+
+	pthread_mutex_lock(&journal_lock);
+
+	cache = &journal_cache[HDR_ADDR(block, page)];
+	if (!cache->valid) {
+		pthread_mutex_unlock(&journal_lock);
+		return U_FAIL;
+	}
+
+	if (mini_header != NULL)
+		memcpy(mini_header, &cache->mini_header, sizeof(uffs_MiniHeader));
+	if (data != NULL)
+		memcpy(data, &cache->info, sizeof(uffs_FileInfo));
+	if (tag != NULL)
+		memcpy(tag, &cache->tag, sizeof(uffs_Tag));
+
+	pthread_mutex_unlock(&journal_lock);
+	return U_SUCC;
+}
+
+/**
+ * \brief 이 스레드가 이어서 append 할 op ops개를 한 commit으로 묶음
+ *
+ * uffs_JournalEndGroup까지는 commit 하지 않고, 그 사이 다른 스레드의 commit(sync 포함)은
+ * group이 닫힐 때까지 기다린다. group 안에서 sync/commit/checkpoint를 부르면 안 된다.
+ */
+URET uffs_JournalBeginGroup(int fd, int ops)
+{
+	int need = ops * (sizeof(uffs_JournalRec) + MAX_FILENAME_LENGTH);
+
+	if (need > (int)sizeof(journal_buf)) {
+		fprintf(stderr, "[uffs_JournalBeginGroup] %d op(s) do not fit in one commit\n", ops);
+		return U_FAIL;
+	}
+
+	pthread_mutex_lock(&journal_lock);
+
+	// 한 번에 group 하나, group의 op가 모두 들어갈 자리를 만들고 남겨 둠
+	// leader가 기록 중이면 끝날 때까지 기다림: 그 사이 append 된 op는 leader의 checkpoint가
+	// 제자리에 쓰므로, group이 반만 journal 없이 반영될 수 있음
+	for (;;) {
+		while (journal_group || journal_committing)
+			pthread_cond_wait(&journal_cond, &journal_lock);
+		if (journal_buf_len + need <= (int)sizeof(journal_buf))
+			break;
+		if (_Commit(fd) == U_FAIL) {
+			pthread_mutex_unlock(&journal_lock);
+			return U_FAIL;
+		}
+	}
+	journal_group = U_TRUE;
+	journal_group_owner = pthread_self();
+	journal_reserved = need;
+
+	pthread_mutex_unlock(&journal_lock);
+	return U_SUCC;
+}
+
+/**
+ * \brief uffs_JournalBeginGroup으로 연 group을 닫음. 이제 다른 op와 같이 commit 될 수 있음
+ */
+URET uffs_JournalEndGroup(int fd)
+{
+	URET ret = U_SUCC;
+
+	pthread_mutex_lock(&journal_lock);
+
+	journal_group = U_FALSE;
+	journal_reserved = 0;
+	pthread_cond_broadcast(&journal_cond);
+	pthread_cond_signal(&journal_timer_cond);
+
+	if (journal_pending_ops > 0 && time(NULL) - journal_pending_since >= UFFS_JOURNAL_COMMIT_INTERVAL)
+		ret = _Commit(fd);
+
+	pthread_mutex_unlock(&journal_lock);
+	return ret;
+}
+
+/**
+ * \brief 모아둔 op들을 journal에 한 번에 기록 (group commit)
+ */
+URET uffs_JournalCommit(int fd)
+{
+	URET ret;
+
+	pthread_mutex_lock(&journal_lock);
+	ret = _Commit(fd);
+	pthread_mutex_unlock(&journal_lock);
+
+	return ret;
+}
+
+/**
+ * \brief fsync/flush 용. 호출 전에 append 된 op가 모두 디스크에 내려갈 때까지 기다림
+ *
+ * 동시에 들어온 호출들은 한 번의 commit으로 묶인다: leader가 기록 중이면
+ * follower는 기다리고, 그 사이 쌓인 op는 다음 leader가 한꺼번에 commit 한다.
+ * data page는 헤더 갱신과 함께 append 되므로 pending op가 없으면 할 일도 없다.
+ */
+URET uffs_JournalSync(int fd)
+{
+	URET ret = U_SUCC;
+	u32 target;
+
+	pthread_mutex_lock(&journal_lock);
+
+	target = journal_ops_appended;
+	while (ret == U_SUCC && (int)(journal_ops_committed - target) < 0) {
+		if (journal_committing)
+			pthread_cond_wait(&journal_cond, &journal_lock);	// follower
+		else
+			ret = _Commit(fd);									// leader
+	}
+	if (journal_io_error)
+		ret = U_FAIL;
+
+	pthread_mutex_unlock(&journal_lock);
+	return ret;
+}
+
+/**
+ * \brief commit 후 cache의 헤더 페이지를 모두 제자리에 반영
+ */
+URET uffs_JournalCheckpoint(int fd)
+{
+	URET ret;
+
+	pthread_mutex_lock(&journal_lock);
+	ret = _Commit(fd);
+	if (ret == U_SUCC)
+		ret = _Checkpoint(fd);
+	pthread_mutex_unlock(&journal_lock);
+
+	return ret;
+}
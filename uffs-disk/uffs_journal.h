@@ -0,0 +1,75 @@
+/**
+ * \file uffs_journal.h
+ * \brief metadata journal for file/dir header pages
+ *
+ * 헤더 페이지(metadata 블록의 페이지) 갱신은 바로 제자리에 쓰지 않고
+ * UFFS_JOURNAL_BLOCK의 페이지 ring에 record로 append 한다.
+ * 여러 op를 모아 한 번에 commit 하고(group commit), 제자리 반영(checkpoint)은
+ * ring이 찰 때나 unmount 시에 몰아서 한다. mount 시에는 ring을 replay 한다.
+ */
+
+#ifndef _UFFS_JOURNAL_H_
+#define _UFFS_JOURNAL_H_
+
+#include "uffs_types.h"
+#include "uffs_disk.h"
+
+#define UFFS_JOURNAL_MAGIC			0x4C4E524A	//!< "JRNL"
+#define UFFS_JOURNAL_PAGES			PAGES_PER_BLOCK_DEFAULT	//!< ring 크기
+#define UFFS_JOURNAL_GROUP_PAGES	4			//!< 한 번의 commit에 쓰는 최대 페이지 수
+#define UFFS_JOURNAL_COMMIT_INTERVAL	1		//!< pending op가 이 시간(초) 이상 지나면 commit
+
+#define UFFS_JOURNAL_FLAG_COMMIT_END	0x01	//!< commit의 마지막 페이지
+
+/**
+ * \struct uffs_JournalHeaderSt
+ * \brief journal page의 data 영역 앞부분
+ */
+struct uffs_JournalHeaderSt {
+	u32 magic;			//!< #UFFS_JOURNAL_MAGIC
+	u32 seq;			//!< page sequence number, 1부터 증가
+	u32 ckpt_seq;		//!< 이 seq까지는 제자리에 반영됨
+	u16 used;			//!< payload 사용량
+	u8 flags;			//!< #UFFS_JOURNAL_FLAG_COMMIT_END
+	u8 reserved;
+};
+typedef struct uffs_JournalHeaderSt uffs_JournalHeader;
+
+#define UFFS_JOURNAL_PAYLOAD_SIZE	(PAGE_DATA_SIZE_DEFAULT - sizeof(uffs_JournalHeader))
+
+/**
+ * \struct uffs_JournalRecSt
+ * \brief 헤더 페이지 하나를 통째로 다시 만들 수 있는 redo record, 뒤에 name이 붙음
+ *
+ * attr에 #FILE_ATTR_INLINE이 있으면 name 바로 뒤에 len bytes의 inline data가 이어짐
+ * (#FILE_ATTR_COMPRESS면 len 대신 chunk index 크기만큼)
+ */
+struct uffs_JournalRecSt {
+	u16 block;			//!< 헤더 페이지가 있는 (metadata) 블록
+	u16 name_len;		//!< 뒤따르는 name 길이 (NULL 제외)
+	u16 serial;
+	u16 parent;
+	u8 type;			//!< #UFFS_TYPE_DIR, #UFFS_TYPE_FILE, #UFFS_TYPE_RESV면 헤더를 지움
+	u8 page;			//!< 블록 안에서 헤더 페이지 위치
+	u16 data_sum;
+	u32 len;			//!< file length
+	u32 attr;
+	u32 create_time;
+	u32 last_modify;
+	u32 access;
+};
+typedef struct uffs_JournalRecSt uffs_JournalRec;
+
+URET uffs_JournalInit(int fd);
+URET uffs_JournalWriteHeader(int fd, int block, int page, uffs_FileInfo *file_info, uffs_Tag *tag);
+URET uffs_JournalDeleteHeader(int fd, int block, int page);
+URET uffs_JournalReadHeader(int block, int page, uffs_MiniHeader *mini_header, char *data, uffs_Tag *tag);
+URET uffs_JournalBeginGroup(int fd, int ops);
+URET uffs_JournalEndGroup(int fd);
+URET uffs_JournalCommit(int fd);
+URET uffs_JournalSync(int fd);
+URET uffs_JournalCheckpoint(int fd);
+URET uffs_JournalStartTimer(int fd);
+void uffs_JournalStopTimer(void);
+
+#endif
@@ -0,0 +1,193 @@
+/**
+ * \file uffs_lz4.c
+ * \brief LZ4 block format compressor/decompressor (frame 없이 block만)
+ *
+ * 결과는 liblz4의 LZ4_compress_default / LZ4_decompress_safe와 호환된다.
+ * 압축은 4바이트 hash 한 번으로 이전 위치를 찾는 greedy 방식이라
+ * liblz4 기본 모드와 비슷한 속도/압축률을 낸다.
+ *
+ * sequence: token(literal 길이 4 bits | match 길이-4 4 bits), [literal 길이 추가 바이트],
+ *           literals, offset(LE 16 bits), [match 길이 추가 바이트]
+ * 마지막 sequence는 literal만 있고, 마지막 5바이트는 항상 literal이어야 한다.
+ */
+
+#include "uffs_lz4.h"
+
+#include <string.h>
+
+#define LZ4_MINMATCH		4
+#define LZ4_LASTLITERALS	5		//!< 마지막 5바이트는 literal
+#define LZ4_MFLIMIT			12		//!< 마지막 12바이트 안에서는 match를 시작하지 않음
+#define LZ4_MAX_OFFSET		65535
+#define LZ4_HASH_LOG		12
+
+static u32 _Read32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static u32 _Hash(u32 seq)
+{
+	return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+// 길이 15 이상일 때 붙는 추가 바이트 (255씩 이어짐)
+static u8 * _PutLength(u8 *op, u8 *oend, int len)
+{
+	while (len >= 255) {
+		if (op >= oend)
+			return NULL;
+		*op++ = 255;
+		len -= 255;
+	}
+	if (op >= oend)
+		return NULL;
+	*op++ = (u8)len;
+	return op;
+}
+
+// literal [anchor, anchor + lit_len) 와 match 하나를 sequence로 씀. match_len == 0이면 마지막 sequence
+static u8 * _PutSequence(u8 *op, u8 *oend, const u8 *anchor, int lit_len, int offset, int match_len)
+{
+	u8 *token;
+
+	if (op >= oend)
+		return NULL;
+	token = op++;
+	*token = (u8)((lit_len >= 15 ? 15 : lit_len) << 4);
+	if (lit_len >= 15 && (op = _PutLength(op, oend, lit_len - 15)) == NULL)
+		return NULL;
+
+	if (op + lit_len > oend)
+		return NULL;
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	if (match_len == 0)
+		return op;
+
+	if (op + 2 > oend)
+		return NULL;
+	*op++ = (u8)offset;
+	*op++ = (u8)(offset >> 8);
+
+	match_len -= LZ4_MINMATCH;
+	*token |= (u8)(match_len >= 15 ? 15 : match_len);
+	if (match_len >= 15 && (op = _PutLength(op, oend, match_len - 15)) == NULL)
+		return NULL;
+	return op;
+}
+
+/**
+ * \brief compress src into LZ4 block
+ * \return 압축된 길이, dst_cap 안에 들어가지 않으면 0
+ */
+int uffs_Lz4Compress(const void *src, int src_len, void *dst, int dst_cap)
+{
+	int table[1 << LZ4_HASH_LOG];	//!< hash -> 위치 + 1 (0: 비어 있음)
+	const u8 *base = (const u8 *)src;
+	const u8 *ip = base, *anchor = base;
+	const u8 *mflimit = base + src_len - LZ4_MFLIMIT;
+	const u8 *matchlimit = base + src_len - LZ4_LASTLITERALS;
+	u8 *op = (u8 *)dst, *oend = (u8 *)dst + dst_cap;
+
+	if (src_len < 0 || dst_cap <= 0)
+		return 0;
+
+	memset(table, 0, sizeof(table));
+
+	if (src_len > LZ4_MFLIMIT) {
+		while (ip < mflimit) {
+			u32 seq = _Read32(ip);
+			u32 h = _Hash(seq);
+			int prev = table[h];
+			const u8 *ref = base + prev - 1;
+			int match_len;
+
+			table[h] = (int)(ip - base) + 1;
+			if (prev == 0 || ip - ref > LZ4_MAX_OFFSET || _Read32(ref) != seq) {
+				ip++;
+				continue;
+			}
+
+			match_len = LZ4_MINMATCH;
+			while (ip + match_len < matchlimit && ref[match_len] == ip[match_len])
+				match_len++;
+
+			op = _PutSequence(op, oend, anchor, (int)(ip - anchor), (int)(ip - ref), match_len);
+			if (op == NULL)
+				return 0;
+
+			ip += match_len;
+			anchor = ip;
+		}
+	}
+
+	op = _PutSequence(op, oend, anchor, (int)(base + src_len - anchor), 0, 0);
+	if (op == NULL)
+		return 0;
+	return (int)(op - (u8 *)dst);
+}
+
+/**
+ * \brief decompress LZ4 block
+ * \return 풀린 길이, 깨진 입력이거나 dst_cap을 넘으면 -1
+ */
+int uffs_Lz4Decompress(const void *src, int src_len, void *dst, int dst_cap)
+{
+	const u8 *ip = (const u8 *)src, *iend = (const u8 *)src + src_len;
+	u8 *op = (u8 *)dst, *oend = (u8 *)dst + dst_cap;
+
+	while (ip < iend) {
+		int token = *ip++;
+		int lit_len = token >> 4;
+		int match_len, offset;
+		const u8 *ref;
+
+		if (lit_len == 15) {
+			do {
+				if (ip >= iend)
+					return -1;
+				lit_len += *ip;
+			} while (*ip++ == 255);
+		}
+		if (lit_len > iend - ip || lit_len > oend - op)
+			return -1;
+		memcpy(op, ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+
+		// 마지막 sequence
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - (u8 *)dst)
+			return -1;
+
+		match_len = token & 15;
+		if (match_len == 15) {
+			do {
+				if (ip >= iend)
+					return -1;
+				match_len += *ip;
+			} while (*ip++ == 255);
+		}
+		match_len += LZ4_MINMATCH;
+		if (match_len > oend - op)
+			return -1;
+
+		// offset < match_len 이면 겹쳐서 반복되므로 바이트 단위로 복사
+		ref = op - offset;
+		while (match_len-- > 0)
+			*op++ = *ref++;
+	}
+
+	return (int)(op - (u8 *)dst);
+}
@@ -0,0 +1,14 @@
+/**
+ * \file uffs_lz4.h
+ * \brief LZ4 block format compressor/decompressor (frame 없이 block만)
+ */
+
+#ifndef _UFFS_LZ4_H_
+#define _UFFS_LZ4_H_
+
+#include "uffs_types.h"
+
+int uffs_Lz4Compress(const void *src, int src_len, void *dst, int dst_cap);
+int uffs_Lz4Decompress(const void *src, int src_len, void *dst, int dst_cap);
+
+#endif
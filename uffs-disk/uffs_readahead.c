@@ -0,0 +1,391 @@
+/**
+ * \file uffs_readahead.c
+ * \brief per-open-file sequential readahead for file data pages
+ *
+ * 페이지 위치는 파일 안의 페이지 번호(file page)로 본다. 블록 map 파일은
+ * PAGES_PER_BLOCK_DEFAULT 페이지마다 다른 디바이스 블록에 있으므로, 읽는 쪽이
+ * 지금 블록 다음의 파일 블록이 있는 디바이스 블록을 같이 넘겨 주면
+ * window가 블록 경계를 넘어 그 블록의 앞 페이지까지 prefetch 한다.
+ *
+ * 미리 읽은 페이지는 uffs_ReadAhead 안의 cache(블록 두 개 크기, file page로 찾음)에 둔다.
+ * 블록마다 generation을 두고 write 전후로 올려서, write와 겹친 prefetch나
+ * write 이전에 읽어둔 페이지는 쓰이지 않게 한다.
+ *
+ * prefetch는 스레드 하나가 queue에서 꺼내 readPages로 읽는다.
+ * 파일마다 prefetch는 한 번에 하나만 걸리고, 읽는 중인 페이지를 요청하면
+ * 끝날 때까지 기다렸다가 cache에서 가져간다.
+ */
+
+#include "uffs_readahead.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RA_QUEUE_SIZE		64
+#define RA_CACHE_PAGES		(UFFS_RA_MAX_PAGES * 2)	//!< 지금 블록 + 다음 블록
+#define RA_FILE_BLOCK(page)	((page) / PAGES_PER_BLOCK_DEFAULT)
+#define RA_BLOCK_PAGE(page)	((page) % PAGES_PER_BLOCK_DEFAULT)
+
+struct uffs_ReadAheadSt {
+	int refs;				//!< open handle + queue/worker가 잡고 있는 수
+	UBOOL closed;
+
+	// sequential 판단
+	int next_page;			//!< 다음에 이어서 읽힐 file page
+	int window;
+
+	// cache, file page % RA_CACHE_PAGES 자리에 둠
+	int page[RA_CACHE_PAGES];	//!< 자리에 있는 file page
+	int block[RA_CACHE_PAGES];	//!< 그 페이지를 읽은 디바이스 블록
+	u32 gen[RA_CACHE_PAGES];	//!< 읽을 때의 block generation
+	u8 valid[RA_CACHE_PAGES];
+	u8 used[RA_CACHE_PAGES];
+	char data[RA_CACHE_PAGES][PAGE_DATA_SIZE_DEFAULT];
+
+	// prefetch 중인 구간 (file page)
+	UBOOL pf_busy;
+	int pf_start, pf_count;
+
+	uffs_ReadAheadStat stat;
+};
+
+/** file page start부터 count 페이지, 많아야 파일 블록 두 개에 걸침 */
+struct ra_JobSt {
+	uffs_ReadAhead *ra;
+	int start;
+	int count;
+	int block[2];			//!< RA_FILE_BLOCK(start)와 그 다음 파일 블록의 디바이스 블록
+	u32 gen[2];
+};
+
+static pthread_mutex_t ra_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ra_cond = PTHREAD_COND_INITIALIZER;		//!< queue에 job이 들어옴
+static pthread_cond_t ra_done_cond = PTHREAD_COND_INITIALIZER;	//!< prefetch 하나가 끝남
+
+static u32 ra_block_gen[TOTAL_BLOCKS_DEFAULT];
+static uffs_ReadAheadStat ra_total;
+
+static struct ra_JobSt ra_queue[RA_QUEUE_SIZE];
+static int ra_queue_head = 0, ra_queue_len = 0;
+
+static pthread_t ra_worker;
+static UBOOL ra_running = U_FALSE;
+static UBOOL ra_stop = U_FALSE;
+static int ra_fd = -1;
+
+// ra_lock 잡고 호출
+static void _Put(uffs_ReadAhead *ra)
+{
+	if (--ra->refs == 0)
+		free(ra);
+}
+
+// ra_lock 잡고 호출. 자리를 비움, 쓰이지 않은 페이지였으면 wasted
+static void _Drop(uffs_ReadAhead *ra, int slot)
+{
+	if (ra->valid[slot] && !ra->used[slot]) {
+		ra->stat.wasted++;
+		ra_total.wasted++;
+	}
+	ra->valid[slot] = 0;
+	ra->used[slot] = 0;
+}
+
+// ra_lock 잡고 호출. block에 있는 file page가 cache에 있으면 그 자리, 없으면 -1
+static int _Lookup(uffs_ReadAhead *ra, int page, int block)
+{
+	int slot = page % RA_CACHE_PAGES;
+
+	if (!ra->valid[slot] || ra->page[slot] != page)
+		return -1;
+	// 그 사이 write가 있었거나 파일 블록이 다른 디바이스 블록으로 옮겨감
+	if (ra->block[slot] != block || ra->gen[slot] != ra_block_gen[block]) {
+		_Drop(ra, slot);
+		return -1;
+	}
+	return slot;
+}
+
+static void * _Worker(void *arg)
+{
+	static char buf[UFFS_RA_MAX_PAGES][PAGE_DATA_SIZE_DEFAULT];
+	uffs_PageReq reqs[UFFS_RA_MAX_PAGES];
+	struct ra_JobSt job;
+	uffs_ReadAhead *ra;
+	int i, n, k, page, slot;
+
+	pthread_mutex_lock(&ra_lock);
+
+	while (1) {
+		while (!ra_stop && ra_queue_len == 0)
+			pthread_cond_wait(&ra_cond, &ra_lock);
+		if (ra_queue_len == 0)
+			break;
+
+		job = ra_queue[ra_queue_head];
+		ra_queue_head = (ra_queue_head + 1) % RA_QUEUE_SIZE;
+		ra_queue_len--;
+		ra = job.ra;
+
+		k = RA_FILE_BLOCK(job.start);
+		if (ra_stop || ra->closed || job.gen[0] != ra_block_gen[job.block[0]]) {
+			ra->pf_busy = U_FALSE;
+			pthread_cond_broadcast(&ra_done_cond);
+			_Put(ra);
+			continue;
+		}
+
+		pthread_mutex_unlock(&ra_lock);
+
+		for (i = 0; i < job.count; i++) {
+			page = job.start + i;
+			reqs[i].block_id = job.block[RA_FILE_BLOCK(page) - k];
+			reqs[i].page_Id = RA_BLOCK_PAGE(page);
+			reqs[i].mini_header = NULL;
+			reqs[i].data = buf[i];
+			reqs[i].tag = NULL;
+		}
+		readPages(ra_fd, reqs, job.count);
+
+		pthread_mutex_lock(&ra_lock);
+
+		// 읽는 동안 write가 있었던 블록의 페이지는 버림
+		for (i = 0, n = 0; i < job.count; i++) {
+			page = job.start + i;
+			if (IS_FAIL(reqs[i].ret) || job.gen[RA_FILE_BLOCK(page) - k] != ra_block_gen[reqs[i].block_id] ||
+				_Lookup(ra, page, reqs[i].block_id) >= 0)
+				continue;
+			slot = page % RA_CACHE_PAGES;
+			_Drop(ra, slot);
+			memcpy(ra->data[slot], buf[i], PAGE_DATA_SIZE_DEFAULT);
+			ra->page[slot] = page;
+			ra->block[slot] = reqs[i].block_id;
+			ra->gen[slot] = job.gen[RA_FILE_BLOCK(page) - k];
+			ra->valid[slot] = 1;
+			n++;
+		}
+		ra->stat.prefetched += n;
+		ra_total.prefetched += n;
+
+		ra->pf_busy = U_FALSE;
+		pthread_cond_broadcast(&ra_done_cond);
+		_Put(ra);
+	}
+
+	pthread_mutex_unlock(&ra_lock);
+	return NULL;
+}
+
+// ra_lock 잡고 호출. 방금 읽은 페이지들이 파일 블록 k(디바이스 블록 block)에 있음
+static void _Schedule(uffs_ReadAhead *ra, int k, int block, int next_block, int file_pages)
+{
+	struct ra_JobSt *job;
+	int start = ra->next_page;
+	int end = ra->next_page + ra->window;
+	int blocks[3] = { block, next_block, -1 };
+	int limit;
+
+	if (!ra_running || ra->pf_busy || ra_queue_len == RA_QUEUE_SIZE)
+		return;
+
+	// 디바이스 블록을 아는 파일 블록까지만 (hole이나 모르는 블록에서 멈춤)
+	limit = next_block > 0 ? (k + 2) * PAGES_PER_BLOCK_DEFAULT : (k + 1) * PAGES_PER_BLOCK_DEFAULT;
+	if (end > limit)
+		end = limit;
+	if (end > file_pages)
+		end = file_pages;
+	// 이미 cache에 있는 앞부분은 건너뜀
+	while (start < end && _Lookup(ra, start, blocks[RA_FILE_BLOCK(start) - k]) >= 0)
+		start++;
+	if (start >= end)
+		return;
+
+	job = &ra_queue[(ra_queue_head + ra_queue_len) % RA_QUEUE_SIZE];
+	job->ra = ra;
+	job->start = start;
+	job->count = end - start;
+	job->block[0] = blocks[RA_FILE_BLOCK(start) - k];
+	job->block[1] = blocks[RA_FILE_BLOCK(start) - k + 1];
+	job->gen[0] = ra_block_gen[job->block[0]];
+	job->gen[1] = job->block[1] > 0 ? ra_block_gen[job->block[1]] : 0;
+	ra_queue_len++;
+
+	ra->refs++;
+	ra->pf_busy = U_TRUE;
+	ra->pf_start = job->start;
+	ra->pf_count = job->count;
+	pthread_cond_signal(&ra_cond);
+}
+
+/**
+ * \brief start prefetch thread
+ * \return U_FAIL이면 prefetch 없이 동작 (uffs_ReadAheadRead는 그대로 쓸 수 있음)
+ */
+URET uffs_ReadAheadInit(int fd)
+{
+	pthread_mutex_lock(&ra_lock);
+	ra_fd = fd;
+	ra_stop = U_FALSE;
+	ra_running = pthread_create(&ra_worker, NULL, _Worker, NULL) == 0 ? U_TRUE : U_FALSE;
+	pthread_mutex_unlock(&ra_lock);
+
+	if (!ra_running) {
+		fprintf(stderr, "[uffs_ReadAheadInit] prefetch thread create error\n");
+		return U_FAIL;
+	}
+	return U_SUCC;
+}
+
+void uffs_ReadAheadRelease(void)
+{
+	pthread_mutex_lock(&ra_lock);
+	if (!ra_running) {
+		pthread_mutex_unlock(&ra_lock);
+		return;
+	}
+	ra_stop = U_TRUE;
+	pthread_cond_broadcast(&ra_cond);
+	pthread_mutex_unlock(&ra_lock);
+
+	pthread_join(ra_worker, NULL);
+	ra_running = U_FALSE;
+}
+
+uffs_ReadAhead * uffs_ReadAheadOpen(void)
+{
+	uffs_ReadAhead *ra;
+
+	ra = (uffs_ReadAhead *)malloc(sizeof(uffs_ReadAhead));
+	if (ra == NULL)
+		return NULL;
+
+	memset(ra, 0, sizeof(uffs_ReadAhead));
+	ra->refs = 1;
+	return ra;
+}
+
+/**
+ * \brief release per-open-file state
+ * \param[out] stat 이 파일의 metrics, NULL 가능
+ */
+void uffs_ReadAheadClose(uffs_ReadAhead *ra, uffs_ReadAheadStat *stat)
+{
+	int i;
+
+	if (ra == NULL)
+		return;
+
+	pthread_mutex_lock(&ra_lock);
+	for (i = 0; i < RA_CACHE_PAGES; i++)
+		_Drop(ra, i);
+	if (stat != NULL) {
+		*stat = ra->stat;
+		stat->window = ra->window;
+	}
+	ra->closed = U_TRUE;
+	_Put(ra);
+	pthread_mutex_unlock(&ra_lock);
+}
+
+/**
+ * \brief read file data pages through readahead cache
+ *
+ * cache에 있는 페이지는 복사하고, 없는 페이지만 readPages로 읽는다.
+ * 그 다음 sequential이면 window를 키우고 이어지는 페이지를 prefetch 한다.
+ *
+ * \param[in] file_page reqs[0]의 파일 안 페이지 번호 (블록 하나짜리 파일은 page_Id와 같음)
+ * \param[in] file_pages 파일의 페이지 수, prefetch는 이 안에서만
+ * \param[in] next_block 다음 파일 블록이 있는 디바이스 블록, 없거나 hole이면 -1
+ * \param[in,out] reqs 한 블록의 연속된 페이지들 (data 필수, 결과는 ret)
+ * \return 모든 페이지를 읽었으면 U_SUCC
+ */
+URET uffs_ReadAheadRead(uffs_ReadAhead *ra, int fd, int file_page, int file_pages, int next_block,
+						uffs_PageReq *reqs, int count)
+{
+	uffs_PageReq *miss[UFFS_RA_MAX_PAGES];
+	uffs_PageReq mreqs[UFFS_RA_MAX_PAGES];
+	int i, n = 0, slot, block, start_page;
+	URET ret = U_SUCC;
+
+	if (count <= 0)
+		return U_SUCC;
+
+	block = reqs[0].block_id;
+	start_page = reqs[0].page_Id;
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT || start_page < 0 ||
+		start_page + count > UFFS_RA_MAX_PAGES || RA_BLOCK_PAGE(file_page) != start_page) {
+		return readPages(fd, reqs, count);
+	}
+	if (next_block >= TOTAL_BLOCKS_DEFAULT)
+		next_block = -1;
+
+	pthread_mutex_lock(&ra_lock);
+
+	// sequential 판단 (블록 경계를 넘어도 이어짐)
+	if (file_page == ra->next_page)
+		ra->window = ra->window == 0 ? UFFS_RA_INIT_PAGES :
+					 (ra->window * 2 > UFFS_RA_MAX_PAGES ? UFFS_RA_MAX_PAGES : ra->window * 2);
+	else
+		ra->window = 0;
+	ra->next_page = file_page + count;
+	if (ra->window > ra_total.window)
+		ra_total.window = ra->window;
+
+	// prefetch 중인 페이지면 기다림
+	while (ra->pf_busy && ra->pf_start < file_page + count && file_page < ra->pf_start + ra->pf_count)
+		pthread_cond_wait(&ra_done_cond, &ra_lock);
+
+	for (i = 0; i < count; i++) {
+		slot = _Lookup(ra, file_page + i, block);
+		if (slot >= 0) {
+			memcpy(reqs[i].data, ra->data[slot], PAGE_DATA_SIZE_DEFAULT);
+			ra->used[slot] = 1;
+			reqs[i].ret = UFFS_FLASH_NO_ERR;
+			continue;
+		}
+		miss[n] = &reqs[i];
+		mreqs[n++] = reqs[i];
+	}
+	ra->stat.hits += count - n;
+	ra->stat.misses += n;
+	ra_total.hits += count - n;
+	ra_total.misses += n;
+
+	if (ra->window > 0)
+		_Schedule(ra, RA_FILE_BLOCK(file_page), block, next_block, file_pages);
+
+	pthread_mutex_unlock(&ra_lock);
+
+	if (n > 0) {
+		readPages(fd, mreqs, n);
+		for (i = 0; i < n; i++)
+			miss[i]->ret = mreqs[i].ret;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (IS_FAIL(reqs[i].ret))
+			ret = U_FAIL;
+	}
+	return ret;
+}
+
+/**
+ * \brief block의 data가 바뀜, write 전과 후에 모두 호출
+ */
+void uffs_ReadAheadInvalidate(int block)
+{
+	if (block <= 0 || block >= TOTAL_BLOCKS_DEFAULT)
+		return;
+
+	pthread_mutex_lock(&ra_lock);
+	ra_block_gen[block]++;
+	pthread_mutex_unlock(&ra_lock);
+}
+
+void uffs_ReadAheadGetStat(uffs_ReadAheadStat *stat)
+{
+	pthread_mutex_lock(&ra_lock);
+	*stat = ra_total;
+	pthread_mutex_unlock(&ra_lock);
+}
@@ -0,0 +1,46 @@
+/**
+ * \file uffs_readahead.h
+ * \brief per-open-file sequential readahead for file data pages
+ *
+ * open 한 파일마다 window를 두고, 연속된 offset으로 읽으면 sequential로 보고
+ * window를 두 배씩(최대 #UFFS_RA_MAX_PAGES) 키우면서 다음 페이지들을
+ * 백그라운드 스레드가 미리 읽어 둔다. 중간에 다른 offset을 읽으면 window는 0.
+ * 블록 map 파일은 파일 안의 페이지 번호로 이어 보므로 블록 경계에서 끊기지 않는다.
+ */
+
+#ifndef _UFFS_READAHEAD_H_
+#define _UFFS_READAHEAD_H_
+
+#include "uffs_types.h"
+#include "uffs_disk.h"
+
+#define UFFS_RA_INIT_PAGES		8		//!< sequential로 판단했을 때 첫 window
+#define UFFS_RA_MAX_PAGES		PAGES_PER_BLOCK_DEFAULT	//!< window 상한 (한 번에 읽는 페이지도 블록 하나 안)
+
+typedef struct uffs_ReadAheadSt uffs_ReadAhead;
+
+/**
+ * \struct uffs_ReadAheadStatSt
+ * \brief readahead metrics (페이지 단위)
+ */
+struct uffs_ReadAheadStatSt {
+	u32 hits;			//!< 미리 읽어둔 페이지로 처리한 수
+	u32 misses;			//!< 직접 읽은 페이지 수
+	u32 prefetched;		//!< 백그라운드로 읽은 페이지 수
+	u32 wasted;			//!< 미리 읽었지만 쓰이지 않고 버려진 페이지 수
+	int window;			//!< 현재 window (global 통계에서는 최대값)
+};
+typedef struct uffs_ReadAheadStatSt uffs_ReadAheadStat;
+
+URET uffs_ReadAheadInit(int fd);
+void uffs_ReadAheadRelease(void);
+
+uffs_ReadAhead * uffs_ReadAheadOpen(void);
+void uffs_ReadAheadClose(uffs_ReadAhead *ra, uffs_ReadAheadStat *stat);
+
+URET uffs_ReadAheadRead(uffs_ReadAhead *ra, int fd, int file_page, int file_pages, int next_block,
+						uffs_PageReq *reqs, int count);
+void uffs_ReadAheadInvalidate(int block);
+void uffs_ReadAheadGetStat(uffs_ReadAheadStat *stat);
+
+#endif
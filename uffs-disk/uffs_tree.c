@@ -5,20 +5,27 @@
  */
 
 #include "uffs_tree.h"
+#include "uffs_journal.h"
+#include "uffs_io.h"
+#include "uffs_dedup.h"
+#include "uffs_blockmap.h"
 
 #include <string.h>
 
-static void _InsertToEntry(uffs_Device *dev, uint64_t *entry,
+// tree 노드 pool 메모리 (노드 하나 16 bytes, chain은 이 안의 index로 이음)
+static TreeNode tree_nodes_pool_buf[MAX_TREE_NODES];
+
+static void _InsertToEntry(uffs_Device *dev, u16 *entry,
 						   int hash, TreeNode *node)
 {
     // fprintf(stdout,"[_InsertToEntry] called\n");
 	node->hash_next = entry[hash];
 	node->hash_prev = EMPTY_NODE;
-    if ((TreeNode*)node->hash_next != EMPTY_NODE) {
-        TreeNode* temp_node = (TreeNode*)node->hash_next;
-        temp_node->hash_prev = (uint64_t) node;
+    if (node->hash_next != EMPTY_NODE) {
+        TreeNode* temp_node = FROM_IDX(node->hash_next, TPOOL(dev));
+        temp_node->hash_prev = TO_IDX(node, TPOOL(dev));
     }
-    entry[hash] = node;
+    entry[hash] = TO_IDX(node, TPOOL(dev));
     // fprintf(stdout,"[_InsertToEntry] finished\n");
 }
 
@@ -66,12 +73,59 @@ void uffs_InsertNodeToTree(uffs_Device *dev, u8 type, TreeNode *node)
     fprintf(stdout,"[uffs_InsertNodeToTree] finished\n");
 }
 
+// hash chain에서 노드를 뺌 (hash_prev가 있어서 chain을 따라가지 않음)
+// 노드의 key(serial 등)를 바꾸기 전에 호출
+void uffs_BreakFromEntry(uffs_Device *dev, u8 type, TreeNode *node)
+{
+    u16 *entry;
+    int hash;
+    u16 prev = node->hash_prev;
+    u16 next = node->hash_next;
+
+    switch (type) {
+    case UFFS_TYPE_DIR:
+        entry = dev->tree.dir_entry;
+        hash = GET_DIR_HASH(node->u.dir.serial);
+        break;
+    case UFFS_TYPE_FILE:
+        entry = dev->tree.file_entry;
+        hash = GET_FILE_HASH(node->u.file.serial);
+        break;
+    case UFFS_TYPE_DATA:
+        entry = dev->tree.data_entry;
+        hash = GET_DATA_HASH(node->u.data.parent, node->u.data.serial);
+        break;
+    default:
+        fprintf(stderr, "[uffs_BreakFromEntry] node type error\n");
+        return;
+    }
+
+    if (prev != EMPTY_NODE) {
+        FROM_IDX(prev, TPOOL(dev))->hash_next = next;
+    } else {
+        entry[hash] = next;
+    }
+    if (next != EMPTY_NODE) {
+        FROM_IDX(next, TPOOL(dev))->hash_prev = prev;
+    }
+    node->hash_next = EMPTY_NODE;
+    node->hash_prev = EMPTY_NODE;
+}
+
 URET uffs_TreeInit(uffs_Device *dev)
 {
     fprintf(stdout, "[uffs_TreeInit] called\n");
 
     int i;
 
+    if (uffs_PoolInit(TPOOL(dev), tree_nodes_pool_buf, sizeof(tree_nodes_pool_buf),
+                      sizeof(TreeNode), MAX_TREE_NODES) == U_FAIL) {
+        fprintf(stderr, "[uffs_TreeInit] tree node pool init error\n");
+        return U_FAIL;
+    }
+    fprintf(stdout, "[uffs_TreeInit] %d tree nodes, %d bytes\n",
+            MAX_TREE_NODES, (int)sizeof(tree_nodes_pool_buf));
+
     for (i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
 		dev->tree.dir_entry[i] = EMPTY_NODE;
 	}
@@ -90,42 +144,172 @@ URET uffs_TreeInit(uffs_Device *dev)
 	return U_SUCC;
 }
 
+/**
+ * \brief pool에서 tree 노드 하나를 받음 (0으로 채워서 줌)
+ * \return pool이 비었으면 NULL
+ */
+TreeNode * uffs_TreeNodeGet(uffs_Device *dev) {
+    TreeNode *node = (TreeNode *)uffs_PoolGet(TPOOL(dev));
+
+    if (node == NULL) {
+        fprintf(stderr, "[uffs_TreeNodeGet] out of tree nodes\n");
+        return NULL;
+    }
+    memset(node, 0, sizeof(TreeNode));
+    return node;
+}
+
+/**
+ * \brief tree 노드를 pool에 돌려줌 (chain에서는 먼저 빼고 호출)
+ */
+void uffs_TreeNodePut(uffs_Device *dev, TreeNode *node) {
+    if (node != NULL) {
+        uffs_PoolPut(TPOOL(dev), node);
+    }
+}
+
 static u32 GET_CURRENT_TIME() {
     time_t now = time(NULL);
     return (u32)now;
 }
 
+// 헤더 페이지 하나를 dir/file 노드로 만들어 트리에 넣음
+// dedup 파일은 공유 블록에 tag가 따로 없어서 헤더의 참조로 data 노드도 만듦
+static void buildHeaderNode(uffs_Device *dev, int block, int page, uffs_Tag *tag, char *data) {
+    TreeNode* node;
+    uffs_FileInfo *info = (uffs_FileInfo *)data;
+    uffs_DedupRef ref;
+
+    if (tag->s.type != UFFS_TYPE_DIR && tag->s.type != UFFS_TYPE_FILE) {
+        return;
+    }
+
+    node = uffs_TreeNodeGet(dev);
+    if (node == NULL) {
+        return;
+    }
+    if (tag->s.type == UFFS_TYPE_DIR) {
+        node->u.dir.parent = tag->s.parent;
+        node->u.dir.serial = tag->s.serial;
+        node->u.dir.hdr = HDR_ADDR(block, page);
+        node->u.dir.checksum = tag->data_sum;
+        uffs_InsertToDirEntry(dev, node);
+        fprintf(stdout, "[uffs_BuildTree] made dir node - name: %s\n", ((uffs_FileInfo *)data)->name);
+    }
+    else {
+        node->u.file.parent = tag->s.parent;
+        node->u.file.serial = tag->s.serial;
+        node->u.file.hdr = HDR_ADDR(block, page);
+        node->u.file.checksum = tag->data_sum;
+        node->u.file.len = tag->s.data_len;
+        uffs_InsertToFileEntry(dev, node);
+        fprintf(stdout, "[uffs_BuildTree] made file node - name: %s\n", ((uffs_FileInfo *)data)->name);
+
+        if ((info->attr & FILE_ATTR_DEDUP) && info->name_len < MAX_FILENAME_LENGTH &&
+            UFFS_DEDUP_REF_FITS(info->name_len)) {
+            memcpy(&ref, UFFS_INLINE_DATA(info), sizeof(ref));
+            node->u.file.len = ref.len;
+            uffs_DedupScanRef(ref.block, ref.len);
+
+            node = uffs_TreeNodeGet(dev);
+            if (node == NULL) {
+                return;
+            }
+            node->u.data.parent = tag->s.serial;
+            node->u.data.serial = ref.block;
+            node->u.data.block = ref.block;
+            node->u.data.len = ref.len;
+            uffs_InsertToDataEntry(dev, node);
+        }
+        // 블록 map 파일은 파일 블록마다 tag가 있어서 data 노드는 따로 만들어짐, 길이만 헤더에서
+        else if ((info->attr & FILE_ATTR_BLOCKMAP) && info->name_len < MAX_FILENAME_LENGTH &&
+                 UFFS_BLOCKMAP_FITS(info->name_len)) {
+            node->u.file.len = uffs_BlockMapFileLen(info);
+        }
+    }
+}
+
 URET uffs_BuildTree(uffs_Device *dev) {
     fprintf(stdout, "[uffs_BuildTree] called\n");
 
-    // 블록 및 페이지 초기화
+    // 모든 블록의 page 0을 한 번에 읽음
+    static uffs_Tag tags[TOTAL_BLOCKS_DEFAULT];
+    static char datas[TOTAL_BLOCKS_DEFAULT][PAGE_DATA_SIZE_DEFAULT];
+    static uffs_MiniHeader mini_headers[TOTAL_BLOCKS_DEFAULT];
+    uffs_PageReq reqs[TOTAL_BLOCKS_DEFAULT];
+
+    // metadata 블록의 나머지 페이지
+    static uffs_Tag meta_tags[PAGES_PER_BLOCK_DEFAULT];
+    static char meta_datas[PAGES_PER_BLOCK_DEFAULT][PAGE_DATA_SIZE_DEFAULT];
+    static uffs_MiniHeader meta_mini_headers[PAGES_PER_BLOCK_DEFAULT];
+    uffs_PageReq meta_reqs[PAGES_PER_BLOCK_DEFAULT];
+    int meta_blocks = 0, headers = 0, orphans;
+
     for (int block = 1; block < TOTAL_BLOCKS_DEFAULT; block++) {
-        uffs_Tag tag = {0};
-        char data[PAGE_DATA_SIZE_DEFAULT];
-        uffs_MiniHeader mini_header = {0};
-        readPage(dev->fd, block, 0, &mini_header, data, &tag);
-        TreeNode* node = (TreeNode*)malloc(sizeof(TreeNode));
-        memset(node, 0, sizeof(TreeNode));
-        // fprintf(stdout, "[uffs_BuildTree] block: %d, type of tag: %d\n", block, tag.s.type);
+        memset(&tags[block], 0, sizeof(uffs_Tag));
+        memset(&mini_headers[block], 0, sizeof(uffs_MiniHeader));
+        reqs[block - 1].block_id = block;
+        reqs[block - 1].page_Id = 0;
+        reqs[block - 1].mini_header = &mini_headers[block];
+        reqs[block - 1].data = datas[block];
+        reqs[block - 1].tag = &tags[block];
+    }
+    // mount scan은 앞에서부터 한 번만 읽음
+    diskAdvise(dev->fd, 1, TOTAL_BLOCKS_DEFAULT - 1, UFFS_IO_ADVISE_SEQUENTIAL);
+    readPages(dev->fd, reqs, TOTAL_BLOCKS_DEFAULT - 1);
+
+    for (int block = 1; block < TOTAL_BLOCKS_DEFAULT; block++) {
+        uffs_Tag tag = tags[block];
+        TreeNode* node;
+        u32 free_pages = 0;
+
         switch (tag.s.type) {
 		case UFFS_TYPE_DIR:
-			node->u.dir.parent = tag.s.parent;
-			node->u.dir.serial = tag.s.serial;
-			node->u.dir.block = block;
-			node->u.dir.checksum = tag.data_sum;
-            fprintf(stdout, "[uffs_BuildTree] made dir node - name: %s\n", ((uffs_FileInfo *)data)->name);
-            uffs_InsertToDirEntry(dev, node);
-			break;
 		case UFFS_TYPE_FILE:
-			node->u.file.parent = tag.s.parent;
-			node->u.file.serial = tag.s.serial;
-			node->u.file.block = block;
-			node->u.file.checksum = tag.data_sum;
-            node->u.file.len = tag.s.data_len;
-            uffs_InsertToFileEntry(dev, node);
-            fprintf(stdout, "[uffs_BuildTree] made file node - name: %s\n", ((uffs_FileInfo *)data)->name);
+            // page 0이 헤더면 metadata 블록: 다른 페이지에도 헤더가 있을 수 있어서 블록 전체를 봄
+            // (page 0의 헤더가 지워졌으면 tombstone만 남아 있음)
+            if (mini_headers[block].status != MINI_HEADER_STATUS_DEAD) {
+                buildHeaderNode(dev, block, 0, &tag, datas[block]);
+                headers++;
+            }
+
+            for (int page = 1; page < PAGES_PER_BLOCK_DEFAULT; page++) {
+                memset(&meta_tags[page], 0, sizeof(uffs_Tag));
+                memset(&meta_mini_headers[page], 0, sizeof(uffs_MiniHeader));
+                meta_reqs[page - 1].block_id = block;
+                meta_reqs[page - 1].page_Id = page;
+                meta_reqs[page - 1].mini_header = &meta_mini_headers[page];
+                meta_reqs[page - 1].data = meta_datas[page];
+                meta_reqs[page - 1].tag = &meta_tags[page];
+            }
+            readPages(dev->fd, meta_reqs, PAGES_PER_BLOCK_DEFAULT - 1);
+
+            for (int page = 1; page < PAGES_PER_BLOCK_DEFAULT; page++) {
+                if (IS_FAIL(meta_reqs[page - 1].ret)) {
+                    continue;
+                }
+                if (meta_mini_headers[page].status == 0xFF) {
+                    free_pages |= 1U << page;
+                    continue;
+                }
+                if (meta_tags[page].s.type == UFFS_TYPE_DIR || meta_tags[page].s.type == UFFS_TYPE_FILE) {
+                    buildHeaderNode(dev, block, page, &meta_tags[page], meta_datas[page]);
+                    headers++;
+                }
+            }
+            diskMetaAddBlock(block, free_pages);
+            meta_blocks++;
 			break;
 		case UFFS_TYPE_DATA:
+            // dedup 블록(page 0 data_sum이 참조 수)은 참조하는 헤더마다 data 노드를 만듦
+            if (tag.data_sum != 0) {
+                uffs_DedupScanBlock(block, tag.data_sum);
+                break;
+            }
+            node = uffs_TreeNodeGet(dev);
+            if (node == NULL) {
+                break;
+            }
 			node->u.data.parent = tag.s.parent;
 			node->u.data.serial = tag.s.serial;
 			node->u.data.block = block;
@@ -139,8 +323,36 @@ URET uffs_BuildTree(uffs_Device *dev) {
 			break;
 		}
     }
+    diskAdvise(dev->fd, 1, TOTAL_BLOCKS_DEFAULT - 1, UFFS_IO_ADVISE_NORMAL);
+
+    // 헤더가 없는 파일의 data 블록 (rename이 target 헤더를 지운 뒤 블록을 돌려주기 전에 멈춤)
+    // 두면 같은 serial을 받은 새 파일의 data로 보이므로 지움
+    orphans = 0;
+    for (int i = 0; i < DATA_NODE_ENTRY_LEN; i++) {
+        u16 x = dev->tree.data_entry[i];
+
+        while (x != EMPTY_NODE) {
+            TreeNode *node = FROM_IDX(x, TPOOL(dev));
+
+            x = node->hash_next;
+            if (uffs_TreeFindFileNode(dev, node->u.data.parent) != NULL) {
+                continue;
+            }
+            eraseBlock(dev->fd, node->u.data.block);
+            uffs_BreakFromEntry(dev, UFFS_TYPE_DATA, node);
+            uffs_TreeNodePut(dev, node);
+            orphans++;
+        }
+    }
+
+    // 헤더에서 센 참조 수로 dedup index를 만듦
+    if (uffs_DedupBuild(dev->fd) == U_FAIL) {
+        fprintf(stderr, "[uffs_BuildTree] dedup index build error\n");
+    }
 
     // 성공적으로 초기화된 경우
+    fprintf(stdout, "[uffs_BuildTree] %d headers in %d metadata blocks, %d orphan data block(s) freed\n",
+            headers, meta_blocks, orphans);
     fprintf(stderr,"[uffs_BuildTree] finished\n");
     return U_SUCC;
 }
@@ -148,16 +360,18 @@ URET uffs_BuildTree(uffs_Device *dev) {
 static URET getRootDir(uffs_Device *dev, TreeNode **cur_node) {
     fprintf(stdout, "[getRootDir] called\n");
     int hash = GET_DIR_HASH(ROOT_DIR_SERIAL);
-    *cur_node = dev->tree.dir_entry[hash];
-    while ((*cur_node)->u.dir.serial != ROOT_DIR_SERIAL) {
-        if ((*cur_node)->hash_next == EMPTY_NODE) {
-            fprintf(stderr, "[getRootDir] fail - can't find root node\n");
-            return U_FAIL;
+    u16 x = dev->tree.dir_entry[hash];
+
+    while (x != EMPTY_NODE) {
+        *cur_node = FROM_IDX(x, TPOOL(dev));
+        if ((*cur_node)->u.dir.serial == ROOT_DIR_SERIAL) {
+            fprintf(stdout, "[getRootDir] finished - found root node\n");
+            return U_SUCC;
         }
-        *cur_node = (*cur_node)->hash_next;
+        x = (*cur_node)->hash_next;
     }
-    fprintf(stdout, "[getRootDir] finished - found root node\n");
-    return U_SUCC;
+    fprintf(stderr, "[getRootDir] fail - can't find root node\n");
+    return U_FAIL;
 }
 
 // node찾아서 매개변수 node에 넣어주기
@@ -219,13 +433,13 @@ URET uffs_TreeFindNodeByName(uffs_Device *dev, TreeNode **node, const char *name
         uffs_FileInfo temp_info;
         u32 file_len = 0; // 태그에서 가져올 파일 길이
 
-        if (getFileInfoBySerial(dev->fd, (*node)->u.file.serial, &temp_info, &file_len) == U_SUCC) {
+        if (getFileInfoByHeader(dev->fd, (*node)->u.file.hdr, &temp_info, &file_len) == U_SUCC) {
             memcpy(&object_info->info, &temp_info, sizeof(uffs_FileInfo));
             object_info->len = file_len;
             object_info->serial = (*node)->u.file.serial;
         } else {
             // 파일 정보 가져오기 실패시 처리
-            fprintf(stderr, "[uffs_TreeFindNodeByName] can't get file info by serial\n");
+            fprintf(stderr, "[uffs_TreeFindNodeByName] can't get file info by header\n");
         }
     }
 
@@ -239,6 +453,15 @@ URET uffs_TreeFindNodeByName(uffs_Device *dev, TreeNode **node, const char *name
 }
 
 TreeNode * uffs_TreeFindFileNode(uffs_Device *dev, u16 serial) {
+    TreeNode *node;
+    u16 x;
+
+    for (x = dev->tree.file_entry[GET_FILE_HASH(serial)]; x != EMPTY_NODE; x = node->hash_next) {
+        node = FROM_IDX(x, TPOOL(dev));
+        if (node->u.file.serial == serial) {
+            return node;
+        }
+    }
     return NULL;
 }
 
@@ -249,62 +472,91 @@ TreeNode * uffs_TreeFindFileNodeWithParent(uffs_Device *dev, u16 parent) {
 TreeNode * uffs_TreeFindDirNode(uffs_Device *dev, u16 serial) {
     // fprintf(stdout,"[uffs_TreeFindDirNode] called\n");
     int i;
+	u16 x;
 	TreeNode *node;
 	struct uffs_TreeSt *tree = &(dev->tree);
 	
 	for (i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
-		node = tree->dir_entry[i];
-		while (node != EMPTY_NODE) {
+		x = tree->dir_entry[i];
+		while (x != EMPTY_NODE) {
+			node = FROM_IDX(x, TPOOL(dev));
 			if (node->u.dir.serial == serial) {
 				return node;
 			}
-			node = node->hash_next;
+			x = node->hash_next;
 		}
 	}
     // fprintf(stdout,"[uffs_TreeFindDirNode] finished\n");
     return NULL;
 }
 
+// 안 쓰는 file/dir serial 중 가장 작은 것, 없으면 INVALID_UFFS_SERIAL
+// 헤더가 블록을 따로 쓰지 않으니 serial은 블록 번호와 상관없이 tag에 들어가는 범위 안에서 고름
+u16 uffs_FindFreeFsnSerial(uffs_Device *dev) {
+    TreeNode *node;
+    u16 x, serial;
+    UBOOL used;
+
+    for (serial = 1; serial <= MAX_OBJECT_SERIAL; serial++) {
+        if (serial == ROOT_DIR_SERIAL) {
+            continue;
+        }
+        used = U_FALSE;
+        for (x = dev->tree.dir_entry[GET_DIR_HASH(serial)]; x != EMPTY_NODE && !used; x = node->hash_next) {
+            node = FROM_IDX(x, TPOOL(dev));
+            used = node->u.dir.serial == serial;
+        }
+        for (x = dev->tree.file_entry[GET_FILE_HASH(serial)]; x != EMPTY_NODE && !used; x = node->hash_next) {
+            node = FROM_IDX(x, TPOOL(dev));
+            used = node->u.file.serial == serial;
+        }
+        if (!used) {
+            return serial;
+        }
+    }
+    return INVALID_UFFS_SERIAL;
+}
+
 TreeNode * uffs_TreeFindDirNodeWithParent(uffs_Device *dev, u16 parent) {
 	return NULL;
 }
 
-static UBOOL uffs_TreeCompareFileName(uffs_Device* dev, char* name, u16 parent, u8 expected_type, uffs_ObjectInfo* object_info) {
+// node의 헤더 페이지에 있는 이름과 비교
+static UBOOL uffs_TreeCompareFileName(uffs_Device* dev, TreeNode *node, const char* name, uffs_ObjectInfo* object_info) {
     uffs_ObjectInfo temp_objectInfo = {0};
+    u32 len = 0;
 
-    for (int i =1; i<TOTAL_BLOCKS_DEFAULT; i++) {
-        uffs_Tag tag={0};
-        if (readPage(dev->fd,i,0,NULL,(char*)&temp_objectInfo.info,&tag) == U_SUCC) {
-            if (tag.s.parent == parent && tag.s.type == expected_type &&
-                strcmp(temp_objectInfo.info.name, name) == 0) {
-                temp_objectInfo.len = 0; 
-                temp_objectInfo.serial = tag.s.serial;
-                if(object_info != NULL) {
-                    *object_info = temp_objectInfo;
-                }
-                // fprintf(stdout,"[uffs_TreeCompareFileName] finished\n");
-                return U_TRUE;
-            }
-        }
+    if (IS_FAIL(getFileInfoByHeader(dev->fd, node->u.file.hdr, &temp_objectInfo.info, &len))) {
+        return U_FALSE;
     }
-    return U_FAIL;
+    if (strcmp(temp_objectInfo.info.name, name) != 0) {
+        return U_FALSE;
+    }
+    temp_objectInfo.len = len;
+    temp_objectInfo.serial = node->u.file.serial;
+    if (object_info != NULL) {
+        *object_info = temp_objectInfo;
+    }
+    return U_TRUE;
 }
 
 
 TreeNode * uffs_TreeFindFileNodeByName(uffs_Device *dev, const char *name, u32 len, u16 parent, uffs_ObjectInfo* object_info) {
     // fprintf(stdout,"[uffs_TreeFindFileNodeByName] called\n");
     int i;
+	u16 x;
 	TreeNode *node;
 	struct uffs_TreeSt *tree = &(dev->tree);
 	
 	for (i = 0; i < FILE_NODE_ENTRY_LEN; i++) {
-		node = tree->file_entry[i];
-		while (node != EMPTY_NODE) {
-			if (node->u.file.parent == parent && uffs_TreeCompareFileName(dev, name, parent,UFFS_TYPE_FILE,object_info) == U_TRUE) {
+		x = tree->file_entry[i];
+		while (x != EMPTY_NODE) {
+			node = FROM_IDX(x, TPOOL(dev));
+			if (node->u.file.parent == parent && uffs_TreeCompareFileName(dev, node, name, object_info) == U_TRUE) {
                 // fprintf(stdout,"[uffs_TreeFindFileNodeByName] find node success\n");
                 return node;
 			}
-			node = node->hash_next;
+			x = node->hash_next;
 		}
 	}
     // fprintf(stdout,"[uffs_TreeFindFileNodeByName] finished: can't find file node by name.\n");
@@ -314,17 +566,19 @@ TreeNode * uffs_TreeFindFileNodeByName(uffs_Device *dev, const char *name, u32 l
 TreeNode * uffs_TreeFindDirNodeByName(uffs_Device *dev, const char *name, u32 len, u16 parent, uffs_ObjectInfo* object_info) {
     // fprintf(stdout,"[uffs_TreeFindDirNodeByName] called\n");
     int i;
+	u16 x;
 	TreeNode *node;
 	struct uffs_TreeSt *tree = &(dev->tree);
 	
 	for (i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
-		node = tree->dir_entry[i];
-		while (node != EMPTY_NODE) {
-			if (node->u.dir.parent == parent && uffs_TreeCompareFileName(dev, name, parent, UFFS_TYPE_DIR,object_info) == U_TRUE) {
+		x = tree->dir_entry[i];
+		while (x != EMPTY_NODE) {
+			node = FROM_IDX(x, TPOOL(dev));
+			if (node->u.dir.parent == parent && uffs_TreeCompareFileName(dev, node, name, object_info) == U_TRUE) {
                 // fprintf(stdout,"[uffs_TreeFindDirNodeByName] finished\n");
                 return node;
 			}
-			node = node->hash_next;
+			x = node->hash_next;
 		}
 	}
     // fprintf(stdout,"[uffs_TreeFindDirNodeByName] finished: can't find dir node by name\n");
@@ -332,22 +586,35 @@ TreeNode * uffs_TreeFindDirNodeByName(uffs_Device *dev, const char *name, u32 le
 }   
 
 
+// 블록 map 파일(#FILE_ATTR_BLOCKMAP)의 data 노드: serial은 파일 안의 블록 번호
 TreeNode * uffs_TreeFindDataNode(uffs_Device *dev, u16 parent, u16 serial) {
+    u16 x = dev->tree.data_entry[GET_DATA_HASH(parent, serial)];
+    TreeNode *node;
+
+    while (x != EMPTY_NODE) {
+        node = FROM_IDX(x, TPOOL(dev));
+        if (node->u.data.parent == parent && node->u.data.serial == serial) {
+            return node;
+        }
+        x = node->hash_next;
+    }
     return NULL;
 }
 
 TreeNode * uffs_TreeFindDataNodeByParent(uffs_Device *dev, u16 parent) {
     // fprintf(stdout,"[uffs_TreeFindDataNodeByParent] started\n");
     TreeNode *node;
+    u16 x;
     struct uffs_TreeSt *tree = &(dev->tree);
     for (int i = 0; i < DATA_NODE_ENTRY_LEN; i++) {
-		node = tree->data_entry[i];
-		while (node != EMPTY_NODE) {
+		x = tree->data_entry[i];
+		while (x != EMPTY_NODE) {
+			node = FROM_IDX(x, TPOOL(dev));
 			if (node->u.data.parent == parent) {
                 // fprintf(stdout,"[uffs_TreeFindDataNodeByParent] finished\n");
                 return node;
 			}
-			node = node->hash_next;
+			x = node->hash_next;
 		}
 	}
     // fprintf(stdout,"[uffs_TreeFindDataNodeByParent] failed\n");
@@ -524,6 +791,7 @@ int parsePath(const char *path, char *nameBuffer, int maxNameLength) {
 }
 
 // 노드 초기화
+// block_id: file/dir는 헤더 페이지 주소(HDR_ADDR), data는 블록 번호
 URET initNode(uffs_Device *dev, TreeNode *node, int block_id,u8 type, u16 parent_serial, u16 serial) {
 
     if(block_id == -1){
@@ -533,13 +801,13 @@ URET initNode(uffs_Device *dev, TreeNode *node, int block_id,u8 type, u16 parent
     memset(node,0,sizeof(TreeNode));
 
     if (type == UFFS_TYPE_FILE) {
-        node->u.file.block = block_id;
+        node->u.file.hdr = block_id;
         node->u.file.checksum = 0; 
         node->u.file.parent = parent_serial;
         node->u.file.serial = serial;
         node->u.file.len = 0;
     } else if (type == UFFS_TYPE_DIR) {
-        node->u.dir.block = block_id;
+        node->u.dir.hdr = block_id;
         node->u.dir.checksum = 0;
         node->u.dir.parent = parent_serial;
         node->u.dir.serial = serial;
@@ -556,7 +824,6 @@ URET initNode(uffs_Device *dev, TreeNode *node, int block_id,u8 type, u16 parent
 }
 
 URET updateFileInfoPage(uffs_Device  *dev, TreeNode *node, uffs_FileInfo *file_info, int is_create, u8 type) {
-    uffs_MiniHeader mini_header={0x01,0x00,0xFFFF};
     uffs_Tag tag={0};
     if(is_create){
         file_info->create_time = GET_CURRENT_TIME();
@@ -572,7 +839,7 @@ URET updateFileInfoPage(uffs_Device  *dev, TreeNode *node, uffs_FileInfo *file_i
         // 디렉토리는 길이 0
         tag.s.data_len = 0; 
     } else {
-        file_info->attr = FILE_ATTR_WRITE; // 일반 파일
+        file_info->attr = FILE_ATTR_WRITE | (file_info->attr & (FILE_ATTR_INLINE | FILE_ATTR_COMPRESS | FILE_ATTR_DEDUP | FILE_ATTR_BLOCKMAP)); // 일반 파일
         tag.s.type = UFFS_TYPE_FILE;
         tag.s.serial = node->u.file.serial;
         tag.s.parent = node->u.file.parent;
@@ -591,14 +858,26 @@ URET updateFileInfoPage(uffs_Device  *dev, TreeNode *node, uffs_FileInfo *file_i
     tag.s.dirty = 1;
     tag.s.valid = 0;
     tag.s.block_ts = 0;
-    tag.s.page_id = 0;
+    tag.s.page_id = HDR_PAGE(node->u.file.hdr);
     tag.s.tag_ecc = TAG_ECC_DEFAULT;
     tag.data_sum = 0;
     tag.seal_byte = 0;
 
-    if (writePage(dev->fd, node->u.file.block,0,&mini_header,(char*)file_info,&tag)<0) {
+    // 제자리에 바로 쓰지 않고 journal에 append (commit/checkpoint는 journal이 알아서)
+    if (uffs_JournalWriteHeader(dev->fd, HDR_BLOCK(node->u.file.hdr), HDR_PAGE(node->u.file.hdr), file_info, &tag) == U_FAIL) {
         return U_FAIL;
     }
 
     return U_SUCC;
 }
+
+// unlink/rmdir: 노드의 헤더 페이지를 지우고 다른 헤더가 쓸 수 있게 돌려줌 (노드는 호출한 쪽에서 뺌)
+URET deleteFileInfoPage(uffs_Device *dev, TreeNode *node) {
+    u16 hdr = node->u.file.hdr;
+
+    if (uffs_JournalDeleteHeader(dev->fd, HDR_BLOCK(hdr), HDR_PAGE(hdr)) == U_FAIL) {
+        return U_FAIL;
+    }
+    diskMetaFreePage(HDR_BLOCK(hdr), HDR_PAGE(hdr));
+    return U_SUCC;
+}
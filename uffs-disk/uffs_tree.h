@@ -7,11 +7,13 @@
 
 #include "uffs_types.h"
 #include "uffs_disk.h"
+#include "uffs_pool.h"
 
-#define EMPTY_NODE ((TreeNode*)NULL)
+#define EMPTY_NODE 0xffff
+#define INVALID_UFFS_SERIAL 0xFFFF
 
 struct DirhSt {		/* 8 bytes */
-	u16 block;
+	u16 hdr;		/* header page, HDR_ADDR(block, page) */
 	u16 checksum;	/* check sum of dir name */
 	u16 parent;
 	u16 serial;
@@ -19,7 +21,7 @@ struct DirhSt {		/* 8 bytes */
 
 
 struct FilehSt {	/* 12 bytes */
-	u16 block;
+	u16 hdr;		/* header page, HDR_ADDR(block, page) */
 	u16 checksum;	/* check sum of file name */
 	u16 parent;
 	u16 serial;
@@ -38,17 +40,27 @@ struct FdataSt {	/* 10 bytes */
 #define GET_DIR_HASH(serial)			(serial & DIR_NODE_HASH_MASK)
 #define GET_DATA_HASH(parent, serial)	((parent + serial) & DATA_NODE_HASH_MASK)
 
-//UFFS TreeNode (14 or 16 bytes)
+//UFFS TreeNode (16 bytes)
+// 노드는 tree pool에서 받고, chain은 pointer 대신 pool 안의 index로 이음
 typedef struct uffs_TreeNodeSt {
 	union {
 		struct DirhSt dir;
 		struct FilehSt file;
 		struct FdataSt data;
 	} u;
-	struct uffs_TreeNodeSt *hash_next;
-	struct uffs_TreeNodeSt *hash_prev;
+	u16 hash_next;
+	u16 hash_prev;
 } TreeNode;
 
+_Static_assert(sizeof(TreeNode) == 16, "TreeNode must be 16 bytes");
+
+// dir/file은 serial 하나에 하나, data는 블록마다 하나 + dedup 파일마다 하나
+#define MAX_TREE_NODES	((MAX_OBJECT_SERIAL + 1) * 2 + TOTAL_BLOCKS_DEFAULT)
+
+#define TPOOL(dev)				(&(dev)->tree.pool)
+#define FROM_IDX(idx, pool)		((TreeNode *)uffs_PoolGetBufByIndex(pool, idx))
+#define TO_IDX(p, pool)			((u16)uffs_PoolGetIndex(pool, (void *) p))
+
 #define DIR_NODE_HASH_MASK		0x1f
 #define DIR_NODE_ENTRY_LEN		(DIR_NODE_HASH_MASK + 1)
 
@@ -59,10 +71,11 @@ typedef struct uffs_TreeNodeSt {
 #define DATA_NODE_ENTRY_LEN		(DATA_NODE_HASH_MASK + 1)
 
 struct uffs_TreeSt {
-	uint64_t dir_entry[DIR_NODE_ENTRY_LEN];
-	uint64_t file_entry[FILE_NODE_ENTRY_LEN];
-	uint64_t data_entry[DATA_NODE_ENTRY_LEN];
+	u16 dir_entry[DIR_NODE_ENTRY_LEN];
+	u16 file_entry[FILE_NODE_ENTRY_LEN];
+	u16 data_entry[DATA_NODE_ENTRY_LEN];
 	u16 max_serial;
+	uffs_Pool pool;		//!< tree node pool
 };
 
 
@@ -72,7 +85,7 @@ URET uffs_TreeInit(uffs_Device *dev);
 
 // URET uffs_TreeRelease(uffs_Device *dev);
 URET uffs_BuildTree(uffs_Device *dev);
-// u16 uffs_FindFreeFsnSerial(uffs_Device *dev);
+u16 uffs_FindFreeFsnSerial(uffs_Device *dev);
 TreeNode * uffs_TreeFindFileNode(uffs_Device *dev, u16 serial);
 TreeNode * uffs_TreeFindFileNodeWithParent(uffs_Device *dev, u16 parent);
 TreeNode * uffs_TreeFindDirNode(uffs_Device *dev, u16 serial);
@@ -82,6 +95,7 @@ TreeNode * uffs_TreeFindDirNodeByName(uffs_Device *dev, const char *name, u32 le
 TreeNode * uffs_TreeFindDataNode(uffs_Device *dev, u16 parent, u16 serial);
 TreeNode * uffs_TreeFindDataNodeByParent(uffs_Device *dev, u16 parent);
 void uffs_InsertNodeToTree(uffs_Device *dev, u8 type, TreeNode *node);
+void uffs_BreakFromEntry(uffs_Device *dev, u8 type, TreeNode *node);
 
 // custom 
 URET uffs_TreeFindNodeByName(uffs_Device *dev, TreeNode **node, const char *name, u8 *type, uffs_ObjectInfo* object_info);
@@ -90,4 +104,7 @@ URET uffs_TreeFindFileNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
 URET uffs_TreeFindParentNodeByName(uffs_Device *dev, TreeNode **node, const char *name, int isNodeExist);
 URET initNode(uffs_Device *dev, TreeNode *node, int block_id,u8 type, u16 parent_serial, u16 serial);
 URET updateFileInfoPage(uffs_Device *dev, TreeNode *node, uffs_FileInfo *file_info, int is_create, u8 type);
+URET deleteFileInfoPage(uffs_Device *dev, TreeNode *node);
+TreeNode * uffs_TreeNodeGet(uffs_Device *dev);
+void uffs_TreeNodePut(uffs_Device *dev, TreeNode *node);
 #endif
\ No newline at end of file
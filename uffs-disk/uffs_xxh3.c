@@ -0,0 +1,342 @@
+/**
+ * \file uffs_xxh3.c
+ * \brief XXH3 128-bit hash (seed 0, default secret)
+ *
+ * 결과는 libxxhash의 XXH3_128bits()와 같다. SIMD 없이 scalar 경로만 있고,
+ * 길이에 따라 0~16, 17~128, 129~240, 그 이상(1KB 블록 단위 accumulate)으로 나뉜다.
+ */
+
+#include "uffs_xxh3.h"
+
+#include <string.h>
+
+#define XXH_PRIME32_1	0x9E3779B1U
+#define XXH_PRIME32_2	0x85EBCA77U
+#define XXH_PRIME32_3	0xC2B2AE3DU
+
+#define XXH_PRIME64_1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3	0x165667B19E3779F9ULL
+#define XXH_PRIME64_4	0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5	0x27D4EB2F165667C5ULL
+
+#define XXH_PRIME_MX1	0x165667919E3779F9ULL
+#define XXH_PRIME_MX2	0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_SIZE			192
+#define XXH_STRIPE_LEN			64
+#define XXH_SECRET_CONSUME_RATE	8
+#define XXH_ACC_NB				8
+#define XXH_MIDSIZE_MAX			240
+#define XXH_MIDSIZE_STARTOFFSET	3
+#define XXH_MIDSIZE_LASTOFFSET	17
+#define XXH_SECRET_SIZE_MIN		136
+#define XXH_SECRET_LASTACC_START	7
+#define XXH_SECRET_MERGEACCS_START	11
+
+static const u8 xxh_secret[XXH_SECRET_SIZE] = {
+	0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+	0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+	0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+	0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+	0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+	0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+	0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+	0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+	0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+	0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+	0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+	0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static u32 _Read32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint64_t _Read64(const u8 *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static u32 _Swap32(u32 x)
+{
+	return __builtin_bswap32(x);
+}
+
+static uint64_t _Swap64(uint64_t x)
+{
+	return __builtin_bswap64(x);
+}
+
+static u32 _Rotl32(u32 x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static uffs_Hash128 _Mult64to128(uint64_t a, uint64_t b)
+{
+	unsigned __int128 p = (unsigned __int128)a * b;
+	uffs_Hash128 r;
+
+	r.low = (uint64_t)p;
+	r.high = (uint64_t)(p >> 64);
+	return r;
+}
+
+static uint64_t _Mul128Fold64(uint64_t a, uint64_t b)
+{
+	uffs_Hash128 p = _Mult64to128(a, b);
+
+	return p.low ^ p.high;
+}
+
+static uint64_t _Xxh64Avalanche(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= XXH_PRIME64_2;
+	h ^= h >> 29;
+	h *= XXH_PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64_t _Avalanche(uint64_t h)
+{
+	h ^= h >> 37;
+	h *= XXH_PRIME_MX1;
+	h ^= h >> 32;
+	return h;
+}
+
+static uint64_t _Mix16B(const u8 *in, const u8 *secret, uint64_t seed)
+{
+	return _Mul128Fold64(_Read64(in) ^ (_Read64(secret) + seed),
+						 _Read64(in + 8) ^ (_Read64(secret + 8) - seed));
+}
+
+static void _Mix32B(uffs_Hash128 *acc, const u8 *in1, const u8 *in2, const u8 *secret, uint64_t seed)
+{
+	acc->low += _Mix16B(in1, secret, seed);
+	acc->low ^= _Read64(in2) + _Read64(in2 + 8);
+	acc->high += _Mix16B(in2, secret + 16, seed);
+	acc->high ^= _Read64(in1) + _Read64(in1 + 8);
+}
+
+static uffs_Hash128 _Len1to3(const u8 *in, size_t len, uint64_t seed)
+{
+	u32 c1 = in[0], c2 = in[len >> 1], c3 = in[len - 1];
+	u32 combinedl = (c1 << 16) | (c2 << 24) | c3 | ((u32)len << 8);
+	u32 combinedh = _Rotl32(_Swap32(combinedl), 13);
+	uint64_t bitflipl = (_Read32(xxh_secret) ^ _Read32(xxh_secret + 4)) + seed;
+	uint64_t bitfliph = (_Read32(xxh_secret + 8) ^ _Read32(xxh_secret + 12)) - seed;
+	uffs_Hash128 h;
+
+	h.low = _Xxh64Avalanche((uint64_t)combinedl ^ bitflipl);
+	h.high = _Xxh64Avalanche((uint64_t)combinedh ^ bitfliph);
+	return h;
+}
+
+static uffs_Hash128 _Len4to8(const u8 *in, size_t len, uint64_t seed)
+{
+	uint64_t input64, bitflip;
+	uffs_Hash128 m;
+
+	seed ^= (uint64_t)_Swap32((u32)seed) << 32;
+	input64 = _Read32(in) + ((uint64_t)_Read32(in + len - 4) << 32);
+	bitflip = (_Read64(xxh_secret + 16) ^ _Read64(xxh_secret + 24)) + seed;
+
+	m = _Mult64to128(input64 ^ bitflip, XXH_PRIME64_1 + (len << 2));
+	m.high += m.low << 1;
+	m.low ^= m.high >> 3;
+	m.low ^= m.low >> 35;
+	m.low *= XXH_PRIME_MX2;
+	m.low ^= m.low >> 28;
+	m.high = _Avalanche(m.high);
+	return m;
+}
+
+static uffs_Hash128 _Len9to16(const u8 *in, size_t len, uint64_t seed)
+{
+	uint64_t bitflipl = (_Read64(xxh_secret + 32) ^ _Read64(xxh_secret + 40)) - seed;
+	uint64_t bitfliph = (_Read64(xxh_secret + 48) ^ _Read64(xxh_secret + 56)) + seed;
+	uint64_t input_lo = _Read64(in);
+	uint64_t input_hi = _Read64(in + len - 8);
+	uffs_Hash128 m, h;
+
+	m = _Mult64to128(input_lo ^ input_hi ^ bitflipl, XXH_PRIME64_1);
+	m.low += (uint64_t)(len - 1) << 54;
+	input_hi ^= bitfliph;
+	m.high += input_hi + (uint64_t)(u32)input_hi * (XXH_PRIME32_2 - 1);
+	m.low ^= _Swap64(m.high);
+
+	h = _Mult64to128(m.low, XXH_PRIME64_2);
+	h.high += m.high * XXH_PRIME64_2;
+	h.low = _Avalanche(h.low);
+	h.high = _Avalanche(h.high);
+	return h;
+}
+
+static uffs_Hash128 _Len0to16(const u8 *in, size_t len, uint64_t seed)
+{
+	uffs_Hash128 h;
+
+	if (len > 8)
+		return _Len9to16(in, len, seed);
+	if (len >= 4)
+		return _Len4to8(in, len, seed);
+	if (len > 0)
+		return _Len1to3(in, len, seed);
+
+	h.low = _Xxh64Avalanche(seed ^ _Read64(xxh_secret + 64) ^ _Read64(xxh_secret + 72));
+	h.high = _Xxh64Avalanche(seed ^ _Read64(xxh_secret + 80) ^ _Read64(xxh_secret + 88));
+	return h;
+}
+
+// 17~240 공통 마무리
+static uffs_Hash128 _MidFinal(uffs_Hash128 acc, size_t len, uint64_t seed)
+{
+	uffs_Hash128 h;
+
+	h.low = acc.low + acc.high;
+	h.high = acc.low * XXH_PRIME64_1 + acc.high * XXH_PRIME64_4 + ((len - seed) * XXH_PRIME64_2);
+	h.low = _Avalanche(h.low);
+	h.high = 0 - _Avalanche(h.high);
+	return h;
+}
+
+static uffs_Hash128 _Len17to128(const u8 *in, size_t len, uint64_t seed)
+{
+	uffs_Hash128 acc;
+
+	acc.low = len * XXH_PRIME64_1;
+	acc.high = 0;
+	if (len > 32) {
+		if (len > 64) {
+			if (len > 96)
+				_Mix32B(&acc, in + 48, in + len - 64, xxh_secret + 96, seed);
+			_Mix32B(&acc, in + 32, in + len - 48, xxh_secret + 64, seed);
+		}
+		_Mix32B(&acc, in + 16, in + len - 32, xxh_secret + 32, seed);
+	}
+	_Mix32B(&acc, in, in + len - 16, xxh_secret, seed);
+	return _MidFinal(acc, len, seed);
+}
+
+static uffs_Hash128 _Len129to240(const u8 *in, size_t len, uint64_t seed)
+{
+	int rounds = (int)len / 32;
+	uffs_Hash128 acc;
+	int i;
+
+	acc.low = len * XXH_PRIME64_1;
+	acc.high = 0;
+	for (i = 0; i < 4; i++)
+		_Mix32B(&acc, in + 32 * i, in + 32 * i + 16, xxh_secret + 32 * i, seed);
+	acc.low = _Avalanche(acc.low);
+	acc.high = _Avalanche(acc.high);
+	for (i = 4; i < rounds; i++)
+		_Mix32B(&acc, in + 32 * i, in + 32 * i + 16,
+				xxh_secret + XXH_MIDSIZE_STARTOFFSET + 32 * (i - 4), seed);
+	// 마지막 32바이트
+	_Mix32B(&acc, in + len - 16, in + len - 32,
+			xxh_secret + XXH_SECRET_SIZE_MIN - XXH_MIDSIZE_LASTOFFSET - 16, 0 - seed);
+	return _MidFinal(acc, len, seed);
+}
+
+static void _Accumulate512(uint64_t *acc, const u8 *in, const u8 *secret)
+{
+	int i;
+
+	for (i = 0; i < XXH_ACC_NB; i++) {
+		uint64_t data_val = _Read64(in + 8 * i);
+		uint64_t data_key = data_val ^ _Read64(secret + 8 * i);
+
+		acc[i ^ 1] += data_val;
+		acc[i] += (uint64_t)(u32)data_key * (data_key >> 32);
+	}
+}
+
+static void _Accumulate(uint64_t *acc, const u8 *in, size_t stripes)
+{
+	size_t n;
+
+	for (n = 0; n < stripes; n++)
+		_Accumulate512(acc, in + n * XXH_STRIPE_LEN, xxh_secret + n * XXH_SECRET_CONSUME_RATE);
+}
+
+static void _Scramble(uint64_t *acc, const u8 *secret)
+{
+	int i;
+
+	for (i = 0; i < XXH_ACC_NB; i++) {
+		uint64_t a = acc[i];
+
+		a ^= a >> 47;
+		a ^= _Read64(secret + 8 * i);
+		a *= XXH_PRIME32_1;
+		acc[i] = a;
+	}
+}
+
+static uint64_t _MergeAccs(const uint64_t *acc, const u8 *secret, uint64_t start)
+{
+	uint64_t r = start;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		r += _Mul128Fold64(acc[2 * i] ^ _Read64(secret + 16 * i),
+						   acc[2 * i + 1] ^ _Read64(secret + 16 * i + 8));
+	return _Avalanche(r);
+}
+
+// 240바이트 초과: 64바이트 stripe 16개(1KB)마다 scramble
+static uffs_Hash128 _HashLong(const u8 *in, size_t len)
+{
+	uint64_t acc[XXH_ACC_NB] = {
+		XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+		XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1,
+	};
+	size_t stripes_per_block = (XXH_SECRET_SIZE - XXH_STRIPE_LEN) / XXH_SECRET_CONSUME_RATE;
+	size_t block_len = XXH_STRIPE_LEN * stripes_per_block;
+	size_t blocks = (len - 1) / block_len;
+	size_t n, stripes;
+	uffs_Hash128 h;
+
+	for (n = 0; n < blocks; n++) {
+		_Accumulate(acc, in + n * block_len, stripes_per_block);
+		_Scramble(acc, xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN);
+	}
+
+	stripes = ((len - 1) - block_len * blocks) / XXH_STRIPE_LEN;
+	_Accumulate(acc, in + blocks * block_len, stripes);
+	_Accumulate512(acc, in + len - XXH_STRIPE_LEN,
+				   xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - XXH_SECRET_LASTACC_START);
+
+	h.low = _MergeAccs(acc, xxh_secret + XXH_SECRET_MERGEACCS_START, len * XXH_PRIME64_1);
+	h.high = _MergeAccs(acc, xxh_secret + XXH_SECRET_SIZE - sizeof(acc) - XXH_SECRET_MERGEACCS_START,
+						~(len * XXH_PRIME64_2));
+	return h;
+}
+
+/**
+ * \brief XXH3_128bits(data, len)
+ */
+uffs_Hash128 uffs_Xxh3_128(const void *data, size_t len)
+{
+	const u8 *in = (const u8 *)data;
+
+	if (len <= 16)
+		return _Len0to16(in, len, 0);
+	if (len <= 128)
+		return _Len17to128(in, len, 0);
+	if (len <= XXH_MIDSIZE_MAX)
+		return _Len129to240(in, len, 0);
+	return _HashLong(in, len);
+}
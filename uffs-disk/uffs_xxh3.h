@@ -0,0 +1,26 @@
+/**
+ * \file uffs_xxh3.h
+ * \brief XXH3 128-bit hash (seed 0, default secret)
+ */
+
+#ifndef _UFFS_XXH3_H_
+#define _UFFS_XXH3_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uffs_types.h"
+
+/**
+ * \struct uffs_Hash128St
+ * \brief xxhash의 XXH128_hash_t와 같은 순서
+ */
+struct uffs_Hash128St {
+	uint64_t low;
+	uint64_t high;
+};
+typedef struct uffs_Hash128St uffs_Hash128;
+
+uffs_Hash128 uffs_Xxh3_128(const void *data, size_t len);
+
+#endif
@@ -17,51 +17,140 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <fnmatch.h>
+#include <pthread.h>
 
 #include "uffs_tree.h"
 #include "uffs_types.h"
 #include "uffs_disk.h"
+#include "uffs_blockmap.h"
+#include "uffs_snapshot.h"
+#include "uffs_seqlock.h"
 
 uffs_Device dev = {0};
 data_Disk disk = {0};
+u32 disk_blocks = 0;	//!< --size로 정한 최대 블록 수 (0이면 BLOCK_COUNT_DEFAULT)
+const char *snapshot_load = NULL;	//!< --load: 시작할 때 올릴 snapshot
+const char *snapshot_save = NULL;	//!< --save: umount할 때 쓸 snapshot
+
+// fuse_loop_mt에서 여러 thread가 함께 부름
+// - 이름을 바꾸는 op (create/mkdir/unlink/rmdir/rename)는 ns_lock을 write로 잡고 dev.tree.seq를 올림
+// - write/truncate는 ns_lock을 read로 잡고 파일마다 file_locks로 줄 세운 뒤 header 블록의 seq를 올림
+// - getattr/open/opendir/read는 lock 없이 찾고 읽은 다음 seq가 바뀌었으면 처음부터 다시 (uffs_lookup)
+#define FILE_LOCK_STRIPES 64
+static pthread_rwlock_t ns_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t file_locks[FILE_LOCK_STRIPES];
+
+#define FILE_LOCK(block) (&file_locks[(block) % FILE_LOCK_STRIPES])
+
+static void uffs_ns_write_begin(void)
+{
+    pthread_rwlock_wrlock(&ns_lock);
+    uffs_SeqWriteBegin(&dev.tree.seq);
+}
+
+static void uffs_ns_write_end(void)
+{
+    uffs_SeqWriteEnd(&dev.tree.seq);
+    pthread_rwlock_unlock(&ns_lock);
+}
+
+#define LOOKUP_ANY  0
+#define LOOKUP_DIR  1
+#define LOOKUP_FILE 2
+
+// lock 없이 찾은 노드에서 복사해 둔 값
+struct uffs_lookup {
+    int isDir;
+    u16 block;      //!< header 블록
+    u32 len;        //!< 파일 길이
+    u32 fseq;       //!< 파일 seq를 읽기 시작한 값, 파일 내용까지 읽은 뒤에 uffs_SeqReadRetry로 확인
+    short nlink;
+    u16 mode;
+};
+
+// path를 tree lock 없이 찾아 out에 복사함, 찾는 동안 tree가 바뀌었으면 다시 찾음
+static URET uffs_lookup(const char *path, int kind, struct uffs_lookup *out)
+{
+    TreeNode *node;
+    uffs_FileInfo *info;
+    URET result;
+    u32 ts;
+
+    do {
+        ts = uffs_SeqReadBegin(&dev.tree.seq);
+        out->isDir = kind != LOOKUP_FILE;
+        if (kind == LOOKUP_ANY)
+            result = uffs_TreeFindNodeByName(&dev, &node, path, &out->isDir);
+        else if (kind == LOOKUP_DIR)
+            result = uffs_TreeFindDirNodeByNameWithoutParent(&dev, &node, path);
+        else
+            result = uffs_TreeFindFileNodeByNameWithoutParent(&dev, &node, path);
+        if (result == U_SUCC) {
+            out->block = node->u.file.block;
+            if (out->block >= __atomic_load_n(&disk.nblocks, __ATOMIC_ACQUIRE)) {
+                // 바뀌는 중에 읽은 노드, tree seq가 그대로면 실패
+                result = U_FAIL;
+            }
+            else {
+                out->fseq = uffs_SeqReadBegin(&disk.blocks[out->block].seq);
+                out->len = node->u.file.len;
+                info = &disk.blocks[out->block].info;
+                out->nlink = info->nlink;
+                out->mode = info->mode;
+            }
+        }
+    } while (uffs_SeqReadRetry(&dev.tree.seq, ts));
+    return result;
+}
 
 int uffs_init()
 {
 	fprintf(stdout, "[uffs_init] called\n");
 
+	dev.disk = &disk;
+	for (int i = 0; i < FILE_LOCK_STRIPES; i++) {
+		pthread_mutex_init(&file_locks[i], NULL);
+	}
+	if (snapshot_load != NULL) {
+		if (uffs_SnapshotLoad(&dev, snapshot_load) == U_SUCC) {
+			fprintf(stdout, "[uffs_init] finished\n");
+			return 0;
+		}
+		fprintf(stderr, "[uffs_init] snapshot load failed, starting empty\n");
+	}
+	uffs_InitBlock(&disk, disk_blocks);
 	uffs_TreeInit(&dev);
 	uffs_BuildTree(&dev);
-	uffs_InitBlock(&disk);
 	fprintf(stdout, "[uffs_init] finished\n");
 	return 0;
 }
 
+void uffs_destroy(void *private_data)
+{
+	fprintf(stdout, "[uffs_destroy] called\n");
+	if (snapshot_save != NULL && uffs_SnapshotSave(&dev, snapshot_save) == U_FAIL) {
+		fprintf(stderr, "[uffs_destroy] snapshot save failed\n");
+	}
+}
+
+// 가장 자주 불리는 op라 stdout trace는 남기지 않음 (stdio lock에서 thread가 줄을 섬)
 int uffs_getattr(const char *path, struct stat *stbuf)
 {
-	fprintf(stdout, "[uffs_getattr] called\n");
-	fprintf(stdout, "[uffs_getattr] path: %s\n", path);
+	struct uffs_lookup f;
 
-	TreeNode *node;
-	URET result;
-    int isDir = 1;
-	
 	memset(stbuf, 0, sizeof(struct stat));
 
-	if (strcmp(path, "/") == 0) {
-		result = uffs_TreeFindNodeByName(&dev, &node, path, &isDir);
-	}
-	else {
-		if (result = uffs_TreeFindNodeByName(&dev, &node, path, &isDir) != U_SUCC) {
+	// 파일 길이는 write가 tree seq 없이 바꾸므로 파일 seq로 확인
+	do {
+		if (uffs_lookup(path, LOOKUP_ANY, &f) != U_SUCC) {
 			fprintf(stderr, "[uffs_getattr] result is U_FAIL\n");
-            return -ENOENT;
-        }
-	}
-    
-    stbuf->st_mode = (isDir ? S_IFDIR : S_IFREG) | node->info.mode;
-    stbuf->st_nlink = node->info.nlink;
-    stbuf->st_size = node->info.len;
-	
-	fprintf(stdout, "[uffs_getattr] finished\n");
+			return -ENOENT;
+		}
+	} while (!f.isDir && uffs_SeqReadRetry(&disk.blocks[f.block].seq, f.fseq));
+
+    stbuf->st_mode = (f.isDir ? S_IFDIR : S_IFREG) | f.mode;
+    stbuf->st_nlink = f.nlink;
+    stbuf->st_size = f.isDir ? 0 : f.len;
 	return 0;
 }
 
@@ -83,12 +172,16 @@ int uffs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
         return -ENOMEM;
     }
 
+    // 목록을 다 넘길 때까지 이름이 바뀌지 않게 함
+    pthread_rwlock_rdlock(&ns_lock);
+
     // 해당 path에 대응하는 node 찾기
     result = uffs_TreeFindNodeByName(&dev, &node, path_copy, NULL);
     free(path_copy); // TreeFindNodeByName 호출 후 복사본은 더 이상 필요 없음
     path_copy = NULL;
 
     if (result != U_SUCC || node == NULL) {
+        pthread_rwlock_unlock(&ns_lock);
         fprintf(stderr, "[uffs_readdir] node not found for path: %s\n", path);
         return -ENOENT;
     }
@@ -118,31 +211,34 @@ int uffs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
     // 해당 디렉토리 하위에 존재하는 디렉토리 엔트리 출력
     for (int i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
-        TreeNode *dnode = dev.tree.dir_entry[i];
-        while (dnode != EMPTY_NODE) {
+        u16 x = dev.tree.dir_entry[i];
+        while (x != EMPTY_NODE) {
+            TreeNode *dnode = FROM_IDX(x, TPOOL(&dev));
             if (dnode->u.dir.parent == parent_serial) {
                 // '.'와 '..'를 제외한 실제 하위 디렉토리 엔트리 이름 추가
-                if (strcmp(dnode->info.name, "/") != 0) { 
+                if (strcmp(NODE_INFO(&dev, dnode)->name, "/") != 0) { 
                     // 루트 노드 이름 '/'는 하위에 직접 표시하지 않음 
                     // 필요에 따라 이 조건은 제거할 수 있음
-                    filler(buf, dnode->info.name, NULL, 0);
+                    filler(buf, NODE_INFO(&dev, dnode)->name, NULL, 0);
                 }
             }
-            dnode = dnode->hash_next;
+            x = dnode->hash_next;
         }
     }
 
     // 해당 디렉토리 하위에 존재하는 파일 엔트리 출력
     for (int i = 0; i < FILE_NODE_ENTRY_LEN; i++) {
-        TreeNode *fnode = dev.tree.file_entry[i];
-        while (fnode != EMPTY_NODE) {
+        u16 x = dev.tree.file_entry[i];
+        while (x != EMPTY_NODE) {
+            TreeNode *fnode = FROM_IDX(x, TPOOL(&dev));
             if (fnode->u.file.parent == parent_serial) {
                 // 파일 이름 출력
-                filler(buf, fnode->info.name, NULL, 0);
+                filler(buf, NODE_INFO(&dev, fnode)->name, NULL, 0);
             }
-            fnode = fnode->hash_next;
+            x = fnode->hash_next;
         }
     }
+    pthread_rwlock_unlock(&ns_lock);
 
     fprintf(stdout, "[uffs_readdir] finished\n");
     return 0;
@@ -150,18 +246,15 @@ int uffs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
 int uffs_opendir(const char *path, struct fuse_file_info *fu)
 {
-    fprintf(stdout, "[uffs_opendir] called\n");
-    TreeNode* node;
+    struct uffs_lookup f;
 	int result;
 	if (strcmp("/", path) == 0) {
-        fprintf(stdout, "[uffs_opendir] finished\n");
 		return 0;
 	}
 
-	result = uffs_TreeFindDirNodeByNameWithoutParent(&dev, &node, path);
+	result = uffs_lookup(path, LOOKUP_DIR, &f);
 
 	if (result == U_SUCC) {
-        fprintf(stdout, "[uffs_opendir] finished\n");
         return 0;
     }
     fprintf(stderr, "[uffs_opendir] error\n");
@@ -170,38 +263,106 @@ int uffs_opendir(const char *path, struct fuse_file_info *fu)
 
 int uffs_open(const char *path, struct fuse_file_info *fi)
 {
-    fprintf(stdout, "[uffs_open] called\n");
-    TreeNode* node;
+    struct uffs_lookup f;
     int result;
-    result = uffs_TreeFindNodeByName(&dev, &node, path, NULL);
+    result = uffs_lookup(path, LOOKUP_ANY, &f);
 
 	if (result == U_SUCC){
-        fprintf(stdout, "[uffs_open] finished\n");
 		return 0;	
 	}
     fprintf(stderr, "[uffs_open] error\n");
 	return -ENOENT;
 }
 
+// lock 없이 복사한 뒤, 그동안 파일이 바뀌었거나 지워졌으면 (header 블록 seq) 다시 읽음
 int uffs_read(const char *path, char *buf, size_t size, off_t offset,
 		      struct fuse_file_info *fi)
 {
-    fprintf(stdout, "[uffs_read] called\n");
-    TreeNode* node;
+    struct uffs_lookup f;
     int result;
-	result = uffs_TreeFindFileNodeByNameWithoutParent(&dev, &node, path);
 
-    if (result == U_FAIL) {
-        fprintf(stderr, "[uffs_read] error\n");
-        return -ENOENT;	
-	}
+    do {
+        if (uffs_lookup(path, LOOKUP_FILE, &f) == U_FAIL) {
+            fprintf(stderr, "[uffs_read] error\n");
+            return -ENOENT;
+        }
+        result = uffs_BlockMapRead(&disk, &disk.blocks[f.block], f.len, buf, size, offset);
+    } while (uffs_SeqReadRetry(&disk.blocks[f.block].seq, f.fseq));
+    return result;
+}
 
-    if (size > node->info.len) {
-        size = node->info.len;
+// 블록을 복사하지 않고 arena memfd의 위치로 넘김, libfuse가 /dev/fuse로 splice (안 되면 pread)
+// fuse가 끝나고 fd가 아닌 buf의 mem은 free하므로 hole과 memfd 밖의 chunk만 따로 받아서 복사함
+// splice는 여기서 돌아간 뒤에 일어나서 그 사이 블록이 다른 파일로 가도 알 수 없음: -s(single thread)에서만 씀 (main)
+int uffs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+                  struct fuse_file_info *fi)
+{
+    TreeNode* node;
+    data_Block* file;
+    uffs_BlockExtent *ext;
+    struct fuse_bufvec *src;
+    struct fuse_buf *b;
+    int max_ext, n, i;
+    off_t pos;
+
+    if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, &node, path) == U_FAIL) {
+        fprintf(stderr, "[uffs_read_buf] error\n");
+        return -ENOENT;
+    }
+    file = &disk.blocks[node->u.file.block];
+    if (size > BLOCKMAP_MAX_LEN) {
+        size = BLOCKMAP_MAX_LEN;
+    }
+
+    max_ext = size / BLOCK_DATA_SIZE + 2;
+    ext = malloc(max_ext * sizeof(uffs_BlockExtent));
+    src = malloc(sizeof(struct fuse_bufvec) + max_ext * sizeof(struct fuse_buf));
+    if (ext == NULL || src == NULL) {
+        free(ext);
+        free(src);
+        return -ENOMEM;
     }
-	memcpy(buf, disk.blocks[node->u.file.block].data, size);
-    fprintf(stdout, "[uffs_read] finished\n");
-    return size;
+    n = uffs_BlockMapExtents(&disk, file, node->u.file.len, size, offset, ext, max_ext);
+    if (n < 0) {
+        free(ext);
+        free(src);
+        return n;
+    }
+
+    *src = FUSE_BUFVEC_INIT(0);
+    for (i = 0; i < n; i++) {
+        b = &src->buf[i];
+        *b = src->buf[0];
+        b->size = ext[i].len;
+        b->mem = NULL;
+        b->fd = ext[i].block == BLOCKMAP_HOLE ? -1 : getBlockFd(&disk, ext[i].block, &pos);
+        if (b->fd >= 0) {
+            b->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+            b->pos = pos + ext[i].offset;
+            continue;
+        }
+        b->flags = 0;
+        b->mem = ext[i].block == BLOCKMAP_HOLE ? calloc(1, b->size) : malloc(b->size);
+        if (b->mem == NULL) {
+            while (i-- > 0) {
+                if (!(src->buf[i].flags & FUSE_BUF_IS_FD)) {
+                    free(src->buf[i].mem);
+                }
+            }
+            free(ext);
+            free(src);
+            return -ENOMEM;
+        }
+        if (ext[i].block != BLOCKMAP_HOLE) {
+            memcpy(b->mem, BLOCK_DATA(&disk, ext[i].block) + ext[i].offset, b->size);
+        }
+    }
+    if (n > 0) {
+        src->count = n;
+    }
+    free(ext);
+    *bufp = src;
+    return 0;
 }
 
 int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
@@ -211,31 +372,72 @@ int uffs_write(const char *path, const char *buf, size_t size, off_t offset,
     URET block_result, node_result;
     TreeNode* node;
     data_Block* block;
+    int ret;
 
-    // 쓰기 범위 확인
-    if (size > BLOCK_DATA_SIZE) {
-        fprintf(stderr, "[uffs_write] file size too big\n");
-        return -EFBIG; // 파일 크기 초과 오류
-    }
+    pthread_rwlock_rdlock(&ns_lock);
     node_result = uffs_TreeFindFileNodeByNameWithoutParent(&dev, &node, path);
     if(node_result == U_FAIL) {
+        pthread_rwlock_unlock(&ns_lock);
         fprintf(stderr, "[uffs_write] find node error\n");
         return -ENOSPC;
     }
     block_result = getUsedBlockById(&disk,&block, node->u.file.block);
     if(block_result == U_FAIL) {
+        pthread_rwlock_unlock(&ns_lock);
         fprintf(stderr, "[uffs_write] getUsedBlockById error\n");
         return -ENOSPC;
     }
-	memcpy(block->data, buf, size);
-    node->info.len = size;
-    block->tag.data_len = node->info.len;
+    pthread_mutex_lock(FILE_LOCK(block->tag.block_id));
+    uffs_SeqWriteBegin(&block->seq);
+    // offset부터 필요한 만큼 블록을 받아서 씀, 파일 길이는 늘어날 때만 바꿈
+    ret = uffs_BlockMapWrite(&disk, block, buf, size, offset);
+    if (ret > 0 && offset + ret > node->u.file.len) {
+        node->u.file.len = offset + ret;
+        block->tag.data_len = node->u.file.len;
+    }
+    uffs_SeqWriteEnd(&block->seq);
+    pthread_mutex_unlock(FILE_LOCK(block->tag.block_id));
+    pthread_rwlock_unlock(&ns_lock);
+
+    return ret;
+}
 
+int uffs_truncate(const char *path, off_t size)
+{
+    fprintf(stdout, "[uffs_truncate] called, path: %s, size: %lld\n", path, (long long)size);
+    TreeNode* node;
+    data_Block* block;
 
-    return size;
+    if (size < 0)
+        return -EINVAL;
+    if (size > BLOCKMAP_MAX_LEN) {
+        fprintf(stderr, "[uffs_truncate] file size too big\n");
+        return -EFBIG;
+    }
+    pthread_rwlock_rdlock(&ns_lock);
+    if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, &node, path) == U_FAIL) {
+        pthread_rwlock_unlock(&ns_lock);
+        fprintf(stderr, "[uffs_truncate] find node error\n");
+        return -ENOENT;
+    }
+    block = &disk.blocks[node->u.file.block];
+
+    pthread_mutex_lock(FILE_LOCK(node->u.file.block));
+    uffs_SeqWriteBegin(&block->seq);
+    // 늘릴 때는 길이만 바꾸면 됨 (EOF 뒤는 hole이거나 0)
+    if (size < node->u.file.len)
+        uffs_BlockMapTruncate(&disk, block, size);
+    node->u.file.len = size;
+    block->tag.data_len = size;
+    uffs_SeqWriteEnd(&block->seq);
+    pthread_mutex_unlock(FILE_LOCK(node->u.file.block));
+    pthread_rwlock_unlock(&ns_lock);
+
+    fprintf(stdout, "[uffs_truncate] finished\n");
+    return 0;
 }
 
-int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+static int uffs_create_locked(const char *path, mode_t mode, struct fuse_file_info *fi) {
     fprintf(stdout, "[uffs_create] called, path: %s\n", path);
 
     // 블록 할당
@@ -250,25 +452,31 @@ int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
     URET initBlockResult = initBlock(&freeBlock, UFFS_TYPE_FILE, 0);
     if (initBlockResult == U_FAIL) {
         fprintf(stderr, "[uffs_create] initBlock error\n");
+        releaseBlock(&disk, freeBlock->tag.block_id);
         return -EINVAL;
     }
 
     // 노드 생성
-    TreeNode *node = (TreeNode *) malloc(sizeof(TreeNode));
-    memset(node, 0, sizeof(TreeNode));
+    TreeNode *node = uffs_TreeNodeGet(&dev);
+    if (node == NULL) {
+        releaseBlock(&disk, freeBlock->tag.block_id);
+        return -ENOSPC;
+    }
     URET initNodeResult = initNode(&dev, node, freeBlock, path, UFFS_TYPE_FILE);
     if (initNodeResult == U_FAIL) {
         fprintf(stderr, "[uffs_create] init node error\n");
+        uffs_TreeNodePut(&dev, node);
+        releaseBlock(&disk, freeBlock->tag.block_id);
         return -EINVAL;
     }
 
-    freeBlock->status = usedblock;
+    uffs_BlockMapInit(&disk, freeBlock);
     uffs_InsertNodeToTree(&dev, UFFS_TYPE_FILE, node);
 
     return 0;
 }
 
-int uffs_mkdir(const char *path, mode_t mode) {
+static int uffs_mkdir_locked(const char *path, mode_t mode) {
     fprintf(stdout, "[uffs_mkdir] called, path: %s\n", path);
 
     // 부모 디렉토리 노드 확인
@@ -291,53 +499,349 @@ int uffs_mkdir(const char *path, mode_t mode) {
     result = initBlock(&freeBlock, UFFS_TYPE_DIR, 0);
     if (result == U_FAIL) {
         fprintf(stderr, "[uffs_mkdir] block initialization failed\n");
+        releaseBlock(&disk, freeBlock->tag.block_id);
         return -EIO;
     }
 
     // 새로운 노드 생성 및 초기화
-    TreeNode *new_node = (TreeNode *)malloc(sizeof(TreeNode));
+    TreeNode *new_node = uffs_TreeNodeGet(&dev);
     if (new_node == NULL) {
-        fprintf(stderr, "[uffs_mkdir] memory allocation failed\n");
-        return -ENOMEM;
+        fprintf(stderr, "[uffs_mkdir] no tree node left\n");
+        releaseBlock(&disk, freeBlock->tag.block_id);
+        return -ENOSPC;
     }
-    memset(new_node, 0, sizeof(TreeNode));
 
     result = initNode(&dev, new_node, freeBlock, path, UFFS_TYPE_DIR);
     if (result == U_FAIL) {
         fprintf(stderr, "[uffs_mkdir] node initialization failed\n");
-        free(new_node);
+        uffs_TreeNodePut(&dev, new_node);
+        releaseBlock(&disk, freeBlock->tag.block_id);
         return -EIO;
     }
 
-    freeBlock->status = usedblock;
     // 새 디렉토리를 트리에 추가
     uffs_InsertNodeToTree(&dev, UFFS_TYPE_DIR, new_node);
 
     // 디렉토리 링크 수 업데이트
-    parent_node->info.nlink++;
-    parent_node->info.last_modify = (u32)time(NULL);
+    NODE_INFO(&dev, parent_node)->nlink++;
+    NODE_INFO(&dev, parent_node)->last_modify = (u32)time(NULL);
 
 
     fprintf(stdout, "[uffs_mkdir] finished\n");
     return 0;
 }
 
+// 하위에 디렉토리나 파일이 있는지 (자식 목록이 따로 없어서 hash를 훑음)
+static int uffs_dir_empty(TreeNode *dir_node) {
+    u16 serial = dir_node->u.dir.serial;
+    TreeNode *node;
+    u16 x;
+
+    for (int i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
+        for (x = dev.tree.dir_entry[i]; x != EMPTY_NODE; x = node->hash_next) {
+            node = FROM_IDX(x, TPOOL(&dev));
+            if (node != dir_node && node->u.dir.parent == serial) {
+                return 0;
+            }
+        }
+    }
+    for (int i = 0; i < FILE_NODE_ENTRY_LEN; i++) {
+        for (x = dev.tree.file_entry[i]; x != EMPTY_NODE; x = node->hash_next) {
+            node = FROM_IDX(x, TPOOL(&dev));
+            if (node->u.file.parent == serial) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// 노드의 블록을 돌려주고 트리에서 뺌
+static void uffs_remove_node(TreeNode *node, u8 type) {
+    if (type == UFFS_TYPE_DIR) {
+        TreeNode *parent_node = uffs_TreeFindDirNode(&dev, node->u.dir.parent);
+        if (parent_node != NULL) {
+            NODE_INFO(&dev, parent_node)->nlink--;
+            NODE_INFO(&dev, parent_node)->last_modify = (u32)time(NULL);
+        }
+    }
+    else {
+        // 파일 블록 map이 가리키는 data 블록부터 돌려줌
+        // 읽고 있던 쪽은 블록이 다른 파일로 가기 전에 seq가 바뀐 것을 봄
+        uffs_SeqWriteBegin(&disk.blocks[node->u.file.block].seq);
+        uffs_BlockMapTruncate(&disk, &disk.blocks[node->u.file.block], 0);
+        uffs_SeqWriteEnd(&disk.blocks[node->u.file.block].seq);
+    }
+    releaseBlock(&disk, node->u.file.block);
+    uffs_BreakFromEntry(&dev, type, node);
+    uffs_TreeNodePut(&dev, node);
+}
+
+static int uffs_unlink_locked(const char *path) {
+    fprintf(stdout, "[uffs_unlink] called, path: %s\n", path);
+
+    TreeNode *node;
+    if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, &node, path) == U_FAIL) {
+        if (uffs_TreeFindDirNodeByNameWithoutParent(&dev, &node, path) == U_SUCC) {
+            return -EISDIR;
+        }
+        fprintf(stderr, "[uffs_unlink] file node not found\n");
+        return -ENOENT;
+    }
+
+    uffs_remove_node(node, UFFS_TYPE_FILE);
+
+    fprintf(stdout, "[uffs_unlink] finished\n");
+    return 0;
+}
+
+static int uffs_rmdir_locked(const char *path) {
+    fprintf(stdout, "[uffs_rmdir] called, path: %s\n", path);
+
+    TreeNode *node;
+    if (strcmp(path, "/") == 0) {
+        return -EBUSY;
+    }
+    if (uffs_TreeFindDirNodeByNameWithoutParent(&dev, &node, path) == U_FAIL) {
+        if (uffs_TreeFindFileNodeByNameWithoutParent(&dev, &node, path) == U_SUCC) {
+            return -ENOTDIR;
+        }
+        fprintf(stderr, "[uffs_rmdir] dir node not found\n");
+        return -ENOENT;
+    }
+    if (!uffs_dir_empty(node)) {
+        return -ENOTEMPTY;
+    }
+
+    uffs_remove_node(node, UFFS_TYPE_DIR);
+
+    fprintf(stdout, "[uffs_rmdir] finished\n");
+    return 0;
+}
+
+// 이름과 부모만 바꿈 (data 블록은 그대로)
+static int uffs_rename_locked(const char *from, const char *to) {
+    fprintf(stdout, "[uffs_rename] called - from: %s, to: %s\n", from, to);
+
+    TreeNode *node, *new_parent, *old_parent, *target, *dir;
+    uffs_FileInfo *info;
+    int isDir = 1;
+    int target_is_dir = 1;
+    char parent_path[MAX_FILENAME_LENGTH];
+    const char *name = strrchr(to, '/') ? strrchr(to, '/') + 1 : to;
+    int name_len = strlen(name);
+
+    if (strcmp(from, "/") == 0 || strcmp(to, "/") == 0) {
+        return -EBUSY;
+    }
+    if (name_len == 0 || name_len > MAX_FILENAME_LENGTH - 1 || name - to >= MAX_FILENAME_LENGTH) {
+        return -ENAMETOOLONG;
+    }
+    if (uffs_TreeFindNodeByName(&dev, &node, from, &isDir) != U_SUCC) {
+        fprintf(stderr, "[uffs_rename] node not found: %s\n", from);
+        return -ENOENT;
+    }
+
+    // 새 부모 디렉토리
+    memcpy(parent_path, to, name - to);
+    parent_path[name - to] = '\0';
+    if (parent_path[0] == '\0') {
+        strcpy(parent_path, "/");
+    }
+    if (uffs_TreeFindDirNodeByNameWithoutParent(&dev, &new_parent, parent_path) == U_FAIL) {
+        fprintf(stderr, "[uffs_rename] parent dir not found: %s\n", parent_path);
+        return -ENOENT;
+    }
+
+    // 디렉토리를 자기 아래로 옮길 수 없음
+    if (isDir) {
+        for (dir = new_parent; dir != NULL && dir->u.dir.serial != ROOT_SERIAL; dir = uffs_TreeFindDirNode(&dev, dir->u.dir.parent)) {
+            if (dir == node) {
+                return -EINVAL;
+            }
+        }
+    }
+
+    // 같은 이름이 이미 있으면 바꿔치기
+    target = uffs_TreeFindDirNodeByName(&dev, name, name_len, new_parent->u.dir.serial);
+    if (target == NULL) {
+        target = uffs_TreeFindFileNodeByName(&dev, name, name_len, new_parent->u.dir.serial);
+        target_is_dir = 0;
+    }
+    if (target == node) {
+        return 0;
+    }
+    if (target != NULL) {
+        if (target_is_dir && !isDir) {
+            return -EISDIR;
+        }
+        if (!target_is_dir && isDir) {
+            return -ENOTDIR;
+        }
+        if (target_is_dir && !uffs_dir_empty(target)) {
+            return -ENOTEMPTY;
+        }
+        uffs_remove_node(target, target_is_dir ? UFFS_TYPE_DIR : UFFS_TYPE_FILE);
+    }
+
+    // parent는 hash key가 아니라서 노드는 그대로 두고 값만 바꿈
+    if (isDir && node->u.dir.parent != new_parent->u.dir.serial) {
+        old_parent = uffs_TreeFindDirNode(&dev, node->u.dir.parent);
+        if (old_parent != NULL) {
+            NODE_INFO(&dev, old_parent)->nlink--;
+        }
+        NODE_INFO(&dev, new_parent)->nlink++;
+    }
+    node->u.file.parent = new_parent->u.dir.serial;
+    disk.blocks[node->u.file.block].tag.parent = new_parent->u.dir.serial;
+    info = NODE_INFO(&dev, node);
+    memset(info->name, 0, MAX_FILENAME_LENGTH);
+    memcpy(info->name, name, name_len);
+    info->name_len = name_len;
+    info->last_modify = (u32)time(NULL);
+    node->u.file.checksum = uffs_MakeSum16(name, name_len);
+
+    fprintf(stdout, "[uffs_rename] finished\n");
+    return 0;
+}
+
+// 이름을 바꾸는 op는 ns_lock을 write로 잡고 하나씩
+int uffs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    uffs_ns_write_begin();
+    int ret = uffs_create_locked(path, mode, fi);
+    uffs_ns_write_end();
+    return ret;
+}
+
+int uffs_mkdir(const char *path, mode_t mode) {
+    uffs_ns_write_begin();
+    int ret = uffs_mkdir_locked(path, mode);
+    uffs_ns_write_end();
+    return ret;
+}
+
+int uffs_unlink(const char *path) {
+    uffs_ns_write_begin();
+    int ret = uffs_unlink_locked(path);
+    uffs_ns_write_end();
+    return ret;
+}
+
+int uffs_rmdir(const char *path) {
+    uffs_ns_write_begin();
+    int ret = uffs_rmdir_locked(path);
+    uffs_ns_write_end();
+    return ret;
+}
+
+int uffs_rename(const char *from, const char *to) {
+    uffs_ns_write_begin();
+    int ret = uffs_rename_locked(from, to);
+    uffs_ns_write_end();
+    return ret;
+}
+
+// ramdisk는 모든 데이터가 메모리에 있어 내려보낼 것이 없음
+int uffs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    fprintf(stdout, "[uffs_fsync] called - path: %s\n", path);
+    return 0;
+}
+
+int uffs_flush(const char *path, struct fuse_file_info *fi)
+{
+    fprintf(stdout, "[uffs_flush] called - path: %s\n", path);
+    return 0;
+}
+
+int uffs_release(const char *path, struct fuse_file_info *fi)
+{
+    fprintf(stdout, "[uffs_release] called - path: %s\n", path);
+    return 0;
+}
+
 struct fuse_operations uffs_oper = {
 	.init		= uffs_init,
+	.destroy	= uffs_destroy,
 	.getattr	= uffs_getattr,
 	.readdir	= uffs_readdir,
     .opendir    = uffs_opendir,
     .open       = uffs_open,
     .read       = uffs_read,
+    .read_buf   = uffs_read_buf,
     .write      = uffs_write,
+    .truncate   = uffs_truncate,
     .create     = uffs_create,
-    .mkdir      = uffs_mkdir
+    .mkdir      = uffs_mkdir,
+    .unlink     = uffs_unlink,
+    .rmdir      = uffs_rmdir,
+    .rename     = uffs_rename,
+    .flush      = uffs_flush,
+    .release    = uffs_release,
+    .fsync      = uffs_fsync
 };
 
+// "64M"처럼 K/M/G를 붙일 수 있는 크기를 블록 수로
+static int parseSize(const char *arg, u32 *blocks) {
+    char *end;
+    unsigned long long bytes = strtoull(arg, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g': bytes <<= 10; /* fall through */
+    case 'M': case 'm': bytes <<= 10; /* fall through */
+    case 'K': case 'k': bytes <<= 10; end++; break;
+    case '\0': break;
+    default: return -1;
+    }
+    if (*end != '\0' || bytes / BLOCK_DATA_SIZE < 2 || bytes / BLOCK_DATA_SIZE > BLOCK_COUNT_MAX) {
+        return -1;
+    }
+    *blocks = bytes / BLOCK_DATA_SIZE;
+    return 0;
+}
+
+// usage: mkuffs [--size=<bytes>[K|M|G]] [--load=<snapshot>] [--save=<snapshot>] <fuse options> <mount point>
+// --load가 있으면 --size 대신 snapshot의 크기를 씀
+// read_buf가 넘기는 memfd 구간을 복사 없이 /dev/fuse로 보내려면 fuse option에 -s -o splice_write
 int main(int argc, char *argv[])
 {
+    // --size, --load, --save는 fuse에 넘기지 않음
+    int n = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--size=", 7) == 0) {
+            if (parseSize(argv[i] + 7, &disk_blocks) < 0) {
+                fprintf(stderr, "[main] invalid size: %s (max %u blocks of %d bytes)\n",
+                        argv[i] + 7, BLOCK_COUNT_MAX, BLOCK_DATA_SIZE);
+                return -1;
+            }
+            continue;
+        }
+        if (strncmp(argv[i], "--load=", 7) == 0) {
+            snapshot_load = argv[i] + 7;
+            continue;
+        }
+        if (strncmp(argv[i], "--save=", 7) == 0) {
+            snapshot_save = argv[i] + 7;
+            continue;
+        }
+        argv[n++] = argv[i];
+    }
+    argc = n;
+    argv[argc] = NULL;
+
+    // read_buf는 블록을 splice 할 때까지 붙잡아 둘 수 없어서 single thread(-s)에서만
+    int single = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+            single = 1;
+        }
+    }
+    if (!single) {
+        uffs_oper.read_buf = NULL;
+    }
+
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <mount-directory>\n", argv[0]);
+        fprintf(stderr, "Usage: %s [--size=<bytes>[K|M|G]] [--load=<snapshot>] [--save=<snapshot>] <mount-directory>\n", argv[0]);
         return -1;
     }
 
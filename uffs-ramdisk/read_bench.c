@@ -0,0 +1,198 @@
+/**
+ * \file read_bench.c
+ * \brief read throughput vs thread count
+ *
+ * mount 없이 mkuffs.c의 FUSE 콜백을 여러 thread에서 직접 불러서 (fuse_loop_mt처럼)
+ * thread 수를 늘려 가며 정해진 시간 동안 uffs_read를 몇 번 했는지 잰다.
+ * 마지막 run은 writer thread 하나가 파일 전체를 한 가지 바이트로 계속 다시 쓰고
+ * 이름도 만들고 지우는 중에 읽어서, 두 가지 바이트가 섞인 결과(torn)가 없는지 본다.
+ *
+ * usage: read_bench [max threads]
+ */
+
+#define main mkuffs_main
+#include "mkuffs.c"
+#undef main
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#define BENCH_FILES			64			//!< 읽는 파일 수
+#define BENCH_FILE_LEN		(64 * 1024)	//!< 파일 하나의 길이
+#define BENCH_READ_SIZE		4096		//!< uffs_read 한 번에 읽는 양
+#define BENCH_SECONDS		0.5			//!< thread 수마다 재는 시간
+#define BENCH_MAX_THREADS	64
+
+struct bench_ThreadSt {
+	pthread_t tid;
+	unsigned int seed;
+	unsigned long long ops;
+	unsigned long long bytes;
+	unsigned long long torn;		//!< 한 번 읽은 내용에 다른 바이트가 섞임
+	unsigned long long errors;		//!< 읽기 실패나 짧게 읽음
+};
+
+static volatile int stop;
+static unsigned long long rewrites;
+
+static double _Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void _FilePath(char *path, int i)
+{
+	sprintf(path, "/dir%d/file%d", i % 4, i);
+}
+
+// 파일 전체를 c로 씀
+static int _Fill(int i, char c)
+{
+	static char data[BENCH_FILE_LEN];
+	char path[64];
+
+	memset(data, c, sizeof(data));
+	_FilePath(path, i);
+	return uffs_write(path, data, sizeof(data), 0, NULL) == sizeof(data) ? 0 : -1;
+}
+
+static void * _Reader(void *arg)
+{
+	struct bench_ThreadSt *t = arg;
+	char buf[BENCH_READ_SIZE];
+	char path[64];
+	off_t offset;
+	int i, n, k;
+
+	while (!stop) {
+		i = rand_r(&t->seed) % BENCH_FILES;
+		offset = (off_t)(rand_r(&t->seed) % (BENCH_FILE_LEN / BENCH_READ_SIZE)) * BENCH_READ_SIZE;
+		_FilePath(path, i);
+		n = uffs_read(path, buf, sizeof(buf), offset, NULL);
+		if (n != sizeof(buf)) {
+			t->errors++;
+			continue;
+		}
+		for (k = 1; k < n; k++) {
+			if (buf[k] != buf[0]) {
+				t->torn++;
+				break;
+			}
+		}
+		t->ops++;
+		t->bytes += n;
+	}
+	return NULL;
+}
+
+// 파일을 돌아가며 다른 바이트로 다시 쓰고, 가끔 tree도 바꿈
+static void * _Writer(void *arg)
+{
+	char path[64];
+	int i = 0;
+
+	while (!stop) {
+		if (_Fill(i % BENCH_FILES, 'a' + rewrites % 26) != 0)
+			fprintf(stderr, "[read_bench] rewrite error\n");
+		if (rewrites % 8 == 0) {
+			sprintf(path, "/dir%d/tmp", i % 4);
+			uffs_create(path, 0644, NULL);
+			uffs_unlink(path);
+		}
+		rewrites++;
+		i++;
+	}
+	return NULL;
+}
+
+static void _Run(int nthreads, UBOOL writer, struct bench_ThreadSt *sum, double *seconds)
+{
+	static struct bench_ThreadSt t[BENCH_MAX_THREADS];
+	pthread_t wtid;
+	double start;
+	int i;
+
+	memset(t, 0, sizeof(t));
+	memset(sum, 0, sizeof(*sum));
+	stop = 0;
+	start = _Now();
+	for (i = 0; i < nthreads; i++) {
+		t[i].seed = 46 + i;
+		pthread_create(&t[i].tid, NULL, _Reader, &t[i]);
+	}
+	if (writer)
+		pthread_create(&wtid, NULL, _Writer, NULL);
+	usleep(BENCH_SECONDS * 1e6);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(t[i].tid, NULL);
+		sum->ops += t[i].ops;
+		sum->bytes += t[i].bytes;
+		sum->torn += t[i].torn;
+		sum->errors += t[i].errors;
+	}
+	if (writer)
+		pthread_join(wtid, NULL);
+	*seconds = _Now() - start;
+}
+
+static void _Print(const char *name, int nthreads, struct bench_ThreadSt *r, double seconds, double base)
+{
+	double ops = r->ops / seconds;
+
+	fprintf(stderr, "%-8s %8d %12.0f %10.1f %8.2f %8llu %8llu\n", name, nthreads, ops,
+			r->bytes / seconds / (1024 * 1024), base > 0 ? ops / base : 1.0, r->torn, r->errors);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_ThreadSt r;
+	double seconds, base = 0;
+	unsigned long long bad = 0;
+	char path[64];
+	int max_threads = argc > 1 ? atoi(argv[1]) : 2 * sysconf(_SC_NPROCESSORS_ONLN);
+	int n, i;
+
+	if (max_threads < 1 || max_threads > BENCH_MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads (1 ~ %d)]\n", argv[0], BENCH_MAX_THREADS);
+		return -1;
+	}
+
+	// 파일시스템 로그는 stdout으로 나오므로 버리고 결과만 stderr로
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		return -1;
+
+	uffs_init();
+	for (i = 0; i < 4; i++) {
+		sprintf(path, "/dir%d", i);
+		uffs_mkdir(path, 0755);
+	}
+	for (i = 0; i < BENCH_FILES; i++) {
+		_FilePath(path, i);
+		if (uffs_create(path, 0644, NULL) != 0 || _Fill(i, 'a') != 0) {
+			fprintf(stderr, "[read_bench] setup error: %s\n", path);
+			return -1;
+		}
+	}
+
+	fprintf(stderr, "%d files x %d bytes, %d byte reads, %.1f s per run, %ld cpus\n",
+			BENCH_FILES, BENCH_FILE_LEN, BENCH_READ_SIZE, BENCH_SECONDS, sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(stderr, "%-8s %8s %12s %10s %8s %8s %8s\n", "run", "threads", "reads/s", "MB/s", "speedup", "torn", "errors");
+	for (n = 1; n <= max_threads; n *= 2) {
+		_Run(n, U_FALSE, &r, &seconds);
+		if (n == 1)
+			base = r.ops / seconds;
+		_Print("read", n, &r, seconds, base);
+		bad += r.torn + r.errors;
+	}
+	_Run(max_threads, U_TRUE, &r, &seconds);
+	_Print("+writer", max_threads, &r, seconds, base);
+	fprintf(stderr, "writer: %llu whole-file rewrites\n", rewrites);
+	bad += r.torn + r.errors;
+
+	uffs_destroy(NULL);
+	return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+/**
+ * \file uffs_blockmap.c
+ * \brief per-file block map of the ramdisk: offset read/write, truncate
+ *
+ * arena에서 블록 번호가 이어지는 블록은 data 페이지도 이어져 있으므로
+ * (같은 chunk 안이면) 파일 블록 여러 개를 memcpy 한 번으로 복사한다.
+ *
+ * 읽기(Read / Extents)는 lock 없이 쓰기와 겹칠 수 있다 (mkuffs.c의 seqlock으로 나중에 버림).
+ * 그동안 본 블록 번호는 틀릴 수 있어서, 아직 없는 chunk를 건드리지 않도록 nblocks 밖은 hole로 본다.
+ */
+
+#include "uffs_blockmap.h"
+#include "uffs_tree.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+// map에서 읽은 블록 번호를 따라가도 되는지 (쓰는 중에 읽은 값이면 아무 값이나 될 수 있음)
+static UBOOL _Mapped(data_Disk *disk, u16 block)
+{
+	return block != BLOCKMAP_HOLE && block < __atomic_load_n(&disk->nblocks, __ATOMIC_ACQUIRE);
+}
+
+// 파일 블록으로 쓸 빈 블록 (0으로 채움)
+static data_Block * _NewBlock(data_Disk *disk, data_Block *file)
+{
+	data_Block *block;
+
+	if (getFreeBlock(disk, &block) == U_FAIL)
+		return NULL;
+	initBlock(&block, UFFS_TYPE_DATA, 0);
+	block->tag.parent = file->tag.serial;
+	memset(BLOCK_DATA(disk, block->tag.block_id), 0, BLOCK_DATA_SIZE);
+	return block;
+}
+
+// slot이 가리키는 index 블록의 map, 없으면 alloc일 때 새로 받음
+static u16 * _Index(data_Disk *disk, data_Block *file, u16 *slot, UBOOL alloc)
+{
+	data_Block *block;
+	u16 id = *slot;
+
+	if (!_Mapped(disk, id)) {
+		if (!alloc)
+			return NULL;
+		block = _NewBlock(disk, file);
+		if (block == NULL)
+			return NULL;
+		id = *slot = block->tag.block_id;
+	}
+	return (u16 *)BLOCK_DATA(disk, id);
+}
+
+// 파일 블록 k의 블록 번호가 있는 slot, index 블록이 없으면 NULL (alloc이면 만듦)
+static u16 * _Slot(data_Disk *disk, data_Block *file, u32 k, UBOOL alloc)
+{
+	u16 *map = (u16 *)BLOCK_DATA(disk, file->tag.block_id);
+
+	if (k < BLOCKMAP_DIRECT)
+		return &map[k];
+	k -= BLOCKMAP_DIRECT;
+	if (k < BLOCKMAP_PER_PAGE) {
+		map = _Index(disk, file, &map[BLOCKMAP_INDIRECT], alloc);
+		return map ? &map[k] : NULL;
+	}
+	k -= BLOCKMAP_PER_PAGE;
+	map = _Index(disk, file, &map[BLOCKMAP_DINDIRECT], alloc);
+	if (map == NULL)
+		return NULL;
+	map = _Index(disk, file, &map[k / BLOCKMAP_PER_PAGE], alloc);
+	return map ? &map[k % BLOCKMAP_PER_PAGE] : NULL;
+}
+
+// 파일 블록 k의 data 페이지, hole이면 NULL
+static char * _Page(data_Disk *disk, data_Block *file, u32 k)
+{
+	u16 *slot = _Slot(disk, file, k, U_FALSE);
+	u16 block;
+
+	if (slot == NULL)
+		return NULL;
+	block = *slot;
+	if (!_Mapped(disk, block))
+		return NULL;
+	return BLOCK_DATA(disk, block);
+}
+
+// page + in에서 시작해 size까지, 다음 파일 블록의 페이지가 바로 뒤에 붙어 있는 동안 늘린 길이
+static size_t _Run(data_Disk *disk, data_Block *file, u32 k, char *page, u32 in, size_t size)
+{
+	size_t n = BLOCK_DATA_SIZE - in;
+
+	while (n < size && _Page(disk, file, ++k) == page + in + n)
+		n += BLOCK_DATA_SIZE;
+	return n < size ? n : size;
+}
+
+/**
+ * \brief 새 파일의 블록 map을 비움 (create에서)
+ */
+void uffs_BlockMapInit(data_Disk *disk, data_Block *file)
+{
+	memset(BLOCK_DATA(disk, file->tag.block_id), 0, BLOCK_DATA_SIZE);
+}
+
+/**
+ * \brief [offset, offset + size) 읽기, hole은 0
+ * \return 읽은 길이 (EOF면 0)
+ */
+int uffs_BlockMapRead(data_Disk *disk, data_Block *file, u32 file_len, char *buf, size_t size, off_t offset)
+{
+	size_t done = 0, n;
+	u32 k, in;
+	char *page;
+
+	if (offset < 0)
+		return -EINVAL;
+	if (offset >= file_len)
+		return 0;
+	if (size > file_len - offset)
+		size = file_len - offset;
+
+	while (done < size) {
+		k = (offset + done) / BLOCK_DATA_SIZE;
+		in = (offset + done) % BLOCK_DATA_SIZE;
+		page = _Page(disk, file, k);
+		if (page == NULL) {
+			n = BLOCK_DATA_SIZE - in;
+			if (n > size - done)
+				n = size - done;
+			memset(buf + done, 0, n);
+		}
+		else {
+			n = _Run(disk, file, k, page, in, size - done);
+			memcpy(buf + done, page + in, n);
+		}
+		done += n;
+	}
+	return done;
+}
+
+/**
+ * \brief [offset, offset + size)를 구간으로 나눔 (read_buf에서 블록을 복사하지 않고 넘기려고)
+ * 블록 번호가 이어지면 페이지도 arena_fd의 위치도 이어지므로 한 구간으로 묶고, chunk 경계에서는 끊음
+ * \param[out] ext 구간 배열, (size / BLOCK_DATA_SIZE + 2)개면 모자라지 않음
+ * \return 구간 수, max_ext를 넘으면 -EINVAL
+ */
+int uffs_BlockMapExtents(data_Disk *disk, data_Block *file, u32 file_len, size_t size, off_t offset,
+						 uffs_BlockExtent *ext, int max_ext)
+{
+	size_t done = 0, n;
+	u32 k, in;
+	u16 block, *slot;
+	int count = 0;
+	uffs_BlockExtent *last = NULL;
+
+	if (offset < 0)
+		return -EINVAL;
+	if (offset >= file_len)
+		return 0;
+	if (size > file_len - offset)
+		size = file_len - offset;
+
+	while (done < size) {
+		k = (offset + done) / BLOCK_DATA_SIZE;
+		in = (offset + done) % BLOCK_DATA_SIZE;
+		n = BLOCK_DATA_SIZE - in;
+		if (n > size - done)
+			n = size - done;
+		slot = _Slot(disk, file, k, U_FALSE);
+		block = slot ? *slot : BLOCKMAP_HOLE;
+		if (!_Mapped(disk, block))
+			block = BLOCKMAP_HOLE;
+
+		if (last != NULL &&
+			(block == BLOCKMAP_HOLE ? last->block == BLOCKMAP_HOLE :
+			 last->block != BLOCKMAP_HOLE && block % ARENA_CHUNK_BLOCKS != 0 &&
+			 block == last->block + (last->offset + last->len) / BLOCK_DATA_SIZE)) {
+			last->len += n;
+		}
+		else {
+			if (count == max_ext)
+				return -EINVAL;
+			last = &ext[count++];
+			last->block = block;
+			last->offset = in;
+			last->len = n;
+		}
+		done += n;
+	}
+	return count;
+}
+
+/**
+ * \brief [offset, offset + size) 쓰기, 없는 블록은 받아서 씀 (파일 길이는 호출한 쪽에서)
+ * \return 쓴 길이, 하나도 못 썼으면 -ENOSPC / -EFBIG
+ */
+int uffs_BlockMapWrite(data_Disk *disk, data_Block *file, const char *buf, size_t size, off_t offset)
+{
+	size_t done = 0, n;
+	u32 k, in;
+	u16 *slot;
+	char *page;
+	data_Block *block;
+	size_t want = size;
+
+	if (offset < 0)
+		return -EINVAL;
+	if (offset >= BLOCKMAP_MAX_LEN)
+		return -EFBIG;
+	if (size > BLOCKMAP_MAX_LEN - offset)
+		size = BLOCKMAP_MAX_LEN - offset;
+
+	// 먼저 범위의 블록을 순서대로 다 받아 둠: free stack에서 번호가 이어서 나오므로
+	// 새로 늘어나는 부분은 페이지가 이어져 아래에서 한 번에 복사됨
+	for (k = offset / BLOCK_DATA_SIZE; size > 0 && k <= (offset + size - 1) / BLOCK_DATA_SIZE; k++) {
+		slot = _Slot(disk, file, k, U_TRUE);
+		if (slot != NULL && *slot == BLOCKMAP_HOLE) {
+			block = _NewBlock(disk, file);
+			if (block != NULL)
+				*slot = block->tag.block_id;
+		}
+		if (slot == NULL || *slot == BLOCKMAP_HOLE) {
+			// 공간이 모자라면 받은 블록까지만 씀
+			size = (off_t)k * BLOCK_DATA_SIZE > offset ? (off_t)k * BLOCK_DATA_SIZE - offset : 0;
+			break;
+		}
+	}
+
+	while (done < size) {
+		k = (offset + done) / BLOCK_DATA_SIZE;
+		in = (offset + done) % BLOCK_DATA_SIZE;
+		page = _Page(disk, file, k);
+		n = _Run(disk, file, k, page, in, size - done);
+		memcpy(page + in, buf + done, n);
+		done += n;
+	}
+
+	if (done == 0 && want > 0) {
+		fprintf(stderr, "[uffs_BlockMapWrite] no free block\n");
+		return -ENOSPC;
+	}
+	return done;
+}
+
+// slot 아래 level 단계 index에서 파일 블록 first(이 index 안에서의 번호)부터 모두 돌려줌
+// first가 0이면 slot이 가리키는 블록도 돌려줌
+static void _FreeFrom(data_Disk *disk, u16 *slot, u32 first, int level)
+{
+	u32 span = 1, i;
+	u16 *map;
+	int l;
+
+	if (*slot == BLOCKMAP_HOLE)
+		return;
+	if (level > 0) {
+		for (l = 1; l < level; l++)
+			span *= BLOCKMAP_PER_PAGE;
+		map = (u16 *)BLOCK_DATA(disk, *slot);
+		for (i = first / span; i < BLOCKMAP_PER_PAGE; i++)
+			_FreeFrom(disk, &map[i], i == first / span ? first % span : 0, level - 1);
+	}
+	if (first == 0) {
+		releaseBlock(disk, *slot);
+		*slot = BLOCKMAP_HOLE;
+	}
+}
+
+/**
+ * \brief 파일을 new_len으로 줄임: 뒤의 블록을 돌려주고 마지막 블록의 EOF 뒤를 0으로
+ * 늘릴 때는 EOF 뒤가 이미 0이라 할 일이 없음
+ */
+void uffs_BlockMapTruncate(data_Disk *disk, data_Block *file, u32 new_len)
+{
+	u16 *map = (u16 *)BLOCK_DATA(disk, file->tag.block_id);
+	u32 keep = (new_len + BLOCK_DATA_SIZE - 1) / BLOCK_DATA_SIZE;
+	u32 k;
+	char *page;
+
+	for (k = keep; k < BLOCKMAP_DIRECT; k++)
+		_FreeFrom(disk, &map[k], 0, 0);
+	_FreeFrom(disk, &map[BLOCKMAP_INDIRECT],
+			  keep > BLOCKMAP_DIRECT ? keep - BLOCKMAP_DIRECT : 0, 1);
+	_FreeFrom(disk, &map[BLOCKMAP_DINDIRECT],
+			  keep > BLOCKMAP_DIRECT + BLOCKMAP_PER_PAGE ? keep - BLOCKMAP_DIRECT - BLOCKMAP_PER_PAGE : 0, 2);
+
+	if (new_len % BLOCK_DATA_SIZE != 0) {
+		page = _Page(disk, file, new_len / BLOCK_DATA_SIZE);
+		if (page != NULL)
+			memset(page + new_len % BLOCK_DATA_SIZE, 0, BLOCK_DATA_SIZE - new_len % BLOCK_DATA_SIZE);
+	}
+}
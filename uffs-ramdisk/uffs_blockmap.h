@@ -0,0 +1,48 @@
+/**
+ * \file uffs_blockmap.h
+ * \brief per-file block map of the ramdisk: offset read/write, truncate
+ *
+ * 파일이 가진 블록(헤더 블록)의 data 페이지를 블록 map으로 쓴다 (ext2의 inode처럼).
+ * map은 u16 블록 번호 #BLOCKMAP_PER_PAGE개이고, 앞의 #BLOCKMAP_DIRECT개는 파일 블록을
+ * 바로 가리키고, 나머지 둘은 index 블록 하나(#BLOCKMAP_INDIRECT)와 두 단계 index
+ * (#BLOCKMAP_DINDIRECT)를 가리킨다. 그래서 arena 전체만큼 파일을 키울 수 있다.
+ *
+ * 블록 번호가 #BLOCKMAP_HOLE(루트 블록)이면 아직 블록이 없는 hole이라 0으로 읽힌다.
+ * 새 블록은 0으로 채워서 받고, 줄일 때는 EOF 뒤를 0으로 지우므로 EOF 뒤는 늘 0이다.
+ */
+
+#ifndef _UFFS_BLOCKMAP_H_
+#define _UFFS_BLOCKMAP_H_
+
+#include <sys/types.h>
+
+#include "uffs_types.h"
+#include "uffs_disk.h"
+
+#define BLOCKMAP_PER_PAGE	(BLOCK_DATA_SIZE / (int)sizeof(u16))	//!< 페이지 하나에 들어가는 블록 번호 수
+#define BLOCKMAP_DIRECT		(BLOCKMAP_PER_PAGE - 2)				//!< 바로 가리키는 파일 블록 수
+#define BLOCKMAP_INDIRECT	BLOCKMAP_DIRECT						//!< index 블록 slot
+#define BLOCKMAP_DINDIRECT	(BLOCKMAP_DIRECT + 1)				//!< 두 단계 index 블록 slot
+#define BLOCKMAP_HOLE		ROOT_BLOCK							//!< 블록 없음
+
+#define BLOCKMAP_MAX_BLOCKS	((u32)BLOCKMAP_DIRECT + BLOCKMAP_PER_PAGE + BLOCKMAP_PER_PAGE * BLOCKMAP_PER_PAGE)
+#define BLOCKMAP_MAX_LEN	((off_t)BLOCKMAP_MAX_BLOCKS * BLOCK_DATA_SIZE)
+
+/**
+ * \struct uffs_BlockExtentSt
+ * \brief 파일의 한 구간: 번호가 이어지는 블록들 (한 chunk 안) 또는 hole
+ */
+typedef struct uffs_BlockExtentSt {
+	u16 block;		//!< 첫 블록 번호, #BLOCKMAP_HOLE이면 hole
+	u16 offset;		//!< 첫 블록 안에서 시작 위치
+	u32 len;		//!< 구간 길이
+} uffs_BlockExtent;
+
+void uffs_BlockMapInit(data_Disk *disk, data_Block *file);
+int uffs_BlockMapRead(data_Disk *disk, data_Block *file, u32 file_len, char *buf, size_t size, off_t offset);
+int uffs_BlockMapWrite(data_Disk *disk, data_Block *file, const char *buf, size_t size, off_t offset);
+int uffs_BlockMapExtents(data_Disk *disk, data_Block *file, u32 file_len, size_t size, off_t offset,
+						 uffs_BlockExtent *ext, int max_ext);
+void uffs_BlockMapTruncate(data_Disk *disk, data_Block *file, u32 new_len);
+
+#endif // _UFFS_BLOCKMAP_H_
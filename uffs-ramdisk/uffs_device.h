@@ -11,6 +11,7 @@
  */
 typedef struct uffs_DeviceSt {
 	struct uffs_TreeSt				tree;		//!< tree list of block
+	data_Disk						*disk;		//!< 노드의 블록과 uffs_FileInfo가 있는 ramdisk
 } uffs_Device;
 
 #endif
\ No newline at end of file
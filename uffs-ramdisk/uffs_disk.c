@@ -1,51 +1,269 @@
+#define _GNU_SOURCE
 #include "uffs_disk.h"
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// chunk들을 올릴 memfd, 블록 data 페이지를 read_buf에서 fd로 넘기기 위해 씀
+static int openArena(UBOOL huge) {
+#ifdef MFD_HUGETLB
+    if (huge) {
+        int flags = MFD_CLOEXEC | MFD_HUGETLB;
+#ifdef MFD_HUGE_2MB
+        flags |= MFD_HUGE_2MB;
+#endif
+        return memfd_create("uffs-arena", flags);
+    }
+#endif
+    return huge ? -1 : memfd_create("uffs-arena", MFD_CLOEXEC);
+}
+
+// 2 MiB 경계에서 시작하는 chunk 자리: 두 배를 받고 앞뒤 남는 부분을 돌려줌
+static char *mapAligned(void) {
+    char *p, *start;
+
+    p = mmap(NULL, ARENA_CHUNK_SIZE * 2, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    start = (char *)(((uintptr_t)p + ARENA_CHUNK_SIZE - 1) & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1));
+    if (start > p) {
+        munmap(p, start - p);
+    }
+    if (p + ARENA_CHUNK_SIZE * 2 > start + ARENA_CHUNK_SIZE) {
+        munmap(start + ARENA_CHUNK_SIZE, p + ARENA_CHUNK_SIZE * 2 - (start + ARENA_CHUNK_SIZE));
+    }
+    return start;
+}
+
+// arena_fd의 [off, off + ARENA_CHUNK_SIZE)를 MAP_SHARED로 올림
+// hugetlbfs는 mmap할 때 hugepage를 예약하므로 모자라면 여기서 실패함
+static char *mapArenaChunk(data_Disk *disk, off_t off) {
+    char *p;
+
+    if (ftruncate(disk->arena_fd, off + ARENA_CHUNK_SIZE) < 0) {
+        return NULL;
+    }
+    if (disk->arena_huge) {
+        p = mmap(NULL, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, disk->arena_fd, off);
+        return p == MAP_FAILED ? NULL : p;
+    }
+    p = mapAligned();
+    if (p == NULL) {
+        return NULL;
+    }
+    if (mmap(p, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             disk->arena_fd, off) == MAP_FAILED) {
+        munmap(p, ARENA_CHUNK_SIZE);
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(p, ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+// data 페이지 chunk 하나를 받음
+// chunk c는 arena_fd의 c * ARENA_CHUNK_SIZE에 올려서 블록 i가 fd offset i * BLOCK_DATA_SIZE에 오게 함
+// memfd를 못 쓰면 익명 mmap: hugetlbfs 페이지가 있으면 MAP_HUGETLB, 없으면 2 MiB 경계에 맞춰 THP를 요청
+static char *allocChunk(data_Disk *disk, UBOOL *huge, UBOOL *in_fd) {
+    off_t off = (off_t)disk->nchunks * ARENA_CHUNK_SIZE;
+    char *p = NULL;
+
+    if (disk->arena_fd >= 0) {
+        p = mapArenaChunk(disk, off);
+        if (p == NULL && disk->nchunks == 0 && disk->arena_huge) {
+            // hugepage가 없으면 처음부터 일반 memfd로
+            close(disk->arena_fd);
+            disk->arena_huge = U_FALSE;
+            disk->arena_fd = openArena(U_FALSE);
+            if (disk->arena_fd >= 0) {
+                p = mapArenaChunk(disk, off);
+            }
+        }
+        if (p != NULL) {
+            *huge = disk->arena_huge;
+            *in_fd = U_TRUE;
+            return p;
+        }
+    }
+    *in_fd = U_FALSE;
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        *huge = U_TRUE;
+        return p;
+    }
+#endif
+    *huge = U_FALSE;
+    p = mapAligned();
+#ifdef MADV_HUGEPAGE
+    if (p != NULL) {
+        madvise(p, ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+    }
+#endif
+    return p;
+}
+
+// chunk 하나만큼 블록을 늘리고 새 블록을 free stack에 넣음 (낮은 번호부터 나가도록 거꾸로)
+static URET growDisk(data_Disk *disk) {
+    u32 first = disk->nblocks;
+    u32 last;
+    UBOOL huge, in_fd;
+    char *chunk;
+
+    if (first >= disk->max_blocks) {
+        return U_FAIL;
+    }
+    chunk = allocChunk(disk, &huge, &in_fd);
+    if (chunk == NULL) {
+        fprintf(stderr,"[growDisk] chunk mmap error\n");
+        return U_FAIL;
+    }
+    disk->chunk_in_fd[disk->nchunks] = in_fd;
+    disk->chunks[disk->nchunks++] = chunk;
+    if (huge) {
+        disk->huge_chunks++;
+    }
+
+    last = first + ARENA_CHUNK_BLOCKS;
+    if (last > disk->max_blocks) {
+        last = disk->max_blocks;
+    }
+    for (u32 i = last; i-- > first;) {
+        disk->blocks[i].status = unusedblock;
+        if (i != ROOT_BLOCK) {
+            disk->free_blocks[disk->free_count++] = i;
+        }
+    }
+    // 읽는 쪽은 nblocks 안의 블록만 보므로 chunk와 blocks[]를 채운 다음에 늘림
+    __atomic_store_n(&disk->nblocks, last, __ATOMIC_RELEASE);
+    fprintf(stdout,"[growDisk] %u / %u blocks, chunk %u (%s%s)\n", disk->nblocks, disk->max_blocks,
+            disk->nchunks, huge ? "hugetlb" : "thp", in_fd ? ", memfd" : "");
+    return U_SUCC;
+}
+
+// 돌려받은 serial을 먼저 쓰고, 없으면 새 serial (블록마다 하나라서 max_blocks를 넘지 않음)
+static u16 allocSerial(data_Disk *disk) {
+    if (disk->free_serial_count > 0) {
+        return disk->free_serials[--disk->free_serial_count];
+    }
+    return disk->next_serial++;
+}
+
+// free stack에서 블록을 꺼내 사용 중으로 표시, 실패하면 호출한 쪽에서 releaseBlock
 URET getFreeBlock(data_Disk* disk, data_Block** freeBlock) {
     fprintf(stdout,"[getFreeBlock] called\n");
-    for(int i = 0; i<BLOCK_COUNT;i++){
-        if(disk->blocks[i].status == unusedblock) {
-            memset(&disk->blocks[i],0,sizeof(data_Block));
-            srand(time(NULL)); // 시드 초기화
-            u16 random_serial = (u16)(rand() & 0xFFFF); // 16비트 값 생성
-            disk->blocks[i].tag.block_id = i;
-            disk->blocks[i].tag.serial = random_serial;
-            *freeBlock = &disk->blocks[i];
-            fprintf(stdout,"[getFreeBlock] finished\n");
-            return U_SUCC;
-        }
+    pthread_mutex_lock(&disk->lock);
+    if (disk->free_count == 0 && growDisk(disk) == U_FAIL) {
+        pthread_mutex_unlock(&disk->lock);
+        fprintf(stderr,"[getFreeBlock] error 1\n");
+        return U_FAIL;
     }
-    fprintf(stderr,"[getFreeBlock] error 1\n");
-    return U_FAIL;
+    u16 i = disk->free_blocks[--disk->free_count];
+    // data 페이지는 그대로 두고 metadata만 비움
+    memset(&disk->blocks[i].tag,0,sizeof(struct data_TagSt));
+    memset(&disk->blocks[i].info,0,sizeof(uffs_FileInfo));
+    disk->blocks[i].status = usedblock;
+    disk->blocks[i].tag.block_id = i;
+    disk->blocks[i].tag.serial = allocSerial(disk);
+    pthread_mutex_unlock(&disk->lock);
+    *freeBlock = &disk->blocks[i];
+    fprintf(stdout,"[getFreeBlock] finished\n");
+    return U_SUCC;
 };
 
-URET initBlock(data_Block** block, u8 type, u16 data_len) {
+URET initBlock(data_Block** block, u8 type, u32 data_len) {
     fprintf(stdout,"[initBlock] called\n");
     (*block)->tag.data_len = data_len;
     (*block)->tag.type = type;
     (*block)->tag.page_offset = 0;
     fprintf(stdout,"[initBlock] finished\n");
+    return U_SUCC;
 }
 
 URET getUsedBlockById(data_Disk *disk, data_Block **block, u16 block_id){
     fprintf(stdout,"[getUsedBlockById] called\n");
-    for(int i =0;i<BLOCK_COUNT;i++){
-        if(disk->blocks[i].tag.block_id==block_id && disk->blocks[i].status==usedblock){
-            *block=&disk->blocks[i];
-            fprintf(stdout,"[getUsedBlockById] finished\n");
-            return U_SUCC;
-        }
+    if(block_id < disk->nblocks && disk->blocks[block_id].status==usedblock){
+        *block=&disk->blocks[block_id];
+        fprintf(stdout,"[getUsedBlockById] finished\n");
+        return U_SUCC;
     }
     fprintf(stderr,"[getUsedBlockById] error 1\n");
     return U_FAIL;
     
 }
 
-void uffs_InitBlock(data_Disk *disk){
+// read_buf: 블록 data 페이지를 담은 fd와 그 안의 위치, fd에 없는 chunk면 -1
+int getBlockFd(data_Disk *disk, u16 block_id, off_t *pos){
+    if (block_id >= disk->nblocks || !disk->chunk_in_fd[block_id / ARENA_CHUNK_BLOCKS]) {
+        return -1;
+    }
+    *pos = (off_t)block_id * BLOCK_DATA_SIZE;
+    return disk->arena_fd;
+}
+
+// unlink/rmdir: 블록과 serial을 다시 getFreeBlock이 줄 수 있게 돌려줌
+URET releaseBlock(data_Disk *disk, u16 block_id){
+    pthread_mutex_lock(&disk->lock);
+    if (block_id >= disk->nblocks || block_id == ROOT_BLOCK || disk->blocks[block_id].status != usedblock) {
+        pthread_mutex_unlock(&disk->lock);
+        fprintf(stderr,"[releaseBlock] invalid block %u\n", block_id);
+        return U_FAIL;
+    }
+    disk->blocks[block_id].status = unusedblock;
+    disk->free_blocks[disk->free_count++] = block_id;
+    disk->free_serials[disk->free_serial_count++] = disk->blocks[block_id].tag.serial;
+    pthread_mutex_unlock(&disk->lock);
+    return U_SUCC;
+}
+
+// 앞으로 받을 chunk를 올릴 arena memfd를 엶 (hugetlbfs 먼저), 못 열면 arena_fd는 -1
+void uffs_OpenArena(data_Disk *disk){
+    disk->arena_huge = U_TRUE;
+    disk->arena_fd = openArena(U_TRUE);
+    if (disk->arena_fd < 0) {
+        disk->arena_huge = U_FALSE;
+        disk->arena_fd = openArena(U_FALSE);
+    }
+}
+
+/**
+ * \brief ramdisk 초기화: 첫 chunk만 받고 나머지는 블록이 모자랄 때 받음
+ * \param[in] max_blocks 최대 블록 수 (0이면 BLOCK_COUNT_DEFAULT)
+ */
+URET uffs_InitBlock(data_Disk *disk, u32 max_blocks){
     fprintf(stdout,"[uffs_InitBlock] called\n");
-    for(int i=0;i<BLOCK_DATA_SIZE;i++){
-        disk->blocks[i].status = unusedblock;
+    if (max_blocks == 0) {
+        max_blocks = BLOCK_COUNT_DEFAULT;
+    }
+    if (max_blocks < 2 || max_blocks > BLOCK_COUNT_MAX) {
+        fprintf(stderr,"[uffs_InitBlock] invalid block count %u\n", max_blocks);
+        return U_FAIL;
     }
+    memset(disk, 0, sizeof(data_Disk));
+    disk->max_blocks = max_blocks;
+    disk->next_serial = FIRST_SERIAL;
+    pthread_mutex_init(&disk->lock, NULL);
+    uffs_OpenArena(disk);
+    // snapshot에 그대로 쓰므로 쓰레기 값 없이 0으로 받음
+    disk->blocks = (data_Block *)calloc(max_blocks, sizeof(data_Block));
+    disk->free_blocks = (u16 *)calloc(max_blocks, sizeof(u16));
+    disk->free_serials = (u16 *)calloc(max_blocks, sizeof(u16));
+    if (disk->blocks == NULL || disk->free_blocks == NULL || disk->free_serials == NULL) {
+        fprintf(stderr,"[uffs_InitBlock] memory allocation failed\n");
+        return U_FAIL;
+    }
+    if (growDisk(disk) == U_FAIL) {
+        return U_FAIL;
+    }
+    disk->blocks[ROOT_BLOCK].status = usedblock;
     fprintf(stdout,"[uffs_InitBlock] finished\n");
+    return U_SUCC;
 }
 
-
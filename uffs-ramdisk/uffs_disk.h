@@ -4,33 +4,89 @@
 #include "uffs_types.h"
 #include <time.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <pthread.h>
 
-#define BLOCK_COUNT 512               //!< 블록 개수
 #define BLOCK_DATA_SIZE 512
 
+// block_id와 트리 노드 index가 u16이고 0xffff는 EMPTY_NODE라서 블록 수는 이만큼까지
+#define BLOCK_COUNT_MAX 0xfff0        //!< 최대 블록 개수 (약 32 MiB)
+#define BLOCK_COUNT_DEFAULT BLOCK_COUNT_MAX
+
+// data 페이지는 chunk 단위로 mmap 해서 늘림 (chunk 하나가 2 MiB hugepage 하나)
+#define ARENA_CHUNK_SIZE (2 * 1024 * 1024)
+#define ARENA_CHUNK_BLOCKS (ARENA_CHUNK_SIZE / BLOCK_DATA_SIZE)
+#define ARENA_MAX_CHUNKS ((BLOCK_COUNT_MAX + ARENA_CHUNK_BLOCKS - 1) / ARENA_CHUNK_BLOCKS)
+
+#define MAX_FILENAME_LENGTH         128
+
+#define ROOT_BLOCK 0                  //!< 루트 디렉토리 블록, free list에 넣지 않음
+#define FIRST_SERIAL 1                //!< 루트(0) 다음부터 serial을 줌
+
 typedef enum {usedblock, unusedblock} block_status;
 
+// 파일 길이는 tag.data_len과 트리 노드(u.file.len)에 있음
+struct uffs_FileInfoSt {
+    u32 create_time;
+    u32 last_modify;
+    u32 access;
+    u32 reserved;
+    u32 name_len;           //!< length of file/dir name
+    char name[MAX_FILENAME_LENGTH];
+	// TODO: warning
+	short nlink;
+	u16 mode;
+};
+typedef struct uffs_FileInfoSt uffs_FileInfo;
+
 struct data_TagSt {
     u16 block_id;    //!< 블록 ID
     u16 page_offset; //!< 페이지 내 위치
     u8 type;         //!< 블록 타입 (파일, 디렉터리, 데이터 등)
-    u16 data_len;    //!< 데이터 길이
+    u32 data_len;    //!< 데이터 길이 (파일이면 파일 길이)
     u16 serial;      //!< 고유 번호
     u16 parent;      //!< 부모 블록 ID
 };
 
+// 블록의 metadata, data 페이지는 arena chunk에 따로 있음 (BLOCK_DATA)
+// pointer가 없어서 snapshot에서 배열째로 올려 쓸 수 있음
 typedef struct data_BlockSt {
     block_status status; //!< 블록 상태
-    char data[BLOCK_DATA_SIZE];
+    u32 seq;             //!< 파일 header 블록: 파일 내용/길이를 바꾸는 중이면 홀수 (uffs_seqlock.h), 재사용해도 초기화하지 않음
     struct data_TagSt tag;
+    uffs_FileInfo info;  //!< 이 블록을 가진 파일/디렉토리의 정보
 } data_Block;
 
+// block_id는 blocks[] 배열 index와 같음
+// blocks[]와 stack은 max_blocks 만큼 잡고, data 페이지는 nblocks 까지만 chunk로 받아 둠
+// nblocks는 lock 없이 읽는 쪽이 있어서 chunk를 먼저 채우고 늘림
 typedef struct data_DiskSt {
-    struct data_BlockSt blocks[BLOCK_COUNT];
+    data_Block *blocks;
+    u32 nblocks;                    //!< 지금까지 chunk를 받은 블록 수
+    u32 max_blocks;                 //!< 늘릴 수 있는 최대 블록 수
+    char *chunks[ARENA_MAX_CHUNKS]; //!< data 페이지 chunk
+    u32 nchunks;
+    u32 huge_chunks;                //!< hugetlbfs로 받은 chunk 수 (나머지는 THP 요청)
+    int arena_fd;                   //!< chunk들이 올라간 memfd, 블록 i는 offset i * BLOCK_DATA_SIZE (없으면 -1)
+    UBOOL arena_huge;               //!< arena_fd가 hugetlbfs memfd인지
+    u8 chunk_in_fd[ARENA_MAX_CHUNKS]; //!< chunk가 arena_fd에 있는지 (아니면 익명 mmap)
+    u16 *free_blocks;               //!< 빈 블록 stack
+    u32 free_count;
+    u16 *free_serials;              //!< releaseBlock으로 돌아온 serial stack
+    u32 free_serial_count;
+    u16 next_serial;                //!< 한 번도 안 쓴 다음 serial
+    pthread_mutex_t lock;           //!< free stack과 chunk 늘리기 (getFreeBlock / releaseBlock)
 } data_Disk;
 
+// 블록 id의 BLOCK_DATA_SIZE data 페이지 (chunk 번호 = id / ARENA_CHUNK_BLOCKS)
+#define BLOCK_DATA(disk, id) \
+    ((disk)->chunks[(id) / ARENA_CHUNK_BLOCKS] + (size_t)((id) % ARENA_CHUNK_BLOCKS) * BLOCK_DATA_SIZE)
+
 URET getFreeBlock(data_Disk* disk, data_Block** freeBlock);
-URET initBlock(data_Block** block, u8 type, u16 data_len);
+URET initBlock(data_Block** block, u8 type, u32 data_len);
 URET getUsedBlockById(data_Disk *disk, data_Block **block, u16 block_id);
-void uffs_InitBlock(data_Disk *disk);
+URET releaseBlock(data_Disk *disk, u16 block_id);
+int getBlockFd(data_Disk *disk, u16 block_id, off_t *pos);
+URET uffs_InitBlock(data_Disk *disk, u32 max_blocks);
+void uffs_OpenArena(data_Disk *disk);
 #endif
\ No newline at end of file
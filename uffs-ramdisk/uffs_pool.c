@@ -0,0 +1,138 @@
+/**
+ * \file uffs_pool.c
+ * \brief Fast fixed size memory pool management.
+ * \author Ricky Zheng, Simon Kallweit
+ */
+
+#include "uffs_pool.h"
+
+#include <stdio.h>
+
+/**
+ * \brief Initializes the memory pool.
+ * \param[in] pool memory pool
+ * \param[in] mem pool memory
+ * \param[in] mem_size size of pool memory
+ * \param[in] buf_size size of a single buffer
+ * \param[in] num_bufs number of buffers
+ * \return Returns U_SUCC if successful.
+ */
+URET uffs_PoolInit(uffs_Pool *pool, void *mem, u32 mem_size, u32 buf_size, u32 num_bufs)
+{
+	unsigned int i;
+
+	if (pool == NULL || mem == NULL || num_bufs == 0 ||
+		buf_size % sizeof(void *) != 0 || mem_size != num_bufs * buf_size) {
+		fprintf(stderr, "[uffs_PoolInit] invalid pool - buf_size %u, num_bufs %u, mem_size %u\n",
+				buf_size, num_bufs, mem_size);
+		return U_FAIL;
+	}
+
+	pool->mem = (u8 *)mem;
+	pool->buf_size = buf_size;
+	pool->num_bufs = num_bufs;
+	pool->free_count = num_bufs;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	// Initialize the free_list
+	pool->free_list = 0;
+	for (i = 0; i < pool->num_bufs; i++)
+		((uffs_PoolEntry *) (pool->mem + i * pool->buf_size))->next = i + 1 < pool->num_bufs ? i + 1 : POOL_NIL;
+
+	return U_SUCC;
+}
+
+/**
+ * \brief Get a buffer from the memory pool.
+ * \param[in] pool memory pool
+ * \return Returns a pointer to the buffer or NULL if none is available.
+ */
+void *uffs_PoolGet(uffs_Pool *pool)
+{
+	uffs_PoolEntry *e = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->free_list != POOL_NIL) {
+		e = (uffs_PoolEntry *) (pool->mem + pool->free_list * pool->buf_size);
+		pool->free_list = e->next;
+		pool->free_count--;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return e;
+}
+
+/**
+ * \brief Puts a buffer back to the memory pool.
+ * \param[in] pool memory pool
+ * \param[in] p buffer to put back
+ * \return Returns 0 if successful.
+ */
+int uffs_PoolPut(uffs_Pool *pool, void *p)
+{
+	uffs_PoolEntry *e = (uffs_PoolEntry *)p;
+
+	if (e == NULL || (u8 *)p < pool->mem ||
+		(u8 *)p >= pool->mem + pool->num_bufs * pool->buf_size ||
+		((u8 *)p - pool->mem) % pool->buf_size != 0) {
+		fprintf(stderr, "[uffs_PoolPut] buffer %p is not in the pool\n", p);
+		return -1;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	e->next = pool->free_list;
+	pool->free_list = ((u8 *)p - pool->mem) / pool->buf_size;
+	pool->free_count++;
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+/**
+ * \brief Gets a buffer by index (offset).
+ * This method returns a buffer from the memory pool by index.
+ * \param[in] pool memory pool
+ * \param[in] index index
+ * \return Returns a pointer to the buffer.
+ */
+void *uffs_PoolGetBufByIndex(uffs_Pool *pool, u32 index)
+{
+	return (u8 *) pool->mem + index * pool->buf_size;
+}
+
+/**
+ * \brief Gets the index (offset) of a buffer.
+ * \param[in] pool memory pool
+ * \param[in] p buffer
+ * \return Returns the index of the buffer.
+ */
+u32 uffs_PoolGetIndex(uffs_Pool *pool, void *p)
+{
+	return ((u8 *) p - pool->mem) / pool->buf_size;
+}
+
+/**
+ * \brief Gets the number of free buffers.
+ */
+int uffs_PoolGetFreeCount(uffs_Pool *pool)
+{
+	int count;
+
+	pthread_mutex_lock(&pool->lock);
+	count = pool->free_count;
+	pthread_mutex_unlock(&pool->lock);
+
+	return count;
+}
+
+/**
+ * \brief Moves the pool to a copy of its memory at another address.
+ * Links are indices, so only the base pointer and the lock need to be set.
+ * \param[in] pool memory pool, the rest of the fields as they were saved
+ * \param[in] mem new pool memory
+ */
+void uffs_PoolRebase(uffs_Pool *pool, void *mem)
+{
+	pool->mem = (u8 *)mem;
+	pthread_mutex_init(&pool->lock, NULL);
+}
@@ -0,0 +1,50 @@
+/**
+ * \file uffs_pool.h
+ * \brief Fast fixed size memory pool management.
+ * \author Ricky Zheng, Simon Kallweit
+ *
+ * uffs/uffs_pool.c를 옮겨 옴. 고정 크기 buffer를 한 덩어리 메모리에서 나눠 주고,
+ * 빈 buffer는 buffer 자신에 next를 써서 free list로 묶는다.
+ * index로 buffer를 찾을 수 있어서 노드끼리 pointer 대신 16-bit index로 이을 수 있다.
+ * free list도 index로 이어서, snapshot에서 다른 주소에 올린 pool을 그대로 쓸 수 있다.
+ */
+
+#ifndef _UFFS_POOL_H_
+#define _UFFS_POOL_H_
+
+#include "uffs_types.h"
+
+#include <pthread.h>
+
+/**
+ * \struct uffs_PoolEntrySt
+ * \brief Helper type for free buffer entries.
+ */
+typedef struct uffs_PoolEntrySt {
+	u32 next;					//!< 다음 빈 buffer의 index, 끝이면 #POOL_NIL
+} uffs_PoolEntry;
+
+#define POOL_NIL 0xffffffff
+
+/**
+ * \struct uffs_PoolSt
+ * \brief Memory pool.
+ */
+typedef struct uffs_PoolSt {
+	u8 *mem;					//!< memory pool
+	u32 buf_size;				//!< size of a buffer
+	u32 num_bufs;				//!< number of buffers in the pool
+	u32 free_count;				//!< number of buffers in free_list
+	u32 free_list;				//!< index of the first free buffer
+	pthread_mutex_t lock;		//!< buffer lock
+} uffs_Pool;
+
+URET uffs_PoolInit(uffs_Pool *pool, void *mem, u32 mem_size, u32 buf_size, u32 num_bufs);
+void *uffs_PoolGet(uffs_Pool *pool);
+int uffs_PoolPut(uffs_Pool *pool, void *p);
+void *uffs_PoolGetBufByIndex(uffs_Pool *pool, u32 index);
+u32 uffs_PoolGetIndex(uffs_Pool *pool, void *p);
+int uffs_PoolGetFreeCount(uffs_Pool *pool);
+void uffs_PoolRebase(uffs_Pool *pool, void *mem);
+
+#endif // _UFFS_POOL_H_
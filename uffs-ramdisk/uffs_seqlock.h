@@ -0,0 +1,44 @@
+/**
+ * \file uffs_seqlock.h
+ * \brief sequence counter for lock-free readers
+ *
+ * 쓰는 쪽은 (자기들끼리는 lock으로 줄 세운 뒤) 바꾸기 전후로 counter를 하나씩 올린다.
+ * 읽는 쪽은 lock 없이 읽고, 읽기 전후의 counter가 다르거나 홀수였으면 다시 읽는다.
+ * 읽는 중에 본 값은 틀릴 수 있으므로 index나 길이는 범위를 확인하고 써야 한다.
+ */
+
+#ifndef _UFFS_SEQLOCK_H_
+#define _UFFS_SEQLOCK_H_
+
+#include "uffs_types.h"
+
+#include <sched.h>
+
+static inline u32 uffs_SeqReadBegin(const u32 *seq)
+{
+	u32 s;
+
+	while ((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1)
+		sched_yield();
+	return s;
+}
+
+// 읽은 값을 버려야 하면 U_TRUE
+static inline UBOOL uffs_SeqReadRetry(const u32 *seq, u32 s)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != s;
+}
+
+static inline void uffs_SeqWriteBegin(u32 *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void uffs_SeqWriteEnd(u32 *seq)
+{
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif // _UFFS_SEQLOCK_H_
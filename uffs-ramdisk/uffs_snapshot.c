@@ -0,0 +1,228 @@
+/**
+ * \file uffs_snapshot.c
+ * \brief save the ramdisk to a snapshot file and start from it again
+ */
+
+#include "uffs_snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define SNAPSHOT_MAX_IOV	(2 * 5 + ARENA_MAX_CHUNKS)
+
+#define ALIGN_UP(x)		(((x) + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN)
+
+static const char zero_pad[SNAPSHOT_ALIGN];
+
+// header의 크기 값으로 section 위치를 정함 (저장할 때와 올릴 때 같은 계산)
+static void _Layout(uffs_SnapshotHeader *hdr)
+{
+	u32 off = ALIGN_UP(sizeof(uffs_SnapshotHeader));
+
+	hdr->blocks_off = off;
+	off += ALIGN_UP(hdr->max_blocks * hdr->block_info_size);
+	hdr->free_blocks_off = off;
+	off += ALIGN_UP(hdr->max_blocks * sizeof(u16));
+	hdr->free_serials_off = off;
+	off += ALIGN_UP(hdr->max_blocks * sizeof(u16));
+	hdr->nodes_off = off;
+	off += ALIGN_UP(hdr->tree.pool.num_bufs * hdr->node_size);
+	hdr->data_off = off;
+	hdr->size = off + hdr->nblocks * hdr->block_size;
+}
+
+// section 하나와 다음 section까지의 0 padding을 iov에 붙임
+static void _AddSection(struct iovec *iov, int *cnt, u32 *pos, const void *p, u32 len)
+{
+	iov[*cnt].iov_base = (void *)p;
+	iov[*cnt].iov_len = len;
+	(*cnt)++;
+	*pos += len;
+	if (ALIGN_UP(*pos) > *pos) {
+		iov[*cnt].iov_base = (void *)zero_pad;
+		iov[*cnt].iov_len = ALIGN_UP(*pos) - *pos;
+		(*cnt)++;
+		*pos = ALIGN_UP(*pos);
+	}
+}
+
+// 짧게 써지면 남은 iov부터 다시
+static URET _WriteAll(int fd, struct iovec *iov, int cnt)
+{
+	ssize_t n;
+
+	while (cnt > 0) {
+		n = writev(fd, iov, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return U_FAIL;
+		}
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return U_SUCC;
+}
+
+/**
+ * \brief ramdisk 전체를 path에 snapshot으로 씀 (path.tmp에 쓰고 rename)
+ */
+URET uffs_SnapshotSave(uffs_Device *dev, const char *path)
+{
+	data_Disk *disk = dev->disk;
+	uffs_SnapshotHeader hdr;
+	struct iovec iov[SNAPSHOT_MAX_IOV];
+	int cnt = 0, fd;
+	u32 pos = 0, c, n;
+	char *tmp;
+	URET ret;
+
+	fprintf(stdout, "[uffs_SnapshotSave] called, path: %s\n", path);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.block_size = BLOCK_DATA_SIZE;
+	hdr.block_info_size = sizeof(data_Block);
+	hdr.node_size = sizeof(TreeNode);
+	hdr.max_blocks = disk->max_blocks;
+	hdr.nblocks = disk->nblocks;
+	hdr.free_count = disk->free_count;
+	hdr.free_serial_count = disk->free_serial_count;
+	hdr.next_serial = disk->next_serial;
+	hdr.tree = dev->tree;
+	_Layout(&hdr);
+
+	_AddSection(iov, &cnt, &pos, &hdr, sizeof(hdr));
+	_AddSection(iov, &cnt, &pos, disk->blocks, hdr.max_blocks * sizeof(data_Block));
+	_AddSection(iov, &cnt, &pos, disk->free_blocks, hdr.max_blocks * sizeof(u16));
+	_AddSection(iov, &cnt, &pos, disk->free_serials, hdr.max_blocks * sizeof(u16));
+	_AddSection(iov, &cnt, &pos, TPOOL(dev)->mem, hdr.tree.pool.num_bufs * sizeof(TreeNode));
+	// data 영역은 chunk 순서대로 이어 붙임 (블록 id 순서), 끝에는 padding 없음
+	for (c = 0; c < disk->nchunks; c++) {
+		n = disk->nblocks - c * ARENA_CHUNK_BLOCKS;
+		if (n > ARENA_CHUNK_BLOCKS)
+			n = ARENA_CHUNK_BLOCKS;
+		iov[cnt].iov_base = disk->chunks[c];
+		iov[cnt].iov_len = n * BLOCK_DATA_SIZE;
+		cnt++;
+		pos += n * BLOCK_DATA_SIZE;
+	}
+	if (pos != hdr.size) {
+		fprintf(stderr, "[uffs_SnapshotSave] layout mismatch %u / %u\n", pos, hdr.size);
+		return U_FAIL;
+	}
+
+	tmp = malloc(strlen(path) + 5);
+	if (tmp == NULL)
+		return U_FAIL;
+	sprintf(tmp, "%s.tmp", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "[uffs_SnapshotSave] open %s: %s\n", tmp, strerror(errno));
+		free(tmp);
+		return U_FAIL;
+	}
+	ret = _WriteAll(fd, iov, cnt);
+	if (ret == U_SUCC && fsync(fd) < 0)
+		ret = U_FAIL;
+	if (close(fd) < 0)
+		ret = U_FAIL;
+	if (ret == U_SUCC && rename(tmp, path) < 0)
+		ret = U_FAIL;
+	if (ret == U_FAIL) {
+		fprintf(stderr, "[uffs_SnapshotSave] write %s: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+	}
+	free(tmp);
+
+	fprintf(stdout, "[uffs_SnapshotSave] finished, %u blocks, %u bytes\n", hdr.nblocks, hdr.size);
+	return ret;
+}
+
+/**
+ * \brief snapshot을 MAP_PRIVATE로 올려서 uffs_InitBlock / uffs_TreeInit / uffs_BuildTree 대신 씀
+ * dev->disk는 정해져 있어야 함, 실패하면 dev와 disk는 건드리지 않음
+ */
+URET uffs_SnapshotLoad(uffs_Device *dev, const char *path)
+{
+	data_Disk *disk = dev->disk;
+	uffs_SnapshotHeader *hdr, want;
+	struct stat st;
+	char *base;
+	int fd;
+	u32 c;
+
+	fprintf(stdout, "[uffs_SnapshotLoad] called, path: %s\n", path);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "[uffs_SnapshotLoad] open %s: %s\n", path, strerror(errno));
+		return U_FAIL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(uffs_SnapshotHeader)) {
+		fprintf(stderr, "[uffs_SnapshotLoad] not a snapshot: %s\n", path);
+		close(fd);
+		return U_FAIL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "[uffs_SnapshotLoad] mmap %s: %s\n", path, strerror(errno));
+		return U_FAIL;
+	}
+
+	// 크기 값과 section 위치가 이 빌드에서 계산한 것과 같아야 함
+	hdr = (uffs_SnapshotHeader *)base;
+	want = *hdr;
+	_Layout(&want);
+	if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic)) != 0 ||
+		hdr->block_size != BLOCK_DATA_SIZE || hdr->block_info_size != sizeof(data_Block) ||
+		hdr->node_size != sizeof(TreeNode) ||
+		hdr->max_blocks < 2 || hdr->max_blocks > BLOCK_COUNT_MAX ||
+		hdr->nblocks > hdr->max_blocks || hdr->tree.pool.num_bufs != hdr->max_blocks ||
+		hdr->tree.pool.buf_size != sizeof(TreeNode) ||
+		(hdr->tree.pool.free_list != POOL_NIL && hdr->tree.pool.free_list >= hdr->tree.pool.num_bufs) ||
+		hdr->free_count > hdr->max_blocks || hdr->free_serial_count > hdr->max_blocks ||
+		memcmp(hdr, &want, sizeof(want)) != 0 || hdr->size != st.st_size) {
+		fprintf(stderr, "[uffs_SnapshotLoad] bad snapshot header: %s\n", path);
+		munmap(base, st.st_size);
+		return U_FAIL;
+	}
+
+	memset(disk, 0, sizeof(data_Disk));
+	disk->blocks = (data_Block *)(base + hdr->blocks_off);
+	disk->free_blocks = (u16 *)(base + hdr->free_blocks_off);
+	disk->free_serials = (u16 *)(base + hdr->free_serials_off);
+	disk->max_blocks = hdr->max_blocks;
+	disk->nblocks = hdr->nblocks;
+	disk->free_count = hdr->free_count;
+	disk->free_serial_count = hdr->free_serial_count;
+	disk->next_serial = hdr->next_serial;
+	pthread_mutex_init(&disk->lock, NULL);
+	// snapshot의 chunk는 파일 페이지라 read_buf에서는 복사해서 넘김 (chunk_in_fd = 0)
+	disk->nchunks = (hdr->nblocks + ARENA_CHUNK_BLOCKS - 1) / ARENA_CHUNK_BLOCKS;
+	for (c = 0; c < disk->nchunks; c++)
+		disk->chunks[c] = base + hdr->data_off + (size_t)c * ARENA_CHUNK_SIZE;
+	// 이후에 늘리는 chunk는 예전처럼 memfd에서
+	uffs_OpenArena(disk);
+
+	dev->tree = hdr->tree;
+	uffs_PoolRebase(TPOOL(dev), base + hdr->nodes_off);
+
+	fprintf(stdout, "[uffs_SnapshotLoad] finished, %u blocks, %u free\n", disk->nblocks, disk->free_count);
+	return U_SUCC;
+}
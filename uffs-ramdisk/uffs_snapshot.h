@@ -0,0 +1,48 @@
+/**
+ * \file uffs_snapshot.h
+ * \brief save the ramdisk to a snapshot file and start from it again
+ *
+ * snapshot은 header, 블록 metadata 배열(tag), free stack 둘, tree 노드 pool, data 영역을
+ * 이 순서로 #SNAPSHOT_ALIGN 마다 붙여 놓은 파일 하나다. 저장은 writev 한 번으로 순서대로 쓰고,
+ * 올릴 때는 파일 전체를 MAP_PRIVATE로 mmap 한 뒤 각 배열과 chunk pointer를 그 안으로 돌린다.
+ * 블록 metadata와 pool에는 pointer가 없어서 고칠 것이 없으므로 크기와 상관없이 바로 뜨고,
+ * 페이지는 처음 건드릴 때 읽히고 처음 쓸 때 복사된다 (파일은 바뀌지 않음).
+ */
+
+#ifndef _UFFS_SNAPSHOT_H_
+#define _UFFS_SNAPSHOT_H_
+
+#include "uffs_types.h"
+#include "uffs_disk.h"
+#include "uffs_tree.h"
+
+#define SNAPSHOT_MAGIC		"UFFSSNP1"
+#define SNAPSHOT_ALIGN		(64 * 1024)		//!< section 시작 위치 (4K~64K 페이지 모두 mmap 가능)
+
+/**
+ * \struct uffs_SnapshotHeaderSt
+ * \brief snapshot 파일 맨 앞, 크기 값은 같은 빌드에서 만든 파일인지 보려고 둠
+ */
+typedef struct uffs_SnapshotHeaderSt {
+	char magic[8];
+	u32 block_size;			//!< BLOCK_DATA_SIZE
+	u32 block_info_size;	//!< sizeof(data_Block)
+	u32 node_size;			//!< sizeof(TreeNode)
+	u32 max_blocks;
+	u32 nblocks;
+	u32 free_count;
+	u32 free_serial_count;
+	u32 next_serial;
+	u32 blocks_off;			//!< data_Block[max_blocks]
+	u32 free_blocks_off;	//!< u16[max_blocks]
+	u32 free_serials_off;	//!< u16[max_blocks]
+	u32 nodes_off;			//!< TreeNode[pool.num_bufs]
+	u32 data_off;			//!< nblocks개 블록의 data 페이지 (블록 id 순서)
+	u32 size;				//!< 파일 전체 크기
+	struct uffs_TreeSt tree;	//!< entry 표와 pool (pool의 mem과 lock은 올릴 때 다시 정함)
+} uffs_SnapshotHeader;
+
+URET uffs_SnapshotSave(uffs_Device *dev, const char *path);
+URET uffs_SnapshotLoad(uffs_Device *dev, const char *path);
+
+#endif // _UFFS_SNAPSHOT_H_
@@ -6,13 +6,28 @@
 
 #include "uffs_tree.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+// tree 노드 pool 메모리 (노드 하나 16 bytes, chain은 이 안의 index로 이음)
+static TreeNode *tree_nodes_pool_buf;
+
 URET uffs_TreeInit(uffs_Device *dev)
 {
     fprintf(stdout, "[uffs_TreeInit] called\n");
 
     int i;
+    u32 num = MAX_TREE_NODES(dev);
+
+    // uffs_InitBlock 다음에 호출: 블록 수가 정해져야 노드 수가 정해짐
+    free(tree_nodes_pool_buf);
+    tree_nodes_pool_buf = (TreeNode *)malloc(num * sizeof(TreeNode));
+    if (tree_nodes_pool_buf == NULL ||
+        uffs_PoolInit(TPOOL(dev), tree_nodes_pool_buf, num * sizeof(TreeNode),
+                      sizeof(TreeNode), num) == U_FAIL) {
+        fprintf(stderr, "[uffs_TreeInit] tree node pool init error\n");
+        return U_FAIL;
+    }
 
     for (i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
 		dev->tree.dir_entry[i] = EMPTY_NODE;
@@ -37,28 +52,84 @@ static u32 GET_CURRENT_TIME() {
     return (u32)now;
 }
 
+/**
+ * \brief pool에서 tree 노드 하나를 받음 (0으로 채워서 줌)
+ * \return pool이 비었으면 NULL
+ */
+TreeNode * uffs_TreeNodeGet(uffs_Device *dev) {
+    TreeNode *node = (TreeNode *)uffs_PoolGet(TPOOL(dev));
+
+    if (node == NULL) {
+        fprintf(stderr, "[uffs_TreeNodeGet] out of tree nodes\n");
+        return NULL;
+    }
+    memset(node, 0, sizeof(TreeNode));
+    return node;
+}
+
+/**
+ * \brief tree 노드를 pool에 돌려줌 (chain에서는 먼저 빼고 호출)
+ */
+void uffs_TreeNodePut(uffs_Device *dev, TreeNode *node) {
+    if (node != NULL) {
+        uffs_PoolPut(TPOOL(dev), node);
+    }
+}
+
+/**
+ * \brief 이름의 16bit check sum
+ * 노드에 넣어 두고 이름으로 찾을 때 먼저 비교해서, 블록에 있는 이름은 sum이 같을 때만 읽음
+ */
+u16 uffs_MakeSum16(const void *p, int len)
+{
+	u8 ret_lo = 0;
+	u8 ret_hi = 0;
+	const u8 *data = (const u8 *)p;
+
+	while (len-- > 0) {
+		ret_lo += *data;
+		ret_hi ^= *data;
+		data++;
+	}
+
+	return (ret_hi << 8) | ret_lo;
+}
+
+// uffs_InitBlock 다음에 호출: 루트 정보는 ROOT_BLOCK에 둠
 URET uffs_BuildTree(uffs_Device *dev) {
     fprintf(stdout, "[uffs_BuildTree] called\n");
 
-    TreeNode *root = (TreeNode *) malloc(sizeof(TreeNode));
+    TreeNode *root = uffs_TreeNodeGet(dev);
+    data_Block *block = &dev->disk->blocks[ROOT_BLOCK];
+
+    if (root == NULL) {
+        return U_FAIL;
+    }
 
-    memset(root, 0, sizeof(TreeNode));
+    // 루트 블록 (data 페이지는 그대로)
+    memset(&block->tag, 0, sizeof(block->tag));
+    memset(&block->info, 0, sizeof(block->info));
+    block->status = usedblock;
+    block->tag.block_id = ROOT_BLOCK;
+    block->tag.type = UFFS_TYPE_DIR;
+    block->tag.serial = ROOT_SERIAL;
+    block->tag.parent = ROOT_SERIAL;
 
     // 루트 노드 DirhSt 초기화
-    root->u.dir.block = 0;       // 루트 블록 (일반적으로 0)
+    root->u.dir.block = ROOT_BLOCK; // 루트 블록 (uffs_InitBlock이 비워 둠)
     root->u.dir.parent = ROOT_SERIAL; // 루트는 부모가 없음
     root->u.dir.serial = ROOT_SERIAL; // 루트의 고유 시리얼 번호 (0으로 초기화)
 
-    // 루트 노드 FileInfo 초기화
-    root->info.create_time = GET_CURRENT_TIME(); // 현재 시간 함수 호출
-    root->info.last_modify = GET_CURRENT_TIME(); // 생성 시점과 동일하게 초기화
-    root->info.access = GET_CURRENT_TIME();      // 액세스 시간도 동일하게 초기화
-    root->info.reserved = 0;                     // 예약 필드 초기화
-    root->info.name_len = 1;                     // 루트 이름 길이 ("/"만 포함)
-    snprintf(root->info.name, MAX_FILENAME_LENGTH, "/"); // 루트 이름 설정
-    root->info.nlink = 2;    // 디렉토리의 기본 링크 수는 2 ("."과 "..")
-    root->info.len = 0;      // 디렉토리이므로 길이는 0
-    root->info.mode = 0666;
+    // 루트 FileInfo 초기화
+    block->info.create_time = GET_CURRENT_TIME(); // 현재 시간 함수 호출
+    block->info.last_modify = GET_CURRENT_TIME(); // 생성 시점과 동일하게 초기화
+    block->info.access = GET_CURRENT_TIME();      // 액세스 시간도 동일하게 초기화
+    block->info.reserved = 0;                     // 예약 필드 초기화
+    block->info.name_len = 1;                     // 루트 이름 길이 ("/"만 포함)
+    snprintf(block->info.name, MAX_FILENAME_LENGTH, "/"); // 루트 이름 설정
+    block->info.nlink = 2;    // 디렉토리의 기본 링크 수는 2 ("."과 "..")
+    block->info.mode = 0666;
+    root->u.dir.checksum = uffs_MakeSum16(block->info.name, block->info.name_len);
 
     // TreeNode 연결 초기화
     root->hash_prev = EMPTY_NODE;
@@ -66,34 +137,38 @@ URET uffs_BuildTree(uffs_Device *dev) {
 
     // 해시값 계산 및 루트 노드 설정
     int hash = GET_DIR_HASH(root->u.dir.serial); // 시리얼 번호를 기반으로 해시 계산
-    dev->tree.dir_entry[hash] = root;           // 해시 테이블에 루트 노드 등록
+    dev->tree.dir_entry[hash] = TO_IDX(root, TPOOL(dev)); // 해시 테이블에 루트 노드 등록
 
     // 성공적으로 초기화된 경우
     fprintf(stderr,"[uffs_BuildTree] finished\n");
     return U_SUCC;
 }
 
+// getattr/open/read는 tree를 lock 없이 찾으므로 (mkuffs.c) 그동안 chain이 바뀌어 꼬일 수 있음:
+// pool 밖 index에서 멈추고 노드 수보다 많이 따라가지 않음 (찾은 결과는 호출한 쪽이 seqlock으로 버림)
+#define CHAIN_NEXT_OK(dev, x, steps) \
+    ((x) != EMPTY_NODE && (x) < TPOOL(dev)->num_bufs && (steps)++ < TPOOL(dev)->num_bufs)
+
 URET static getRootDir(uffs_Device *dev, TreeNode **cur_node) {
-    fprintf(stdout, "[getRootDir] called\n");
     int hash = GET_DIR_HASH(ROOT_SERIAL);
-    *cur_node = dev->tree.dir_entry[hash];
-    while ((*cur_node)->u.dir.serial != ROOT_SERIAL) {
-        if ((*cur_node)->hash_next == EMPTY_NODE) {
-            fprintf(stderr, "[getRootDir] fail - can't find root node\n");
-            return U_FAIL;
+    u16 x = dev->tree.dir_entry[hash];
+    u32 steps = 0;
+
+    while (CHAIN_NEXT_OK(dev, x, steps)) {
+        *cur_node = FROM_IDX(x, TPOOL(dev));
+        if ((*cur_node)->u.dir.serial == ROOT_SERIAL) {
+            return U_SUCC;
         }
-        *cur_node = (*cur_node)->hash_next;
+        x = (*cur_node)->hash_next;
     }
-    fprintf(stdout, "[getRootDir] finished - found root node\n");
-    return U_SUCC;
+    fprintf(stderr, "[getRootDir] fail - can't find root node\n");
+    return U_FAIL;
 }
 
 // node찾아서 매개변수 node에 넣어주기
 // return: U_SUCC 또는 U_FAIL
 URET uffs_TreeFindNodeByName(uffs_Device *dev, TreeNode **node, const char *name, int *isDir) {
-    fprintf(stdout, "[uffs_TreeFindNodeByName] called\n");
-
-    char *token;
+    char *token, *save;
     const char delimiter[] = "/";
     // copy name
     int name_len = strlen(name) > MAX_FILENAME_LENGTH ? MAX_FILENAME_LENGTH : strlen(name);
@@ -101,7 +176,7 @@ URET uffs_TreeFindNodeByName(uffs_Device *dev, TreeNode **node, const char *name
     strncpy(temp_name, name, name_len);
     temp_name[name_len] = '\0';
 
-    token = strtok(temp_name, delimiter);
+    token = strtok_r(temp_name, delimiter, &save);
     
     TreeNode *cur_node;
     TreeNode *tmp_node;
@@ -112,8 +187,6 @@ URET uffs_TreeFindNodeByName(uffs_Device *dev, TreeNode **node, const char *name
     }
 
     while (token != NULL) {
-        printf("[uffs_TreeFindNodeByName] directory: %s\n", token);
-
         // 디렉터리 노드 찾기
         tmp_node = uffs_TreeFindDirNodeByName(dev, token, strlen(token), cur_node->u.dir.serial);
         if (isDir != NULL) 
@@ -130,12 +203,11 @@ URET uffs_TreeFindNodeByName(uffs_Device *dev, TreeNode **node, const char *name
         }
         cur_node = tmp_node;
         
-        token = strtok(NULL, delimiter);
+        token = strtok_r(NULL, delimiter, &save);
     }
 
     *node = cur_node;
 
-    fprintf(stdout, "[uffs_TreeFindNodeByName] finished - isDir: %d\n", isDir);
     return U_SUCC;
 }
 
@@ -148,21 +220,22 @@ TreeNode * uffs_TreeFindFileNodeWithParent(uffs_Device *dev, u16 parent) {
 }
 
 TreeNode * uffs_TreeFindDirNode(uffs_Device *dev, u16 serial) {
-    fprintf(stdout,"[uffs_TreeFindDirNode] called\n");
     int i;
+	u16 x;
+	u32 steps = 0;
 	TreeNode *node;
 	struct uffs_TreeSt *tree = &(dev->tree);
 	
 	for (i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
-		node = tree->dir_entry[i];
-		while (node != EMPTY_NODE) {
+		x = tree->dir_entry[i];
+		while (CHAIN_NEXT_OK(dev, x, steps)) {
+			node = FROM_IDX(x, TPOOL(dev));
 			if (node->u.dir.serial == serial) {
 				return node;
 			}
-			node = node->hash_next;
+			x = node->hash_next;
 		}
 	}
-    fprintf(stdout,"[uffs_TreeFindDirNode] finished\n");
     return NULL;
 }
 
@@ -171,49 +244,58 @@ TreeNode * uffs_TreeFindDirNodeWithParent(uffs_Device *dev, u16 parent) {
 }
 
 TreeNode * uffs_TreeFindFileNodeByName(uffs_Device *dev, const char *name, u32 len, u16 parent) {
-    fprintf(stdout,"[uffs_TreeFindFileNodeByName] called\n");
     int i;
+	u16 x;
+	u32 steps = 0;
+	u16 sum = uffs_MakeSum16(name, len);
 	TreeNode *node;
+	uffs_FileInfo *info;
 	struct uffs_TreeSt *tree = &(dev->tree);
 	
 	for (i = 0; i < FILE_NODE_ENTRY_LEN; i++) {
-		node = tree->file_entry[i];
-		while (node != EMPTY_NODE) {
-			if (node->u.file.parent == parent) {
-				//read file name from flash, and compare...
-				if (strcmp(node->info.name, name) == 0 && node->info.name_len == len) {
+		x = tree->file_entry[i];
+		while (CHAIN_NEXT_OK(dev, x, steps)) {
+			node = FROM_IDX(x, TPOOL(dev));
+			if (node->u.file.parent == parent && node->u.file.checksum == sum &&
+				node->u.file.block < __atomic_load_n(&dev->disk->nblocks, __ATOMIC_ACQUIRE)) {
+				//read file name from block, and compare...
+				info = NODE_INFO(dev, node);
+				if (strcmp(info->name, name) == 0 && info->name_len == len) {
 					//Got it!
-                    fprintf(stdout,"[uffs_TreeFindFileNodeByName] finished: find file node by name.\n");
 					return node;
 				}
 			}
-			node = node->hash_next;
+			x = node->hash_next;
 		}
 	}
-    fprintf(stdout,"[uffs_TreeFindFileNodeByName] finished: can't find file node by name.\n");
     return NULL;
 }
 
 TreeNode * uffs_TreeFindDirNodeByName(uffs_Device *dev, const char *name, u32 len, u16 parent) {
-    fprintf(stdout,"[uffs_TreeFindDirNodeByName] called\n");
     int i;
+	u16 x;
+	u32 steps = 0;
+	u16 sum = uffs_MakeSum16(name, len);
 	TreeNode *node;
+	uffs_FileInfo *info;
 	struct uffs_TreeSt *tree = &(dev->tree);
 	
 	for (i = 0; i < DIR_NODE_ENTRY_LEN; i++) {
-		node = tree->dir_entry[i];
-		while (node != EMPTY_NODE) {
-			if (node->u.dir.parent == parent) {
-				//read file name from flash, and compare...
-				if (strcmp(node->info.name, name) == 0 && node->info.name_len == len) {
+		x = tree->dir_entry[i];
+		while (CHAIN_NEXT_OK(dev, x, steps)) {
+			node = FROM_IDX(x, TPOOL(dev));
+			if (node->u.dir.parent == parent && node->u.dir.checksum == sum &&
+				node->u.dir.block < __atomic_load_n(&dev->disk->nblocks, __ATOMIC_ACQUIRE)) {
+				//read file name from block, and compare...
+				info = NODE_INFO(dev, node);
+				if (strcmp(info->name, name) == 0 && info->name_len == len) {
 					//Got it!
 					return node;
 				}
 			}
-			node = node->hash_next;
+			x = node->hash_next;
 		}
 	}
-    fprintf(stdout,"[uffs_TreeFindDirNodeByName] finished\n");
     return NULL;
 }   
 
@@ -222,9 +304,7 @@ TreeNode * uffs_TreeFindDataNode(uffs_Device *dev, u16 parent, u16 serial) {
 }
 
 URET uffs_TreeFindDirNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node, const char *name) {
-    fprintf(stdout, "[uffs_TreeFindDirNodeByNameWithoutParent] called\n");
-
-    char *token;
+    char *token, *save;
     const char delimiter[] = "/";
     // copy name
     int name_len = strlen(name) > MAX_FILENAME_LENGTH ? MAX_FILENAME_LENGTH : strlen(name);
@@ -232,7 +312,7 @@ URET uffs_TreeFindDirNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
     strncpy(temp_name, name, name_len);
     temp_name[name_len] = '\0';
 
-    token = strtok(temp_name, delimiter);
+    token = strtok_r(temp_name, delimiter, &save);
     
     TreeNode *cur_node;
     TreeNode *tmp_node;
@@ -243,8 +323,6 @@ URET uffs_TreeFindDirNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
     }
 
     while (token != NULL) {
-        printf("[uffs_TreeFindDirNodeByNameWithoutParent] directory: %s\n", token);
-
         // 디렉터리 노드 찾기
         tmp_node = uffs_TreeFindDirNodeByName(dev, token, strlen(token), cur_node->u.dir.serial);
         if (tmp_node == NULL) {
@@ -253,19 +331,16 @@ URET uffs_TreeFindDirNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
         }
         cur_node = tmp_node;
         
-        token = strtok(NULL, delimiter);
+        token = strtok_r(NULL, delimiter, &save);
     }
 
     *node = cur_node;
 
-    fprintf(stdout, "[uffs_TreeFindDirNodeByNameWithoutParent] finished\n");
     return U_SUCC;
 }
 
 URET uffs_TreeFindFileNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node, const char *name) {
-    fprintf(stdout, "[uffs_TreeFindFileNodeByNameWithoutParent] called\n");
-
-    char *token;
+    char *token, *save;
     const char delimiter[] = "/";
     // copy name
     int name_len = strlen(name) > MAX_FILENAME_LENGTH ? MAX_FILENAME_LENGTH : strlen(name);
@@ -273,7 +348,7 @@ URET uffs_TreeFindFileNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
     strncpy(temp_name, name, name_len);
     temp_name[name_len] = '\0';
 
-    token = strtok(temp_name, delimiter);
+    token = strtok_r(temp_name, delimiter, &save);
     
     TreeNode *cur_node;
     TreeNode *tmp_node;
@@ -284,8 +359,6 @@ URET uffs_TreeFindFileNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
     }
     int isFile = 0;
     while (token != NULL) {
-        printf("[uffs_TreeFindFileNodeByNameWithoutParent] directory: %s\n", token);
-
         // 디렉터리 노드 찾기
         tmp_node = uffs_TreeFindDirNodeByName(dev, token, strlen(token), cur_node->u.dir.serial);
         // 없으면 파일에서 찾기
@@ -298,7 +371,7 @@ URET uffs_TreeFindFileNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
             return U_FAIL;
         }
         cur_node = tmp_node;
-        token = strtok(NULL, delimiter);
+        token = strtok_r(NULL, delimiter, &save);
     }
     if (isFile != 1) {
         fprintf(stderr,"[uffs_TreeFindFileNodeByNameWithoutParent] error 2\n");
@@ -307,21 +380,20 @@ URET uffs_TreeFindFileNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
 
     *node = cur_node;
 
-    fprintf(stdout, "[uffs_TreeFindFileNodeByNameWithoutParent] finished\n");
     return U_SUCC;
 }
 
-static void _InsertToEntry(uffs_Device *dev, uint64_t *entry,
+static void _InsertToEntry(uffs_Device *dev, u16 *entry,
 						   int hash, TreeNode *node)
 {
     fprintf(stdout,"[_InsertToEntry] called\n");
 	node->hash_next = entry[hash];
 	node->hash_prev = EMPTY_NODE;
-    if ((TreeNode*)node->hash_next != EMPTY_NODE) {
-        TreeNode* temp_node = (TreeNode*)node->hash_next;
-        temp_node->hash_prev = (uint64_t) node;
+    if (node->hash_next != EMPTY_NODE) {
+        TreeNode* temp_node = FROM_IDX(node->hash_next, TPOOL(dev));
+        temp_node->hash_prev = TO_IDX(node, TPOOL(dev));
     }
-    entry[hash] = node;
+    entry[hash] = TO_IDX(node, TPOOL(dev));
     fprintf(stdout,"[_InsertToEntry] finished\n");
 }
 
@@ -346,6 +418,40 @@ static void uffs_InsertToDataEntry(uffs_Device *dev, TreeNode *node)
 					node);
 }
 
+// hash chain에서 노드를 뺌 (hash_prev가 있어서 chain을 따라가지 않음)
+void uffs_BreakFromEntry(uffs_Device *dev, u8 type, TreeNode *node)
+{
+    u16 *entry;
+    int hash;
+    u16 prev = node->hash_prev;
+    u16 next = node->hash_next;
+
+    switch (type) {
+    case UFFS_TYPE_DIR:
+        entry = dev->tree.dir_entry;
+        hash = GET_DIR_HASH(node->u.dir.serial);
+        break;
+    case UFFS_TYPE_FILE:
+        entry = dev->tree.file_entry;
+        hash = GET_FILE_HASH(node->u.file.serial);
+        break;
+    default:
+        fprintf(stderr, "[uffs_BreakFromEntry] node type error\n");
+        return;
+    }
+
+    if (prev != EMPTY_NODE) {
+        FROM_IDX(prev, TPOOL(dev))->hash_next = next;
+    } else {
+        entry[hash] = next;
+    }
+    if (next != EMPTY_NODE) {
+        FROM_IDX(next, TPOOL(dev))->hash_prev = prev;
+    }
+    node->hash_next = EMPTY_NODE;
+    node->hash_prev = EMPTY_NODE;
+}
+
 void uffs_InsertNodeToTree(uffs_Device *dev, u8 type, TreeNode *node)
 {
     fprintf(stdout,"[uffs_InsertNodeToTree] called\n");
@@ -371,7 +477,7 @@ URET uffs_TreeFindParentNodeByName(uffs_Device *dev, TreeNode **node, const char
     if(strcmp(name,"/") == 0){
         return U_FAIL;
     }
-    char *token;
+    char *token, *save;
     const char delimiter[] = "/";
     // copy name
     int name_len = strlen(name) > MAX_FILENAME_LENGTH ? MAX_FILENAME_LENGTH : strlen(name);
@@ -379,7 +485,7 @@ URET uffs_TreeFindParentNodeByName(uffs_Device *dev, TreeNode **node, const char
     strncpy(temp_name, name, name_len);
     temp_name[name_len] = '\0';
 
-    token = strtok(temp_name, delimiter);
+    token = strtok_r(temp_name, delimiter, &save);
     
     TreeNode *cur_node;
     TreeNode *tmp_node;
@@ -398,7 +504,7 @@ URET uffs_TreeFindParentNodeByName(uffs_Device *dev, TreeNode **node, const char
         if (tmp_node == NULL) {
             tmp_node = uffs_TreeFindFileNodeByName(dev, token, strlen(token), cur_node->u.dir.serial);
         }
-        token = strtok(NULL, delimiter);
+        token = strtok_r(NULL, delimiter, &save);
         if (tmp_node == NULL) {
             if(!isNodeExist && token == NULL){
                 break;
@@ -470,22 +576,23 @@ URET initNode(uffs_Device *dev, TreeNode *node, data_Block *block, const char *p
         node->u.file.serial = block->tag.serial;            // 고유 시리얼 번호
     }
     
-    // 정보 초기화
-    node->info.create_time = GET_CURRENT_TIME();
-    node->info.last_modify = GET_CURRENT_TIME();
-    node->info.access = GET_CURRENT_TIME();
-    node->info.reserved = 0;
+    // 정보 초기화 (블록에 둠)
+    block->info.create_time = GET_CURRENT_TIME();
+    block->info.last_modify = GET_CURRENT_TIME();
+    block->info.access = GET_CURRENT_TIME();
+    block->info.reserved = 0;
 
     // 경로 파싱하여 이름 및 길이 설정
-    node->info.name_len = parsePath(path, node->info.name, MAX_FILENAME_LENGTH);
+    block->info.name_len = parsePath(path, block->info.name, MAX_FILENAME_LENGTH);
     if(type == UFFS_TYPE_DIR) {
-        node->info.nlink = 2;    // 디렉토리 기본 링크 수
-        node->info.len = 0;      // 디렉토리이므로 길이는 0
+        block->info.nlink = 2;    // 디렉토리 기본 링크 수
+        node->u.dir.checksum = uffs_MakeSum16(block->info.name, block->info.name_len);
     } else{
-        node->info.nlink = 1;    // 디렉토리 기본 링크 수
-        node->info.len = block->tag.data_len;      // 디렉토리이므로 길이는 0
+        block->info.nlink = 1;    // 디렉토리 기본 링크 수
+        node->u.file.len = block->tag.data_len;
+        node->u.file.checksum = uffs_MakeSum16(block->info.name, block->info.name_len);
     }
-    node->info.mode = 0666;
+    block->info.mode = 0666;
     fprintf(stdout,"[initNode] finished\n");
     return U_SUCC;
 }
@@ -7,6 +7,7 @@
 
 #include "uffs_types.h"
 #include "uffs_disk.h"
+#include "uffs_pool.h"
 
 #define UFFS_TYPE_DIR		0
 #define UFFS_TYPE_FILE		1
@@ -14,59 +15,57 @@
 #define UFFS_TYPE_RESV		3
 #define UFFS_TYPE_INVALID	0xFF
 
-#define MAX_FILENAME_LENGTH         128
-
 #define EMPTY_NODE 0xffff				//!< special index num of empty node.
 #define ROOT_DIR_SERIAL	0				//!< serial num of root dir
 
 struct DirhSt {		/* 8 bytes */
 	u16 block;
+	u16 checksum;	/* check sum of dir name */
 	u16 parent;
 	u16 serial;
 };
 
 struct FilehSt {	/* 12 bytes */
 	u16 block;
+	u16 checksum;	/* check sum of file name */
 	u16 parent;
 	u16 serial;
+	u32 len;		/* file length total */
 };
 
 struct FdataSt {	/* 10 bytes */
 	u16 block;
 	u16 parent;
+	u32 len;		/* file data length on this block */
 	u16 serial;
 };
 
-struct uffs_FileInfoSt {
-    u32 create_time;
-    u32 last_modify;
-    u32 access;
-    u32 reserved;
-    u32 name_len;           //!< length of file/dir name
-    char name[MAX_FILENAME_LENGTH];
-	// TODO: warning
-	short nlink;
-	u32 len;
-	u16 mode;
-};
-typedef struct uffs_FileInfoSt uffs_FileInfo;
-
 #define GET_FILE_HASH(serial)			(serial & FILE_NODE_HASH_MASK)
 #define GET_DIR_HASH(serial)			(serial & DIR_NODE_HASH_MASK)
 #define GET_DATA_HASH(parent, serial)	((parent + serial) & DATA_NODE_HASH_MASK)
 
-//UFFS TreeNode (14 or 16 bytes)
+//UFFS TreeNode (16 bytes)
+// 이름 등 uffs_FileInfo는 노드가 가진 블록에 있음 (NODE_INFO), chain은 pool 안의 index로 이음
 typedef struct uffs_TreeNodeSt {
 	union {
 		struct DirhSt dir;
 		struct FilehSt file;
 		struct FdataSt data;
 	} u;
-	uffs_FileInfo info;
-	uint64_t hash_next;
-	uint64_t hash_prev;
+	u16 hash_next;
+	u16 hash_prev;
 } TreeNode;
 
+_Static_assert(sizeof(TreeNode) == 16, "TreeNode must be 16 bytes");
+
+// 노드마다 블록을 하나씩 가지므로 블록 수만큼
+#define MAX_TREE_NODES(dev)		((dev)->disk->max_blocks)
+
+#define TPOOL(dev)				(&(dev)->tree.pool)
+#define FROM_IDX(idx, pool)		((TreeNode *)uffs_PoolGetBufByIndex(pool, idx))
+#define TO_IDX(p, pool)			((u16)uffs_PoolGetIndex(pool, (void *) p))
+#define NODE_INFO(dev, node)	(&(dev)->disk->blocks[(node)->u.file.block].info)
+
 #define DIR_NODE_HASH_MASK		0x1f
 #define DIR_NODE_ENTRY_LEN		(DIR_NODE_HASH_MASK + 1)
 
@@ -77,10 +76,12 @@ typedef struct uffs_TreeNodeSt {
 #define DATA_NODE_ENTRY_LEN		(DATA_NODE_HASH_MASK + 1)
 
 struct uffs_TreeSt {
-	uint64_t dir_entry[DIR_NODE_ENTRY_LEN];
-	uint64_t file_entry[FILE_NODE_ENTRY_LEN];
-	uint64_t data_entry[DATA_NODE_ENTRY_LEN];
+	u16 dir_entry[DIR_NODE_ENTRY_LEN];
+	u16 file_entry[FILE_NODE_ENTRY_LEN];
+	u16 data_entry[DATA_NODE_ENTRY_LEN];
 	u16 max_serial;
+	u32 seq;			//!< entry 표와 chain, 노드를 바꾸는 중이면 홀수 (uffs_seqlock.h)
+	uffs_Pool pool;		//!< tree node pool
 };
 
 
@@ -100,6 +101,7 @@ TreeNode * uffs_TreeFindDirNodeByName(uffs_Device *dev, const char *name, u32 le
 TreeNode * uffs_TreeFindDataNode(uffs_Device *dev, u16 parent, u16 serial);
 
 void uffs_InsertNodeToTree(uffs_Device *dev, u8 type, TreeNode *node);
+void uffs_BreakFromEntry(uffs_Device *dev, u8 type, TreeNode *node);
 
 // custom 
 #define UDIR 0
@@ -110,5 +112,8 @@ URET uffs_TreeFindDirNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node,
 URET uffs_TreeFindFileNodeByNameWithoutParent(uffs_Device *dev, TreeNode **node, const char *name);
 URET initNode(uffs_Device *dev,TreeNode *node, data_Block *block, const char *path, u8 type);
 URET uffs_TreeFindParentNodeByName(uffs_Device *dev, TreeNode **node, const char *name, int isNodeExist);
+TreeNode * uffs_TreeNodeGet(uffs_Device *dev);
+void uffs_TreeNodePut(uffs_Device *dev, TreeNode *node);
+u16 uffs_MakeSum16(const void *p, int len);
 
 #endif
\ No newline at end of file
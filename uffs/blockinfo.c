@@ -8,11 +8,218 @@
 #include "uffs_blockinfo.h"
 #include "uffs_public.h"
 #include "uffs_os.h"
-// #include "uffs_badblock.h"
+#include "uffs_flash.h"
+#include "uffs_badblock.h"
 
 #include <string.h>
 
-/** 
+static u32 _BlockHash(u16 block)
+{
+	u32 h = (u32)block * 0x9e3779b1;
+
+	return h ^ (h >> 16);
+}
+
+/** put a cached block info in the hash index with its current block number */
+static void _HashInsert(uffs_Device *dev, uffs_BlockInfo *p)
+{
+	struct uffs_BlockInfoCacheSt *bc = &dev->bc;
+	u32 i;
+
+	i = _BlockHash(p->block) & bc->hash_mask;
+	while (bc->hash[i] != NULL)
+		i = (i + 1) & bc->hash_mask;
+
+	bc->hash[i] = p;
+}
+
+/**
+ * \brief remove a cached block info from the hash index
+ *
+ * entries after the removed one are shifted back when their probe
+ * sequence passes the freed slot, so no tombstones are needed.
+ */
+static void _HashRemove(uffs_Device *dev, uffs_BlockInfo *p)
+{
+	struct uffs_BlockInfoCacheSt *bc = &dev->bc;
+	u32 i, j, home;
+
+	i = _BlockHash(p->block) & bc->hash_mask;
+	while (bc->hash[i] != p)
+		i = (i + 1) & bc->hash_mask;
+
+	for (j = (i + 1) & bc->hash_mask; bc->hash[j] != NULL; j = (j + 1) & bc->hash_mask) {
+		home = _BlockHash(bc->hash[j]->block) & bc->hash_mask;
+		// can move to i only if i lies cyclically in [home, j)
+		if (((j - home) & bc->hash_mask) >= ((j - i) & bc->hash_mask)) {
+			bc->hash[i] = bc->hash[j];
+			i = j;
+		}
+	}
+
+	bc->hash[i] = NULL;
+}
+
+/** move a block info to the head (most recently used) of the cache list */
+static void _MoveBcToHead(uffs_Device *dev, uffs_BlockInfo *p)
+{
+	if (p == dev->bc.head)
+		return;
+
+	// break from list
+	p->prev->next = p->next;
+	if (p->next)
+		p->next->prev = p->prev;
+	else
+		dev->bc.tail = p->prev;
+
+	// link to head
+	p->prev = NULL;
+	p->next = dev->bc.head;
+	dev->bc.head->prev = p;
+	dev->bc.head = p;
+}
+
+/** record a freshly loaded or written page in the page_id map, if the map is in use */
+static void _MapPage(uffs_Device *dev, uffs_BlockInfo *p, u16 page)
+{
+	uffs_Tags *tag = GET_TAG(p, page);
+	u16 *newest;
+
+	if (!p->map_valid || !TAG_IS_GOOD(tag) || TAG_PAGE_ID(tag) >= dev->attr->pages_per_block)
+		return;
+
+	// pages are programmed in ascending order, the highest page is the newest one
+	newest = &p->page_map[TAG_PAGE_ID(tag)];
+	if (*newest == UFFS_INVALID_PAGE || page > *newest)
+		*newest = page;
+}
+
+/** rebuild page_id map from spares, all spares must be loaded */
+static void _BuildPageMap(uffs_Device *dev, uffs_BlockInfo *p)
+{
+	u16 page;
+
+	for (page = 0; page < dev->attr->pages_per_block; page++)
+		p->page_map[page] = UFFS_INVALID_PAGE;
+
+	p->map_valid = U_TRUE;
+	for (page = 0; page < dev->attr->pages_per_block; page++)
+		_MapPage(dev, p, page);
+}
+
+/**
+ * \brief initialize block info caches
+ *
+ * memory layout: [block infos] [hash index] [spares] [page_id maps]
+ *
+ * \param[in] dev uffs device
+ * \param[in] maxCachedBlocks maximum cache buffers to be allocated
+ * \return result of initialization
+ * \retval U_SUCC successful
+ * \retval U_FAIL failed
+ */
+URET uffs_BlockInfoInitCache(uffs_Device *dev, int maxCachedBlocks)
+{
+	uffs_BlockInfo *blockInfos;
+	uffs_PageSpare *pageSpares;
+	u16 *pageMaps;
+	uffs_BlockInfo *work;
+	void *buf;
+	int pages_per_block = dev->attr->pages_per_block;
+	int size, i, j;
+	int hash_slots;
+
+	if (dev->bc.head != NULL) {
+		fprintf(stderr, "block info cache has been inited already, now release it first.\n");
+		uffs_BlockInfoReleaseCache(dev);
+	}
+
+	if (maxCachedBlocks < 2) {
+		fprintf(stderr, "too few block info caches (%d)\n", maxCachedBlocks);
+		return U_FAIL;
+	}
+
+	// hash index: power of 2 slots, load factor <= 0.5
+	for (hash_slots = 1; hash_slots < 2 * maxCachedBlocks; hash_slots <<= 1)
+		;
+
+	size = (sizeof(uffs_BlockInfo) +
+			(sizeof(uffs_PageSpare) + sizeof(u16)) * pages_per_block) * maxCachedBlocks +
+			sizeof(uffs_BlockInfo *) * hash_slots;
+
+	if (dev->mem.blockinfo_pool_size == 0) {
+		if (dev->mem.malloc) {
+			dev->mem.blockinfo_pool_buf = dev->mem.malloc(dev, size);
+			if (dev->mem.blockinfo_pool_buf)
+				dev->mem.blockinfo_pool_size = size;
+		}
+	}
+	if (size > dev->mem.blockinfo_pool_size) {
+		fprintf(stderr, "Block cache buffer require %d but only %d available.\n",
+				size, dev->mem.blockinfo_pool_size);
+		return U_FAIL;
+	}
+
+	fprintf(stderr, "alloc info cache %d bytes.\n", size);
+
+	buf = dev->mem.blockinfo_pool_buf;
+	memset(buf, 0, size);
+	dev->bc.mem_pool = buf;
+
+	blockInfos = (uffs_BlockInfo *)buf;
+	dev->bc.hash = (uffs_BlockInfo **)(blockInfos + maxCachedBlocks);
+	dev->bc.hash_mask = hash_slots - 1;
+	pageSpares = (uffs_PageSpare *)(dev->bc.hash + hash_slots);
+	pageMaps = (u16 *)(pageSpares + pages_per_block * maxCachedBlocks);
+
+	for (i = 0; i < maxCachedBlocks; i++) {
+		work = &blockInfos[i];
+		work->prev = (i == 0 ? NULL : &blockInfos[i - 1]);
+		work->next = (i == maxCachedBlocks - 1 ? NULL : &blockInfos[i + 1]);
+		work->block = UFFS_INVALID_BLOCK;
+		work->ref_count = 0;
+		work->spares = &pageSpares[i * pages_per_block];
+		work->page_map = &pageMaps[i * pages_per_block];
+		for (j = 0; j < pages_per_block; j++)
+			work->spares[j].expired = 1;
+		work->expired_count = pages_per_block;
+		work->map_valid = U_FALSE;
+	}
+	dev->bc.head = &blockInfos[0];
+	dev->bc.tail = &blockInfos[maxCachedBlocks - 1];
+
+	return U_SUCC;
+}
+
+/**
+ * \brief release all allocated memory of block info cache,
+ *			this function should be called when unmount file system
+ * \param[in] dev uffs device
+ */
+URET uffs_BlockInfoReleaseCache(uffs_Device *dev)
+{
+	if (dev->bc.head == NULL)
+		return U_SUCC;
+
+	if (!uffs_BlockInfoIsAllFree(dev)) {
+		fprintf(stderr, "There are refed block info cache, release cache fail.\n");
+		return U_FAIL;
+	}
+
+	if (dev->mem.free) {
+		dev->mem.free(dev, dev->bc.mem_pool);
+		dev->mem.blockinfo_pool_size = 0;
+	}
+
+	dev->bc.head = dev->bc.tail = NULL;
+	dev->bc.hash = NULL;
+	dev->bc.mem_pool = NULL;
+
+	return U_SUCC;
+}
+
+/**
  * \brief load page spare data to given block info structure
  *			with given page number
  * \param[in] dev uffs device
@@ -24,6 +231,7 @@
  * \retval U_SUCC successful
  * \retval U_FAIL fail to load
  * \note work->block must be set before load block info
+ * \note loading all pages also builds the page_id map if it's not valid
  */
 URET uffs_BlockInfoLoad(uffs_Device *dev, uffs_BlockInfo *work, int page)
 {
@@ -43,22 +251,27 @@ URET uffs_BlockInfoLoad(uffs_Device *dev, uffs_BlockInfo *work, int page)
 			uffs_BadBlockAddByFlashResult(dev, work->block, ret);
 
 			if (UFFS_FLASH_HAVE_ERR(ret)) {
-				uffs_Perror(UFFS_MSG_SERIOUS,
-							"load block %d page %d spare fail.",
+				fprintf(stderr,
+							"load block %d page %d spare fail.\n",
 							work->block, i);
-				TAG_VALID_BIT(&(spare->tag)) = TAG_INVALID;	
-				nfailed++;	
+				TAG_VALID_BIT(&(spare->tag)) = TAG_INVALID;
+				nfailed++;
 			}
 
 			spare->expired = 0;
 			work->expired_count--;
+			_MapPage(dev, work, i);
 		}
+
+		if (!work->map_valid)
+			_BuildPageMap(dev, work);
+
 		if (nfailed > 0)
 			return U_FAIL;
 	}
 	else {
 		if (page < 0 || page >= dev->attr->pages_per_block) {
-			uffs_Perror(UFFS_MSG_SERIOUS, "page out of range !");
+			fprintf(stderr, "page out of range !\n");
 			return U_FAIL;
 		}
 		spare = &(work->spares[page]);
@@ -69,14 +282,228 @@ URET uffs_BlockInfoLoad(uffs_Device *dev, uffs_BlockInfo *work, int page)
             uffs_BadBlockAddByFlashResult(dev, work->block, ret);
 
 			if (UFFS_FLASH_HAVE_ERR(ret)) {
-				uffs_Perror(UFFS_MSG_SERIOUS,
-							"load block %d page %d spare fail.",
+				fprintf(stderr,
+							"load block %d page %d spare fail.\n",
 							work->block, page);
 				return U_FAIL;
 			}
 			spare->expired = 0;
 			work->expired_count--;
+			_MapPage(dev, work, page);
 		}
 	}
 	return U_SUCC;
-}
\ No newline at end of file
+}
+
+/**
+ * \brief find a block cache with given block number
+ * \param[in] dev uffs device
+ * \param[in] block block number
+ * \return found block cache, NULL if not cached
+ * \note the reference count and LRU order are not changed
+ */
+uffs_BlockInfo * uffs_BlockInfoFindInCache(uffs_Device *dev, int block)
+{
+	struct uffs_BlockInfoCacheSt *bc = &dev->bc;
+	uffs_BlockInfo *p;
+	u32 i;
+
+	if (bc->hash == NULL || block < 0 || block >= UFFS_INVALID_BLOCK)
+		return NULL;
+
+	i = _BlockHash((u16)block) & bc->hash_mask;
+	while ((p = bc->hash[i]) != NULL) {
+		if (p->block == block)
+			return p;
+		i = (i + 1) & bc->hash_mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief Find a cached block in cache pool,
+ *			if the cached block exist then return the pointer,
+ *			if the block does not cached already, find a non-used cache.
+ *			if all of cached are used out, return NULL.
+ *
+ * a non-used cache is taken from the least recently used end, its spares
+ * are expired and will be loaded on demand.
+ *
+ * \param[in] dev uffs device
+ * \param[in] block block number
+ * \return found block cache buffer
+ * \retval NULL caches used out
+ * \retval non-NULL buffer pointer of given block
+ * \note uffs_BlockInfoPut() should be called after use.
+ */
+uffs_BlockInfo * uffs_BlockInfoGet(uffs_Device *dev, int block)
+{
+	uffs_BlockInfo *work;
+	int i;
+
+	//search cached block
+	work = uffs_BlockInfoFindInCache(dev, block);
+	if (work == NULL) {
+		//can't find block from cache, need to find a free(unlocked) cache
+		for (work = dev->bc.tail; work != NULL; work = work->prev) {
+			if (work->ref_count == 0)
+				break;
+		}
+		if (work == NULL) {
+			//caches used up
+			fprintf(stderr, "insufficient block info cache\n");
+			return NULL;
+		}
+
+		if (work->block != UFFS_INVALID_BLOCK)
+			_HashRemove(dev, work);
+
+		work->block = block;
+		for (i = 0; i < dev->attr->pages_per_block; i++)
+			work->spares[i].expired = 1;
+		work->expired_count = dev->attr->pages_per_block;
+		work->map_valid = U_FALSE;
+
+		_HashInsert(dev, work);
+	}
+
+	work->ref_count++;
+	_MoveBcToHead(dev, work);
+
+	return work;
+}
+
+/**
+ * \brief put block info buffer back to pool,
+ *			should be called with #uffs_BlockInfoGet in pairs.
+ * \param[in] dev uffs device
+ * \param[in] p pointer of block info buffer
+ */
+void uffs_BlockInfoPut(uffs_Device *dev, uffs_BlockInfo *p)
+{
+	if (p == NULL)
+		return;
+
+	if (p->ref_count == 0) {
+		fprintf(stderr, "Put an unused block info cache back ?\n");
+	}
+	else {
+		p->ref_count--;
+	}
+}
+
+/**
+ * \brief make the given pages expired in given block info buffer
+ * \param[in] dev uffs device
+ * \param[in] p pointer of block info buffer
+ * \param[in] page given page number.
+ *			if #UFFS_ALL_PAGES presented, all pages in the block should be made expired.
+ * \note the page_id map is rebuilt on next lookup
+ */
+void uffs_BlockInfoExpire(uffs_Device *dev, uffs_BlockInfo *p, int page)
+{
+	int i;
+	uffs_PageSpare *spare;
+
+	if (page == UFFS_ALL_PAGES) {
+		for (i = 0; i < dev->attr->pages_per_block; i++) {
+			spare = &(p->spares[i]);
+			if (spare->expired == 0) {
+				spare->expired = 1;
+				p->expired_count++;
+			}
+		}
+	}
+	else {
+		if (page >= 0 && page < dev->attr->pages_per_block) {
+			spare = &(p->spares[page]);
+			if (spare->expired == 0) {
+				spare->expired = 1;
+				p->expired_count++;
+			}
+		}
+	}
+
+	// the map may point to a page whose tag is gone now
+	p->map_valid = U_FALSE;
+}
+
+/**
+ * Is all blcok info cache free (not referenced) ?
+ */
+UBOOL uffs_BlockInfoIsAllFree(uffs_Device *dev)
+{
+	uffs_BlockInfo *work;
+
+	for (work = dev->bc.head; work != NULL; work = work->next) {
+		if (work->ref_count != 0)
+			return U_FALSE;
+	}
+
+	return U_TRUE;
+}
+
+/**
+ * \brief make all cached block info expired
+ */
+void uffs_BlockInfoExpireAll(uffs_Device *dev)
+{
+	uffs_BlockInfo *work;
+
+	for (work = dev->bc.head; work != NULL; work = work->next)
+		uffs_BlockInfoExpire(dev, work, UFFS_ALL_PAGES);
+}
+
+/**
+ * \brief init block info cache for an erased block, without reading spares
+ */
+void uffs_BlockInfoInitErased(uffs_Device *dev, uffs_BlockInfo *p)
+{
+	int i;
+
+	for (i = 0; i < dev->attr->pages_per_block; i++) {
+		memset(&(p->spares[i].tag), 0xFF, sizeof(uffs_Tags));
+		p->spares[i].expired = 0;
+		p->page_map[i] = UFFS_INVALID_PAGE;
+	}
+	p->expired_count = 0;
+	p->map_valid = U_TRUE;
+}
+
+/**
+ * \brief record a page whose tag has been filled in place through GET_TAG(),
+ *			so that lookups by page_id see it without reloading the spare.
+ * \param[in] dev uffs device
+ * \param[in] p pointer of block info buffer
+ * \param[in] page page number
+ */
+void uffs_BlockInfoMapPage(uffs_Device *dev, uffs_BlockInfo *p, u16 page)
+{
+	if (page < dev->attr->pages_per_block)
+		_MapPage(dev, p, page);
+}
+
+/**
+ * \brief find the newest page holding page_id in the block
+ *
+ * expired spares are loaded (and the map built) first,
+ * after that it's a single array lookup.
+ *
+ * \param[in] dev uffs device
+ * \param[in] p pointer of block info buffer
+ * \param[in] page_id page_id to find
+ * \return page number, #UFFS_INVALID_PAGE if page_id is not in the block
+ */
+u16 uffs_BlockInfoFindPage(uffs_Device *dev, uffs_BlockInfo *p, u16 page_id)
+{
+	if (page_id >= dev->attr->pages_per_block)
+		return UFFS_INVALID_PAGE;
+
+	if (p->expired_count > 0)
+		uffs_BlockInfoLoad(dev, p, UFFS_ALL_PAGES);
+	if (!p->map_valid)
+		_BuildPageMap(dev, p);
+
+	return p->page_map[page_id];
+}
@@ -0,0 +1,839 @@
+/**
+ * \file buf_bench.c
+ * \brief page buffer and block info cache test/benchmark on a RAM flash
+ *
+ * uffs_buf.c and blockinfo.c run on a flash kept in memory, without FUSE.
+ * every case checks its results and counts what's wrong as 'bad',
+ * the program exits non-zero if anything is bad.
+ *
+ * usage: buf_bench
+ */
+
+#include "uffs_config.h"
+#include "uffs_types.h"
+#include "uffs_public.h"
+#include "uffs_buf.h"
+#include "uffs_blockinfo.h"
+#include "uffs_badblock.h"
+#include "uffs_flash.h"
+#include "uffs_mem.h"
+#include "uffs_tree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define RAM_BLOCKS			64
+#define RAM_PAGES			32		//!< pages per block
+#define RAM_PAGE_SIZE		512
+
+#define BENCH_BUFS			1024	//!< page buffers for the lookup benchmark
+#define BENCH_LOOKUPS		(4 * 1024 * 1024)
+
+#define FLUSH_FILE_PAGES	8		//!< pages of the file updated by the flush benchmark
+#define FLUSH_UPDATES		2		//!< pages rewritten between two flushes
+#define FLUSH_ROUNDS		240
+
+#define RECLAIM_FILES		8		//!< files written at the same time, one dirty group each
+#define RECLAIM_BUFS		16		//!< few page buffers, so that they run out often
+#define RECLAIM_CACHED_BLOCKS	4	//!< fewer block infos than files
+#define RECLAIM_ROUNDS		400
+
+/** flash in memory, with counters */
+static struct {
+	u8 data[RAM_BLOCKS][RAM_PAGES][RAM_PAGE_SIZE];
+	uffs_TagStore ts[RAM_BLOCKS][RAM_PAGES];
+	u8 sealed[RAM_BLOCKS][RAM_PAGES];
+	u8 top[RAM_BLOCKS];			//!< next page to program in the block
+	u32 tag_reads;
+	u32 page_reads;
+	u32 page_writes;
+	u32 erases;
+	u32 out_of_order;			//!< pages programmed below an already programmed page
+} ram;
+
+static uffs_Device dev;
+static struct uffs_StorageAttrSt attr;
+
+static int ram_ReadPageWithLayout(uffs_Device *dev, u32 block, u32 page, u8 *data, int data_len,
+								  u8 *ecc, uffs_TagStore *ts, u8 *ecc_store)
+{
+	if (block >= RAM_BLOCKS || page >= RAM_PAGES)
+		return UFFS_FLASH_IO_ERR;
+
+	if (data) {
+		memcpy(data, ram.data[block][page], data_len < RAM_PAGE_SIZE ? data_len : RAM_PAGE_SIZE);
+		ram.page_reads++;
+	}
+	if (ts) {
+		memcpy(ts, &ram.ts[block][page], sizeof(uffs_TagStore));
+		ram.tag_reads++;
+		if (!ram.sealed[block][page])
+			return UFFS_FLASH_NOT_SEALED;
+	}
+
+	return UFFS_FLASH_NO_ERR;
+}
+
+static int ram_WritePageWithLayout(uffs_Device *dev, u32 block, u32 page, const u8 *data, int data_len,
+								   const u8 *ecc, const uffs_TagStore *ts)
+{
+	if (block >= RAM_BLOCKS || page >= RAM_PAGES || data_len > RAM_PAGE_SIZE)
+		return UFFS_FLASH_IO_ERR;
+
+	if (ram.sealed[block][page]) {
+		fprintf(stderr, "block %d page %d is programmed twice\n", block, page);
+		return UFFS_FLASH_IO_ERR;
+	}
+	if (page < ram.top[block])
+		ram.out_of_order++;
+	ram.top[block] = page + 1;
+
+	if (data)
+		memcpy(ram.data[block][page], data, data_len);
+	if (ts) {
+		memcpy(&ram.ts[block][page], ts, sizeof(uffs_TagStore));
+		ram.sealed[block][page] = 1;
+	}
+	ram.page_writes++;
+
+	return UFFS_FLASH_NO_ERR;
+}
+
+static int ram_EraseBlock(uffs_Device *dev, u32 block)
+{
+	if (block >= RAM_BLOCKS)
+		return UFFS_FLASH_IO_ERR;
+
+	memset(ram.data[block], 0xFF, sizeof(ram.data[block]));
+	memset(ram.ts[block], 0xFF, sizeof(ram.ts[block]));
+	memset(ram.sealed[block], 0, sizeof(ram.sealed[block]));
+	ram.top[block] = 0;
+	ram.erases++;
+
+	return UFFS_FLASH_NO_ERR;
+}
+
+static struct uffs_FlashOpsSt ram_ops = {
+	NULL,						// InitFlash
+	NULL,						// ReleaseFlash
+	ram_ReadPageWithLayout,
+	ram_WritePageWithLayout,
+	NULL,						// IsBadBlock
+	NULL,						// MarkBadBlock
+	ram_EraseBlock,
+};
+
+/** erase the RAM flash and set up the device, like uffs_InitDevice() + uffs_BuildTree() on an empty flash */
+static void _InitDevice(int buf_max, int cached_blocks, int dirty_groups)
+{
+	TreeNode *node;
+	int i;
+
+	memset(&ram, 0, sizeof(ram));
+	for (i = 0; i < RAM_BLOCKS; i++)
+		ram_EraseBlock(&dev, i);
+	ram.erases = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.total_blocks = RAM_BLOCKS;
+	attr.page_data_size = RAM_PAGE_SIZE;
+	attr.pages_per_block = RAM_PAGES;
+	attr.spare_size = 16;
+	attr.ecc_opt = UFFS_ECC_NONE;
+	attr.layout_opt = UFFS_LAYOUT_FLASH;
+
+	memset(&dev, 0, sizeof(dev));
+	dev.attr = &attr;
+	dev.ops = &ram_ops;
+	dev.par.start = 0;
+	dev.par.end = RAM_BLOCKS - 1;
+	dev.cfg.dirty_groups = dirty_groups;
+	uffs_MemSetupSystemAllocator(&dev.mem);
+
+	// the steps of uffs_InitDevice(), uffs_init.c can't be linked without uffs_fs.c
+	uffs_BadBlockInit(&dev);
+	if (uffs_BufInit(&dev, buf_max, MAX_DIRTY_PAGES_IN_A_BLOCK) != U_SUCC ||
+		uffs_BlockInfoInitCache(&dev, cached_blocks) != U_SUCC ||
+		uffs_TreeInit(&dev) != U_SUCC) {
+		fprintf(stderr, "init device fail\n");
+		exit(1);
+	}
+
+	// every block is erased
+	for (i = 0; i < RAM_BLOCKS; i++) {
+		node = (TreeNode *)uffs_PoolGet(&dev.mem.tree_pool);
+		node->u.list.block = i;
+		uffs_TreeInsertToErasedListTail(&dev, node);
+	}
+}
+
+static void _ReleaseDevice(void)
+{
+	uffs_BufReleaseAll(&dev);
+	uffs_BlockInfoReleaseCache(&dev);
+	dev.mem.free(&dev, dev.mem.tree_nodes_pool_buf);
+}
+
+static double _Now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int _Check(int ok, const char *what)
+{
+	if (!ok)
+		fprintf(stderr, "bad: %s\n", what);
+	return ok ? 0 : 1;
+}
+
+static void _Report(const char *name, int bad)
+{
+	fprintf(stdout, "%-10s %s (%d bad)\n", name, bad == 0 ? "ok" : "FAIL", bad);
+}
+
+/** a clean page buffer holding (parent, serial, page_id), like a page loaded from flash */
+static uffs_Buf * _Load(u16 parent, u16 serial, u16 page_id)
+{
+	uffs_Buf *buf;
+
+	buf = uffs_BufNew(&dev, UFFS_TYPE_DATA, parent, serial, page_id);
+	if (buf) {
+		buf->mark = UFFS_BUF_VALID;
+		uffs_BufPut(&dev, buf);
+	}
+	return buf;
+}
+
+/** slot of buf in the hash index, -1 if it's not there */
+static int _HashSlot(uffs_Buf *buf)
+{
+	int i;
+
+	for (i = 0; i <= dev.buf.hash_mask; i++) {
+		if (dev.buf.hash[i] == buf)
+			return i;
+	}
+	return -1;
+}
+
+/** every indexed buffer can be found, and only those are in the index */
+static int _CheckHashIndex(void)
+{
+	uffs_Buf *buf;
+	int i, slots = 0, hashed = 0, bad = 0;
+
+	for (i = 0; i <= dev.buf.hash_mask; i++) {
+		if (dev.buf.hash[i])
+			slots++;
+	}
+	for (buf = dev.buf.head; buf; buf = buf->next) {
+		if (!buf->hashed)
+			continue;
+		hashed++;
+		if (buf->mark != UFFS_BUF_EMPTY)
+			bad += _Check(uffs_BufFind(&dev, buf->parent, buf->serial, buf->page_id) == buf,
+							"indexed buffer not found");
+	}
+	bad += _Check(slots == hashed, "hash slots != indexed buffers");
+
+	return bad;
+}
+
+/**
+ * hash index: probe wraparound at the last slot and backward-shift delete.
+ * keys are picked by their home slot, found by indexing them alone.
+ */
+static int _TestHash(void)
+{
+	u16 wrap[4], zero[2];
+	uffs_Buf *buf[6];
+	int nwrap = 0, nzero = 0;
+	int i, slot, bad = 0;
+	u16 serial;
+
+	_InitDevice(MAX_PAGE_BUFFERS, MAX_CACHED_BLOCK_INFO, 0);
+
+	for (serial = 1; serial < MAX_UFFS_FDN && (nwrap < 4 || nzero < 2); serial++) {
+		buf[0] = _Load(1, serial, 0);
+		slot = _HashSlot(buf[0]);
+		if (slot == dev.buf.hash_mask && nwrap < 4)
+			wrap[nwrap++] = serial;
+		else if (slot == 0 && nzero < 2)
+			zero[nzero++] = serial;
+		uffs_BufMarkEmpty(&dev, buf[0]);
+	}
+	if (nwrap < 4 || nzero < 2) {
+		fprintf(stderr, "no keys for the last/first hash slot ?\n");
+		return 1;
+	}
+
+	// 4 keys for the last slot wrap around to slots 0, 1, 2, then the 2 keys of slot 0
+	for (i = 0; i < 4; i++)
+		buf[i] = _Load(1, wrap[i], 0);
+	for (i = 0; i < 2; i++)
+		buf[4 + i] = _Load(1, zero[i], 0);
+
+	bad += _Check(_HashSlot(buf[0]) == dev.buf.hash_mask, "first key not in its home slot");
+	for (i = 1; i < 6; i++)
+		bad += _Check(_HashSlot(buf[i]) == i - 1, "probe didn't wrap around to slot 0");
+	bad += _CheckHashIndex();
+
+	// delete the one in the last slot, everything shifts back by one across the wrap
+	uffs_BufMarkEmpty(&dev, buf[0]);
+	bad += _Check(uffs_BufFind(&dev, 1, wrap[0], 0) == NULL, "deleted key still found");
+	bad += _Check(_HashSlot(buf[1]) == dev.buf.hash_mask, "entry not shifted back across the wrap");
+	for (i = 2; i < 6; i++)
+		bad += _Check(_HashSlot(buf[i]) == i - 2, "entry not shifted back");
+	bad += _CheckHashIndex();
+
+	// delete from the middle: slot-0 keys must stay reachable from slot 0
+	uffs_BufMarkEmpty(&dev, buf[3]);
+	bad += _Check(uffs_BufFind(&dev, 1, wrap[3], 0) == NULL, "deleted key still found");
+	bad += _Check(_HashSlot(buf[4]) == 1 && _HashSlot(buf[5]) == 2, "slot-0 keys not shifted back");
+	bad += _CheckHashIndex();
+
+	// random inserts and deletes over the whole pool
+	srand(47);
+	for (i = 0; i < 20000; i++) {
+		serial = 1 + rand() % 200;
+		if (rand() % 3 == 0) {
+			buf[0] = uffs_BufFind(&dev, 1, serial, serial % RAM_PAGES);
+			if (buf[0])
+				uffs_BufMarkEmpty(&dev, buf[0]);
+		}
+		else if (uffs_BufFind(&dev, 1, serial, serial % RAM_PAGES) == NULL) {
+			_Load(1, serial, serial % RAM_PAGES);
+		}
+		if (i % 1000 == 0)
+			bad += _CheckHashIndex();
+	}
+	bad += _CheckHashIndex();
+
+	_ReleaseDevice();
+
+	return bad;
+}
+
+/**
+ * victim order: the least recently used clean buffer is reused first.
+ * referenced buffers, including those referenced by uffs_BufIncRef()
+ * which stay in the free list, are skipped.
+ */
+static int _TestLru(void)
+{
+	int n = MAX_PAGE_BUFFERS - CLONE_BUFFERS_THRESHOLD;
+	uffs_Buf *buf, *held, *victim;
+	int i, bad = 0;
+
+	_InitDevice(MAX_PAGE_BUFFERS, MAX_CACHED_BLOCK_INFO, 0);
+
+	for (i = 0; i < n; i++)
+		_Load(2, i + 1, 0);
+
+	// touch #1, it's the most recently used now
+	buf = uffs_BufGet(&dev, 2, 1, 0);
+	uffs_BufPut(&dev, buf);
+
+	// #2 is referenced without dev (stale in the free list), #3 is held
+	uffs_BufIncRef(uffs_BufFind(&dev, 2, 2, 0));
+	held = uffs_BufGet(&dev, 2, 3, 0);
+
+	for (i = 4; i <= 8; i++) {
+		victim = uffs_BufFind(&dev, 2, i, 0);
+		buf = _Load(3, i, 0);
+		bad += _Check(buf == victim, "victim is not the least recently used clean buffer");
+		bad += _Check(uffs_BufFind(&dev, 2, i, 0) == NULL, "reused buffer still found by old key");
+		bad += _Check(uffs_BufFind(&dev, 3, i, 0) == buf, "reused buffer not found by new key");
+	}
+	bad += _Check(uffs_BufFind(&dev, 2, 1, 0) != NULL, "recently used buffer was reused");
+	bad += _Check(uffs_BufFind(&dev, 2, 2, 0) != NULL, "referenced buffer was reused");
+	bad += _Check(uffs_BufFind(&dev, 2, 3, 0) == held, "held buffer was reused");
+	bad += _CheckHashIndex();
+
+	uffs_BufDecRef(uffs_BufFind(&dev, 2, 2, 0));
+	uffs_BufPut(&dev, held);
+
+	_ReleaseDevice();
+
+	return bad;
+}
+
+/** content of a file page, version v */
+static void _Pattern(u8 *p, int len, u16 serial, u16 page_id, int v)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		p[i] = (u8)(serial * 31 + page_id * 7 + v * 13 + i);
+}
+
+/** write a whole data page through the page buffers */
+static URET _WritePage(u16 parent, u16 serial, u16 page_id, int v)
+{
+	u8 data[RAM_PAGE_SIZE];
+	uffs_Buf *buf;
+	URET ret;
+
+	buf = uffs_BufNew(&dev, UFFS_TYPE_DATA, parent, serial, page_id);
+	if (buf == NULL)
+		return U_FAIL;
+
+	_Pattern(data, dev.com.pg_data_size, serial, page_id, v);
+	ret = uffs_BufWrite(&dev, buf, data, 0, dev.com.pg_data_size);
+	uffs_BufPut(&dev, buf);
+
+	return ret;
+}
+
+/** load a data page (from flash if it's not buffered) and compare it with version v */
+static int _ReadPage(u16 parent, u16 serial, u16 page_id, int v)
+{
+	u8 data[RAM_PAGE_SIZE];
+	TreeNode *node;
+	uffs_Buf *buf;
+	int ok;
+
+	node = uffs_TreeFindDataNode(&dev, parent, serial);
+	if (node == NULL)
+		return _Check(0, "data node not in the tree");
+
+	buf = uffs_BufGetEx(&dev, UFFS_TYPE_DATA, node, page_id, 0);
+	if (buf == NULL)
+		return _Check(0, "can't load page");
+
+	_Pattern(data, dev.com.pg_data_size, serial, page_id, v);
+	ok = (buf->data_len == dev.com.pg_data_size &&
+			memcmp(buf->data, data, dev.com.pg_data_size) == 0);
+	uffs_BufPut(&dev, buf);
+
+	return _Check(ok, "page read back is different");
+}
+
+/** the group of the file has count dirty pages, sorted by page_id */
+static int _CheckDirtySorted(u16 parent, u16 serial, int count)
+{
+	struct uffs_DirtyGroupSt *group;
+	uffs_Buf *buf;
+	int slot, n = 0, bad = 0;
+
+	slot = uffs_BufFindGroupSlot(&dev, parent, serial);
+	if (slot < 0)
+		return _Check(0, "no dirty group for the file");
+
+	group = &dev.buf.dirtyGroup[slot];
+	for (buf = group->dirty; buf; buf = buf->next_dirty) {
+		if (buf->next_dirty)
+			bad += _Check(buf->page_id < buf->next_dirty->page_id, "dirty list not sorted");
+		n++;
+	}
+	bad += _Check(n == count && group->count == count, "wrong number of dirty pages");
+
+	return bad;
+}
+
+/** the first n pages of the block hold page_ids[], the rest are free */
+static int _CheckBlockPages(int block, const u16 *page_ids, int n)
+{
+	int i, bad = 0;
+
+	for (i = 0; i < RAM_PAGES; i++) {
+		if (i < n)
+			bad += _Check(ram.sealed[block][i] && ram.ts[block][i].page_id == page_ids[i],
+							"wrong page_id programmed");
+		else
+			bad += _Check(!ram.sealed[block][i], "page after the flushed ones is programmed");
+	}
+
+	return bad;
+}
+
+/**
+ * dirty groups: pages written out of order by several files at the same time
+ * are kept sorted, and each group is flushed in one ascending pass.
+ */
+static int _TestDirtyGroups(void)
+{
+	static const u16 order[] = { 3, 0, 5, 2, 1, 4 };
+	static const u16 flushed[] = { 0, 1, 2, 3, 4, 5 };
+	static const u16 appended[] = { 0, 1, 2, 3, 4, 5, 2, 6, 7 };
+	TreeNode *node;
+	u32 writes;
+	int f, i, bad = 0;
+
+	_InitDevice(MAX_PAGE_BUFFERS, MAX_CACHED_BLOCK_INFO, 4);
+
+	for (i = 0; i < 6; i++) {
+		for (f = 0; f < 4; f++)
+			bad += _Check(_WritePage(1, 10 + f, order[i], 0) == U_SUCC, "write fail");
+	}
+	for (f = 0; f < 4; f++)
+		bad += _CheckDirtySorted(1, 10 + f, 6);
+	bad += _Check(uffs_BufFindFreeGroupSlot(&dev) < 0, "4 files should take 4 groups");
+
+	// new blocks: only the dirty pages are programmed, in page_id order
+	for (f = 0; f < 4; f++) {
+		writes = ram.page_writes;
+		bad += _Check(uffs_BufFlushGroup(&dev, 1, 10 + f) == U_SUCC, "flush fail");
+		bad += _Check(ram.page_writes - writes == 6, "flush programmed more than the dirty pages");
+		node = uffs_TreeFindDataNode(&dev, 1, 10 + f);
+		if (_Check(node != NULL, "flushed file not in the tree") == 0)
+			bad += _CheckBlockPages(node->u.data.block, flushed, 6);
+	}
+
+	// rewrite page 2 and add 7, 6: appended as 2, 6, 7 to the free pages
+	bad += _Check(_WritePage(1, 10, 7, 0) == U_SUCC, "write fail");
+	bad += _Check(_WritePage(1, 10, 2, 1) == U_SUCC, "write fail");
+	bad += _Check(_WritePage(1, 10, 6, 0) == U_SUCC, "write fail");
+	bad += _CheckDirtySorted(1, 10, 3);
+	bad += _Check(uffs_BufFlushGroup(&dev, 1, 10) == U_SUCC, "flush fail");
+	node = uffs_TreeFindDataNode(&dev, 1, 10);
+	if (node)
+		bad += _CheckBlockPages(node->u.data.block, appended, 9);
+
+	// all groups taken: a 5th file gets the slot of the most dirty group, which is flushed
+	for (f = 0; f < 4; f++)
+		bad += _Check(_WritePage(1, 10 + f, 8 - (f == 0 ? 0 : 2), 0) == U_SUCC, "write fail");
+	bad += _Check(_WritePage(1, 11, 7, 0) == U_SUCC, "write fail");
+	bad += _Check(_WritePage(1, 14, 0, 0) == U_SUCC, "write fail");
+	bad += _Check(uffs_BufFindGroupSlot(&dev, 1, 11) < 0, "most dirty group not flushed");
+	bad += _Check(uffs_BufFindGroupSlot(&dev, 1, 14) >= 0, "new file has no group");
+
+	bad += _Check(uffs_BufFlushAll(&dev) == U_SUCC, "flush all fail");
+	bad += _Check(ram.out_of_order == 0, "pages programmed out of order");
+
+	// everything from flash
+	uffs_BufSetAllEmpty(&dev);
+	for (f = 0; f < 4; f++) {
+		for (i = 0; i < 6; i++)
+			bad += _ReadPage(1, 10 + f, i, (f == 0 && i == 2) ? 1 : 0);
+	}
+	bad += _ReadPage(1, 10, 6, 0);
+	bad += _ReadPage(1, 10, 7, 0);
+	bad += _ReadPage(1, 10, 8, 0);
+	bad += _ReadPage(1, 11, 6, 0);
+	bad += _ReadPage(1, 11, 7, 0);
+	bad += _ReadPage(1, 14, 0, 0);
+
+	_ReleaseDevice();
+
+	return bad;
+}
+
+/** program a good data tag for page_id straight into the RAM flash */
+static void _ProgramTag(int block, int page, u16 page_id)
+{
+	uffs_TagStore *ts = &ram.ts[block][page];
+
+	memset(ts, 0xFF, sizeof(uffs_TagStore));
+	ts->dirty = TAG_DIRTY;
+	ts->valid = TAG_VALID;
+	ts->type = UFFS_TYPE_DATA;
+	ts->page_id = page_id;
+	ram.sealed[block][page] = 1;
+	ram.top[block] = page + 1;
+}
+
+/** every cached block info can be found, and only those are in the index */
+static int _CheckBlockInfoIndex(void)
+{
+	uffs_BlockInfo *p;
+	int i, slots = 0, cached = 0, bad = 0;
+
+	for (i = 0; i <= dev.bc.hash_mask; i++) {
+		if (dev.bc.hash[i])
+			slots++;
+	}
+	for (p = dev.bc.head; p; p = p->next) {
+		if (p->block == UFFS_INVALID_BLOCK)
+			continue;
+		cached++;
+		bad += _Check(uffs_BlockInfoFindInCache(&dev, p->block) == p, "cached block info not found");
+	}
+	bad += _Check(slots == cached, "hash slots != cached block infos");
+
+	return bad;
+}
+
+/**
+ * block info cache: the page_id map gives the newest page, it's rebuilt
+ * after expire with only the expired spares read again.
+ * LRU reuse keeps recently used and referenced blocks.
+ */
+static int _TestBlockInfo(void)
+{
+	static const u16 ids[] = { 0, 1, 2, 1, 3, 2, 1, 4 };
+	static const u16 newest[] = { 0, 6, 5, 4, 7 };
+	uffs_BlockInfo *bc, *held;
+	u32 reads;
+	int i, block, bad = 0;
+
+	_InitDevice(MAX_PAGE_BUFFERS, 4, 0);
+
+	for (i = 0; i < 8; i++)
+		_ProgramTag(5, i, ids[i]);
+
+	bc = uffs_BlockInfoGet(&dev, 5);
+	if (bc == NULL)
+		return _Check(0, "can't get block info");
+
+	// first lookup loads all the spares, the rest come from the map
+	reads = ram.tag_reads;
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 1) == newest[1], "not the newest page");
+	bad += _Check(ram.tag_reads - reads == RAM_PAGES, "first lookup should read every spare once");
+	reads = ram.tag_reads;
+	for (i = 0; i < 5; i++)
+		bad += _Check(uffs_BlockInfoFindPage(&dev, bc, i) == newest[i], "not the newest page");
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 5) == UFFS_INVALID_PAGE, "page_id not in the block found");
+	bad += _Check(ram.tag_reads == reads, "lookups after load read the flash");
+
+	// one new page expired: one spare read, the map is rebuilt
+	_ProgramTag(5, 8, 0);
+	uffs_BlockInfoExpire(&dev, bc, 8);
+	reads = ram.tag_reads;
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 0) == 8, "map not rebuilt after expire");
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 1) == newest[1], "not the newest page");
+	bad += _Check(ram.tag_reads - reads == 1, "expired page should be read once");
+
+	// tag filled in place by the writer, then mapped: no read
+	_ProgramTag(5, 9, 3);
+	memcpy(&GET_TAG(bc, 9)->s, &ram.ts[5][9], sizeof(uffs_TagStore));
+	SEAL_TAG(GET_TAG(bc, 9));
+	uffs_BlockInfoMapPage(&dev, bc, 9);
+	reads = ram.tag_reads;
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 3) == 9, "mapped page not found");
+	bad += _Check(ram.tag_reads == reads, "mapped page read from flash");
+
+	// all expired: everything read again, same answers
+	uffs_BlockInfoExpire(&dev, bc, UFFS_ALL_PAGES);
+	reads = ram.tag_reads;
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 2) == newest[2], "map not rebuilt after expire all");
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 3) == 9, "map not rebuilt after expire all");
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 0) == 8, "map not rebuilt after expire all");
+	bad += _Check(ram.tag_reads - reads == RAM_PAGES, "expire all should read every spare once");
+
+	// block erased and written again behind the cache: nothing of the old map is left
+	ram_EraseBlock(&dev, 5);
+	_ProgramTag(5, 0, 1);
+	uffs_BlockInfoExpire(&dev, bc, UFFS_ALL_PAGES);
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 1) == 0, "map not rebuilt after expire all");
+	bad += _Check(uffs_BlockInfoFindPage(&dev, bc, 2) == UFFS_INVALID_PAGE, "stale page in the map");
+	uffs_BlockInfoPut(&dev, bc);
+
+	// 4 cached: the least recently used goes first
+	for (block = 10; block < 14; block++)
+		uffs_BlockInfoPut(&dev, uffs_BlockInfoGet(&dev, block));
+	bad += _Check(uffs_BlockInfoFindInCache(&dev, 5) == NULL, "least recently used block still cached");
+	uffs_BlockInfoPut(&dev, uffs_BlockInfoGet(&dev, 10));
+	uffs_BlockInfoPut(&dev, uffs_BlockInfoGet(&dev, 14));
+	bad += _Check(uffs_BlockInfoFindInCache(&dev, 11) == NULL, "least recently used block still cached");
+	bad += _Check(uffs_BlockInfoFindInCache(&dev, 10) != NULL, "recently used block evicted");
+
+	// a referenced block stays
+	held = uffs_BlockInfoGet(&dev, 12);
+	for (block = 15; block < 20; block++)
+		uffs_BlockInfoPut(&dev, uffs_BlockInfoGet(&dev, block));
+	bad += _Check(uffs_BlockInfoFindInCache(&dev, 12) == held, "referenced block evicted");
+	uffs_BlockInfoPut(&dev, held);
+
+	srand(49);
+	for (i = 0; i < 10000; i++)
+		uffs_BlockInfoPut(&dev, uffs_BlockInfoGet(&dev, rand() % RAM_BLOCKS));
+	bad += _CheckBlockInfoIndex();
+
+	_ReleaseDevice();
+
+	return bad;
+}
+
+/**
+ * small updates of one file, flushed after every FLUSH_UPDATES pages:
+ * appended to the free pages of its block, or a block recover every time.
+ */
+static int _BenchFlush(UBOOL force_block_recover, struct uffs_BufStatSt *st, u32 *erases)
+{
+	int ver[FLUSH_FILE_PAGES];
+	int r, i, page_id, bad = 0;
+
+	_InitDevice(MAX_PAGE_BUFFERS, MAX_CACHED_BLOCK_INFO, 0);
+
+	for (i = 0; i < FLUSH_FILE_PAGES; i++) {
+		ver[i] = 0;
+		bad += _Check(_WritePage(1, 10, i, 0) == U_SUCC, "write fail");
+	}
+	bad += _Check(uffs_BufFlushGroup(&dev, 1, 10) == U_SUCC, "flush fail");
+
+	memset(&dev.buf.st, 0, sizeof(dev.buf.st));
+	ram.erases = 0;
+
+	for (r = 0; r < FLUSH_ROUNDS; r++) {
+		for (i = 0; i < FLUSH_UPDATES; i++) {
+			page_id = (r * FLUSH_UPDATES + i) % FLUSH_FILE_PAGES;
+			ver[page_id] = r + 1;
+			bad += _Check(_WritePage(1, 10, page_id, ver[page_id]) == U_SUCC, "write fail");
+		}
+		bad += _Check(uffs_BufFlushGroupEx(&dev, 1, 10, force_block_recover) == U_SUCC, "flush fail");
+	}
+	uffs_BufGetStat(&dev, st);
+	*erases = ram.erases;
+
+	uffs_BufSetAllEmpty(&dev);
+	for (i = 0; i < FLUSH_FILE_PAGES; i++)
+		bad += _ReadPage(1, 10, i, ver[i]);
+	bad += _Check(ram.out_of_order == 0, "pages programmed out of order");
+
+	_ReleaseDevice();
+
+	return bad;
+}
+
+static void _ReportFlush(const char *name, struct uffs_BufStatSt *st, u32 erases)
+{
+	fprintf(stdout, "%-10s %u flushed, %u programmed (%u copied), %u recovers, %u appends, %u erases, %.2f writes/page\n",
+			name, st->flushed_pages, st->page_writes, st->copied_pages, st->block_recovers, st->appends,
+			erases, st->flushed_pages ? (double)st->page_writes / st->flushed_pages : 0.0);
+}
+
+/** write amplification: appends should program far fewer pages than a block recover per flush */
+static int _TestFlush(void)
+{
+	struct uffs_BufStatSt append, recover;
+	u32 append_erases, recover_erases;
+	int bad = 0;
+
+	bad += _BenchFlush(U_FALSE, &append, &append_erases);
+	bad += _BenchFlush(U_TRUE, &recover, &recover_erases);
+
+	_ReportFlush("append", &append, append_erases);
+	_ReportFlush("recover", &recover, recover_erases);
+
+	bad += _Check(append.flushed_pages == FLUSH_ROUNDS * FLUSH_UPDATES &&
+					recover.flushed_pages == FLUSH_ROUNDS * FLUSH_UPDATES, "not every update flushed");
+	bad += _Check(recover.block_recovers == FLUSH_ROUNDS, "forced flush didn't recover the block");
+	bad += _Check(append.appends > 0 && append.page_writes * 2 < recover.page_writes,
+					"appends don't save page writes");
+	bad += _Check(append_erases * 2 < recover_erases, "appends don't save erases");
+
+	return bad;
+}
+
+/**
+ * page buffers running out with many files written at the same time:
+ * picking a group to flush shouldn't read the spares of every group's block.
+ */
+static int _TestReclaim(void)
+{
+	struct uffs_BufStatSt st;
+	u32 reads;
+	int r, f, bad = 0;
+
+	_InitDevice(RECLAIM_BUFS, RECLAIM_CACHED_BLOCKS, RECLAIM_FILES);
+
+	for (f = 0; f < RECLAIM_FILES; f++) {
+		for (r = 0; r < 4; r++)
+			bad += _Check(_WritePage(1, 10 + f, r, 0) == U_SUCC, "write fail");
+		bad += _Check(uffs_BufFlushGroup(&dev, 1, 10 + f) == U_SUCC, "flush fail");
+	}
+
+	memset(&dev.buf.st, 0, sizeof(dev.buf.st));
+	reads = ram.tag_reads;
+
+	for (r = 0; r < RECLAIM_ROUNDS; r++) {
+		for (f = 0; f < RECLAIM_FILES; f++)
+			bad += _Check(_WritePage(1, 10 + f, 4 + r % 8, r + 1) == U_SUCC, "write fail");
+	}
+	uffs_BufGetStat(&dev, &st);
+	reads = ram.tag_reads - reads;
+
+	fprintf(stdout, "reclaim    %d files, %d buffers, %d block infos: %u reclaims, %u spare reads, %.1f reads/reclaim\n",
+			RECLAIM_FILES, RECLAIM_BUFS, RECLAIM_CACHED_BLOCKS, st.reclaims, reads,
+			st.reclaims ? (double)reads / st.reclaims : 0.0);
+
+	bad += _Check(st.reclaims > 0, "page buffers never ran out");
+	// the flushed group's block may be loaded and recovered, the other groups shouldn't be read
+	bad += _Check(reads < st.reclaims * 2 * RAM_PAGES, "spares of every group read on reclaim");
+
+	bad += _Check(uffs_BufFlushAll(&dev) == U_SUCC, "flush all fail");
+	uffs_BufSetAllEmpty(&dev);
+	for (f = 0; f < RECLAIM_FILES; f++) {
+		for (r = 0; r < 8; r++)
+			bad += _ReadPage(1, 10 + f, 4 + r, RECLAIM_ROUNDS - 8 + r + 1);
+	}
+
+	_ReleaseDevice();
+
+	return bad;
+}
+
+/** lookups of resident pages with many page buffers */
+static void _BenchLookup(void)
+{
+	int n = BENCH_BUFS - CLONE_BUFFERS_THRESHOLD;
+	uffs_Buf *buf;
+	double start, seconds;
+	int i, misses = 0;
+
+	_InitDevice(BENCH_BUFS, MAX_CACHED_BLOCK_INFO, 0);
+
+	for (i = 0; i < n; i++)
+		_Load(4, 1 + i / RAM_PAGES, i % RAM_PAGES);
+
+	start = _Now();
+	for (i = 0; i < BENCH_LOOKUPS; i++) {
+		buf = uffs_BufGet(&dev, 4, 1 + (i % n) / RAM_PAGES, (i % n) % RAM_PAGES);
+		if (buf)
+			uffs_BufPut(&dev, buf);
+		else
+			misses++;
+	}
+	seconds = _Now() - start;
+
+	fprintf(stdout, "lookup     %d buffers, %d gets, %.1f ns/get, %d misses\n",
+			BENCH_BUFS, BENCH_LOOKUPS, seconds * 1e9 / BENCH_LOOKUPS, misses);
+
+	_ReleaseDevice();
+}
+
+int main(int argc, char *argv[])
+{
+	int bad, total = 0;
+
+	if (argc != 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		return -1;
+	}
+
+	fprintf(stdout, "ram flash: %d blocks, %d pages, %d bytes\n", RAM_BLOCKS, RAM_PAGES, RAM_PAGE_SIZE);
+
+	bad = _TestHash();
+	_Report("hash", bad);
+	total += bad;
+
+	bad = _TestLru();
+	_Report("lru", bad);
+	total += bad;
+
+	bad = _TestDirtyGroups();
+	_Report("dirty", bad);
+	total += bad;
+
+	bad = _TestBlockInfo();
+	_Report("blockinfo", bad);
+	total += bad;
+
+	bad = _TestFlush();
+	_Report("flush", bad);
+	total += bad;
+
+	bad = _TestReclaim();
+	_Report("reclaim", bad);
+	total += bad;
+
+	_BenchLookup();
+
+	return total == 0 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+/*
+  This file is part of UFFS, the Ultra-low-cost Flash File System.
+  
+  Copyright (C) 2005-2009 Ricky Zheng <ricky_gz_zheng@yahoo.co.nz>
+
+  UFFS is free software; you can redistribute it and/or modify it under
+  the GNU Library General Public License as published by the Free Software 
+  Foundation; either version 2 of the License, or (at your option) any
+  later version.
+
+  UFFS is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  or GNU Library General Public License, as applicable, for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  and GNU Library General Public License along with UFFS; if not, write
+  to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA  02110-1301, USA.
+
+  As a special exception, if other files instantiate templates or use
+  macros or inline functions from this file, or you compile this file
+  and link it with other works to produce a work based on this file,
+  this file does not by itself cause the resulting work to be covered
+  by the GNU General Public License. However the source code for this
+  file must still be made available in accordance with section (3) of
+  the GNU General Public License v2.
+ 
+  This exception does not invalidate any other reasons why a work based
+  on this file might be covered by the GNU General Public License.
+*/
+
+/** 
+ * \file uffs_badblock.c
+ * \brief bad block checking and recovering
+ * \author Ricky Zheng, created in 13th Jun, 2005
+ */
+
+#include "uffs_config.h"
+#include "uffs_types.h"
+#include "uffs_public.h"
+#include "uffs_flash.h"
+#include "uffs_blockinfo.h"
+#include "uffs_badblock.h"
+
+#include <string.h>
+
+#define PFX "bbl : "
+
+void uffs_BadBlockInit(uffs_Device *dev)
+{
+	memset(&dev->pending, 0, sizeof(dev->pending));
+}
+
+/**
+ * \brief add a bad block to the pending list
+ * \param[in] dev uffs device
+ * \param[in] block bad block number
+ * \param[in] mark #UFFS_PENDING_BLK_REFRESH, #UFFS_PENDING_BLK_RECOVER or #UFFS_PENDING_BLK_MARKBAD
+ * \return #U_FAIL if the pending list is full
+ */
+URET uffs_BadBlockAdd(uffs_Device *dev, int block, u8 mark)
+{
+	struct uffs_PendingListSt *pending = &dev->pending;
+	int i;
+
+	for (i = 0; i < pending->count; i++) {
+		if (pending->list[i].block == block) {
+			pending->list[i].mark |= mark;
+			return U_SUCC;
+		}
+	}
+
+	if (pending->count >= CONFIG_MAX_PENDING_BLOCKS) {
+		fprintf(stderr, PFX "too many pending blocks, can't add block %d\n", block);
+		return U_FAIL;
+	}
+
+	pending->list[pending->count].block = block;
+	pending->list[pending->count].mark = mark;
+	pending->count++;
+
+	fprintf(stderr, PFX "block %d pending (mark %d)\n", block, mark);
+
+	return U_SUCC;
+}
+
+/**
+ * \brief add a pending block by the flash operation result
+ * \return #UFFS_PENDING_BLK_NONE if the result is fine, otherwise the mark added
+ */
+int uffs_BadBlockAddByFlashResult(uffs_Device *dev, int block, int flash_op_ret)
+{
+	u8 mark = UFFS_PENDING_BLK_NONE;
+
+	switch (flash_op_ret) {
+	case UFFS_FLASH_ECC_OK:
+		mark = UFFS_PENDING_BLK_REFRESH;
+		break;
+	case UFFS_FLASH_ECC_FAIL:
+		mark = UFFS_PENDING_BLK_RECOVER;
+		break;
+	case UFFS_FLASH_BAD_BLK:
+		mark = UFFS_PENDING_BLK_MARKBAD;
+		break;
+	default:
+		break;
+	}
+
+	if (mark != UFFS_PENDING_BLK_NONE)
+		uffs_BadBlockAdd(dev, block, mark);
+
+	return mark;
+}
+
+int uffs_BadBlockIsPending(uffs_Device *dev, int block)
+{
+	int i;
+
+	for (i = 0; i < dev->pending.count; i++) {
+		if (dev->pending.list[i].block == block)
+			return dev->pending.list[i].mark;
+	}
+
+	return UFFS_PENDING_BLK_NONE;
+}
+
+URET uffs_BadBlockPendingRemove(uffs_Device *dev, int block)
+{
+	struct uffs_PendingListSt *pending = &dev->pending;
+	int i;
+
+	for (i = 0; i < pending->count; i++) {
+		if (pending->list[i].block == block) {
+			pending->count--;
+			for (; i < pending->count; i++)
+				pending->list[i] = pending->list[i + 1];
+			return U_SUCC;
+		}
+	}
+
+	return U_FAIL;
+}
+
+/** 
+ * \brief process a new bad block: mark it bad and put the node to the bad block list
+ * \param[in] dev uffs device
+ * \param[in] node bad block tree node, not in any list
+ * \note the block is removed from the pending list
+ */
+void uffs_BadBlockProcessNode(uffs_Device *dev, TreeNode *node)
+{
+	int block = node->u.list.block;
+
+	uffs_BadBlockPendingRemove(dev, block);
+
+	fprintf(stderr, PFX "mark bad block %d\n", block);
+	uffs_FlashMarkBadBlock(dev, block);
+
+	uffs_TreeInsertToBadBlockList(dev, node);
+}
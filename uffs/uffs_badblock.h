@@ -0,0 +1,80 @@
+/*
+  This file is part of UFFS, the Ultra-low-cost Flash File System.
+  
+  Copyright (C) 2005-2009 Ricky Zheng <ricky_gz_zheng@yahoo.co.nz>
+
+  UFFS is free software; you can redistribute it and/or modify it under
+  the GNU Library General Public License as published by the Free Software 
+  Foundation; either version 2 of the License, or (at your option) any
+  later version.
+
+  UFFS is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  or GNU Library General Public License, as applicable, for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  and GNU Library General Public License along with UFFS; if not, write
+  to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA  02110-1301, USA.
+
+  As a special exception, if other files instantiate templates or use
+  macros or inline functions from this file, or you compile this file
+  and link it with other works to produce a work based on this file,
+  this file does not by itself cause the resulting work to be covered
+  by the GNU General Public License. However the source code for this
+  file must still be made available in accordance with section (3) of
+  the GNU General Public License v2.
+ 
+  This exception does not invalidate any other reasons why a work based
+  on this file might be covered by the GNU General Public License.
+*/
+
+/** 
+ * \file uffs_badblock.h
+ * \brief bad block management
+ * \author Ricky Zheng
+ */
+
+#ifndef _UFFS_BADBLOCK_H_
+#define _UFFS_BADBLOCK_H_
+
+#include "uffs_types.h"
+#include "uffs_device.h"
+#include "uffs_core.h"
+#include "uffs_tree.h"
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define UFFS_PENDING_BLK_NONE		0		//!< not a pending block
+#define UFFS_PENDING_BLK_REFRESH	8		//!< bit-flip corrected by ECC, the block need to be refreshed
+#define UFFS_PENDING_BLK_RECOVER	16		//!< ECC failed, recover what's left and mark it bad
+#define UFFS_PENDING_BLK_MARKBAD	32		//!< flash driver says it's a bad block
+
+#define HAVE_BADBLOCK(dev) (dev->pending.count > 0)
+
+/** initialize bad block management data structures for uffs device */
+void uffs_BadBlockInit(uffs_Device *dev);
+
+/** add a bad block to the pending list, or add the mark if it's already there */
+URET uffs_BadBlockAdd(uffs_Device *dev, int block, u8 mark);
+
+/** add a pending block by the flash operation result, return the mark (#UFFS_PENDING_BLK_NONE if no problem) */
+int uffs_BadBlockAddByFlashResult(uffs_Device *dev, int block, int flash_op_ret);
+
+/** is the block in the pending list ? return the mark */
+int uffs_BadBlockIsPending(uffs_Device *dev, int block);
+
+/** remove a block from the pending list */
+URET uffs_BadBlockPendingRemove(uffs_Device *dev, int block);
+
+/** erase and mark the node's block bad, then put the node to the bad block list */
+void uffs_BadBlockProcessNode(uffs_Device *dev, TreeNode *node);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
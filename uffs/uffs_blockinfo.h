@@ -66,41 +66,56 @@ struct uffs_BlockInfoSt {
 	struct uffs_PageSpareSt *spares;	//!< page spare info array
 	int expired_count;					//!< how many pages expired in this block ? 
 	int ref_count;						//!< reference counter, it's safe to reuse this block memory when the counter is 0.
+	u16 *page_map;						//!< page_id -> newest page holding it, #UFFS_INVALID_PAGE if none
+	UBOOL map_valid;					//!< page_map agrees with spares, otherwise rebuilt on next lookup
 };
 
 /** get tag from block info */
 #define GET_TAG(bc, page) (&(bc)->spares[page].tag)
 
+/**
+ * \def UFFS_BLOCKINFO_HASH_SLOTS_MAX
+ * \brief upper bound of hash index slots for n cached block info.
+ *	the index uses the smallest power of 2 >= 2 * n, which is always < 4 * n.
+ */
+#define UFFS_BLOCKINFO_HASH_SLOTS_MAX(n)	(4 * (n))
+
 
 /** initialize block info caches */
-// URET uffs_BlockInfoInitCache(uffs_Device *dev, int maxCachedBlocks);
+URET uffs_BlockInfoInitCache(uffs_Device *dev, int maxCachedBlocks);
+
+/** release block info caches */
+URET uffs_BlockInfoReleaseCache(uffs_Device *dev);
+
+/** load page spare to block info cache */
+URET uffs_BlockInfoLoad(uffs_Device *dev, uffs_BlockInfo *work, int page);
 
-// /** release block info caches */
-// URET uffs_BlockInfoReleaseCache(uffs_Device *dev);
+/** find block info cache */
+uffs_BlockInfo * uffs_BlockInfoFindInCache(uffs_Device *dev, int block);
 
-// /** load page spare to block info cache */
-// URET uffs_BlockInfoLoad(uffs_Device *dev, uffs_BlockInfo *work, int page);
+/** get block info cache, load it on demand */
+uffs_BlockInfo * uffs_BlockInfoGet(uffs_Device *dev, int block);
 
-// /** find block info cache */
-// uffs_BlockInfo * uffs_BlockInfoFindInCache(uffs_Device *dev, int block);
+/** put info cache back to pool, should be called with #uffs_BlockInfoGet in pairs. */
+void uffs_BlockInfoPut(uffs_Device *dev, uffs_BlockInfo *p);
 
-// /** get block info cache, load it on demand */
-// uffs_BlockInfo * uffs_BlockInfoGet(uffs_Device *dev, int block);
+/** explicitly expire a block info cache */
+void uffs_BlockInfoExpire(uffs_Device *dev, uffs_BlockInfo *p, int page);
 
-// /** put info cache back to pool, should be called with #uffs_BlockInfoGet in pairs. */
-// void uffs_BlockInfoPut(uffs_Device *dev, uffs_BlockInfo *p);
+/** no one hold any block info cache ? safe to release block info caches */
+UBOOL uffs_BlockInfoIsAllFree(uffs_Device *dev);
 
-// /** explicitly expire a block info cache */
-// void uffs_BlockInfoExpire(uffs_Device *dev, uffs_BlockInfo *p, int page);
+/** explicitly expire all block info caches */
+void uffs_BlockInfoExpireAll(uffs_Device *dev);
 
-// /** no one hold any block info cache ? safe to release block info caches */
-// UBOOL uffs_BlockInfoIsAllFree(uffs_Device *dev);
+/** This will init block info cache for an erased block - all '0xFF' */
+void uffs_BlockInfoInitErased(uffs_Device *dev, uffs_BlockInfo *p);
 
-// /** explicitly expire all block info caches */
-// void uffs_BlockInfoExpireAll(uffs_Device *dev);
+/** tag of a page is filled in place (GET_TAG), record it in the page_id map */
+void uffs_BlockInfoMapPage(uffs_Device *dev, uffs_BlockInfo *p, u16 page);
 
-// /** This will init block info cache for an erased block - all '0xFF' */
-// void uffs_BlockInfoInitErased(uffs_Device *dev, uffs_BlockInfo *p);
+/** newest page holding page_id, loads expired spares first */
+u16 uffs_BlockInfoFindPage(uffs_Device *dev, uffs_BlockInfo *p, u16 page_id);
 
 #ifdef __cplusplus
 }
@@ -42,8 +42,9 @@
 #include "uffs_os.h"
 #include "uffs_public.h"
 #include "uffs_pool.h"
+#include "uffs_blockinfo.h"
 // #include "uffs_ecc.h"
-// #include "uffs_badblock.h"
+#include "uffs_badblock.h"
 #include <string.h>
 
 #define PFX "pbuf: "
@@ -84,6 +85,16 @@ void uffs_BufInspect(uffs_Device *dev)
 	// 				"--------------------------------------------"  TENDSTR);
 }
 
+/**
+ * \brief get the flush counters
+ * \param[in] dev uffs device
+ * \param[out] st counters since uffs_BufInit()
+ */
+void uffs_BufGetStat(uffs_Device *dev, struct uffs_BufStatSt *st)
+{
+	memcpy(st, &dev->buf.st, sizeof(struct uffs_BufStatSt));
+}
+
 /**
  * \brief break a buf from buffer pool list
  * \param[in] dev uffs device
@@ -151,6 +162,162 @@ static void _LinkToBufListTail(uffs_Device *dev, uffs_Buf *buf)
 }
 #endif
 
+/**
+ * \brief hash of (parent, serial, page_id) for the buffer index
+ */
+static u32 _BufHash(u16 parent, u16 serial, u16 page_id)
+{
+	u32 h = ((u32)parent << 16 | serial) ^ ((u32)page_id * 0x9e3779b1);
+
+	h ^= h >> 15;
+	h *= 0x2c1b3c6d;
+	h ^= h >> 12;
+
+	return h;
+}
+
+/**
+ * \brief put a buf in the hash index with its current (parent, serial, page_id)
+ * \param[in] dev uffs device
+ * \param[in] buf buffer to be indexed
+ */
+static void _HashInsert(uffs_Device *dev, uffs_Buf *buf)
+{
+	struct uffs_PageBufDescSt *pb = &dev->buf;
+	u32 i;
+
+	if (buf->hashed)
+		return;
+
+	i = _BufHash(buf->parent, buf->serial, buf->page_id) & pb->hash_mask;
+	while (pb->hash[i] != NULL)
+		i = (i + 1) & pb->hash_mask;
+
+	pb->hash[i] = buf;
+	buf->hashed = U_TRUE;
+}
+
+/**
+ * \brief remove a buf from the hash index
+ *
+ * entries after the removed one are shifted back when their probe
+ * sequence passes the freed slot, so no tombstones are needed.
+ *
+ * \param[in] dev uffs device
+ * \param[in] buf buffer to be removed, must still have the key it was inserted with
+ */
+static void _HashRemove(uffs_Device *dev, uffs_Buf *buf)
+{
+	struct uffs_PageBufDescSt *pb = &dev->buf;
+	u32 i, j, home;
+
+	if (!buf->hashed)
+		return;
+
+	i = _BufHash(buf->parent, buf->serial, buf->page_id) & pb->hash_mask;
+	while (pb->hash[i] != buf)
+		i = (i + 1) & pb->hash_mask;
+
+	for (j = (i + 1) & pb->hash_mask; pb->hash[j] != NULL; j = (j + 1) & pb->hash_mask) {
+		home = _BufHash(pb->hash[j]->parent, pb->hash[j]->serial, pb->hash[j]->page_id) & pb->hash_mask;
+		// can move to i only if i lies cyclically in [home, j)
+		if (((j - home) & pb->hash_mask) >= ((j - i) & pb->hash_mask)) {
+			pb->hash[i] = pb->hash[j];
+			i = j;
+		}
+	}
+
+	pb->hash[i] = NULL;
+	buf->hashed = U_FALSE;
+}
+
+/**
+ * \brief give a buf a new (parent, serial, page_id) and re-index it
+ */
+static void _BufSetKey(uffs_Device *dev, uffs_Buf *buf,
+					   u16 parent, u16 serial, u16 page_id)
+{
+	_HashRemove(dev, buf);
+	buf->parent = parent;
+	buf->serial = serial;
+	buf->page_id = page_id;
+	_HashInsert(dev, buf);
+}
+
+/**
+ * \brief find a non-empty buf by (parent, serial, page_id) in the hash index
+ * \return found buffer, or NULL if not found
+ */
+static uffs_Buf * _HashFind(uffs_Device *dev, u16 parent, u16 serial, u16 page_id)
+{
+	struct uffs_PageBufDescSt *pb = &dev->buf;
+	u32 i = _BufHash(parent, serial, page_id) & pb->hash_mask;
+	uffs_Buf *p;
+
+	while ((p = pb->hash[i]) != NULL) {
+		if (p->parent == parent &&
+			p->serial == serial &&
+			p->page_id == page_id &&
+			p->mark != UFFS_BUF_EMPTY)
+			return p;
+		i = (i + 1) & pb->hash_mask;
+	}
+
+	return NULL;
+}
+
+/**
+ * \brief break a buf from the clean free list
+ */
+static void _BreakFromFreeList(uffs_Device *dev, uffs_Buf *buf)
+{
+	if (!buf->in_free_list)
+		return;
+
+	if (buf->next_free)
+		buf->next_free->prev_free = buf->prev_free;
+	else
+		dev->buf.free_tail = buf->prev_free;
+
+	if (buf->prev_free)
+		buf->prev_free->next_free = buf->next_free;
+	else
+		dev->buf.free_head = buf->next_free;
+
+	buf->next_free = buf->prev_free = NULL;
+	buf->in_free_list = U_FALSE;
+}
+
+/**
+ * \brief put a buf in the clean free list head (most recently used)
+ */
+static void _LinkToFreeListHead(uffs_Device *dev, uffs_Buf *buf)
+{
+	buf->prev_free = NULL;
+	buf->next_free = dev->buf.free_head;
+
+	if (dev->buf.free_head)
+		dev->buf.free_head->prev_free = buf;
+	else
+		dev->buf.free_tail = buf;
+
+	dev->buf.free_head = buf;
+	buf->in_free_list = U_TRUE;
+}
+
+/**
+ * \brief re-check a buf after its ref_count or mark changed:
+ *	a clean (not dirty) and unreferenced buf goes to the free list head,
+ *	otherwise it is taken out of the free list.
+ */
+static void _UpdateFreeList(uffs_Device *dev, uffs_Buf *buf)
+{
+	_BreakFromFreeList(dev, buf);
+
+	if (buf->ref_count == 0 && buf->mark != UFFS_BUF_DIRTY)
+		_LinkToFreeListHead(dev, buf);
+}
+
 /**
  * \brief move a buf up to the head of buffer pool list
  * \param[in] dev uffs device
@@ -158,14 +325,16 @@ static void _LinkToBufListTail(uffs_Device *dev, uffs_Buf *buf)
  */
 static void _MoveNodeToHead(uffs_Device *dev, uffs_Buf *p)
 {
-	if (p == dev->buf.head)
-		return;
+	if (p != dev->buf.head) {
+		//break from list
+		_BreakFromBufList(dev, p);
 
-	//break from list
-	_BreakFromBufList(dev, p);
+		//link to head
+		_LinkToBufListHead(dev, p);
+	}
 
-	//link to head
-	_LinkToBufListHead(dev, p);
+	// keep the clean free list in the same (LRU) order
+	_UpdateFreeList(dev, p);
 }
 
 
@@ -206,6 +375,9 @@ static uffs_Buf * _GetFreeCloneBuf(uffs_Device *dev)
  * \param[in] dirty_buf_max maximum dirty buffer allowed,
  *				if the dirty buffer over this number,
  *				than need to be flush to flash
+ * \note dev->cfg.dirty_groups sets how many files can hold dirty pages at the same time,
+ *		0 for #MAX_DIRTY_BUF_GROUPS. it's limited to (buf_max - CLONE_BUFFERS_THRESHOLD - 1)
+ *		since every group holds at least one buffer.
  */
 URET uffs_BufInit(uffs_Device *dev, int buf_max, int dirty_buf_max)
 {
@@ -214,6 +386,7 @@ URET uffs_BufInit(uffs_Device *dev, int buf_max, int dirty_buf_max)
 	uffs_Buf *buf;
 	int size;
 	int i, slot;
+	int hash_slots;
 
 	if (!dev)
 		return U_FAIL;
@@ -228,7 +401,24 @@ URET uffs_BufInit(uffs_Device *dev, int buf_max, int dirty_buf_max)
 		return U_FAIL;
 	}
 	
-	size = (sizeof(uffs_Buf) + dev->com.pg_size) * buf_max;
+	// hash index: power of 2 slots, load factor <= 0.5
+	for (hash_slots = 1; hash_slots < 2 * buf_max; hash_slots <<= 1)
+		;
+
+	if (dev->cfg.dirty_groups <= 0)
+		dev->cfg.dirty_groups = MAX_DIRTY_BUF_GROUPS;
+	if (dev->cfg.dirty_groups > buf_max - CLONE_BUFFERS_THRESHOLD - 1) {
+		fprintf(stderr, "%d dirty groups are too many for %d buffers, use %d\n",
+				dev->cfg.dirty_groups, buf_max, buf_max - CLONE_BUFFERS_THRESHOLD - 1);
+		dev->cfg.dirty_groups = buf_max - CLONE_BUFFERS_THRESHOLD - 1;
+	}
+	if (dev->cfg.dirty_groups < 1) {
+		fprintf(stderr, "too few buffers (%d)\n", buf_max);
+		return U_FAIL;
+	}
+
+	size = (sizeof(uffs_Buf) + dev->com.pg_size) * buf_max + sizeof(uffs_Buf *) * hash_slots +
+			sizeof(struct uffs_DirtyGroupSt) * dev->cfg.dirty_groups;
 	if (dev->mem.pagebuf_pool_size == 0) {
 		if (dev->mem.malloc) {
 			dev->mem.pagebuf_pool_buf = dev->mem.malloc(dev, size);
@@ -249,7 +439,8 @@ URET uffs_BufInit(uffs_Device *dev, int buf_max, int dirty_buf_max)
 	for (i = 0; i < buf_max; i++) {
 		buf = (uffs_Buf *)((u8 *)pool + (sizeof(uffs_Buf) * i));
 		memset(buf, 0, sizeof(uffs_Buf));
-		data = (u8 *)pool + (sizeof(uffs_Buf) * buf_max) + (dev->com.pg_size * i);
+		data = (u8 *)pool + (sizeof(uffs_Buf) * buf_max) + (sizeof(uffs_Buf *) * hash_slots) +
+				(sizeof(struct uffs_DirtyGroupSt) * dev->cfg.dirty_groups) + (dev->com.pg_size * i);
 		buf->header = data;
 		buf->data = data + dev->com.header_size;
 		buf->mark = UFFS_BUF_EMPTY;
@@ -271,14 +462,23 @@ URET uffs_BufInit(uffs_Device *dev, int buf_max, int dirty_buf_max)
 		}
 	}
 
+	// the hash index and dirty groups sit between the buffer descriptors and the page data
+	dev->buf.hash = (uffs_Buf **)((u8 *)pool + (sizeof(uffs_Buf) * buf_max));
+	memset(dev->buf.hash, 0, sizeof(uffs_Buf *) * hash_slots);
+	dev->buf.hash_mask = hash_slots - 1;
+	dev->buf.dirtyGroup = (struct uffs_DirtyGroupSt *)(dev->buf.hash + hash_slots);
+
 	dev->buf.buf_max = buf_max;
 	dev->buf.dirty_buf_max = (dirty_buf_max > dev->attr->pages_per_block ?
 								dev->attr->pages_per_block : dirty_buf_max);
+	memset(&dev->buf.st, 0, sizeof(dev->buf.st));
 
-	// for (slot = 0; slot < dev->cfg.dirty_groups; slot++) {
-	// 	dev->buf.dirtyGroup[slot].dirty = NULL;
-	// 	dev->buf.dirtyGroup[slot].count = 0;
-	// }
+	for (slot = 0; slot < dev->cfg.dirty_groups; slot++) {
+		dev->buf.dirtyGroup[slot].dirty = NULL;
+		dev->buf.dirtyGroup[slot].count = 0;
+		dev->buf.dirtyGroup[slot].lock = 0;
+		dev->buf.dirtyGroup[slot].free_pages = -1;
+	}
 
 	// prepare clone buffers
 	dev->buf.clone = NULL;
@@ -288,6 +488,11 @@ URET uffs_BufInit(uffs_Device *dev, int buf_max, int dirty_buf_max)
 		_InsertToCloneBufList(dev, buf);
 	}
 
+	// all the rest are clean and free, in the same order as buffer list
+	dev->buf.free_head = dev->buf.free_tail = NULL;
+	for (buf = dev->buf.tail; buf; buf = buf->prev)
+		_LinkToFreeListHead(dev, buf);
+
 	return U_SUCC;
 }
 
@@ -298,13 +503,13 @@ URET uffs_BufFlushAll(struct uffs_DeviceSt *dev)
 {
 	int slot;
 	fprintf(stdout, "uffs_BufFlushAll called\n");
-	// for (slot = 0; slot < dev->cfg.dirty_groups; slot++) {
-	// 	if(_BufFlush(dev, FALSE, slot) != U_SUCC) {
-	// 		fprintf(stderr,
-	// 					"fail to flush buffer(slot %d)\n", slot);
-	// 		return U_FAIL;
-	// 	}
-	// }
+	for (slot = 0; slot < dev->cfg.dirty_groups; slot++) {
+		if(_BufFlush(dev, U_FALSE, slot) != U_SUCC) {
+			fprintf(stderr,
+						"fail to flush buffer(slot %d)\n", slot);
+			return U_FAIL;
+		}
+	}
 	return U_SUCC;
 }
 
@@ -347,6 +552,9 @@ URET uffs_BufReleaseAll(uffs_Device *dev)
 
 	dev->buf.pool = NULL;
 	dev->buf.head = dev->buf.tail = NULL;
+	dev->buf.hash = NULL;
+	dev->buf.dirtyGroup = NULL;
+	dev->buf.free_head = dev->buf.free_tail = NULL;
 
 	return U_SUCC;
 }
@@ -354,22 +562,29 @@ URET uffs_BufReleaseAll(uffs_Device *dev)
 // check if the buf is already in dirty list
 static UBOOL _IsBufInInDirtyList(uffs_Device *dev, int slot, uffs_Buf *buf)
 {
-	fprintf(stdout, "_IsBufInInDirtyList called\n");
-	
-	// uffs_Buf *work;
-	// work = dev->buf.dirtyGroup[slot].dirty;
-	// while (work) {
-	// 	if (work == buf) 
-	// 		return U_TRUE;
-	// 	work = work->next_dirty;
-	// }
+	uffs_Buf *work;
+
+	work = dev->buf.dirtyGroup[slot].dirty;
+	while (work) {
+		if (work == buf) 
+			return U_TRUE;
+		work = work->next_dirty;
+	}
 
 	return U_FALSE;
 }
 
+/**
+ * \brief link buf into the dirty list of group slot, keeping the list sorted by page_id
+ *
+ * pages are always programmed in ascending page_id order when a group is flushed,
+ * so keeping the list sorted here lets the flush take pages from the head in one pass.
+ */
 static void _LinkToDirtyList(uffs_Device *dev, int slot, uffs_Buf *buf)
 {
-	fprintf(stdout, "_LinkToDirtyList called\n");
+	struct uffs_DirtyGroupSt *group = &dev->buf.dirtyGroup[slot];
+	uffs_Buf *prev = NULL;
+	uffs_Buf *work;
 
 	if (buf == NULL) {
 		fprintf(stderr,
@@ -377,21 +592,52 @@ static void _LinkToDirtyList(uffs_Device *dev, int slot, uffs_Buf *buf)
 		return;
 	}
 
-	// buf->mark = UFFS_BUF_DIRTY;
-	// buf->prev_dirty = NULL;
-	// buf->next_dirty = dev->buf.dirtyGroup[slot].dirty;
+	buf->mark = UFFS_BUF_DIRTY;
 
-	// if (dev->buf.dirtyGroup[slot].dirty) 
-	// 	dev->buf.dirtyGroup[slot].dirty->prev_dirty = buf;
+	if (group->dirty == NULL)
+		group->free_pages = -1;		// the slot may belong to another file now
 
-	// dev->buf.dirtyGroup[slot].dirty = buf;
-	// dev->buf.dirtyGroup[slot].count++;
+	work = group->dirty;
+	while (work && work->page_id < buf->page_id) {
+		prev = work;
+		work = work->next_dirty;
+	}
+
+	buf->prev_dirty = prev;
+	buf->next_dirty = work;
+
+	if (work) 
+		work->prev_dirty = buf;
+
+	if (prev)
+		prev->next_dirty = buf;
+	else
+		group->dirty = buf;
+
+	group->count++;
+
+	// a dirty buf can't be reused until it's flushed
+	_UpdateFreeList(dev, buf);
 }
 
+/**
+ * \brief find a clean unreferenced buf to reuse, least recently used first
+ *
+ * the victim is the clean free list tail, O(1). buffers referenced by
+ * uffs_BufIncRef() (no dev to update the list) may still sit in the list;
+ * they are dropped here. if the list runs empty, fall back to searching
+ * the buffer list, which also covers uffs_BufDecRef().
+ */
 static uffs_Buf * _FindFreeBuf(uffs_Device *dev)
 {
 	uffs_Buf *buf;
 
+	while ((buf = dev->buf.free_tail) != NULL) {
+		if (buf->ref_count == 0 && buf->mark != UFFS_BUF_DIRTY)
+			return buf;
+		_BreakFromFreeList(dev, buf);
+	}
+
 #if 0
 	buf = dev->buf.head;
 	while (buf) {
@@ -459,20 +705,13 @@ uffs_Buf * uffs_BufFind(uffs_Device *dev,
 {
 	uffs_Buf *p = dev->buf.head;
 
+	if (page_id != UFFS_ALL_PAGES)
+		return _HashFind(dev, parent, serial, page_id);
+
 	return uffs_BufFindFrom(dev, p, parent, serial, page_id);
 }
 
 
-static uffs_Buf * _FindBufInDirtyList(uffs_Buf *dirty, u16 page_id)
-{
-	while(dirty) {
-		if (dirty->page_id == page_id) 
-			return dirty;
-		dirty = dirty->next_dirty;
-	}
-	return NULL;
-}
-
 static URET _BreakFromDirty(uffs_Device *dev, uffs_Buf *dirtyBuf)
 {
 	int slot = -1;
@@ -498,14 +737,14 @@ static URET _BreakFromDirty(uffs_Device *dev, uffs_Buf *dirtyBuf)
 		dirtyBuf->prev_dirty->next_dirty = dirtyBuf->next_dirty;
 	}
 
-	// // check if it's the link head ...
-	// if (dev->buf.dirtyGroup[slot].dirty == dirtyBuf) {
-	// 	dev->buf.dirtyGroup[slot].dirty = dirtyBuf->next_dirty;
-	// }
+	// check if it's the link head ...
+	if (dev->buf.dirtyGroup[slot].dirty == dirtyBuf) {
+		dev->buf.dirtyGroup[slot].dirty = dirtyBuf->next_dirty;
+	}
 
 	dirtyBuf->next_dirty = dirtyBuf->prev_dirty = NULL; // clear dirty link
 
-	// dev->buf.dirtyGroup[slot].count--;
+	dev->buf.dirtyGroup[slot].count--;
 
 	return U_SUCC;
 }
@@ -531,6 +770,7 @@ static URET _CheckDirtyList(uffs_Buf *dirty)
 {
 	u16 parent;
 	u16 serial;
+	u16 page_id;
 
 	if (dirty == NULL) {
 		return U_SUCC;
@@ -538,6 +778,7 @@ static URET _CheckDirtyList(uffs_Buf *dirty)
 
 	parent = dirty->parent;
 	serial = dirty->serial;
+	page_id = dirty->page_id;
 	dirty = dirty->next_dirty;
 
 	while (dirty) {
@@ -552,34 +793,17 @@ static URET _CheckDirtyList(uffs_Buf *dirty)
 					"non-dirty page buffer in dirty buffer list ?\n");
 			return U_FAIL;
 		}
+		if (dirty->page_id <= page_id) {
+			fprintf(stderr,
+					"dirty buffer list is not sorted by page_id ?\n");
+			return U_FAIL;
+		}
+		page_id = dirty->page_id;
 		dirty = dirty->next_dirty;
 	}
 	return U_SUCC;
 }
 
-/** find a page in dirty list, which has minimum page_id */
-uffs_Buf * _FindMinimunPageIdFromDirtyList(uffs_Buf *dirtyList)
-{
-	uffs_Buf * work = dirtyList;
-	uffs_Buf * buf = dirtyList;
-
-	if (buf) {
-		work = work->next_dirty;
-		while (work) {
-			if (work->page_id < buf->page_id)
-				buf = work;
-			work = work->next_dirty;
-		}
-
-		// uffs_Assert(buf->mark == UFFS_BUF_DIRTY, 
-		// 			"buf (serial = %d, parent = %d, page_id = %d, type = %d) in dirty list but mark is 0x%x ?",
-		// 			buf->serial, buf->parent, buf->page_id, buf->type, buf->mark);
-	}
-
-	return buf;
-}
-
-
 /** 
  * \brief flush buffer with block recover
  *
@@ -604,6 +828,7 @@ static URET uffs_BufFlush_Exist_With_BlockRecover(
 	u8 type, timeStamp;
 	u16 page, parent, serial;
 	uffs_Buf *buf;
+	uffs_Buf *dirty;			// next dirty page to write, walks the sorted dirty list once
 	TreeNode *newNode;
 	uffs_BlockInfo *newBc;
 	uffs_Tags *tag, *oldTag;
@@ -616,9 +841,9 @@ static URET uffs_BufFlush_Exist_With_BlockRecover(
 
 	UBOOL useCloneBuf;
 
-	// type = dev->buf.dirtyGroup[slot].dirty->type;
-	// parent = dev->buf.dirtyGroup[slot].dirty->parent;
-	// serial = dev->buf.dirtyGroup[slot].dirty->serial;
+	type = dev->buf.dirtyGroup[slot].dirty->type;
+	parent = dev->buf.dirtyGroup[slot].dirty->parent;
+	serial = dev->buf.dirtyGroup[slot].dirty->serial;
 
 retry:
 	uffs_BlockInfoLoad(dev, bc, UFFS_ALL_PAGES);
@@ -658,6 +883,7 @@ retry:
 //	fprintf(stderr, "Flush buffers with Block Recover, from %d to %d", 
 //					bc->block, newBc->block);
 
+	dirty = dev->buf.dirtyGroup[slot].dirty;
 	for (i = 0; i < dev->attr->pages_per_block; i++) {
 		tag = GET_TAG(newBc, i);
 		TAG_DIRTY_BIT(tag) = TAG_DIRTY;
@@ -669,8 +895,14 @@ retry:
 		TAG_PAGE_ID(tag) = i;	// now, page_id = page.
 
 		SEAL_TAG(tag);
+		uffs_BlockInfoMapPage(dev, newBc, i);
 		
-		buf = _FindBufInDirtyList(dev->buf.dirtyGroup[slot].dirty, i);
+		// dirty list is sorted by page_id, so page i is either at the cursor or not dirty
+		buf = NULL;
+		if (dirty != NULL && dirty->page_id == i) {
+			buf = dirty;
+			dirty = dirty->next_dirty;
+		}
 		if (buf != NULL) {
 			if (i == 0)
 				data_sum = _GetDirOrFileNameSum(dev, buf);
@@ -692,6 +924,7 @@ retry:
 
 				if (buf->data_len > 0) {
 					flash_op_new = uffs_FlashWritePageCombine(dev, newBlock, i, buf, tag);
+					dev->buf.st.page_writes++;
 				}
 				else {
 					// data_len == 0, no I/O needed.
@@ -702,6 +935,7 @@ retry:
 			}
 			else {
 				flash_op_new = uffs_FlashWritePageCombine(dev, newBlock, i, buf, tag);
+				dev->buf.st.page_writes++;
 			}
 		}
 		else {
@@ -774,6 +1008,8 @@ retry:
 				data_sum = _GetDirOrFileNameSum(dev, buf);
 
 			flash_op_new = uffs_FlashWritePageCombine(dev, newBlock, i, buf, tag);
+			dev->buf.st.page_writes++;
+			dev->buf.st.copied_pages++;
 
 			if (buf) {
 				if (useCloneBuf)
@@ -841,16 +1077,15 @@ retry:
 
 	if (succRecover == U_TRUE) {
 		// now it's time to clean the dirty buffers
-		for (i = 0; i < dev->attr->pages_per_block; i++) {
-			buf = _FindBufInDirtyList(dev->buf.dirtyGroup[slot].dirty, i);
-			if (buf) {
-				if (_BreakFromDirty(dev, buf) == U_SUCC) {
-					buf->mark = UFFS_BUF_VALID;
-					buf->ext_mark &= ~UFFS_BUF_EXT_MARK_TRUNC_TAIL;
-					_MoveNodeToHead(dev, buf);
-				}
-			}
+		while ((buf = dev->buf.dirtyGroup[slot].dirty) != NULL) {
+			if (_BreakFromDirty(dev, buf) != U_SUCC)
+				break;
+			buf->mark = UFFS_BUF_VALID;
+			buf->ext_mark &= ~UFFS_BUF_EXT_MARK_TRUNC_TAIL;
+			_MoveNodeToHead(dev, buf);
+			dev->buf.st.flushed_pages++;
 		}
+		dev->buf.st.block_recovers++;
 
 		// swap the old block node and new block node.
 		// it's important that we 'swap' the block and keep the node unchanged
@@ -973,6 +1208,11 @@ ext:
  * \brief flush buffer to a block with enough free pages 
  *  
  *  pages in dirty list must be sorted by page_id to write to flash
+ *
+ *  with partial, the block may have fewer free pages than dirty pages:
+ *  the free pages are filled from the lowest page_id, and the rest stay
+ *  in the dirty list until the group is flushed again (by block recover,
+ *  since the block is full then).
  */
 static
 URET
@@ -980,7 +1220,8 @@ URET
 		uffs_Device *dev,
 		int slot,			//!< dirty group slot
 		TreeNode *node,		//!< tree node
-		uffs_BlockInfo *bc	//!< block info (Source, also destination)
+		uffs_BlockInfo *bc,	//!< block info (Source, also destination)
+		UBOOL partial		//!< U_TRUE: it's ok to leave dirty pages when the block is full
 		)		
 {
 	u16 page;
@@ -1004,10 +1245,14 @@ URET
 				break;
 		}
 
-		if (!uffs_Assert(page < dev->attr->pages_per_block, "no free page? buf flush not finished."))
+		if (page >= dev->attr->pages_per_block) {
+			if (!partial)
+				uffs_Assert(U_FALSE, "no free page? buf flush not finished.");
 			break;
+		}
 
-		buf = _FindMinimunPageIdFromDirtyList(dev->buf.dirtyGroup[slot].dirty);
+		// the head of the sorted dirty list has the minimum page_id
+		buf = dev->buf.dirtyGroup[slot].dirty;
 		if (buf == NULL) {
 			fprintf(stderr,
 						"count > 0, but no dirty pages in list ?\n");
@@ -1026,8 +1271,10 @@ URET
 		TAG_PAGE_ID(tag) = buf->page_id;
 
 		SEAL_TAG(tag);
+		uffs_BlockInfoMapPage(dev, bc, page);
 
 		x = uffs_FlashWritePageCombine(dev, bc->block, page, buf, tag);
+		dev->buf.st.page_writes++;
 		if (x == UFFS_FLASH_IO_ERR) {
 			fprintf(stderr, "I/O error <1>?\n");
 			goto ext;
@@ -1042,34 +1289,96 @@ URET
 			if(_BreakFromDirty(dev, buf) == U_SUCC) {
 				buf->mark = UFFS_BUF_VALID;
 				_MoveNodeToHead(dev, buf);
+				dev->buf.st.flushed_pages++;
 			}
 		}
 	} //end of for
 	
-	if (dev->buf.dirtyGroup[slot].dirty != NULL ||
-			dev->buf.dirtyGroup[slot].count != 0) {
-		fprintf(stderr, "still has dirty buffer ?\n");
+	if (dev->buf.dirtyGroup[slot].dirty == NULL &&
+			dev->buf.dirtyGroup[slot].count == 0) {
+		dev->buf.st.appends++;
+		ret = U_SUCC;
 	}
-	else {
+	else if (partial) {
+		dev->buf.st.appends++;
+		dev->buf.st.partial_appends++;
 		ret = U_SUCC;
 	}
+	else {
+		fprintf(stderr, "still has dirty buffer ?\n");
+	}
 
 ext:
 	return ret;
 }
 
 
-URET _BufFlush(struct uffs_DeviceSt *dev,
-			   UBOOL force_block_recover, int slot)
+/**
+ * \brief find the tree node and block which a dirty group belongs to
+ * \param[in] dev uffs device
+ * \param[in] slot dirty group slot
+ * \param[out] node tree node, NULL if the group doesn't have a block yet
+ * \param[out] block block number of the node
+ */
+static URET _FindGroupBlock(struct uffs_DeviceSt *dev, int slot, TreeNode **node, int *block)
+{
+	uffs_Buf *dirty = dev->buf.dirtyGroup[slot].dirty;
+
+	switch (dirty->type) {
+	case UFFS_TYPE_DIR:
+		*node = uffs_TreeFindDirNode(dev, dirty->serial);
+		break;
+	case UFFS_TYPE_FILE:
+		*node = uffs_TreeFindFileNode(dev, dirty->serial);
+		break;
+	case UFFS_TYPE_DATA:
+		*node = uffs_TreeFindDataNode(dev, dirty->parent, dirty->serial);
+		break;
+	default:
+		fprintf(stderr, "unknown type\n");
+		return U_FAIL;
+	}
+
+	if (*node == NULL)
+		return U_SUCC;
+
+	switch (dirty->type) {
+	case UFFS_TYPE_DIR:
+		*block = (*node)->u.dir.block;
+		break;
+	case UFFS_TYPE_FILE:
+		*block = (*node)->u.file.block;
+		break;
+	default:
+		*block = (*node)->u.data.block;
+		break;
+	}
+
+	return U_SUCC;
+}
+
+/**
+ * \brief flush a dirty group
+ *
+ * dirty pages go to the free pages of the group's block when they fit.
+ * otherwise the block is recovered: valid pages and dirty pages are copied
+ * to a new block and the old one is erased.
+ *
+ * \param[in] dev uffs device
+ * \param[in] force_block_recover #U_TRUE: recover the block even if there are enough free pages
+ * \param[in] slot dirty group slot
+ * \param[in] partial #U_TRUE: the caller only needs some buffers back. if the block has
+ *				some free pages but not enough, fill them and leave the rest dirty,
+ *				so the block is recovered only when it's full.
+ */
+static URET _BufFlushSlot(struct uffs_DeviceSt *dev,
+			   UBOOL force_block_recover, int slot, UBOOL partial)
 {
 	uffs_Buf *dirty;
 	TreeNode *node;
 	uffs_BlockInfo *bc;
 	u16 n;
 	URET ret;
-	u8 type;
-	u16 parent;
-	u16 serial;
 	int block;
 	
 	if (dev->buf.dirtyGroup[slot].count == 0) {
@@ -1081,44 +1390,17 @@ URET _BufFlush(struct uffs_DeviceSt *dev,
 	if (_CheckDirtyList(dirty) == U_FAIL)
 		return U_FAIL;
 
-	type = dirty->type;
-	parent = dirty->parent;
-	serial = dirty->serial;
-
-	switch (type) {
-	case UFFS_TYPE_DIR:
-		node = uffs_TreeFindDirNode(dev, serial);
-		break;
-	case UFFS_TYPE_FILE:
-		node = uffs_TreeFindFileNode(dev, serial);
-		break;
-	case UFFS_TYPE_DATA:
-		node = uffs_TreeFindDataNode(dev, parent, serial);
-		break;
-	default:
-		fprintf(stderr, "unknown type\n");
+	if (_FindGroupBlock(dev, slot, &node, &block) != U_SUCC)
 		return U_FAIL;
-	}
+
+	// the block changes, counted again when the group is considered for reclaim
+	dev->buf.dirtyGroup[slot].free_pages = -1;
 
 	if (node == NULL) {
 		//not found in the tree, need to generate a new block
 		ret = _BufFlush_NewBlock(dev, slot);
 	}
 	else {
-		switch (type) {
-		case UFFS_TYPE_DIR:
-			block = node->u.dir.block;
-			break;
-		case UFFS_TYPE_FILE:
-			block = node->u.file.block;
-			break;
-		case UFFS_TYPE_DATA:
-			block = node->u.data.block;
-			break;
-		default:
-			fprintf(stderr, "unknown type.\n");
-			return U_FAIL;
-		}
 		bc = uffs_BlockInfoGet(dev, block);
 		if(bc == NULL) {
 			fprintf(stderr, "get block info fail.\n");
@@ -1130,9 +1412,15 @@ URET _BufFlush(struct uffs_DeviceSt *dev,
 
 			n = uffs_GetFreePagesCount(dev, bc);
 
-			if (n >= dev->buf.dirtyGroup[slot].count && !force_block_recover) {
-				//The free pages are enough for the dirty pages
-				ret = uffs_BufFlush_Exist_With_Enough_FreePage(dev,	slot, node, bc);
+			if (!force_block_recover &&
+					(n >= dev->buf.dirtyGroup[slot].count || (partial && n > 0))) {
+				//The free pages are enough for the dirty pages, or for some of them
+				ret = uffs_BufFlush_Exist_With_Enough_FreePage(dev,	slot, node, bc, partial);
+				if (ret == U_SUCC) {
+					// tags of the appended pages are in bc already
+					dev->buf.dirtyGroup[slot].free_pages = uffs_GetFreePagesCount(dev, bc);
+					dev->buf.dirtyGroup[slot].free_block = block;
+				}
 			}
 			else {
 				ret = uffs_BufFlush_Exist_With_BlockRecover(dev, slot, node, bc, U_FALSE);
@@ -1144,6 +1432,99 @@ URET _BufFlush(struct uffs_DeviceSt *dev,
 	return ret;
 }
 
+URET _BufFlush(struct uffs_DeviceSt *dev,
+			   UBOOL force_block_recover, int slot)
+{
+	return _BufFlushSlot(dev, force_block_recover, slot, U_FALSE);
+}
+
+/**
+ * \brief will flushing the group need a block recover (block copy) ?
+ *
+ * the free pages of the group's block are counted once and kept in the group
+ * until the group is flushed, so picking a group to reclaim doesn't load the
+ * spares of every group's block each time page buffers run out.
+ * it's only a hint, _BufFlushSlot() counts the free pages again.
+ */
+static UBOOL _GroupNeedsBlockRecover(struct uffs_DeviceSt *dev, int slot)
+{
+	struct uffs_DirtyGroupSt *group = &dev->buf.dirtyGroup[slot];
+	TreeNode *node;
+	uffs_BlockInfo *bc;
+	int block;
+
+	if (_FindGroupBlock(dev, slot, &node, &block) != U_SUCC)
+		return U_TRUE;
+
+	if (node == NULL)
+		return U_FALSE;		// goes to a new block, only dirty pages are written
+
+	if (group->free_pages < 0 || group->free_block != block) {
+		bc = uffs_BlockInfoGet(dev, block);
+		if (bc == NULL)
+			return U_TRUE;
+
+		if (uffs_BlockInfoLoad(dev, bc, UFFS_ALL_PAGES) == U_SUCC) {
+			group->free_pages = uffs_GetFreePagesCount(dev, bc);
+			group->free_block = block;
+		}
+		uffs_BlockInfoPut(dev, bc);
+
+		if (group->free_pages < 0)
+			return U_TRUE;
+	}
+
+	return (group->free_pages == 0 ? U_TRUE : U_FALSE);
+}
+
+/**
+ * \brief pick a dirty group to flush when page buffers run out
+ *
+ * groups which can be flushed into free pages (or a new block) go first.
+ * a group whose block is full needs a block recover, it's left to collect
+ * more dirty pages so that the block copy absorbs as many updates as
+ * possible, and only picked when every group needs a recover.
+ * the most dirty group of the chosen kind is returned.
+ */
+static int _FindGroupToReclaim(struct uffs_DeviceSt *dev)
+{
+	struct uffs_DirtyGroupSt *group;
+	int i, slot = -1, recover_slot = -1;
+	int max_count = 0, recover_max_count = 0;
+
+	for (i = 0; i < dev->cfg.dirty_groups; i++) {
+		group = &dev->buf.dirtyGroup[i];
+		if (group->dirty == NULL || group->lock != 0)
+			continue;
+
+		if (_GroupNeedsBlockRecover(dev, i)) {
+			if (group->count > recover_max_count) {
+				recover_max_count = group->count;
+				recover_slot = i;
+			}
+		}
+		else if (group->count > max_count) {
+			max_count = group->count;
+			slot = i;
+		}
+	}
+
+	return (slot >= 0 ? slot : recover_slot);
+}
+
+/** flush (part of) a dirty group to get page buffers back */
+static URET _BufReclaim(struct uffs_DeviceSt *dev)
+{
+	int slot;
+
+	slot = _FindGroupToReclaim(dev);
+	if (slot >= 0) {
+		dev->buf.st.reclaims++;
+		return _BufFlushSlot(dev, U_FALSE, slot, U_TRUE);
+	}
+	return U_SUCC;
+}
+
 static int _FindMostDirtyGroup(struct uffs_DeviceSt *dev)
 {
 	int i, slot = -1;
@@ -1406,7 +1787,7 @@ uffs_Buf *uffs_BufNew(struct uffs_DeviceSt *dev,
 
 	buf = _FindFreeBuf(dev);
 	if (buf == NULL) {
-		uffs_BufFlushMostDirtyGroup(dev);
+		_BufReclaim(dev);
 		buf = _FindFreeBuf(dev);
 		if (buf == NULL) {
 			fprintf(stderr, "no free page buf!\n");
@@ -1416,9 +1797,7 @@ uffs_Buf *uffs_BufNew(struct uffs_DeviceSt *dev,
 
 	buf->mark = UFFS_BUF_EMPTY;
 	buf->type = type;
-	buf->parent = parent;
-	buf->serial = serial;
-	buf->page_id = page_id;
+	_BufSetKey(dev, buf, parent, serial, page_id);
 	buf->data_len = 0;
 	buf->ref_count++;
 	memset(buf->data, 0xff, dev->com.pg_data_size);
@@ -1473,19 +1852,20 @@ uffs_Buf *uffs_BufGetEx(struct uffs_DeviceSt *dev,
 	buf = uffs_BufFind(dev, parent, serial, page_id);
 	if (buf) {
 		buf->ref_count++;
+		_UpdateFreeList(dev, buf);
 		return buf;
 	}
 
 	buf = _FindFreeBuf(dev);
 	if (buf == NULL) {
-		uffs_BufFlushMostDirtyGroup(dev);
+		_BufReclaim(dev);
 		buf = _FindFreeBuf(dev);
 		if (buf == NULL) {
 			fprintf(stderr, "no free page buf!\n");
 			return NULL;
 		}
 
-		/* Note: if uffs_BufFlushMostDirtyGroup() flush the same block as we'll write to,
+		/* Note: if _BufReclaim() flush the same block as we'll write to,
 		 *	the block will be changed to a new one! (and the content of 'node' is changed).
 		 *	So here we need to update block number from the new 'node'.
 		 */
@@ -1525,9 +1905,7 @@ uffs_Buf *uffs_BufGetEx(struct uffs_DeviceSt *dev,
 
 	buf->mark = UFFS_BUF_EMPTY;
 	buf->type = type;
-	buf->parent = parent;
-	buf->serial = serial;
-	buf->page_id = page_id;
+	_BufSetKey(dev, buf, parent, serial, page_id);
 
 	ret = uffs_FlashReadPage(dev, block, page, buf, oflag & UO_NOECC ? U_TRUE : U_FALSE);
 
@@ -1576,6 +1954,8 @@ URET uffs_BufPut(uffs_Device *dev, uffs_Buf *buf)
 	}
 	else {
 		buf->ref_count--;
+		if (buf->ref_count == 0)
+			_UpdateFreeList(dev, buf);
 		ret = U_SUCC;
 	}
 
@@ -1683,12 +2063,18 @@ URET uffs_BufSetAllEmpty(struct uffs_DeviceSt *dev)
 
 	while (buf) {
 		buf->mark = UFFS_BUF_EMPTY;
+		_HashRemove(dev, buf);
+		_UpdateFreeList(dev, buf);
 		buf = buf->next;
 	}
 	return U_SUCC;
 }
 
 
+/**
+ * \note no dev here to update the clean free list, _FindFreeBuf() skips
+ *	referenced buffers and searches the buffer list when the free list is empty.
+ */
 void uffs_BufIncRef(uffs_Buf *buf)
 {
 	buf->ref_count++;
@@ -1709,6 +2095,8 @@ void uffs_BufMarkEmpty(uffs_Device *dev, uffs_Buf *buf)
 			if (buf->mark == UFFS_BUF_DIRTY)
 				_BreakFromDirty(dev, buf);
 			buf->mark = UFFS_BUF_EMPTY;
+			_HashRemove(dev, buf);
+			_UpdateFreeList(dev, buf);
 		}
 	}
 }
@@ -1770,7 +2158,8 @@ URET uffs_BufWrite(struct uffs_DeviceSt *dev,
 	}
 
 	if (dev->buf.dirtyGroup[slot].count >= dev->buf.dirty_buf_max) {
-		if (uffs_BufFlushGroup(dev, buf->parent, buf->serial) != U_SUCC) {
+		// append what the block can take, recover the block only when it's full
+		if (_BufFlushSlot(dev, U_FALSE, slot, U_TRUE) != U_SUCC) {
 			return U_FAIL;
 		}
 	}
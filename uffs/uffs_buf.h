@@ -64,6 +64,10 @@ struct uffs_BufSt{
 	struct uffs_BufSt *prev;			//!< link to previous buffer
 	struct uffs_BufSt *next_dirty;		//!< link to next dirty buffer
 	struct uffs_BufSt *prev_dirty;		//!< link to previous dirty buffer
+	struct uffs_BufSt *next_free;		//!< link to next clean free buffer
+	struct uffs_BufSt *prev_free;		//!< link to previous clean free buffer
+	u8 hashed;							//!< U_TRUE if the buffer is in the (parent, serial, page_id) hash index
+	u8 in_free_list;					//!< U_TRUE if the buffer is in the clean free list
 	u8 type;							//!< #UFFS_TYPE_DIR or #UFFS_TYPE_FILE or #UFFS_TYPE_DATA
 	u8 ext_mark;						//!< extension mark. 
 	u16 parent;							//!< parent serial
@@ -79,6 +83,13 @@ struct uffs_BufSt{
 
 #define uffs_BufIsFree(buf) (buf->ref_count == 0 ? U_TRUE : U_FALSE)
 
+/**
+ * \def UFFS_BUF_HASH_SLOTS_MAX
+ * \brief upper bound of hash index slots for n page buffers.
+ *	the index uses the smallest power of 2 >= 2 * n, which is always < 4 * n.
+ */
+#define UFFS_BUF_HASH_SLOTS_MAX(n)	(4 * (n))
+
 /** initialize page buffers */
 URET uffs_BufInit(struct uffs_DeviceSt *dev, int buf_max, int dirty_buf_max);
 
@@ -161,6 +172,11 @@ uffs_Buf * uffs_BufClone(struct uffs_DeviceSt *dev, uffs_Buf *buf);
 /** release a cloned page buffer, call in pair with #uffs_BufClone */
 URET uffs_BufFreeClone(uffs_Device *dev, uffs_Buf *buf);
 
+struct uffs_BufStatSt;
+
+/** get the flush counters */
+void uffs_BufGetStat(struct uffs_DeviceSt *dev, struct uffs_BufStatSt *st);
+
 /** showing page buffers info, for debug only */
 void uffs_BufInspect(uffs_Device *dev);
 
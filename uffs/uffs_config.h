@@ -59,16 +59,23 @@
  * \def MAX_CACHED_BLOCK_INFO
  * \note uffs cache the block info for opened directories and files,
  *       a practical value is 5 ~ MAX_OBJECT_HANDLE
+ * \note cached block info is found by a hash index on block number.
  */
+#ifndef MAX_CACHED_BLOCK_INFO
 #define MAX_CACHED_BLOCK_INFO	50
+#endif
 
 /** 
  * \def MAX_PAGE_BUFFERS
  * \note the bigger value will bring better read/write performance.
  *       but few writing performance will be improved when this 
  *       value is become larger than 'max pages per block'
+ * \note buffer lookup and victim selection are O(1) (hash index and clean free list),
+ *       so this can be raised well beyond 40, e.g. -DMAX_PAGE_BUFFERS=1024 for server use.
  */
+#ifndef MAX_PAGE_BUFFERS
 #define MAX_PAGE_BUFFERS		40
+#endif
 
 
 /** 
@@ -104,6 +111,17 @@
  */
 #define MAX_DIRTY_PAGES_IN_A_BLOCK	32
 
+/**
+ * \def MAX_DIRTY_BUF_GROUPS
+ * \note default number of dirty groups, used when dev->cfg.dirty_groups is 0.
+ *       each file being written holds one group until it is flushed, so set
+ *       dev->cfg.dirty_groups to the number of files written concurrently.
+ *       UFFS_PAGE_BUFFER_SIZE() reserves room for this many groups.
+ */
+#ifndef MAX_DIRTY_BUF_GROUPS
+#define MAX_DIRTY_BUF_GROUPS	3
+#endif
+
 /**
  * \def CONFIG_ENABLE_UFFS_DEBUG_MSG
  * \note Enable debug message output. You must call uffs_InitDebugMessageOutput()
@@ -257,8 +275,9 @@
 			(											\
 				(										\
 					sizeof(uffs_BlockInfo) +			\
-					sizeof(uffs_PageSpare) * n_pages_per_block \
-				 ) * MAX_CACHED_BLOCK_INFO				\
+					(sizeof(uffs_PageSpare) + sizeof(u16)) * n_pages_per_block \
+				 ) * MAX_CACHED_BLOCK_INFO +			\
+				sizeof(uffs_BlockInfo *) * UFFS_BLOCKINFO_HASH_SLOTS_MAX(MAX_CACHED_BLOCK_INFO) \
 			)
 
 /**
@@ -269,7 +288,9 @@
 			(								\
 				(							\
 					sizeof(uffs_Buf) + n_page_size	\
-				) * MAX_PAGE_BUFFERS		\
+				) * MAX_PAGE_BUFFERS +		\
+				sizeof(uffs_Buf *) * UFFS_BUF_HASH_SLOTS_MAX(MAX_PAGE_BUFFERS) + \
+				sizeof(struct uffs_DirtyGroupSt) * MAX_DIRTY_BUF_GROUPS \
 			)
 
 /**
@@ -301,6 +322,10 @@
 #error "MAX_PAGE_BUFFERS is too small"
 #endif
 
+#if (MAX_DIRTY_BUF_GROUPS < 1)
+#error "MAX_DIRTY_BUF_GROUPS should >= 1"
+#endif
+
 #if (MAX_DIRTY_PAGES_IN_A_BLOCK < 2)
 #error "MAX_DIRTY_PAGES_IN_A_BLOCK should >= 2"
 #endif
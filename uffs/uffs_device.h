@@ -1,6 +1,7 @@
 #ifndef UFFS_DEVICE_H
 #define UFFS_DEVICE_H
 
+#include "uffs_config.h"
 #include "uffs_types.h"
 #include "uffs_buf.h"
 #include "uffs_pool.h"
@@ -9,10 +10,25 @@
 #include "uffs_core.h"
 #include "uffs_flash.h"
 
-// /**
-//  * \def MAX_DIRTY_BUF_GROUPS
-//  */
-// #define MAX_DIRTY_BUF_GROUPS    3
+/** 
+ * \struct uffs_DirtyGroupSt
+ * \brief dirty pages of one file block (same parent and serial)
+ */
+struct uffs_DirtyGroupSt {
+	int count;				//!< number of dirty pages in the list
+	int lock;				//!< lock count, a locked group is not picked for flushing
+	uffs_Buf *dirty;		//!< dirty pages, sorted by page_id in ascending order
+	int free_pages;			//!< free pages left in the group's block, -1: not counted yet
+	u16 free_block;			//!< the block free_pages was counted on
+};
+
+/** 
+ * \struct uffs_ConfigSt
+ * \brief run time configuration, set before uffs_BufInit()
+ */
+struct uffs_ConfigSt {
+	int dirty_groups;		//!< number of dirty groups, one per file written concurrently. 0: #MAX_DIRTY_BUF_GROUPS
+};
 
 /** 
  * \struct uffs_PartitionSt
@@ -23,6 +39,51 @@ struct uffs_PartitionSt {
 	u16 end;		//!< end block number of partition
 };
 
+/** 
+ * \struct uffs_BlockInfoCacheSt
+ * \brief block information structure, used to manager block information caches
+ */
+struct uffs_BlockInfoCacheSt {
+	uffs_BlockInfo *head;			//!< most recently used block info
+	uffs_BlockInfo *tail;			//!< least recently used block info, reused first
+	uffs_BlockInfo **hash;			//!< open addressing index on block, linear probing
+	int hash_mask;					//!< number of hash slots - 1 (power of 2, at least 2 * cached blocks)
+	void *mem_pool;					//!< internal memory pool, used for release whole buffer
+};
+
+/** 
+ * \struct uffs_BufStatSt
+ * \brief page buffer flush counters.
+ *	write amplification of buffered writes is page_writes / flushed_pages.
+ */
+struct uffs_BufStatSt {
+	u32 flushed_pages;		//!< dirty pages written out
+	u32 page_writes;		//!< pages programmed by buffer flushes, including copied pages
+	u32 copied_pages;		//!< unchanged pages copied to a new block by block recover
+	u32 block_recovers;		//!< block recovers done (one block copy and one erase each)
+	u32 appends;			//!< flushes into free pages of the existing block
+	u32 partial_appends;	//!< appends which filled the block and left dirty pages for a later recover
+	u32 reclaims;			//!< groups flushed because page buffers ran out
+};
+
+/** 
+ * \struct uffs_PendingBlockSt
+ * \brief Pending block descriptor
+ */
+struct uffs_PendingBlockSt {
+	u16 block;			//!< pending block number
+	u8 mark;			//!< pending block mark, #UFFS_PENDING_BLK_REFRESH|RECOVER|MARKBAD
+};
+
+/** 
+ * \struct uffs_PendingListSt
+ * \brief blocks waiting for refresh, recover or being marked bad
+ */
+struct uffs_PendingListSt {
+	int count;			//!< pending block count
+	struct uffs_PendingBlockSt list[CONFIG_MAX_PENDING_BLOCKS];	//!< pending block list
+};
+
 /** 
  * \struct uffs_PageBufDescSt
  * \brief uffs page buffers descriptor
@@ -31,9 +92,14 @@ struct uffs_PageBufDescSt {
 	uffs_Buf *head;			//!< head of buffers (double linked list)
 	uffs_Buf *tail;			//!< tail of buffers (double linked list)
 	uffs_Buf *clone;		//!< head of clone buffers (single linked list)
-	// struct uffs_DirtyGroupSt dirtyGroup[MAX_DIRTY_BUF_GROUPS];	//!< dirty buffer groups
+	uffs_Buf **hash;		//!< open addressing index on (parent, serial, page_id), linear probing
+	int hash_mask;			//!< number of hash slots - 1 (power of 2, at least 2 * buf_max)
+	uffs_Buf *free_head;	//!< clean free buffers (ref_count == 0 and not dirty), most recently used first
+	uffs_Buf *free_tail;	//!< least recently used clean free buffer, the next victim
+	struct uffs_DirtyGroupSt *dirtyGroup;	//!< dirty buffer groups, dev->cfg.dirty_groups of them
 	int buf_max;			//!< maximum buffers
 	int dirty_buf_max;		//!< maximum dirty buffer allowed
+	struct uffs_BufStatSt st;	//!< flush counters
 	void *pool;				//!< memory pool for buffers
 };
 
@@ -62,10 +128,13 @@ struct uffs_DeviceSt {
 
 	struct uffs_StorageAttrSt		*attr;		//!< storage attribute
 	struct uffs_PartitionSt			par;		//!< partition information
-	// struct uffs_FlashOpsSt			*ops;		//!< flash operations
+	struct uffs_ConfigSt			cfg;		//!< run time configuration
+	struct uffs_BlockInfoCacheSt	bc;			//!< block info cache
+	struct uffs_FlashOpsSt			*ops;		//!< flash operations
 	struct uffs_PageBufDescSt		buf;		//!< page buffers
 	struct uffs_PageCommInfoSt		com;		//!< common information
 	struct uffs_TreeSt				tree;		//!< tree list of block
+	struct uffs_PendingListSt		pending;	//!< pending block list, to be recover/mark 'bad'/refresh
 	// struct uffs_FlashStatSt			st;			//!< statistic (counters)
 	struct uffs_memAllocatorSt		mem;		//!< uffs memory allocator
 	u32	ref_count;								//!< device reference count
@@ -0,0 +1,167 @@
+/*
+  This file is part of UFFS, the Ultra-low-cost Flash File System.
+  
+  Copyright (C) 2005-2009 Ricky Zheng <ricky_gz_zheng@yahoo.co.nz>
+
+  UFFS is free software; you can redistribute it and/or modify it under
+  the GNU Library General Public License as published by the Free Software 
+  Foundation; either version 2 of the License, or (at your option) any
+  later version.
+
+  UFFS is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+  or GNU Library General Public License, as applicable, for more details.
+ 
+  You should have received a copy of the GNU General Public License
+  and GNU Library General Public License along with UFFS; if not, write
+  to the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA  02110-1301, USA.
+
+  As a special exception, if other files instantiate templates or use
+  macros or inline functions from this file, or you compile this file
+  and link it with other works to produce a work based on this file,
+  this file does not by itself cause the resulting work to be covered
+  by the GNU General Public License. However the source code for this
+  file must still be made available in accordance with section (3) of
+  the GNU General Public License v2.
+ 
+  This exception does not invalidate any other reasons why a work based
+  on this file might be covered by the GNU General Public License.
+*/
+
+/** 
+ * \file uffs_flash.c
+ * \brief UFFS flash interface
+ * \author Ricky Zheng, created 17th July, 2009
+ * \note the flash driver does the spare layout (#UFFS_LAYOUT_FLASH) and ECC,
+ *		this layer fills the mini header and keeps the block info cache in step.
+ */
+
+#include "uffs_config.h"
+#include "uffs_types.h"
+#include "uffs_public.h"
+#include "uffs_flash.h"
+#include "uffs_blockinfo.h"
+#include "uffs_crc.h"
+
+#include <string.h>
+
+#define PFX "flsh: "
+
+/**
+ * \brief read page tag
+ * \param[in] dev uffs device
+ * \param[in] block block number
+ * \param[in] page page number
+ * \param[out] tag tag read from the page, seal_byte is 0xFF if the tag is not sealed
+ * \return flash result, #UFFS_FLASH_NOT_SEALED is not an error here.
+ */
+int uffs_FlashReadPageTag(uffs_Device *dev, int block, int page, uffs_Tags *tag)
+{
+	int ret;
+
+	ret = dev->ops->ReadPageWithLayout(dev, block, page, NULL, 0, NULL, &tag->s, NULL);
+
+	if (ret == UFFS_FLASH_NOT_SEALED) {
+		// erased page, or the tag write was interrupted
+		tag->seal_byte = 0xFF;
+		ret = UFFS_FLASH_NO_ERR;
+	}
+	else {
+		SEAL_TAG(tag);
+	}
+
+	return ret;
+}
+
+/**
+ * \brief read page data (mini header + data) to the page buffer
+ * \param[in] skip_ecc not used, ECC is done by the flash driver
+ * \return flash result
+ */
+int uffs_FlashReadPage(uffs_Device *dev, int block, int page, uffs_Buf *buf, UBOOL skip_ecc)
+{
+	int ret;
+
+	skip_ecc = skip_ecc;
+
+	ret = dev->ops->ReadPageWithLayout(dev, block, page, buf->header, dev->com.pg_size, NULL, NULL, NULL);
+	if (ret == UFFS_FLASH_NOT_SEALED)
+		ret = UFFS_FLASH_NO_ERR;
+
+	return ret;
+}
+
+/**
+ * \brief write page data (mini header + buf->data_len bytes of data) and tag
+ * \param[in] tag tag to be written, it should be sealed (SEAL_TAG) already
+ * \return flash result
+ */
+int uffs_FlashWritePageCombine(uffs_Device *dev, int block, int page, uffs_Buf *buf, uffs_Tags *tag)
+{
+	struct uffs_MiniHeaderSt *header = (struct uffs_MiniHeaderSt *)buf->header;
+	int ret;
+
+	header->status = 0;
+	header->reserved = 0xFF;
+	header->crc = uffs_crc16sum(buf->data, buf->data_len);
+
+	ret = dev->ops->WritePageWithLayout(dev, block, page, buf->header,
+										dev->com.header_size + buf->data_len, NULL, &tag->s);
+	if (UFFS_FLASH_HAVE_ERR(ret))
+		fprintf(stderr, PFX "write block %d page %d fail (%d)\n", block, page, ret);
+
+	return ret;
+}
+
+/**
+ * \brief erase a block
+ *
+ * a cached block info of the block is reset to 'all erased', so the spares
+ * don't need to be read again.
+ *
+ * \return flash result
+ */
+int uffs_FlashEraseBlock(uffs_Device *dev, int block)
+{
+	uffs_BlockInfo *bc;
+	int ret;
+
+	ret = dev->ops->EraseBlock(dev, block);
+
+	bc = uffs_BlockInfoFindInCache(dev, block);
+	if (bc) {
+		if (UFFS_FLASH_HAVE_ERR(ret))
+			uffs_BlockInfoExpire(dev, bc, UFFS_ALL_PAGES);
+		else
+			uffs_BlockInfoInitErased(dev, bc);
+	}
+
+	return ret;
+}
+
+/**
+ * \brief mark a bad block
+ * \return 0 if success, otherwise -1.
+ */
+int uffs_FlashMarkBadBlock(uffs_Device *dev, int block)
+{
+#ifdef CONFIG_ERASE_BLOCK_BEFORE_MARK_BAD
+	uffs_FlashEraseBlock(dev, block);
+#endif
+
+	if (dev->ops->MarkBadBlock)
+		return dev->ops->MarkBadBlock(dev, block);
+
+	fprintf(stderr, PFX "no MarkBadBlock, block %d is not marked\n", block);
+	return -1;
+}
+
+UBOOL uffs_FlashIsBadBlock(uffs_Device *dev, int block)
+{
+	if (dev->ops->IsBadBlock)
+		return dev->ops->IsBadBlock(dev, block) ? U_TRUE : U_FALSE;
+
+	return U_FALSE;
+}
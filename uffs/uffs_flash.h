@@ -48,4 +48,83 @@ struct uffs_StorageAttrSt {
 	void *_private;			//!< private data for storage attribute
 };
 
+/** 
+ * \struct uffs_FlashOpsSt
+ * \brief low level flash operations, provided by the flash driver
+ * \note only #UFFS_LAYOUT_FLASH is supported for now: the driver stores the
+ *		tag (uffs_TagStore) itself and tells whether it was sealed.
+ */
+struct uffs_FlashOpsSt {
+	/** 
+	 * Initialize flash driver (optional)
+	 * \return #U_SUCC if no error, return #U_FAIL otherwise.
+	 */
+	int (*InitFlash)(uffs_Device *dev);
+
+	/** 
+	 * Release flash driver (optional)
+	 * \return #U_SUCC if no error, return #U_FAIL otherwise.
+	 */
+	int (*ReleaseFlash)(uffs_Device *dev);
+
+	/**
+	 * Read page data and tag.
+	 * \param[out] data page data buffer, NULL if only the tag is needed
+	 * \param[out] ts tag store, NULL if only the page data is needed
+	 * \return #UFFS_FLASH_NO_ERR, #UFFS_FLASH_ECC_OK, #UFFS_FLASH_NOT_SEALED (page is not written),
+	 *			#UFFS_FLASH_IO_ERR, #UFFS_FLASH_ECC_FAIL or #UFFS_FLASH_BAD_BLK
+	 */
+	int (*ReadPageWithLayout)(uffs_Device *dev, u32 block, u32 page, u8 *data, int data_len, u8 *ecc,
+								uffs_TagStore *ts, u8 *ecc_store);
+
+	/**
+	 * Write page data and tag, the tag is sealed after it's written.
+	 * \return #UFFS_FLASH_NO_ERR, #UFFS_FLASH_IO_ERR or #UFFS_FLASH_BAD_BLK
+	 */
+	int (*WritePageWithLayout)(uffs_Device *dev, u32 block, u32 page, const u8 *data, int data_len,
+								const u8 *ecc, const uffs_TagStore *ts);
+
+	/**
+	 * Check bad block (optional)
+	 * \return 1 if it's a bad block, 0 if it's not.
+	 */
+	int (*IsBadBlock)(uffs_Device *dev, u32 block);
+
+	/**
+	 * Mark a new bad block (optional)
+	 * \return 0 if success, otherwise return -1.
+	 */
+	int (*MarkBadBlock)(uffs_Device *dev, u32 block);
+
+	/**
+	 * Erase a block, driver MUST implement this.
+	 * \return #UFFS_FLASH_NO_ERR, #UFFS_FLASH_IO_ERR or #UFFS_FLASH_BAD_BLK
+	 */
+	int (*EraseBlock)(uffs_Device *dev, u32 block);
+};
+
+/** flash operation has error */
+#define UFFS_FLASH_HAVE_ERR(ret)	((ret) < 0)
+
+/** flash operation says it's a bad block */
+#define UFFS_FLASH_IS_BAD_BLOCK(ret)	((ret) == UFFS_FLASH_ECC_FAIL || (ret) == UFFS_FLASH_BAD_BLK)
+
+/** read page tag, tag->seal_byte tells if the tag was sealed */
+int uffs_FlashReadPageTag(uffs_Device *dev, int block, int page, uffs_Tags *tag);
+
+/** read page data (mini header + data) to page buffer */
+int uffs_FlashReadPage(uffs_Device *dev, int block, int page, uffs_Buf *buf, UBOOL skip_ecc);
+
+/** write page data (mini header + data) and tag */
+int uffs_FlashWritePageCombine(uffs_Device *dev, int block, int page, uffs_Buf *buf, uffs_Tags *tag);
+
+/** erase a block, cached block info of the block is expired */
+int uffs_FlashEraseBlock(uffs_Device *dev, int block);
+
+/** erase (if #CONFIG_ERASE_BLOCK_BEFORE_MARK_BAD) and mark a bad block */
+int uffs_FlashMarkBadBlock(uffs_Device *dev, int block);
+
+/** is it a bad block ? */
+UBOOL uffs_FlashIsBadBlock(uffs_Device *dev, int block);
+
 #endif
\ No newline at end of file
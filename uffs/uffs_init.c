@@ -1,5 +1,7 @@
 #include "uffs_types.h"
 #include "uffs_public.h"
+#include "uffs_blockinfo.h"
+#include "uffs_badblock.h"
 
 URET uffs_InitDevice(uffs_Device *dev)
 {
@@ -21,7 +23,26 @@ URET uffs_InitDevice(uffs_Device *dev)
 	// memset(&(dev->st), 0, sizeof(uffs_FlashStat));
 
 	// uffs_DeviceInitLock(dev);
-	// uffs_BadBlockInit(dev);
+	uffs_BadBlockInit(dev);
+
+	if (dev->ops->InitFlash) {
+		if (dev->ops->InitFlash(dev) != U_SUCC) {
+			fprintf(stderr, "Init flash fail.\n");
+			return U_FAIL;
+		}
+	}
+
+	ret = uffs_BufInit(dev, MAX_PAGE_BUFFERS, MAX_DIRTY_PAGES_IN_A_BLOCK);
+	if (ret != U_SUCC) {
+		fprintf(stderr, "Initialize page buffers fail\n");
+		return U_FAIL;
+	}
+
+	ret = uffs_BlockInfoInitCache(dev, MAX_CACHED_BLOCK_INFO);
+	if (ret != U_SUCC) {
+		fprintf(stderr, "Initialize block info fail\n");
+		return U_FAIL;
+	}
 
 	ret = uffs_TreeInit(dev);
 	if (ret != U_SUCC) {
@@ -94,4 +94,15 @@ void *uffs_PoolGetBufByIndex(uffs_Pool *pool, u32 index)
 	// }
 
 	return (u8 *) pool->mem + index * pool->buf_size;
-}
\ No newline at end of file
+}
+
+/**
+ * \brief Gets the index (offset) of a buffer.
+ * \param[in] pool memory pool
+ * \param[in] p buffer from the pool
+ * \return Returns the index of the buffer.
+ */
+u32 uffs_PoolGetIndex(uffs_Pool *pool, void *p)
+{
+	return ((u8 *) p - pool->mem) / pool->buf_size;
+}
@@ -10,8 +10,10 @@
 #include "uffs_device.h"
 #include "uffs_os.h"
 #include "uffs_crc.h"
+#include "uffs_blockinfo.h"
 
 #include <string.h>
+#include <stdarg.h>
 
 /** 
  * calculate sum of data, 8bit version
@@ -33,4 +35,148 @@ u8 uffs_MakeSum8(const void *p, int len)
 u16 uffs_MakeSum16(const void *p, int len)
 {
 	return uffs_crc16sum(p, len);
-}
\ No newline at end of file
+}
+/** 
+ * \brief find a valid page with given page_id
+ * \param[in] dev uffs device
+ * \param[in] bc block info
+ * \param[in] page_id page_id to be find
+ * \return the newest page with page_id, or #UFFS_INVALID_PAGE if not found
+ * \note this is a lookup in the block info page_id map, spares are only read
+ *		 when they are not cached yet
+ */
+u16 uffs_FindPageInBlockWithPageId(uffs_Device *dev, uffs_BlockInfo *bc, u16 page_id)
+{
+	return uffs_BlockInfoFindPage(dev, bc, page_id);
+}
+
+/** 
+ * \brief find the newest version of the given page in the block
+ * \param[in] dev uffs device
+ * \param[in] bc block info
+ * \param[in] page a page holding the page_id we want
+ * \return the newest page with the same page_id, or #UFFS_INVALID_PAGE
+ */
+u16 uffs_FindBestPageInBlock(uffs_Device *dev, uffs_BlockInfo *bc, u16 page)
+{
+	uffs_Tags *tag;
+	u16 best;
+
+	if (page >= dev->attr->pages_per_block)
+		return UFFS_INVALID_PAGE;
+
+	uffs_BlockInfoLoad(dev, bc, page);
+	tag = GET_TAG(bc, page);
+	if (!TAG_IS_GOOD(tag))
+		return UFFS_INVALID_PAGE;
+
+	best = uffs_BlockInfoFindPage(dev, bc, TAG_PAGE_ID(tag));
+
+	return (best == UFFS_INVALID_PAGE ? page : best);
+}
+
+/** 
+ * \brief is this page an erased page ?
+ * \param[in] dev uffs device
+ * \param[in] bc block info
+ * \param[in] page page number to be check
+ * \retval U_TRUE page is erased, ready to use
+ * \retval U_FALSE page is dirty
+ */
+UBOOL uffs_IsPageErased(uffs_Device *dev, uffs_BlockInfo *bc, u16 page)
+{
+	uffs_Tags *tag;
+
+	uffs_BlockInfoLoad(dev, bc, page);
+	tag = GET_TAG(bc, page);
+
+	if (!TAG_IS_SEALED(tag) &&
+		!TAG_IS_DIRTY(tag) &&
+		!TAG_IS_VALID(tag)) {
+		return U_TRUE;
+	}
+
+	return U_FALSE;
+}
+
+/** 
+ * \brief get free pages number
+ * \param[in] dev uffs device
+ * \param[in] bc block info
+ * \return number of erased pages at the end of the block
+ */
+int uffs_GetFreePagesCount(uffs_Device *dev, uffs_BlockInfo *bc)
+{
+	int count = 0;
+	int i;
+
+	// search from the last page ... to first page
+	for (i = dev->attr->pages_per_block - 1; i >= 0; i--) {
+		if (uffs_IsPageErased(dev, bc, (u16)i) == U_TRUE) {
+			count++;
+		}
+		else break;
+	}
+
+	return count;
+}
+
+/** 
+ * \brief is this block used ?
+ * \param[in] dev uffs device
+ * \param[in] bc block info
+ * \retval U_TRUE block is used
+ * \retval U_FALSE block is free
+ */
+UBOOL uffs_IsThisBlockUsed(uffs_Device *dev, uffs_BlockInfo *bc)
+{
+	return uffs_IsPageErased(dev, bc, 0) ? U_FALSE : U_TRUE;
+}
+
+/** 
+ * \brief get block time stamp from a exist block
+ * \param[in] dev uffs device
+ * \param[in] bc block info
+ */
+int uffs_GetBlockTimeStamp(uffs_Device *dev, uffs_BlockInfo *bc)
+{
+	if (uffs_IsThisBlockUsed(dev, bc) == U_FALSE) 
+		return uffs_GetFirstBlockTimeStamp();
+
+	return TAG_BLOCK_TS(GET_TAG(bc, 0));
+}
+
+/** time stamp of a new block */
+int uffs_GetFirstBlockTimeStamp(void)
+{
+	return 0;
+}
+
+/** 
+ * \brief time stamp of the block which replaces a block with time stamp prev
+ * \note time stamps go 0 -> 1 -> 2 -> 0, so the newer one of two blocks
+ *		holding the same data can be told.
+ */
+int uffs_GetNextBlockTimeStamp(int prev)
+{
+	return (prev + 1) % 3;
+}
+
+/**
+ * \brief print the message to stderr if expr is false
+ * \return expr
+ */
+UBOOL uffs_Assert(UBOOL expr, const char *fmt, ...)
+{
+	va_list args;
+
+	if (!expr) {
+		fprintf(stderr, "assert failed: ");
+		va_start(args, fmt);
+		vfprintf(stderr, fmt, args);
+		va_end(args);
+		fprintf(stderr, "\n");
+	}
+
+	return expr ? U_TRUE : U_FALSE;
+}
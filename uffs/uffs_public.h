@@ -127,9 +127,9 @@ URET uffs_DirEntryBufInit(void);
 // 					  u16 newPage, 
 // 					  uffs_Buf *buf);
 // int uffs_FindFreePageInBlock(uffs_Device *dev, uffs_BlockInfo *bc);
-// u16 uffs_FindBestPageInBlock(uffs_Device *dev, uffs_BlockInfo *bc, u16 page);
+u16 uffs_FindBestPageInBlock(uffs_Device *dev, uffs_BlockInfo *bc, u16 page);
 // u16 uffs_FindFirstFreePage(uffs_Device *dev, uffs_BlockInfo *bc, u16 pageFrom);
-// u16 uffs_FindPageInBlockWithPageId(uffs_Device *dev, uffs_BlockInfo *bc, u16 page_id);
+u16 uffs_FindPageInBlockWithPageId(uffs_Device *dev, uffs_BlockInfo *bc, u16 page_id);
 
 /** 
  * \struct uffs_MiniHeaderSt
@@ -174,17 +174,44 @@ struct uffs_TagsSt {
 	u8 seal_byte;			//!< seal byte.
 };
 
+#define TAG_DIRTY		0		//!< #uffs_TagStoreSt.dirty: page is written
+#define TAG_CLEAR		1		//!< #uffs_TagStoreSt.dirty: page is erased
+#define TAG_VALID		0		//!< #uffs_TagStoreSt.valid
+#define TAG_INVALID		1		//!< #uffs_TagStoreSt.valid
+
+#define TAG_DIRTY_BIT(tag)	(tag)->s.dirty
+#define TAG_VALID_BIT(tag)	(tag)->s.valid
+#define TAG_TYPE(tag)		(tag)->s.type
+#define TAG_BLOCK_TS(tag)	(tag)->s.block_ts
+#define TAG_DATA_LEN(tag)	(tag)->s.data_len
+#define TAG_SERIAL(tag)		(tag)->s.serial
+#define TAG_PARENT(tag)		(tag)->s.parent
+#define TAG_PAGE_ID(tag)	(tag)->s.page_id
+
+/** seal byte is cleared after the tag is written, so a torn tag write can be detected */
+#define SEAL_TAG(tag)		(tag)->seal_byte = 0
+#define TAG_IS_SEALED(tag)	((tag)->seal_byte != 0xFF)
+#define TAG_IS_DIRTY(tag)	(TAG_DIRTY_BIT(tag) == TAG_DIRTY)
+#define TAG_IS_VALID(tag)	(TAG_VALID_BIT(tag) == TAG_VALID)
+
+/** tag of a written, sealed and valid page */
+#define TAG_IS_GOOD(tag)	(TAG_IS_SEALED(tag) && TAG_IS_DIRTY(tag) && TAG_IS_VALID(tag))
+
 u8 uffs_MakeSum8(const void *p, int len);
 u16 uffs_MakeSum16(const void *p, int len);
 // URET uffs_CreateNewFile(uffs_Device *dev, u16 parent, u16 serial, uffs_BlockInfo *bc, uffs_FileInfo *fi);
 
 // int uffs_GetBlockFileDataLength(uffs_Device *dev, uffs_BlockInfo *bc, u8 type);
-// UBOOL uffs_IsPageErased(uffs_Device *dev, uffs_BlockInfo *bc, u16 page);
-// int uffs_GetFreePagesCount(uffs_Device *dev, uffs_BlockInfo *bc);
+UBOOL uffs_IsPageErased(uffs_Device *dev, uffs_BlockInfo *bc, u16 page);
+int uffs_GetFreePagesCount(uffs_Device *dev, uffs_BlockInfo *bc);
 // UBOOL uffs_IsDataBlockReguFull(uffs_Device *dev, uffs_BlockInfo *bc);
-// UBOOL uffs_IsThisBlockUsed(uffs_Device *dev, uffs_BlockInfo *bc);
+UBOOL uffs_IsThisBlockUsed(uffs_Device *dev, uffs_BlockInfo *bc);
+
+int uffs_GetBlockTimeStamp(uffs_Device *dev, uffs_BlockInfo *bc);
+int uffs_GetFirstBlockTimeStamp(void);
+int uffs_GetNextBlockTimeStamp(int prev);
 
-// int uffs_GetBlockTimeStamp(uffs_Device *dev, uffs_BlockInfo *bc);
+UBOOL uffs_Assert(UBOOL expr, const char *fmt, ...);
 
 // int uffs_GetDeviceUsed(uffs_Device *dev);
 // int uffs_GetDeviceFree(uffs_Device *dev);
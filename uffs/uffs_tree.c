@@ -3,7 +3,8 @@
 #include "uffs_os.h"
 #include "uffs_pool.h"
 #include "uffs_flash.h"
-// #include "uffs_badblock.h"
+#include "uffs_badblock.h"
+#include "uffs_buf.h"
 
 #include <string.h>
 
@@ -209,4 +210,173 @@ u16 uffs_FindFreeFsnSerial(uffs_Device *dev)
 	}
 
 	return INVALID_UFFS_SERIAL;
-}
\ No newline at end of file
+}
+
+/** put a bad block node to the bad block list */
+void uffs_TreeInsertToBadBlockList(uffs_Device *dev, TreeNode *node)
+{
+	struct uffs_TreeSt *tree = &(dev->tree);
+
+	node->u.list.prev = NULL;
+	node->u.list.next = tree->bad;
+
+	if (tree->bad)
+		tree->bad->u.list.prev = node;
+
+	tree->bad = node;
+	tree->bad_count++;
+}
+
+TreeNode * uffs_TreeFindDataNode(uffs_Device *dev, u16 parent, u16 serial)
+{
+	int hash;
+	u16 x;
+	TreeNode *node;
+	struct uffs_TreeSt *tree = &(dev->tree);
+
+	hash = GET_DATA_HASH(parent, serial);
+	x = tree->data_entry[hash];
+	while (x != EMPTY_NODE) {
+		node = FROM_IDX(x, TPOOL(dev));
+		if (node->u.data.parent == parent && node->u.data.serial == serial) {
+			return node;
+		}
+		else {
+			x = node->hash_next;
+		}
+	}
+	return NULL;
+}
+
+/** 
+ * compare file or dir name with the name stored in page 0 of the node's block
+ * \return #U_TRUE if matched
+ */
+UBOOL uffs_TreeCompareFileName(uffs_Device *dev,
+							   const char *name, u32 len, u16 sum,
+							   TreeNode *node, int type)
+{
+	UBOOL matched = U_FALSE;
+	uffs_FileInfo *fi;
+	uffs_Buf *buf;
+
+	buf = uffs_BufGetEx(dev, type, node, 0, 0);
+	if (buf == NULL) {
+		fprintf(stderr, "can't get buf !\n");
+		return U_FALSE;
+	}
+
+	fi = (uffs_FileInfo *)(buf->data);
+	if (fi->name_len == len &&
+		uffs_MakeSum16(fi->name, fi->name_len) == sum &&
+		memcmp(fi->name, name, len) == 0) {
+		matched = U_TRUE;
+	}
+
+	uffs_BufPut(dev, buf);
+
+	return matched;
+}
+
+/** take a node from the erased list head */
+TreeNode * uffs_TreeGetErasedNode(uffs_Device *dev)
+{
+	struct uffs_TreeSt *tree = &(dev->tree);
+	TreeNode *node = tree->erased;
+
+	if (node) {
+		tree->erased = node->u.list.next;
+		if (tree->erased)
+			tree->erased->u.list.prev = NULL;
+		else
+			tree->erased_tail = NULL;
+		node->u.list.next = node->u.list.prev = NULL;
+		tree->erased_count--;
+	}
+
+	return node;
+}
+
+/** put an erased node back to the erased list head, it will be used first */
+void uffs_InsertToErasedListHead(uffs_Device *dev, TreeNode *node)
+{
+	struct uffs_TreeSt *tree = &(dev->tree);
+
+	node->u.list.prev = NULL;
+	node->u.list.next = tree->erased;
+
+	if (tree->erased)
+		tree->erased->u.list.prev = node;
+	else
+		tree->erased_tail = node;
+
+	tree->erased = node;
+	tree->erased_count++;
+}
+
+/** put an erased node to the erased list tail */
+void uffs_TreeInsertToErasedListTail(uffs_Device *dev, TreeNode *node)
+{
+	struct uffs_TreeSt *tree = &(dev->tree);
+
+	node->u.list.next = NULL;
+	node->u.list.prev = tree->erased_tail;
+
+	if (tree->erased_tail)
+		tree->erased_tail->u.list.next = node;
+	else
+		tree->erased = node;
+
+	tree->erased_tail = node;
+	tree->erased_count++;
+}
+
+/** 
+ * erase the node's block
+ * \return #U_FAIL if erase failed, a bad block is added to the pending list
+ */
+URET uffs_TreeEraseNode(uffs_Device *dev, TreeNode *node)
+{
+	int ret;
+
+	ret = uffs_FlashEraseBlock(dev, node->u.list.block);
+	uffs_BadBlockAddByFlashResult(dev, node->u.list.block, ret);
+
+	if (UFFS_FLASH_HAVE_ERR(ret)) {
+		fprintf(stderr, "erase block %d fail (%d)\n", node->u.list.block, ret);
+		return U_FAIL;
+	}
+
+	return U_SUCC;
+}
+
+static void _InsertToEntry(uffs_Device *dev, u16 *entry, int hash, TreeNode *node)
+{
+	node->hash_next = entry[hash];
+	node->hash_prev = EMPTY_NODE;
+
+	if (entry[hash] != EMPTY_NODE)
+		FROM_IDX(entry[hash], TPOOL(dev))->hash_prev = TO_IDX(node, TPOOL(dev));
+
+	entry[hash] = TO_IDX(node, TPOOL(dev));
+}
+
+/** insert a dir, file or data node to the tree */
+void uffs_InsertNodeToTree(uffs_Device *dev, u8 type, TreeNode *node)
+{
+	switch (type) {
+	case UFFS_TYPE_DIR:
+		_InsertToEntry(dev, dev->tree.dir_entry, GET_DIR_HASH(node->u.dir.serial), node);
+		break;
+	case UFFS_TYPE_FILE:
+		_InsertToEntry(dev, dev->tree.file_entry, GET_FILE_HASH(node->u.file.serial), node);
+		break;
+	case UFFS_TYPE_DATA:
+		_InsertToEntry(dev, dev->tree.data_entry,
+						GET_DATA_HASH(node->u.data.parent, node->u.data.serial), node);
+		break;
+	default:
+		fprintf(stderr, "unknown type %d\n", type);
+		break;
+	}
+}
@@ -192,7 +192,7 @@ TreeNode * uffs_TreeFindDirNode(uffs_Device *dev, u16 serial);
 // TreeNode * uffs_TreeFindDirNodeWithParent(uffs_Device *dev, u16 parent);
 TreeNode * uffs_TreeFindFileNodeByName(uffs_Device *dev, const char *name, u32 len, u16 sum, u16 parent);
 TreeNode * uffs_TreeFindDirNodeByName(uffs_Device *dev, const char *name, u32 len, u16 sum, u16 parent);
-// TreeNode * uffs_TreeFindDataNode(uffs_Device *dev, u16 parent, u16 serial);
+TreeNode * uffs_TreeFindDataNode(uffs_Device *dev, u16 parent, u16 serial);
 
 
 // TreeNode * uffs_TreeFindDirNodeByBlock(uffs_Device *dev, u16 block);
@@ -214,16 +214,16 @@ TreeNode * uffs_TreeFindSuspendNode(uffs_Device *dev, u16 serial);
 
 
 
-// UBOOL uffs_TreeCompareFileName(uffs_Device *dev, const char *name, u32 len, u16 sum, TreeNode *node, int type);
+UBOOL uffs_TreeCompareFileName(uffs_Device *dev, const char *name, u32 len, u16 sum, TreeNode *node, int type);
 
-// TreeNode * uffs_TreeGetErasedNode(uffs_Device *dev);
-// URET uffs_TreeEraseNode(uffs_Device *dev, TreeNode *node);
+TreeNode * uffs_TreeGetErasedNode(uffs_Device *dev);
+URET uffs_TreeEraseNode(uffs_Device *dev, TreeNode *node);
 
-// void uffs_InsertNodeToTree(uffs_Device *dev, u8 type, TreeNode *node);
-// void uffs_InsertToErasedListHead(uffs_Device *dev, TreeNode *node);
-// void uffs_TreeInsertToErasedListTail(uffs_Device *dev, TreeNode *node);
+void uffs_InsertNodeToTree(uffs_Device *dev, u8 type, TreeNode *node);
+void uffs_InsertToErasedListHead(uffs_Device *dev, TreeNode *node);
+void uffs_TreeInsertToErasedListTail(uffs_Device *dev, TreeNode *node);
 // void uffs_TreeInsertToErasedListTailEx(uffs_Device *dev, TreeNode *node, int need_check);
-// void uffs_TreeInsertToBadBlockList(uffs_Device *dev, TreeNode *node);
+void uffs_TreeInsertToBadBlockList(uffs_Device *dev, TreeNode *node);
 
 // void uffs_BreakFromEntry(uffs_Device *dev, u8 type, TreeNode *node);
 